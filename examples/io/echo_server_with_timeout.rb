@@ -13,15 +13,13 @@ begin
     client = server.accept
     client.write "Hi there\n"
     spin do
-      move_on_after(5) do |scope|
-        scope.when_cancelled do
-          client.write "Disconnecting due to inactivity\n"
-        end
+      # the idle timeout is pushed back on each read and write
+      result = move_on_after_idle(5, with_value: :idle) do
         client.read_loop do |data|
-          scope.reset_timeout
           client.write "You said: #{data}"
         end
       end
+      client.write "Disconnecting due to inactivity\n" if result == :idle
     rescue StandardError => e
       puts "client error: #{e.inspect}"
     ensure
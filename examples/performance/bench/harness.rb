@@ -0,0 +1,137 @@
+# frozen_string_literal: true
+
+require 'rbconfig'
+
+# A minimal benchmark harness. Each scenario is set up once, then its op is run
+# for a number of warmup rounds, followed by a number of measured iterations.
+# Each op is timed individually for computing latency percentiles, and the
+# total time of each iteration is used for computing throughput.
+module Bench
+  Scenario = Struct.new(:name, :ops, :setup, :teardown)
+
+  PERCENTILES = [50, 90, 99, 99.9].freeze
+
+  class << self
+    def scenarios
+      @scenarios ||= {}
+    end
+
+    # Defines a scenario, with the given number of ops per iteration. The block
+    # is called to set up the scenario, and should return a callable op. It may
+    # also return [op, teardown].
+    def scenario(name, ops:, &setup)
+      scenarios[name] = Scenario.new(name, ops, setup)
+    end
+
+    def now
+      Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    end
+
+    def run(scenario, iterations:, warmup:)
+      op, teardown = scenario.setup.()
+      warmup.times { run_iteration(op, scenario.ops, nil) }
+
+      latencies = []
+      rates = []
+      gc_count = GC.count
+      iterations.times do
+        GC.start
+        elapsed = run_iteration(op, scenario.ops, latencies)
+        rates << scenario.ops / elapsed
+      end
+
+      {
+        ops_per_iteration: scenario.ops,
+        ops_per_sec: summary(rates),
+        latency_us: latency_summary(latencies),
+        gc_count: GC.count - gc_count
+      }
+    ensure
+      teardown&.()
+    end
+
+    # Returns the approximate memory cost of a fiber waiting on an operation,
+    # measured both as process RSS and as heap slots.
+    def fiber_memory(count)
+      GC.start
+      rss0 = rss
+      slots0 = live_slots
+      fibers = count.times.map { spin { suspend } }
+      snooze
+      GC.start
+      result = {
+        fiber_count: count,
+        rss_bytes_per_fiber: (rss - rss0) / count,
+        slots_per_fiber: (live_slots - slots0).fdiv(count).round(2)
+      }
+      fibers.each { |f| f.schedule }
+      fibers.each(&:await)
+      result
+    end
+
+    def environment
+      {
+        backend: Thread.current.backend.kind,
+        polyphony_version: Polyphony::VERSION,
+        ruby_version: RUBY_VERSION,
+        ruby_platform: RUBY_PLATFORM,
+        git_commit: git_commit
+      }
+    end
+
+    private
+
+    def run_iteration(op, count, latencies)
+      t0 = now
+      if latencies
+        count.times do
+          t1 = now
+          op.()
+          latencies << now - t1
+        end
+      else
+        count.times { op.() }
+      end
+      now - t0
+    end
+
+    def summary(values)
+      sorted = values.sort
+      mean = values.sum / values.size
+      stddev = Math.sqrt(values.sum { |v| (v - mean)**2 } / values.size)
+      {
+        median: sorted[sorted.size / 2].round,
+        mean: mean.round,
+        stddev: stddev.round,
+        min: sorted.first.round,
+        max: sorted.last.round
+      }
+    end
+
+    def latency_summary(latencies)
+      sorted = latencies.sort
+      result = PERCENTILES.each_with_object({}) do |p, h|
+        index = ((sorted.size - 1) * p / 100.0).round
+        h[:"p#{p.to_s.sub('.', '_')}"] = (sorted[index] * 1e6).round(3)
+      end
+      result[:max] = (sorted.last * 1e6).round(3)
+      result
+    end
+
+    def rss
+      File.read('/proc/self/statm').split[1].to_i * 4096
+    rescue SystemCallError
+      `ps -o rss= #{$$}`.to_i * 1024
+    end
+
+    def live_slots
+      GC.stat(:heap_live_slots)
+    end
+
+    def git_commit
+      dir = File.expand_path('../../..', __dir__)
+      commit = `git -C #{dir} rev-parse --short HEAD 2>/dev/null`.chomp
+      commit.empty? ? nil : commit
+    end
+  end
+end
@@ -0,0 +1,65 @@
+# frozen_string_literal: true
+
+# Runs the benchmark suite on each available backend, emitting the results as
+# JSON. Each backend is benchmarked in a separate process. Usage:
+#
+#   rake bench
+#   ruby examples/performance/bench/run.rb [scenario ...]
+#
+# The following environment variables can be used to configure the run:
+#
+# - BENCH_BACKENDS:   comma-separated list of backends (default: io_uring,libev)
+# - BENCH_ITERATIONS: number of measured iterations per scenario (default: 10)
+# - BENCH_WARMUP:     number of warmup iterations per scenario (default: 2)
+# - BENCH_FIBERS:     number of fibers for measuring memory per fiber (default: 10000)
+# - BENCH_OUTPUT:     path of file to write results to (default: stdout)
+
+require 'json'
+require 'rbconfig'
+
+lib = File.expand_path('../../../lib', __dir__)
+
+if ENV['BENCH_WORKER']
+  $LOAD_PATH.unshift(lib)
+  require 'polyphony'
+  require 'polyphony/version'
+  require_relative 'harness'
+  require_relative 'scenarios'
+
+  names = ARGV.empty? ? Bench.scenarios.keys : ARGV.map(&:to_sym)
+  iterations = ENV.fetch('BENCH_ITERATIONS', 10).to_i
+  warmup = ENV.fetch('BENCH_WARMUP', 2).to_i
+
+  results = names.each_with_object({}) do |name, h|
+    scenario = Bench.scenarios[name] or raise ArgumentError, "Unknown scenario #{name}"
+    h[name] = Bench.run(scenario, iterations: iterations, warmup: warmup)
+    warn format('%-10s %-16s %10d ops/s  p99 %8.3fus', Thread.current.backend.kind, name,
+                h[name][:ops_per_sec][:median], h[name][:latency_us][:p99])
+  end
+
+  puts JSON.generate(
+    environment: Bench.environment,
+    config: { iterations: iterations, warmup: warmup },
+    scenarios: results,
+    memory: Bench.fiber_memory(ENV.fetch('BENCH_FIBERS', 10_000).to_i)
+  )
+  exit
+end
+
+backends = ENV.fetch('BENCH_BACKENDS', 'io_uring,libev').split(',')
+runs = backends.each_with_object({}) do |backend, h|
+  env = { 'BENCH_WORKER' => '1', 'POLYPHONY_BACKEND' => backend }
+  output = IO.popen(env, [RbConfig.ruby, __FILE__, *ARGV], &:read)
+  if $?.success?
+    h[backend] = JSON.parse(output)
+  else
+    warn "Skipping #{backend} backend (benchmark process failed)"
+  end
+end
+
+json = JSON.pretty_generate(runs)
+if (path = ENV['BENCH_OUTPUT'])
+  File.write(path, json)
+else
+  puts json
+end
@@ -0,0 +1,70 @@
+# frozen_string_literal: true
+
+require 'socket'
+
+def bench_tcp_server
+  server = Polyphony::Net.tcp_listen('127.0.0.1', 0, reuse_addr: true)
+  [server.local_address.ip_port, server]
+end
+
+Bench.scenario(:snooze, ops: 100_000) do
+  -> { snooze }
+end
+
+Bench.scenario(:switch, ops: 100_000) do
+  main = Fiber.current
+  peer = spin_loop do
+    main.schedule
+    suspend
+  end
+  snooze
+  op = -> { peer.schedule; suspend }
+  [op, -> { peer.stop }]
+end
+
+Bench.scenario(:queue_ping_pong, ops: 50_000) do
+  ping = Polyphony::Queue.new
+  pong = Polyphony::Queue.new
+  peer = spin_loop { pong << ping.shift }
+  op = -> { ping << 1; pong.shift }
+  [op, -> { peer.stop }]
+end
+
+Bench.scenario(:echo, ops: 20_000) do
+  port, server = bench_tcp_server
+  server_fiber = spin do
+    server.accept_loop do |conn|
+      spin { conn.read_loop { |data| conn << data } rescue nil }
+    end
+  end
+  client = TCPSocket.new('127.0.0.1', port)
+  msg = 'x' * 64
+  buf = +''
+  op = -> { client << msg; client.readpartial(64, buf) }
+  [op, -> { client.close; server_fiber.stop; server.close }]
+end
+
+Bench.scenario(:splice, ops: 10_000) do
+  chunk = 'x' * 16_384
+  src_r, src_w = IO.pipe
+  dest_r, dest_w = IO.pipe
+  buf = +''
+  op = lambda do
+    src_w << chunk
+    len = 0
+    len += dest_w.splice(src_r, chunk.bytesize - len) while len < chunk.bytesize
+    dest_r.read(chunk.bytesize, buf)
+  end
+  [op, -> { [src_r, src_w, dest_r, dest_w].each(&:close) }]
+end
+
+Bench.scenario(:accept_storm, ops: 5_000) do
+  port, server = bench_tcp_server
+  server_fiber = spin { server.accept_loop(&:close) }
+  op = -> { TCPSocket.new('127.0.0.1', port).close }
+  [op, -> { server_fiber.stop; server.close }]
+end
+
+Bench.scenario(:timeout_churn, ops: 50_000) do
+  -> { move_on_after(10) { snooze } }
+end
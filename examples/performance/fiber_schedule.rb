@@ -0,0 +1,27 @@
+# frozen_string_literal: true
+
+require 'bundler/setup'
+require 'polyphony'
+
+# Measures the cost of scheduling a fiber, which involves looking up the
+# fiber's scheduling state and checking whether it's already runnable.
+
+X = 2_000_000
+N = 1000
+
+fibers = N.times.map { spin { suspend } }
+snooze
+
+STDOUT << 'Fiber#schedule:   '
+t0 = Time.now
+(X / N).times { fibers.each(&:schedule) }
+dt = Time.now - t0
+puts format('%d/s', (X / dt))
+
+STDOUT << 'Fiber#state:      '
+t0 = Time.now
+(X / N).times { fibers.each(&:state) }
+dt = Time.now - t0
+puts format('%d/s', (X / dt))
+
+fibers.each(&:stop)
@@ -51,6 +51,19 @@ def compare_performance
       avg_perf,
       avg_perf / native_perf
     )
+
+    native_pool = Polyphony::NativeThreadPool.new
+    t0 = Time.now
+    X.times do
+      spin { native_pool.read_file(__FILE__).clear }
+    end
+    Fiber.current.await_all_children
+    native_pool_perf = X / (Time.now - t0)
+    puts format(
+      'spin X native thread pool performance: %g (X %0.2f)',
+      native_pool_perf,
+      native_pool_perf / native_perf
+    )
   rescue Exception => e
     p e
     puts e.backtrace.join("\n")
@@ -0,0 +1,356 @@
+#include <stdlib.h>
+#include <string.h>
+#include "polyphony.h"
+#include "backend_common.h"
+
+// Backend selection and dispatch. Both backends may be compiled into the
+// extension (on Linux, the libev backend is always available as a fallback),
+// and the backend implementation is selected at runtime when a backend is
+// created. Polyphony::Backend is an abstract class, and Backend.new returns an
+// instance of either Polyphony::Backend::IOUring or Polyphony::Backend::Libev.
+//
+// Backend ops are defined as methods of Polyphony::Backend, so all calls,
+// whether from Ruby or from C, go through the dispatch functions below. Ops
+// performed on an io first send any data buffered for it if it is corked (see
+// cork.c), so data is never put on the wire ahead of corked data.
+
+#ifdef POLYPHONY_BACKEND_LIBEV
+void Init_LibevBackend(VALUE cBackend);
+#endif
+#ifdef POLYPHONY_BACKEND_LIBURING
+void Init_IOUringBackend(VALUE cBackend);
+int io_uring_backend_supported();
+#endif
+void Init_TraceRing(VALUE cBackend);
+void Init_Watchdog(VALUE cBackend);
+void Init_IdleDeadline(VALUE cBackend);
+void Init_IdleGC(VALUE cBackend);
+
+static VALUE cBackend = Qnil;
+static VALUE cDefaultBackend = Qnil;
+static VALUE cFallbackBackend = Qnil;
+static VALUE default_kind = Qnil;
+
+#define BACKEND_BASE(self) ((struct Backend_base *)RTYPEDDATA_DATA(self))
+#define BACKEND_INTERFACE(self) (BACKEND_BASE(self)->interface)
+#define CORK_FLUSH(self, io) BACKEND_CORK_FLUSH(self, BACKEND_BASE(self), io)
+
+VALUE Backend_accept(VALUE self, VALUE server_socket, VALUE socket_class) {
+  return BACKEND_INTERFACE(self)->accept(self, server_socket, socket_class);
+}
+
+VALUE Backend_accept_loop(VALUE self, VALUE server_socket, VALUE socket_class) {
+  return BACKEND_INTERFACE(self)->accept_loop(self, server_socket, socket_class);
+}
+
+VALUE Backend_connect(VALUE self, VALUE io, VALUE addr, VALUE port) {
+  return BACKEND_INTERFACE(self)->connect(self, io, addr, port);
+}
+
+VALUE Backend_connect_racing(VALUE self, VALUE addrinfos, VALUE stagger_delay) {
+  return BACKEND_INTERFACE(self)->connect_racing(self, addrinfos, stagger_delay);
+}
+
+VALUE Backend_close(VALUE self, VALUE io) {
+  CORK_FLUSH(self, io);
+  return BACKEND_INTERFACE(self)->close(self, io);
+}
+
+VALUE Backend_shutdown(VALUE self, VALUE io, VALUE how) {
+  CORK_FLUSH(self, io);
+  return BACKEND_INTERFACE(self)->shutdown(self, io, how);
+}
+
+VALUE Backend_feed_loop(VALUE self, VALUE io, VALUE receiver, VALUE method) {
+  CORK_FLUSH(self, io);
+  return BACKEND_INTERFACE(self)->feed_loop(self, io, receiver, method);
+}
+
+VALUE Backend_read(VALUE self, VALUE io, VALUE str, VALUE length, VALUE to_eof, VALUE pos) {
+  CORK_FLUSH(self, io);
+  return BACKEND_INTERFACE(self)->read(self, io, str, length, to_eof, pos);
+}
+
+VALUE Backend_read_loop(VALUE self, VALUE io, VALUE maxlen) {
+  CORK_FLUSH(self, io);
+  return BACKEND_INTERFACE(self)->read_loop(self, io, maxlen);
+}
+
+VALUE Backend_gets_loop(VALUE self, VALUE io, VALUE sep, VALUE chomp, VALUE buffer) {
+  CORK_FLUSH(self, io);
+  return BACKEND_INTERFACE(self)->gets_loop(self, io, sep, chomp, buffer);
+}
+
+VALUE Backend_readv(VALUE self, VALUE io, VALUE buffers) {
+  CORK_FLUSH(self, io);
+  return BACKEND_INTERFACE(self)->readv(self, io, buffers);
+}
+
+VALUE Backend_recv(VALUE self, VALUE io, VALUE str, VALUE length, VALUE pos) {
+  CORK_FLUSH(self, io);
+  return BACKEND_INTERFACE(self)->recv(self, io, str, length, pos);
+}
+
+VALUE Backend_recv_loop(VALUE self, VALUE io, VALUE maxlen) {
+  CORK_FLUSH(self, io);
+  return BACKEND_INTERFACE(self)->recv_loop(self, io, maxlen);
+}
+
+VALUE Backend_recv_feed_loop(VALUE self, VALUE io, VALUE receiver, VALUE method) {
+  CORK_FLUSH(self, io);
+  return BACKEND_INTERFACE(self)->recv_feed_loop(self, io, receiver, method);
+}
+
+VALUE Backend_send(VALUE self, VALUE io, VALUE msg, VALUE flags) {
+  CORK_FLUSH(self, io);
+  return BACKEND_INTERFACE(self)->send(self, io, msg, flags);
+}
+
+VALUE Backend_recvfrom(VALUE self, VALUE io, VALUE maxlen, VALUE flags) {
+  CORK_FLUSH(self, io);
+  return BACKEND_INTERFACE(self)->recvfrom(self, io, maxlen, flags);
+}
+
+VALUE Backend_sendto(VALUE self, VALUE io, VALUE msg, VALUE flags, VALUE addr) {
+  CORK_FLUSH(self, io);
+  return BACKEND_INTERFACE(self)->sendto(self, io, msg, flags, addr);
+}
+
+VALUE Backend_recvmmsg(VALUE self, VALUE io, VALUE count, VALUE maxlen) {
+  CORK_FLUSH(self, io);
+  return BACKEND_INTERFACE(self)->recvmmsg(self, io, count, maxlen);
+}
+
+VALUE Backend_sendmmsg(VALUE self, VALUE io, VALUE msgs, VALUE addr) {
+  CORK_FLUSH(self, io);
+  return BACKEND_INTERFACE(self)->sendmmsg(self, io, msgs, addr);
+}
+
+VALUE Backend_sleep(VALUE self, VALUE duration) {
+  return BACKEND_INTERFACE(self)->sleep(self, duration);
+}
+
+VALUE Backend_splice(VALUE self, VALUE src, VALUE dest, VALUE maxlen) {
+  CORK_FLUSH(self, src);
+  CORK_FLUSH(self, dest);
+  return BACKEND_INTERFACE(self)->splice(self, src, dest, maxlen);
+}
+
+VALUE Backend_splice_to_eof(VALUE self, VALUE src, VALUE dest, VALUE chunksize) {
+  CORK_FLUSH(self, src);
+  CORK_FLUSH(self, dest);
+  return BACKEND_INTERFACE(self)->splice_to_eof(self, src, dest, chunksize);
+}
+
+VALUE Backend_timeout(int argc, VALUE *argv, VALUE self) {
+  return BACKEND_INTERFACE(self)->timeout(argc, argv, self);
+}
+
+VALUE Backend_timer_loop(VALUE self, VALUE interval) {
+  return BACKEND_INTERFACE(self)->timer_loop(self, interval);
+}
+
+VALUE Backend_wait_io(VALUE self, VALUE io, VALUE write) {
+  CORK_FLUSH(self, io);
+  return BACKEND_INTERFACE(self)->wait_io(self, io, write);
+}
+
+VALUE Backend_waitpid(VALUE self, VALUE pid) {
+  return BACKEND_INTERFACE(self)->waitpid(self, pid);
+}
+
+VALUE Backend_write_m(int argc, VALUE *argv, VALUE self) {
+  if (argc) CORK_FLUSH(self, argv[0]);
+  return BACKEND_INTERFACE(self)->write_m(argc, argv, self);
+}
+
+// Flushes the ios of all chain ops, i.e. the op elements following the op
+// type which are not strings or numbers.
+VALUE Backend_chain(int argc, VALUE *argv, VALUE self) {
+  for (int i = 0; i < argc; i++) {
+    if (!RB_TYPE_P(argv[i], T_ARRAY)) continue;
+    for (long j = 1; j < RARRAY_LEN(argv[i]) && j <= 2; j++) {
+      VALUE io = RARRAY_AREF(argv[i], j);
+      if (RB_TYPE_P(io, T_FILE) || RB_TYPE_P(io, T_OBJECT)) CORK_FLUSH(self, io);
+    }
+  }
+  return BACKEND_INTERFACE(self)->chain(argc, argv, self);
+}
+
+VALUE Backend_sendfile(int argc, VALUE *argv, VALUE self) {
+  if (argc > 1) CORK_FLUSH(self, argv[1]);
+  return BACKEND_INTERFACE(self)->sendfile(argc, argv, self);
+}
+
+VALUE Backend_splice_chunks(VALUE self, VALUE src, VALUE dest, VALUE prefix, VALUE postfix, VALUE chunk_prefix, VALUE chunk_postfix, VALUE chunk_size) {
+  CORK_FLUSH(self, src);
+  CORK_FLUSH(self, dest);
+  return BACKEND_INTERFACE(self)->splice_chunks(self, src, dest, prefix, postfix, chunk_prefix, chunk_postfix, chunk_size);
+}
+
+VALUE Backend_poll(VALUE self, VALUE blocking) {
+  return BACKEND_INTERFACE(self)->poll(self, blocking);
+}
+
+VALUE Backend_wait_event(VALUE self, VALUE raise_on_exception) {
+  return BACKEND_INTERFACE(self)->wait_event(self, raise_on_exception);
+}
+
+VALUE Backend_wakeup(VALUE self) {
+  return BACKEND_INTERFACE(self)->wakeup(self);
+}
+
+VALUE Backend_switch_fiber(VALUE self) {
+  return BACKEND_INTERFACE(self)->switch_fiber(self);
+}
+
+void Backend_schedule_fiber(VALUE thread, VALUE self, VALUE fiber, VALUE value, int prioritize) {
+  BACKEND_INTERFACE(self)->schedule_fiber(thread, self, fiber, value, prioritize);
+}
+
+void Backend_unschedule_fiber(VALUE self, VALUE fiber) {
+  BACKEND_INTERFACE(self)->unschedule_fiber(self, fiber);
+}
+
+void Backend_park_fiber(VALUE self, VALUE fiber) {
+  BACKEND_INTERFACE(self)->park_fiber(self, fiber);
+}
+
+void Backend_unpark_fiber(VALUE self, VALUE fiber) {
+  BACKEND_INTERFACE(self)->unpark_fiber(self, fiber);
+}
+
+int Backend_fiber_runnable_p(VALUE self, VALUE fiber) {
+  return BACKEND_INTERFACE(self)->fiber_runnable_p(self, fiber);
+}
+
+void Backend_watch_thread_pool_job(VALUE self, struct thread_pool_job *job) {
+  BACKEND_INTERFACE(self)->watch_thread_pool_job(self, job);
+}
+
+struct backend_stats backend_get_stats(VALUE self) {
+  return backend_base_stats((struct Backend_base *)RTYPEDDATA_DATA(self));
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+static VALUE Backend_new_instance(VALUE arg) {
+  VALUE *args = (VALUE *)arg;
+  return rb_class_new_instance((int)args[0], args + 2, args[1]);
+}
+
+// Called if setting up the default backend fails for the current thread (for
+// example, if the io_uring ring cannot be allocated due to RLIMIT_MEMLOCK).
+static VALUE Backend_new_fallback(VALUE arg, VALUE exception) {
+  VALUE *args = (VALUE *)arg;
+  return rb_class_new_instance((int)args[0], args + 2, cFallbackBackend);
+}
+
+// Creates a backend. Polyphony::Backend.new creates an instance of the
+// selected backend implementation, falling back to the libev backend if the
+// selected implementation cannot be set up.
+static VALUE Backend_s_new(int argc, VALUE *argv, VALUE self) {
+  if (self != cBackend) return rb_class_new_instance(argc, argv, self);
+  if (cFallbackBackend == Qnil) return rb_class_new_instance(argc, argv, cDefaultBackend);
+
+  VALUE *args = ALLOCA_N(VALUE, argc + 2);
+  args[0] = (VALUE)argc;
+  args[1] = cDefaultBackend;
+  memcpy(args + 2, argv, argc * sizeof(VALUE));
+  return rb_rescue2(
+    Backend_new_instance, (VALUE)args, Backend_new_fallback, (VALUE)args, rb_eSystemCallError, (VALUE)0
+  );
+}
+
+static VALUE Backend_s_default_kind(VALUE self) {
+  return default_kind;
+}
+
+// Selects the default backend implementation. The POLYPHONY_BACKEND
+// environment variable can be used to select either the io_uring or the libev
+// backend. Otherwise, the io_uring backend is used if supported.
+static void backend_select_default(VALUE cIOUringBackend, VALUE cLibevBackend) {
+  const char *name = getenv("POLYPHONY_BACKEND");
+
+  if (name && *name) {
+    if (!strcmp(name, "libev"))
+      cDefaultBackend = cLibevBackend;
+    else if (!strcmp(name, "io_uring")) {
+      if (cIOUringBackend == Qnil)
+        rb_raise(rb_eRuntimeError, "io_uring backend is not available");
+      cDefaultBackend = cIOUringBackend;
+    }
+    else
+      rb_raise(rb_eArgError, "invalid backend %s specified in POLYPHONY_BACKEND", name);
+    return;
+  }
+
+#ifdef POLYPHONY_BACKEND_LIBURING
+  if (io_uring_backend_supported()) {
+    cDefaultBackend = cIOUringBackend;
+    cFallbackBackend = cLibevBackend;
+    return;
+  }
+#endif
+  cDefaultBackend = cLibevBackend;
+}
+
+void Init_Backend() {
+  VALUE cIOUringBackend = Qnil;
+  VALUE cLibevBackend = Qnil;
+
+  cBackend = rb_define_class_under(mPolyphony, "Backend", rb_cObject);
+  rb_undef_alloc_func(cBackend);
+  rb_define_singleton_method(cBackend, "new", Backend_s_new, -1);
+  rb_define_singleton_method(cBackend, "default_kind", Backend_s_default_kind, 0);
+  mNativeFeed = rb_define_module_under(mPolyphony, "NativeFeed");
+
+  rb_define_method(cBackend, "chain", Backend_chain, -1);
+  rb_define_method(cBackend, "splice_chunks", Backend_splice_chunks, 7);
+  rb_define_method(cBackend, "accept", Backend_accept, 2);
+  rb_define_method(cBackend, "accept_loop", Backend_accept_loop, 2);
+  rb_define_method(cBackend, "connect", Backend_connect, 3);
+  rb_define_method(cBackend, "connect_racing", Backend_connect_racing, 2);
+  rb_define_method(cBackend, "close", Backend_close, 1);
+  rb_define_method(cBackend, "shutdown", Backend_shutdown, 2);
+  rb_define_method(cBackend, "feed_loop", Backend_feed_loop, 3);
+  rb_define_method(cBackend, "read", Backend_read, 5);
+  rb_define_method(cBackend, "readv", Backend_readv, 2);
+  rb_define_method(cBackend, "read_loop", Backend_read_loop, 2);
+  rb_define_method(cBackend, "gets_loop", Backend_gets_loop, 4);
+  rb_define_method(cBackend, "recv", Backend_recv, 4);
+  rb_define_method(cBackend, "recv_feed_loop", Backend_recv_feed_loop, 3);
+  rb_define_method(cBackend, "recv_loop", Backend_recv_loop, 2);
+  rb_define_method(cBackend, "send", Backend_send, 3);
+  rb_define_method(cBackend, "sendv", Backend_sendv, 3);
+  rb_define_method(cBackend, "recvfrom", Backend_recvfrom, 3);
+  rb_define_method(cBackend, "sendto", Backend_sendto, 4);
+  rb_define_method(cBackend, "recvmmsg", Backend_recvmmsg, 3);
+  rb_define_method(cBackend, "sendmmsg", Backend_sendmmsg, 3);
+  rb_define_method(cBackend, "sleep", Backend_sleep, 1);
+  rb_define_method(cBackend, "sendfile", Backend_sendfile, -1);
+  rb_define_method(cBackend, "splice", Backend_splice, 3);
+  rb_define_method(cBackend, "splice_to_eof", Backend_splice_to_eof, 3);
+  rb_define_method(cBackend, "timeout", Backend_timeout, -1);
+  rb_define_method(cBackend, "timer_loop", Backend_timer_loop, 1);
+  rb_define_method(cBackend, "wait_event", Backend_wait_event, 1);
+  rb_define_method(cBackend, "wait_io", Backend_wait_io, 2);
+  rb_define_method(cBackend, "waitpid", Backend_waitpid, 1);
+  rb_define_method(cBackend, "write", Backend_write_m, -1);
+
+  Init_TraceRing(cBackend);
+  Init_Watchdog(cBackend);
+  Init_IdleDeadline(cBackend);
+  Init_IdleGC(cBackend);
+
+#ifdef POLYPHONY_BACKEND_LIBURING
+  Init_IOUringBackend(cBackend);
+  cIOUringBackend = rb_const_get(cBackend, rb_intern("IOUring"));
+#endif
+  Init_LibevBackend(cBackend);
+  cLibevBackend = rb_const_get(cBackend, rb_intern("Libev"));
+
+  backend_select_default(cIOUringBackend, cLibevBackend);
+  default_kind = ID2SYM(rb_intern(cDefaultBackend == cLibevBackend ? "libev" : "io_uring"));
+}
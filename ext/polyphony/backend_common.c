@@ -1,61 +1,210 @@
+#ifdef POLYPHONY_LINUX
+#define _GNU_SOURCE 1
+#endif
+
 #include <time.h>
+#include <string.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <errno.h>
 #include "ruby.h"
 #include "ruby/io.h"
 #include "polyphony.h"
 #include "backend_common.h"
 
+#ifdef POLYPHONY_LINUX
+#include <sys/eventfd.h>
+#endif
+
 inline void backend_base_initialize(struct Backend_base *base) {
   runqueue_initialize(&base->runqueue);
   runqueue_initialize(&base->parked_runqueue);
+  base->parked_count = 0;
   base->currently_polling = 0;
   base->op_count = 0;
   base->switch_count = 0;
   base->poll_count = 0;
   base->pending_count = 0;
+  base->completion_count = 0;
+  base->max_poll_completions = 0;
+  base->sq_full_count = 0;
+  base->watchdog_hit_count = 0;
+  base->idle_gc_minor_count = 0;
+  base->idle_gc_major_count = 0;
+  base->idle_gc_deferred_count = 0;
+  base->idle_gc_time = 0;
+  base->extended_stats = NULL;
+  base->watchdog = NULL;
+  base->idle_deadlines = NULL;
+  base->idle_deadline_count = 0;
+  base->poll_min_complete = 1;
+  base->poll_max_wait = 0;
+  base->poll_busy_spin = 0;
   base->idle_gc_period = 0;
   base->idle_gc_last_time = 0;
+  base->idle_gc = NULL;
   base->idle_proc = Qnil;
   base->trace_proc = Qnil;
+  base->trace_ring = NULL;
+  base->scheduler_group = Qnil;
+  base->pending_corks = Qnil;
+  base->cork_flushers = 0;
+  base->inbox = NULL;
+  base->inbox_wakeup_pending = 0;
+  base->completions = NULL;
+  base->completions_in_flight = 0;
+}
+
+static void backend_inbox_free(struct Backend_base *base) {
+  backend_inbox_entry *entry = __atomic_exchange_n(&base->inbox, NULL, __ATOMIC_ACQ_REL);
+  while (entry) {
+    backend_inbox_entry *next = entry->next;
+    xfree(entry);
+    entry = next;
+  }
+  base->inbox_wakeup_pending = 0;
+}
+
+static void backend_completions_release(backend_completions_t *completions) {
+  if (__atomic_sub_fetch(&completions->refcount, 1, __ATOMIC_ACQ_REL)) return;
+
+  // no job is in flight, and the backend is gone
+  thread_pool_job_t *job = completions->head;
+  while (job) {
+    thread_pool_job_t *next = job->next;
+    thread_pool_job_free(job);
+    job = next;
+  }
+  close(completions->fd);
+  if (completions->write_fd != completions->fd) close(completions->write_fd);
+  free(completions);
 }
 
 inline void backend_base_finalize(struct Backend_base *base) {
   runqueue_finalize(&base->runqueue);
   runqueue_finalize(&base->parked_runqueue);
+  backend_inbox_free(base);
+  if (base->completions) {
+    backend_completions_release(base->completions);
+    base->completions = NULL;
+  }
+  if (base->extended_stats) {
+    free(base->extended_stats);
+    base->extended_stats = NULL;
+  }
+  if (base->trace_ring) {
+    trace_ring_free(base->trace_ring);
+    base->trace_ring = NULL;
+  }
+  if (base->idle_gc) {
+    free(base->idle_gc);
+    base->idle_gc = NULL;
+  }
+  backend_watchdog_stop(base);
 }
 
 inline void backend_base_mark(struct Backend_base *base) {
   if (base->idle_proc != Qnil) rb_gc_mark(base->idle_proc);
   if (base->trace_proc != Qnil) rb_gc_mark(base->trace_proc);
+  if (base->scheduler_group != Qnil) rb_gc_mark(base->scheduler_group);
+  if (base->pending_corks != Qnil) rb_gc_mark(base->pending_corks);
+  if (base->watchdog) backend_watchdog_mark(base);
+  if (base->idle_deadlines) backend_idle_deadlines_mark(base);
   runqueue_mark(&base->runqueue);
   runqueue_mark(&base->parked_runqueue);
+
+  backend_inbox_entry *entry = __atomic_load_n(&base->inbox, __ATOMIC_ACQUIRE);
+  for (; entry; entry = entry->next) {
+    rb_gc_mark(entry->fiber);
+    rb_gc_mark(entry->value);
+  }
 }
 
 void backend_base_reset(struct Backend_base *base) {
   runqueue_finalize(&base->runqueue);
   runqueue_finalize(&base->parked_runqueue);
+  backend_inbox_free(base);
+
+  // jobs submitted before forking are not run in the child process, and are
+  // left holding their references to the channel. Jobs done but not yet
+  // reaped are leaked, as their fibers might still free them.
+  if (base->completions) {
+    base->completions->head = NULL;
+    backend_completions_release(base->completions);
+    base->completions = NULL;
+  }
+  base->completions_in_flight = 0;
 
   runqueue_initialize(&base->runqueue);
   runqueue_initialize(&base->parked_runqueue);
 
+  base->parked_count = 0;
   base->currently_polling = 0;
   base->op_count = 0;
   base->switch_count = 0;
   base->poll_count = 0;
   base->pending_count = 0;
+  base->completion_count = 0;
+  base->max_poll_completions = 0;
+  base->watchdog_hit_count = 0;
+  base->idle_gc_minor_count = 0;
+  base->idle_gc_major_count = 0;
+  base->idle_gc_deferred_count = 0;
+  base->idle_gc_time = 0;
+  base->poll_min_complete = 1;
+  base->poll_max_wait = 0;
+  base->poll_busy_spin = 0;
   base->idle_gc_period = 0;
   base->idle_gc_last_time = 0;
+  if (base->idle_gc) {
+    free(base->idle_gc);
+    base->idle_gc = NULL;
+  }
   base->idle_proc = Qnil;
   base->trace_proc = Qnil;
+  base->scheduler_group = Qnil;
+  backend_corks_reset(base);
+
+  // the watchdog's monitor thread does not survive forking
+  backend_watchdog_reset(base);
+
+  // idle deadlines belong to fibers of the parent process, which are never
+  // resumed in the child process
+  base->idle_deadlines = NULL;
+  base->idle_deadline_count = 0;
+
+  // records from the parent process are discarded
+  if (base->trace_ring) base->trace_ring->head = base->trace_ring->tail;
+
+  // extended stats remain enabled, but start afresh
+  if (base->extended_stats) {
+    memset(base->extended_stats, 0, sizeof(struct backend_extended_stats));
+    base->extended_stats->start_time = current_time_ns();
+  }
 }
 
 const unsigned int ANTI_STARVE_SWITCH_COUNT_THRESHOLD = 64;
+const unsigned int ANTI_STARVE_LOW_PRIORITY_SWITCH_COUNT_THRESHOLD = 16;
 
+// When running low priority fibers, the backend is polled more frequently, so
+// higher priority fibers waiting on I/O are scheduled sooner.
 inline void conditional_nonblocking_poll(VALUE backend, struct Backend_base *base, VALUE current, VALUE next) {
-  if ((base->switch_count % ANTI_STARVE_SWITCH_COUNT_THRESHOLD) == 0 || next == current)
+  unsigned int threshold = base->runqueue.last_level == RUNQUEUE_LEVEL_LOW ?
+    ANTI_STARVE_LOW_PRIORITY_SWITCH_COUNT_THRESHOLD : ANTI_STARVE_SWITCH_COUNT_THRESHOLD;
+  if ((base->switch_count % threshold) == 0 || next == current)
     Backend_poll(backend, Qnil);
 }
 
+// Records the time the current fiber has been running since the last switch.
+static inline void backend_stats_record_run_slice(struct backend_extended_stats *stats) {
+  if (!stats->run_slice_start) return;
+
+  uint64_t slice = current_time_ns() - stats->run_slice_start;
+  if (slice > stats->max_run_slice) stats->max_run_slice = slice;
+}
+
 VALUE backend_base_switch_fiber(VALUE backend, struct Backend_base *base) {
   VALUE current_fiber = rb_fiber_current();
   runqueue_entry next;
@@ -65,8 +214,13 @@ VALUE backend_base_switch_fiber(VALUE backend, struct Backend_base *base) {
 
   base->switch_count++;
   COND_TRACE(base, 2, SYM_fiber_switchpoint, current_fiber);
+  TRACE_RING_RECORD(base, TRACE_FIBER_SWITCHPOINT, current_fiber, 0, 0, -1, 0, 0);
+  if (base->extended_stats) backend_stats_record_run_slice(base->extended_stats);
+  if (base->watchdog) backend_watchdog_slice_end(base);
+  if (base->pending_corks != Qnil) backend_corks_flush_nonblock(base);
 
   while (1) {
+    if (base->inbox) backend_base_drain_inbox(base);
     next = runqueue_shift(&base->runqueue);
     if (next.fiber != Qnil) {
       // Polling for I/O op completion is normally done when the run queue is
@@ -86,57 +240,252 @@ VALUE backend_base_switch_fiber(VALUE backend, struct Backend_base *base) {
     if (!idle_tasks_run_count) {
       idle_tasks_run_count++;
       backend_run_idle_tasks(base);
+      // Idle tasks may schedule fibers, and other threads may push onto the
+      // inbox while idle tasks are running, so both are checked again before
+      // blocking.
+      continue;
     }
+    // before blocking, take a task from the scheduler group, if any
+    if (base->scheduler_group != Qnil && SchedulerGroup_run_task(base->scheduler_group))
+      continue;
     if (pending_ops_count == 0) break;
-    Backend_poll(backend, Qtrue);
+    if (base->extended_stats || base->idle_gc) {
+      uint64_t poll_start = current_time_ns();
+      Backend_poll(backend, Qtrue);
+      uint64_t poll_wait_time = current_time_ns() - poll_start;
+      if (base->extended_stats) base->extended_stats->poll_wait_time += poll_wait_time;
+      if (base->idle_gc) backend_idle_gc_record_poll_wait(base, poll_wait_time / 1e9);
+    }
+    else
+      Backend_poll(backend, Qtrue);
     backend_was_polled = 1;
   }
 
   if (next.fiber == Qnil) return Qnil;
+  if (base->extended_stats) base->extended_stats->run_slice_start = current_time_ns();
+  if (base->watchdog) backend_watchdog_slice_start(base, next.fiber);
 
   // run next fiber
   COND_TRACE(base, 3, SYM_fiber_run, next.fiber, next.value);
+  TRACE_RING_RECORD(base, TRACE_FIBER_RUN, next.fiber, 0, 0, -1, 0, 0);
 
-  rb_ivar_set(next.fiber, ID_ivar_runnable, Qnil);
   RB_GC_GUARD(next.fiber);
   RB_GC_GUARD(next.value);
   return (next.fiber == current_fiber) ?
     next.value : FIBER_TRANSFER(next.fiber, next.value);
 }
 
-void backend_base_schedule_fiber(VALUE thread, VALUE backend, struct Backend_base *base, VALUE fiber, VALUE value, int prioritize) {
+static inline int backend_base_fiber_queued_p(struct Backend_base *base, VALUE fiber) {
+  return runqueue_includes_p(&base->runqueue, fiber) ||
+    (base->parked_count && runqueue_includes_p(&base->parked_runqueue, fiber));
+}
+
+static void backend_base_schedule_fiber_local(struct Backend_base *base, VALUE fiber, VALUE value, int prioritize) {
   int already_runnable;
 
   if (rb_fiber_alive_p(fiber) != Qtrue) return;
-  already_runnable = rb_ivar_get(fiber, ID_ivar_runnable) != Qnil;
+  // a fiber is runnable as long as it's in one of the runqueues, the parked
+  // runqueue is only looked at if any fiber is parked
+  already_runnable = backend_base_fiber_queued_p(base, fiber);
 
   COND_TRACE(base, 4, SYM_fiber_schedule, fiber, value, prioritize ? Qtrue : Qfalse);
+  TRACE_RING_RECORD(base, TRACE_FIBER_SCHEDULE, fiber, 0, 0, -1, 0, prioritize);
 
-  runqueue_t *runqueue = rb_ivar_get(fiber, ID_ivar_parked) == Qtrue ?
+  runqueue_t *runqueue = (base->parked_count && Fiber_parked_state(fiber)) ?
     &base->parked_runqueue : &base->runqueue;
 
-  (prioritize ? runqueue_unshift : runqueue_push)(runqueue, fiber, value, already_runnable);
-  if (!already_runnable) {
-    rb_ivar_set(fiber, ID_ivar_runnable, Qtrue);
-    if (rb_thread_current() != thread) {
-      // If the fiber scheduling is done across threads, we need to make sure the
-      // target thread is woken up in case it is in the middle of running its
-      // event selector. Otherwise it's gonna be stuck waiting for an event to
-      // happen, not knowing that it there's already a fiber ready to run in its
-      // run queue.
-      Backend_wakeup(backend);
+  // A pending exception (e.g. from Fiber#raise) is not overridden by a plain
+  // value, such as an op completion resuming the same fiber, so the fiber is
+  // never resumed without the exception having been raised.
+  if (already_runnable && !TEST_EXCEPTION(value)) {
+    VALUE pending = runqueue_value_of(runqueue, fiber);
+    if (pending != Qundef && TEST_EXCEPTION(pending)) return;
+  }
+
+  // prioritized fibers are put at the head of the highest priority level
+  if (prioritize)
+    runqueue_unshift(runqueue, fiber, value, RUNQUEUE_LEVEL_HIGH, already_runnable);
+  else
+    runqueue_push(runqueue, fiber, value, Fiber_priority_state(fiber), already_runnable);
+}
+
+// Fibers scheduled from other threads are pushed onto the backend's inbox,
+// a lock-free LIFO list, without touching the runqueue. Only the first push
+// after the inbox was drained wakes up the backend, so a burst of cross-thread
+// schedulings results in a single wakeup.
+static void backend_base_inbox_push(VALUE backend, struct Backend_base *base, VALUE fiber, VALUE value, int prioritize) {
+  backend_inbox_entry *entry = ALLOC(backend_inbox_entry);
+  entry->fiber = fiber;
+  entry->value = value;
+  entry->prioritize = prioritize;
+  entry->next = __atomic_load_n(&base->inbox, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(
+    &base->inbox, &entry->next, entry, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED
+  ));
+
+  // If the fiber scheduling is done across threads, we need to make sure the
+  // target thread is woken up in case it is in the middle of running its
+  // event selector. Otherwise it's gonna be stuck waiting for an event to
+  // happen, not knowing that it there's already a fiber ready to run.
+  if (!__atomic_exchange_n(&base->inbox_wakeup_pending, 1, __ATOMIC_ACQ_REL))
+    Backend_wakeup(backend);
+}
+
+// Moves all fibers scheduled from other threads into the runqueue, in the
+// order they were scheduled.
+void backend_base_drain_inbox(struct Backend_base *base) {
+  __atomic_store_n(&base->inbox_wakeup_pending, 0, __ATOMIC_RELEASE);
+  backend_inbox_entry *entry = __atomic_exchange_n(&base->inbox, NULL, __ATOMIC_ACQ_REL);
+  backend_inbox_entry *reversed = NULL;
+
+  while (entry) {
+    backend_inbox_entry *next = entry->next;
+    entry->next = reversed;
+    reversed = entry;
+    entry = next;
+  }
+
+  while (reversed) {
+    entry = reversed;
+    reversed = entry->next;
+    backend_base_schedule_fiber_local(base, entry->fiber, entry->value, entry->prioritize);
+    RB_GC_GUARD(entry->fiber);
+    RB_GC_GUARD(entry->value);
+    xfree(entry);
+  }
+}
+
+// Entries are only ever pushed onto the head of the inbox, and are freed only
+// by the thread holding the GVL, so the inbox can be walked without draining
+// it.
+static int backend_base_inbox_includes_p(struct Backend_base *base, VALUE fiber) {
+  backend_inbox_entry *entry = __atomic_load_n(&base->inbox, __ATOMIC_ACQUIRE);
+  for (; entry; entry = entry->next)
+    if (entry->fiber == fiber) return 1;
+  return 0;
+}
+
+// Sets up the completion channel's fds. On Linux both ends are the same
+// eventfd. Elsewhere, a non-blocking self-pipe is used.
+static int backend_completions_open(backend_completions_t *completions) {
+#ifdef POLYPHONY_LINUX
+  completions->fd = completions->write_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  return completions->fd;
+#else
+  int pipefd[2];
+  if (pipe(pipefd) == -1) return -1;
+
+  for (int i = 0; i < 2; i++) {
+    fcntl(pipefd[i], F_SETFL, O_NONBLOCK);
+    fcntl(pipefd[i], F_SETFD, FD_CLOEXEC);
+  }
+  completions->fd = pipefd[0];
+  completions->write_fd = pipefd[1];
+  return 0;
+#endif
+}
+
+static backend_completions_t *backend_base_completions(struct Backend_base *base) {
+  if (!base->completions) {
+    backend_completions_t *completions = malloc(sizeof(backend_completions_t));
+    if (!completions) rb_memerror();
+    if (backend_completions_open(completions) == -1) {
+      int e = errno;
+      free(completions);
+      rb_syserr_fail(e, strerror(e));
     }
+    completions->head = NULL;
+    completions->refcount = 1;
+    base->completions = completions;
+  }
+  return base->completions;
+}
+
+// Associates the given job with the backend, returning the completion fd to
+// be watched.
+int backend_base_watch_job(struct Backend_base *base, thread_pool_job_t *job) {
+  backend_completions_t *completions = backend_base_completions(base);
+  __atomic_add_fetch(&completions->refcount, 1, __ATOMIC_RELAXED);
+  job->base = base;
+  job->completions = completions;
+  base->completions_in_flight++;
+  return completions->fd;
+}
+
+// Called on a thread pool worker thread, without the GVL. The completion fd
+// is only written to when pushing onto an empty list, so many completions can
+// be reaped in a single poll.
+void thread_pool_job_push_completion(thread_pool_job_t *job) {
+  backend_completions_t *completions = job->completions;
+  job->next = __atomic_load_n(&completions->head, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(
+    &completions->head, &job->next, job, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED
+  ));
+
+  if (!job->next) {
+    uint64_t value = 1;
+    while (write(completions->write_fd, &value, sizeof(value)) < 0 && errno == EINTR);
+  }
+  backend_completions_release(completions);
+}
+
+void backend_base_drain_completions(struct Backend_base *base) {
+  uint64_t value;
+  backend_completions_t *completions = base->completions;
+  if (!completions) return;
+#ifdef POLYPHONY_LINUX
+  if (read(completions->fd, &value, sizeof(value)) < 0 && errno != EAGAIN) return;
+#else
+  // the self-pipe might hold more than one wakeup
+  ssize_t ret;
+  while ((ret = read(completions->fd, &value, sizeof(value))) > 0);
+  if (ret < 0 && errno != EAGAIN) return;
+#endif
+
+  thread_pool_job_t *job = __atomic_exchange_n(&completions->head, NULL, __ATOMIC_ACQ_REL);
+  while (job) {
+    thread_pool_job_t *next = job->next;
+    base->completions_in_flight--;
+    job->completed = 1;
+    if (job->abandoned)
+      thread_pool_job_free(job);
+    else
+      Fiber_make_runnable(job->fiber, Qnil);
+    job = next;
   }
 }
 
+void backend_base_schedule_fiber(VALUE thread, VALUE backend, struct Backend_base *base, VALUE fiber, VALUE value, int prioritize) {
+  if (rb_thread_current() != thread)
+    backend_base_inbox_push(backend, base, fiber, value, prioritize);
+  else
+    backend_base_schedule_fiber_local(base, fiber, value, prioritize);
+}
+
 inline void backend_base_park_fiber(struct Backend_base *base, VALUE fiber) {
+  base->parked_count++;
   runqueue_migrate(&base->runqueue, &base->parked_runqueue, fiber);
 }
 
 inline void backend_base_unpark_fiber(struct Backend_base *base, VALUE fiber) {
+  if (base->parked_count) base->parked_count--;
   runqueue_migrate(&base->parked_runqueue, &base->runqueue, fiber);
 }
 
+// A fiber scheduled from another thread is runnable as soon as it's pushed
+// onto the inbox, even before the inbox is drained into the runqueue.
+inline int backend_base_fiber_runnable_p(struct Backend_base *base, VALUE fiber) {
+  return backend_base_fiber_queued_p(base, fiber) ||
+    (base->inbox && backend_base_inbox_includes_p(base, fiber));
+}
+
+// The inbox is drained first, so a fiber scheduled from another thread is
+// removed along with any fibers scheduled locally.
+inline void backend_base_unschedule_fiber(struct Backend_base *base, VALUE fiber) {
+  if (base->inbox) backend_base_drain_inbox(base);
+  runqueue_delete(&base->runqueue, fiber);
+}
+
 inline void backend_trace(struct Backend_base *base, int argc, VALUE *argv) {
   if (base->trace_proc == Qnil) return;
 
@@ -207,6 +556,176 @@ inline VALUE io_enc_str(VALUE str, rb_io_t *fptr) {
   return str;
 }
 
+// Sets up an iovec array for reading into the given buffers. Each buffer is
+// either a string, which is read into up to its current length (or up to its
+// capacity if empty), or a [string, length] pair. The iovec array is allocated
+// in a string pushed onto strs, followed by the buffer strings, so they are
+// all kept alive for as long as strs is, even if the read is interrupted. An
+// ArgumentError is raised if the buffers have no room for reading, since the
+// read would otherwise be mistaken for an EOF.
+struct iovec *io_readv_setup(VALUE buffers, VALUE strs, int *count) {
+  long total = 0;
+  Check_Type(buffers, T_ARRAY);
+  *count = RARRAY_LEN(buffers);
+  if (!*count) rb_raise(rb_eArgError, "no buffers given");
+
+  VALUE iov_str = rb_str_buf_new(*count * sizeof(struct iovec));
+  rb_ary_push(strs, iov_str);
+  struct iovec *iov = (struct iovec *)RSTRING_PTR(iov_str);
+  for (int i = 0; i < *count; i++) {
+    VALUE buffer = RARRAY_AREF(buffers, i);
+    VALUE str = buffer;
+    long len;
+    if (TYPE(buffer) == T_ARRAY) {
+      str = rb_ary_entry(buffer, 0);
+      len = NUM2LONG(rb_ary_entry(buffer, 1));
+    }
+    else
+      len = -1;
+    if (TYPE(str) != T_STRING) rb_raise(rb_eTypeError, "expected a string buffer");
+    rb_str_modify(str);
+    if (len >= 0) rb_str_resize(str, len);
+    rb_ary_push(strs, str);
+    iov[i].iov_base = RSTRING_PTR(str);
+    iov[i].iov_len = (len < 0 && !RSTRING_LEN(str)) ? rb_str_capacity(str) : (size_t)RSTRING_LEN(str);
+    total += iov[i].iov_len;
+  }
+  if (!total) rb_raise(rb_eArgError, "no room in buffers");
+  return iov;
+}
+
+// Truncates each string to the length actually read into it.
+void io_readv_set_lengths(VALUE strs, struct iovec *iov, long total, rb_io_t *fptr) {
+  long count = RARRAY_LEN(strs);
+  for (long i = 1; i < count; i++) {
+    VALUE str = RARRAY_AREF(strs, i);
+    long len = (long)iov[i - 1].iov_len < total ? (long)iov[i - 1].iov_len : total;
+    io_set_read_length(str, len, 0);
+    io_enc_str(str, fptr);
+    total -= len;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void io_gets_loop_setup(struct gets_loop_ctx *ctx, VALUE backend, VALUE io, rb_io_t *fptr, VALUE buffer, VALUE sep, VALUE chomp) {
+  if (NIL_P(sep)) sep = rb_rs;
+  StringValue(sep);
+  if (!RSTRING_LEN(sep)) rb_raise(rb_eArgError, "empty separator");
+  if (NIL_P(buffer)) buffer = rb_str_buf_new(GETS_LOOP_READ_SIZE);
+  else StringValue(buffer);
+
+  ctx->backend = backend;
+  ctx->io = io;
+  ctx->fptr = fptr;
+  ctx->buffer = buffer;
+  ctx->sep = sep;
+  ctx->sep_len = RSTRING_LEN(sep);
+  ctx->chomp = RTEST(chomp);
+  ctx->pos = 0;
+  ctx->scan_pos = 0;
+}
+
+// Yields a line taken from the buffer at the given offset.
+static inline void io_gets_loop_yield(struct gets_loop_ctx *ctx, long offset, long len, int terminated) {
+  if (terminated && ctx->chomp) len -= ctx->sep_len;
+  VALUE line = rb_str_new(RSTRING_PTR(ctx->buffer) + offset, len);
+  io_enc_str(line, ctx->fptr);
+  rb_yield(line);
+  RB_GC_GUARD(line);
+}
+
+// Yields all complete lines in the buffer. Separator scanning is done with
+// memchr on the separator's first byte, which libc implements with vector
+// instructions, followed by a memcmp for multi-byte separators. The buffer
+// pointer is refetched after each yield, since the block may modify it.
+static void io_gets_loop_scan(struct gets_loop_ctx *ctx) {
+  const char *sep = RSTRING_PTR(ctx->sep);
+  long sep_len = ctx->sep_len;
+
+  while (1) {
+    char *ptr = RSTRING_PTR(ctx->buffer);
+    long len = RSTRING_LEN(ctx->buffer);
+    if (ctx->scan_pos < ctx->pos) ctx->scan_pos = ctx->pos;
+    if (len - ctx->scan_pos < sep_len) return;
+
+    char *found = memchr(ptr + ctx->scan_pos, sep[0], len - ctx->scan_pos - sep_len + 1);
+    if (!found) {
+      ctx->scan_pos = len - sep_len + 1;
+      return;
+    }
+    if (sep_len > 1 && memcmp(found + 1, sep + 1, sep_len - 1)) {
+      ctx->scan_pos = found - ptr + 1;
+      continue;
+    }
+
+    long offset = ctx->pos;
+    long end = found - ptr + sep_len;
+    ctx->pos = ctx->scan_pos = end;
+    io_gets_loop_yield(ctx, offset, end - offset, 1);
+  }
+}
+
+// Discards consumed data from the front of the buffer.
+static inline void io_gets_loop_compact(struct gets_loop_ctx *ctx) {
+  if (!ctx->pos) return;
+
+  long len = RSTRING_LEN(ctx->buffer);
+  long remaining = len > ctx->pos ? len - ctx->pos : 0;
+  rb_str_modify(ctx->buffer);
+  char *ptr = RSTRING_PTR(ctx->buffer);
+  if (remaining) memmove(ptr, ptr + ctx->pos, remaining);
+  rb_str_set_len(ctx->buffer, remaining);
+  ctx->scan_pos = ctx->scan_pos > ctx->pos ? ctx->scan_pos - ctx->pos : 0;
+  ctx->pos = 0;
+}
+
+// Returns a pointer to the free space at the end of the buffer, making room
+// for at least GETS_LOOP_READ_SIZE bytes. Any lines already in the buffer
+// (e.g. left over from a previous gets) are yielded first.
+char *io_gets_loop_reserve(struct gets_loop_ctx *ctx, long *len) {
+  io_gets_loop_scan(ctx);
+  io_gets_loop_compact(ctx);
+
+  long used = RSTRING_LEN(ctx->buffer);
+  long capa = rb_str_capacity(ctx->buffer);
+  if (capa - used < GETS_LOOP_READ_SIZE) {
+    rb_str_modify_expand(ctx->buffer, GETS_LOOP_READ_SIZE);
+    capa = rb_str_capacity(ctx->buffer);
+  }
+  else
+    rb_str_modify(ctx->buffer);
+
+  *len = capa - used;
+  return RSTRING_PTR(ctx->buffer) + used;
+}
+
+// Adds n bytes read into the reserved space to the buffer, and yields any
+// complete lines.
+void io_gets_loop_commit(struct gets_loop_ctx *ctx, long n) {
+  rb_str_set_len(ctx->buffer, RSTRING_LEN(ctx->buffer) + n);
+  io_gets_loop_scan(ctx);
+}
+
+// Yields the last line, if not terminated by a separator, on EOF.
+void io_gets_loop_finish(struct gets_loop_ctx *ctx) {
+  long len = RSTRING_LEN(ctx->buffer);
+  if (len <= ctx->pos) return;
+
+  long offset = ctx->pos;
+  ctx->pos = ctx->scan_pos = len;
+  io_gets_loop_yield(ctx, offset, len - offset, 0);
+}
+
+// Called when the loop is done, whether normally, by an exception or by
+// breaking out of the block. Unconsumed data is left in the buffer, so it can
+// be picked up by a subsequent read.
+VALUE io_gets_loop_cleanup(VALUE arg) {
+  io_gets_loop_compact((struct gets_loop_ctx *)arg);
+  return Qnil;
+}
+
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
@@ -246,6 +765,12 @@ inline double current_time() {
   return t / 1e9;
 }
 
+inline uint64_t current_time_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 inline VALUE backend_timeout_exception(VALUE exception) {
   if (rb_obj_is_kind_of(exception, rb_cArray) == Qtrue)
     return rb_funcall(rb_ary_entry(exception, 0), ID_new, 1, rb_ary_entry(exception, 1));
@@ -267,6 +792,387 @@ VALUE Backend_timeout_ensure_safe(VALUE arg) {
   return rb_rescue2(Backend_timeout_safe, Qnil, Backend_timeout_rescue, Qnil, rb_eException, (VALUE)0);
 }
 
+// Returns a scratch string with at least the given capacity, for memory that
+// might be referenced by the kernel while the fiber is suspended. The string
+// is never embedded, since embedded strings might be moved by GC compaction.
+#define BACKEND_SCRATCH_MIN_SIZE 1024
+
+VALUE backend_scratch_buffer(size_t size, char **ptr) {
+  VALUE str = rb_str_buf_new(size < BACKEND_SCRATCH_MIN_SIZE ? BACKEND_SCRATCH_MIN_SIZE : size);
+  *ptr = RSTRING_PTR(str);
+  return str;
+}
+
+// Datagram batches are laid out in a single scratch string: the message
+// headers, followed by the iovecs, the peer addresses and (when receiving) the
+// datagram buffers. The scratch string is GC-managed, so nothing leaks if the
+// fiber is interrupted while waiting, and it can be attached to an abandoned
+// io_uring op, which might still reference it on the kernel side.
+#ifdef POLYPHONY_LINUX
+typedef struct mmsghdr udp_msg_t;
+#else
+typedef struct { struct msghdr msg_hdr; unsigned int msg_len; } udp_msg_t;
+#endif
+
+#define UDP_MSGS(batch) ((udp_msg_t *)RSTRING_PTR((batch)->scratch))
+
+static inline char *udp_batch_alloc(udp_batch_t *batch, size_t buffer_size) {
+  size_t header_size =
+    batch->count * (sizeof(udp_msg_t) + sizeof(struct iovec) + sizeof(struct sockaddr_storage));
+  char *ptr;
+  if (buffer_size > SIZE_MAX - header_size) rb_raise(rb_eArgError, "Batch too large");
+  batch->scratch = backend_scratch_buffer(header_size + buffer_size, &ptr);
+  memset(ptr, 0, header_size);
+  return ptr;
+}
+
+static inline void udp_batch_check_count(long count) {
+  if (count < 1 || count > UDP_BATCH_MAX_COUNT)
+    rb_raise(rb_eArgError, "Invalid batch size %ld (expected 1..%d)", count, UDP_BATCH_MAX_COUNT);
+}
+
+void udp_batch_init_recv(udp_batch_t *batch, VALUE count, VALUE maxlen, int flags) {
+  long count_long = NUM2LONG(count);
+  long maxlen_long = NUM2LONG(maxlen);
+  udp_batch_check_count(count_long);
+  if (maxlen_long < 1 || maxlen_long > UDP_BATCH_MAX_LEN)
+    rb_raise(rb_eArgError, "Invalid maxlen %ld (expected 1..%d)", maxlen_long, UDP_BATCH_MAX_LEN);
+
+  batch->count = count_long;
+  batch->maxlen = maxlen_long;
+  batch->flags = flags;
+  batch->msgs = Qnil;
+  if ((size_t)batch->maxlen > SIZE_MAX / batch->count) rb_raise(rb_eArgError, "Batch too large");
+  char *ptr = udp_batch_alloc(batch, batch->count * batch->maxlen);
+  udp_msg_t *msgs = (udp_msg_t *)ptr;
+  struct iovec *iovs = (struct iovec *)(msgs + batch->count);
+  struct sockaddr_storage *addrs = (struct sockaddr_storage *)(iovs + batch->count);
+  char *buffer = (char *)(addrs + batch->count);
+
+  for (unsigned int i = 0; i < batch->count; i++) {
+    iovs[i].iov_base = buffer + i * batch->maxlen;
+    iovs[i].iov_len = batch->maxlen;
+    msgs[i].msg_hdr.msg_name = addrs + i;
+    msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+    msgs[i].msg_hdr.msg_iov = iovs + i;
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+}
+
+static inline void udp_msg_set_addr(udp_msg_t *msg, struct sockaddr_storage *storage, VALUE addr) {
+  if (addr == Qnil) return;
+
+  StringValue(addr);
+  long len = RSTRING_LEN(addr);
+  if (len > (long)sizeof(struct sockaddr_storage)) rb_raise(rb_eArgError, "Invalid address");
+  memcpy(storage, RSTRING_PTR(addr), len);
+  msg->msg_hdr.msg_name = storage;
+  msg->msg_hdr.msg_namelen = len;
+}
+
+// Prepares a batch of datagrams for sending. Each message is either a string,
+// sent to the given address (or to the connected peer if addr is nil), or a
+// [string, address] pair. Addresses are given as packed sockaddr strings.
+// The strings sent are kept in batch->msgs, which must be kept alive (or
+// attached to the op) for as long as the batch is used.
+void udp_batch_init_send(udp_batch_t *batch, VALUE msgs, VALUE addr, int flags) {
+  Check_Type(msgs, T_ARRAY);
+  udp_batch_check_count(RARRAY_LEN(msgs));
+
+  batch->count = RARRAY_LEN(msgs);
+  batch->maxlen = 0;
+  batch->flags = flags;
+  batch->msgs = rb_ary_new_capa(batch->count);
+  char *ptr = udp_batch_alloc(batch, 0);
+  udp_msg_t *msg = (udp_msg_t *)ptr;
+  struct iovec *iovs = (struct iovec *)(msg + batch->count);
+  struct sockaddr_storage *addrs = (struct sockaddr_storage *)(iovs + batch->count);
+
+  for (unsigned int i = 0; i < batch->count; i++, msg++) {
+    VALUE str = RARRAY_AREF(msgs, i);
+    VALUE msg_addr = addr;
+    if (TYPE(str) == T_ARRAY) {
+      if (RARRAY_LEN(str) != 2) rb_raise(rb_eArgError, "Expected [message, address] pair");
+      msg_addr = RARRAY_AREF(str, 1);
+      str = RARRAY_AREF(str, 0);
+    }
+    // a frozen copy shares the string's contents, and is not affected by
+    // later changes to the string
+    str = rb_str_new_frozen(rb_str_to_str(str));
+    rb_ary_push(batch->msgs, str);
+    iovs[i].iov_base = RSTRING_PTR(str);
+    iovs[i].iov_len = RSTRING_LEN(str);
+    msg->msg_hdr.msg_iov = iovs + i;
+    msg->msg_hdr.msg_iovlen = 1;
+    udp_msg_set_addr(msg, addrs + i, msg_addr);
+  }
+}
+
+struct msghdr *udp_batch_msghdr(udp_batch_t *batch, unsigned int idx) {
+  return &UDP_MSGS(batch)[idx].msg_hdr;
+}
+
+void udp_batch_set_len(udp_batch_t *batch, unsigned int idx, unsigned int len) {
+  UDP_MSGS(batch)[idx].msg_len = len;
+}
+
+// Receives (without blocking) up to count - offset datagrams into the batch,
+// starting at the given offset. Returns the number of datagrams received, or
+// -1 (with errno set) on error.
+int udp_batch_recv_nonblock(int fd, udp_batch_t *batch, unsigned int offset) {
+  udp_msg_t *msgs = UDP_MSGS(batch) + offset;
+  unsigned int count = batch->count - offset;
+  int flags = batch->flags | MSG_DONTWAIT;
+#ifdef POLYPHONY_LINUX
+  return recvmmsg(fd, msgs, count, flags, NULL);
+#else
+  for (unsigned int i = 0; i < count; i++) {
+    ssize_t n = recvmsg(fd, &msgs[i].msg_hdr, flags);
+    if (n < 0) return i ? (int)i : -1;
+    msgs[i].msg_len = n;
+  }
+  return count;
+#endif
+}
+
+// Sends (without blocking) the datagrams in the batch, starting at the given
+// offset. Returns the number of datagrams sent, or -1 (with errno set) on
+// error.
+int udp_batch_send_nonblock(int fd, udp_batch_t *batch, unsigned int offset) {
+  udp_msg_t *msgs = UDP_MSGS(batch) + offset;
+  unsigned int count = batch->count - offset;
+  int flags = batch->flags | MSG_DONTWAIT;
+#ifdef POLYPHONY_LINUX
+  return sendmmsg(fd, msgs, count, flags);
+#else
+  for (unsigned int i = 0; i < count; i++) {
+    ssize_t n = sendmsg(fd, &msgs[i].msg_hdr, flags);
+    if (n < 0) return i ? (int)i : -1;
+    msgs[i].msg_len = n;
+  }
+  return count;
+#endif
+}
+
+// Returns the total number of bytes in count datagrams, starting at the given
+// offset.
+long udp_batch_total_len(udp_batch_t *batch, unsigned int offset, unsigned int count) {
+  udp_msg_t *msgs = UDP_MSGS(batch) + offset;
+  long total = 0;
+  for (unsigned int i = 0; i < count; i++) total += msgs[i].msg_len;
+  return total;
+}
+
+// Returns the received datagrams as an array of [data, address] pairs, with
+// addresses given as frozen packed sockaddr strings (or nil for unnamed
+// peers). Consecutive datagrams from the same peer share the same address
+// string.
+VALUE udp_batch_recv_result(udp_batch_t *batch, unsigned int received) {
+  udp_msg_t *msgs = UDP_MSGS(batch);
+  VALUE result = rb_ary_new_capa(received);
+  VALUE addr = Qnil;
+  struct msghdr *prev_hdr = NULL;
+
+  for (unsigned int i = 0; i < received; i++) {
+    struct msghdr *hdr = &msgs[i].msg_hdr;
+    VALUE str = rb_str_new(hdr->msg_iov->iov_base, msgs[i].msg_len);
+    if (!hdr->msg_namelen)
+      addr = Qnil;
+    else if (!prev_hdr || prev_hdr->msg_namelen != hdr->msg_namelen ||
+              memcmp(prev_hdr->msg_name, hdr->msg_name, hdr->msg_namelen)) {
+      addr = rb_str_new(hdr->msg_name, hdr->msg_namelen);
+      rb_obj_freeze(addr);
+    }
+    prev_hdr = hdr;
+    rb_ary_push(result, rb_ary_new_from_args(2, str, addr));
+  }
+  RB_GC_GUARD(batch->scratch);
+  return result;
+}
+
+// Fills in the given sockaddr for the given host and port. If port is nil, the
+// host is a packed sockaddr string of any family (e.g. as returned by
+// Addrinfo#to_sockaddr), otherwise the host is a numeric IPv4 or IPv6 address.
+socklen_t backend_sockaddr(VALUE host, VALUE port, struct sockaddr_storage *addr) {
+  if (port == Qnil) {
+    StringValue(host);
+    long len = RSTRING_LEN(host);
+    if (len < (long)sizeof(sa_family_t) || len > (long)sizeof(struct sockaddr_storage))
+      rb_raise(rb_eArgError, "Invalid address");
+    memcpy(addr, RSTRING_PTR(host), len);
+    return len;
+  }
+
+  char port_buf[16];
+  struct addrinfo hints = {0};
+  struct addrinfo *info;
+  hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+  snprintf(port_buf, sizeof(port_buf), "%d", NUM2INT(port));
+  if (getaddrinfo(StringValueCStr(host), port_buf, &hints, &info))
+    rb_raise(rb_eArgError, "Invalid address %"PRIsVALUE, host);
+
+  socklen_t len = info->ai_addrlen;
+  memcpy(addr, info->ai_addr, len);
+  freeaddrinfo(info);
+  return len;
+}
+
+static ID ID_afamily;
+static ID ID_socktype;
+static ID ID_protocol;
+static ID ID_to_sockaddr;
+static ID ID_for_fd;
+
+// Prepares a connection race over the given addrinfos, which are attempted in
+// the given order. The attempts are kept in a scratch string, since their
+// addresses and (on libev) watchers might be referenced while the fiber is
+// suspended. Sockets are created natively, and only the winning socket is
+// wrapped in a Socket instance.
+void connect_race_init(connect_race_t *race, VALUE addrinfos, VALUE stagger_delay) {
+  if (!ID_afamily) {
+    ID_afamily      = rb_intern("afamily");
+    ID_socktype     = rb_intern("socktype");
+    ID_protocol     = rb_intern("protocol");
+    ID_to_sockaddr  = rb_intern("to_sockaddr");
+    ID_for_fd       = rb_intern("for_fd");
+  }
+
+  Check_Type(addrinfos, T_ARRAY);
+  race->count = RARRAY_LEN(addrinfos);
+  if (!race->count) rb_raise(rb_eArgError, "No addresses given");
+  race->stagger_delay = NUM2DBL(stagger_delay);
+  race->started = 0;
+  race->pending = 0;
+  race->last_error = 0;
+
+  char *ptr;
+  race->scratch = backend_scratch_buffer(race->count * sizeof(connect_attempt_t), &ptr);
+  race->attempts = (connect_attempt_t *)ptr;
+  memset(race->attempts, 0, race->count * sizeof(connect_attempt_t));
+
+  for (unsigned int i = 0; i < race->count; i++) {
+    connect_attempt_t *attempt = race->attempts + i;
+    VALUE info = RARRAY_AREF(addrinfos, i);
+    attempt->fd = -1;
+    attempt->family = NUM2INT(rb_funcall(info, ID_afamily, 0));
+    attempt->socktype = NUM2INT(rb_funcall(info, ID_socktype, 0));
+    attempt->protocol = NUM2INT(rb_funcall(info, ID_protocol, 0));
+    if (!attempt->socktype) attempt->socktype = SOCK_STREAM;
+    attempt->addrlen = backend_sockaddr(rb_funcall(info, ID_to_sockaddr, 0), Qnil, &attempt->addr);
+  }
+}
+
+// Creates the socket for the next attempt, in non-blocking mode if nonblock is
+// set. Returns the attempt, or NULL (with the error recorded) if the socket
+// could not be created.
+connect_attempt_t *connect_race_next_attempt(connect_race_t *race, int nonblock) {
+  connect_attempt_t *attempt = race->attempts + race->started++;
+#if defined(SOCK_CLOEXEC) && defined(SOCK_NONBLOCK)
+  int type = attempt->socktype | SOCK_CLOEXEC | (nonblock ? SOCK_NONBLOCK : 0);
+  attempt->fd = socket(attempt->family, type, attempt->protocol);
+#else
+  attempt->fd = socket(attempt->family, attempt->socktype, attempt->protocol);
+  if (attempt->fd >= 0) {
+    fcntl(attempt->fd, F_SETFD, FD_CLOEXEC);
+    if (nonblock) fcntl(attempt->fd, F_SETFL, fcntl(attempt->fd, F_GETFL) | O_NONBLOCK);
+  }
+#endif
+  if (attempt->fd < 0) {
+    race->last_error = errno;
+    attempt->done = 1;
+    return NULL;
+  }
+  race->pending++;
+  return attempt;
+}
+
+// Marks the given attempt as done. Failed attempts are closed.
+void connect_race_attempt_done(connect_race_t *race, connect_attempt_t *attempt, int result) {
+  attempt->done = 1;
+  attempt->result = result;
+  race->pending--;
+  if (result) {
+    race->last_error = result;
+    close(attempt->fd);
+    attempt->fd = -1;
+  }
+}
+
+// Closes the sockets of all attempts other than the winner. The backend should
+// have already cancelled or stopped any pending ops on those sockets.
+void connect_race_close_losers(connect_race_t *race, connect_attempt_t *winner) {
+  for (unsigned int i = 0; i < race->started; i++) {
+    connect_attempt_t *attempt = race->attempts + i;
+    if (attempt == winner || attempt->fd < 0) continue;
+
+    close(attempt->fd);
+    attempt->fd = -1;
+  }
+}
+
+VALUE connect_race_winner_socket(connect_race_t *race, connect_attempt_t *winner) {
+  connect_race_close_losers(race, winner);
+  VALUE cSocket = rb_path2class("Socket");
+  return rb_funcall(cSocket, ID_for_fd, 1, INT2NUM(winner->fd));
+}
+
+void connect_race_fail(connect_race_t *race) {
+  int e = race->last_error ? race->last_error : ECONNREFUSED;
+  rb_syserr_fail(e, strerror(e));
+}
+
+// Detaches the file descriptor of the given io, so it can be closed by the
+// backend. The io itself is closed through a duplicate descriptor, which keeps
+// the underlying file open, so closing the io is cheap and never blocks, and
+// the duplicate is returned to the caller, which closes it. may_block is set if
+// the final close might block, i.e. for sockets with SO_LINGER set. Returns -1
+// if the io is already closed, or if it was closed synchronously (since no
+// descriptor was available for the duplicate).
+int backend_io_detach_fd(VALUE io, int *may_block) {
+  VALUE underlying_io = rb_ivar_get(io, ID_ivar_io);
+  if (underlying_io != Qnil) io = underlying_io;
+  io = rb_io_get_io(io);
+  rb_io_t *fptr = RFILE(io)->fptr;
+  if (!fptr || fptr->fd < 0) return -1;
+
+  backend_unregister_closing_io(io);
+
+  struct linger linger;
+  socklen_t len = sizeof(linger);
+  *may_block = !getsockopt(fptr->fd, SOL_SOCKET, SO_LINGER, &linger, &len) &&
+    linger.l_onoff && linger.l_linger > 0;
+
+  int fd = fcntl(fptr->fd, F_DUPFD_CLOEXEC, 0);
+  rb_io_close(io);
+  return fd;
+}
+
+// Unregisters the given io, which is about to be closed, from the backend it was
+// registered with, if any (see Backend#register_io). A registered file is held
+// open by the kernel until unregistered, so it must be unregistered on every
+// close path, including when closed from another thread.
+void backend_unregister_closing_io(VALUE io) {
+  VALUE backend = rb_ivar_get(io, ID_registered_backend);
+  if (backend != Qnil) rb_funcall(backend, ID_unregister_io, 1, io);
+}
+
+// Converts the given shutdown mode (a symbol, a Socket::SHUT_* constant or nil
+// for both directions) to the corresponding SHUT_* value.
+int backend_shutdown_how(VALUE how) {
+  if (how == Qnil) return SHUT_RDWR;
+  if (SYMBOL_P(how)) {
+    ID id = SYM2ID(how);
+    if (id == rb_intern("RD") || id == rb_intern("SHUT_RD")) return SHUT_RD;
+    if (id == rb_intern("WR") || id == rb_intern("SHUT_WR")) return SHUT_WR;
+    if (id == rb_intern("RDWR") || id == rb_intern("SHUT_RDWR")) return SHUT_RDWR;
+  }
+  else {
+    int value = NUM2INT(how);
+    if (value == SHUT_RD || value == SHUT_WR || value == SHUT_RDWR) return value;
+  }
+  rb_raise(rb_eArgError, "invalid shutdown mode");
+}
+
 static VALUE empty_string = Qnil;
 
 VALUE Backend_sendv(VALUE self, VALUE io, VALUE ary, VALUE flags) {
@@ -313,18 +1219,30 @@ inline void io_verify_blocking_mode(rb_io_t *fptr, VALUE io, VALUE blocking) {
 }
 
 inline void backend_run_idle_tasks(struct Backend_base *base) {
+  double start = base->idle_gc ? current_time() : 0;
+
   if (base->idle_proc != Qnil)
     rb_funcall(base->idle_proc, ID_call, 0);
 
+  if (base->interface->trim) base->interface->trim(base);
+
   if (base->idle_gc_period == 0) return;
 
   double now = current_time();
   if (now - base->idle_gc_last_time < base->idle_gc_period) return;
 
+  // a budgeted idle GC might be deferred or downgraded (see idle_gc.c)
+  if (base->idle_gc) {
+    backend_idle_gc_run_budgeted(base, now, now - start);
+    return;
+  }
+
   base->idle_gc_last_time = now;
   rb_gc_enable();
   rb_gc_start();
   rb_gc_disable();
+  base->idle_gc_major_count++;
+  base->idle_gc_time += current_time() - now;
 }
 
 inline struct backend_stats backend_base_stats(struct Backend_base *base) {
@@ -335,15 +1253,92 @@ inline struct backend_stats backend_base_stats(struct Backend_base *base) {
     .op_count = base->op_count,
     .switch_count = base->switch_count,
     .poll_count = base->poll_count,
-    .pending_ops = base->pending_count
+    .pending_ops = base->pending_count,
+    .completion_count = base->completion_count,
+    .max_poll_completions = base->max_poll_completions,
+    .sq_full_count = base->sq_full_count,
+    .watchdog_hit_count = base->watchdog_hit_count,
+    .idle_gc_minor_count = base->idle_gc_minor_count,
+    .idle_gc_major_count = base->idle_gc_major_count,
+    .idle_gc_deferred_count = base->idle_gc_deferred_count,
+    .idle_gc_time = base->idle_gc_time
   };
 
   base->op_count = 0;
   base->switch_count = 0;
   base->poll_count = 0;
+  base->completion_count = 0;
+  base->max_poll_completions = 0;
+  base->sq_full_count = 0;
+  base->watchdog_hit_count = 0;
+  base->idle_gc_minor_count = 0;
+  base->idle_gc_major_count = 0;
+  base->idle_gc_deferred_count = 0;
+  base->idle_gc_time = 0;
   return stats;
 }
 
+VALUE SYM_min_complete;
+VALUE SYM_max_wait;
+VALUE SYM_busy_spin;
+
+static inline double poll_policy_duration(VALUE policy, VALUE key) {
+  VALUE value = rb_hash_aref(policy, key);
+  if (value == Qnil) return 0;
+
+  double duration = NUM2DBL(value);
+  if (duration < 0) rb_raise(rb_eArgError, "%"PRIsVALUE" must not be negative", key);
+  return duration;
+}
+
+// Sets the poll policy from a hash with the following optional keys:
+// - min_complete: minimum number of completions to wait for in a blocking poll
+// - max_wait: maximum duration to wait for min_complete completions
+// - busy_spin: duration to busy-wait for completions before blocking
+void backend_base_set_poll_policy(struct Backend_base *base, VALUE policy) {
+  Check_Type(policy, T_HASH);
+
+  VALUE min_complete = rb_hash_aref(policy, SYM_min_complete);
+  unsigned int min_complete_int = (min_complete == Qnil) ? 1 : NUM2UINT(min_complete);
+  double max_wait = poll_policy_duration(policy, SYM_max_wait);
+  double busy_spin = poll_policy_duration(policy, SYM_busy_spin);
+
+  if (min_complete_int < 1)
+    rb_raise(rb_eArgError, "min_complete must be at least 1");
+  if (min_complete_int > 1 && max_wait == 0)
+    rb_raise(rb_eArgError, "max_wait must be specified when min_complete is greater than 1");
+
+  base->poll_min_complete = min_complete_int;
+  base->poll_max_wait = max_wait;
+  base->poll_busy_spin = busy_spin;
+}
+
+VALUE backend_base_poll_policy(struct Backend_base *base) {
+  VALUE policy = rb_hash_new();
+  rb_hash_aset(policy, SYM_min_complete, UINT2NUM(base->poll_min_complete));
+  rb_hash_aset(policy, SYM_max_wait, base->poll_max_wait ? DBL2NUM(base->poll_max_wait) : Qnil);
+  rb_hash_aset(policy, SYM_busy_spin, base->poll_busy_spin ? DBL2NUM(base->poll_busy_spin) : Qnil);
+  RB_GC_GUARD(policy);
+  return policy;
+}
+
+VALUE mNativeFeed = Qnil;
+
+// Returns the native feed interface of the given feed loop receiver, or NULL
+// if the receiver is not native.
+const polyphony_native_feed_t *backend_native_feed(VALUE receiver) {
+  if (!rb_obj_is_kind_of(receiver, mNativeFeed)) return NULL;
+
+  if (!RB_TYPE_P(receiver, T_DATA) || !RTYPEDDATA_P(receiver))
+    rb_raise(rb_eTypeError, "native feed receiver must be a typed data object");
+  const polyphony_native_feed_t *native_feed = RTYPEDDATA_TYPE(receiver)->data;
+  if (!native_feed || native_feed->magic != POLYPHONY_NATIVE_FEED_MAGIC || !native_feed->feed)
+    rb_raise(rb_eTypeError, "invalid native feed receiver");
+  if (native_feed->version != POLYPHONY_NATIVE_FEED_VERSION)
+    rb_raise(rb_eTypeError, "unsupported native feed version %u", native_feed->version);
+  return native_feed;
+}
+
 VALUE SYM_runqueue_size;
 VALUE SYM_runqueue_length;
 VALUE SYM_runqueue_max_length;
@@ -351,6 +1346,14 @@ VALUE SYM_op_count;
 VALUE SYM_switch_count;
 VALUE SYM_poll_count;
 VALUE SYM_pending_ops;
+VALUE SYM_completion_count;
+VALUE SYM_max_poll_completions;
+VALUE SYM_sq_full_count;
+VALUE SYM_watchdog_hit_count;
+VALUE SYM_idle_gc_minor_count;
+VALUE SYM_idle_gc_major_count;
+VALUE SYM_idle_gc_deferred_count;
+VALUE SYM_idle_gc_time;
 
 VALUE Backend_stats(VALUE self) {
   struct backend_stats backend_stats = backend_get_stats(self);
@@ -363,10 +1366,171 @@ VALUE Backend_stats(VALUE self) {
   rb_hash_aset(stats, SYM_switch_count, INT2NUM(backend_stats.switch_count));
   rb_hash_aset(stats, SYM_poll_count, INT2NUM(backend_stats.poll_count));
   rb_hash_aset(stats, SYM_pending_ops, INT2NUM(backend_stats.pending_ops));
+  rb_hash_aset(stats, SYM_completion_count, INT2NUM(backend_stats.completion_count));
+  rb_hash_aset(stats, SYM_max_poll_completions, INT2NUM(backend_stats.max_poll_completions));
+  rb_hash_aset(stats, SYM_sq_full_count, INT2NUM(backend_stats.sq_full_count));
+  rb_hash_aset(stats, SYM_watchdog_hit_count, INT2NUM(backend_stats.watchdog_hit_count));
+  rb_hash_aset(stats, SYM_idle_gc_minor_count, INT2NUM(backend_stats.idle_gc_minor_count));
+  rb_hash_aset(stats, SYM_idle_gc_major_count, INT2NUM(backend_stats.idle_gc_major_count));
+  rb_hash_aset(stats, SYM_idle_gc_deferred_count, INT2NUM(backend_stats.idle_gc_deferred_count));
+  rb_hash_aset(stats, SYM_idle_gc_time, DBL2NUM(backend_stats.idle_gc_time));
   RB_GC_GUARD(stats);
   return stats;
 }
 
+static const char *op_type_names[OP_TYPE_COUNT] = {
+  "none", "read", "readv", "writev", "write", "recv", "send", "send_zc",
+  "recvmsg", "sendmsg", "splice", "timeout", "poll", "accept", "connect",
+  "close", "shutdown", "chain", "chain_link"
+};
+
+const char *op_type_to_str(enum op_type type) {
+  return (type < OP_TYPE_COUNT) ? op_type_names[type] : "";
+}
+
+VALUE SYM_uptime;
+VALUE SYM_bytes_read;
+VALUE SYM_bytes_written;
+VALUE SYM_poll_wait_time;
+VALUE SYM_run_time;
+VALUE SYM_max_run_slice;
+VALUE SYM_ops;
+VALUE SYM_count;
+VALUE SYM_latency_sum;
+VALUE SYM_latency_max;
+VALUE SYM_latency_buckets;
+VALUE SYM_op_types[OP_TYPE_COUNT];
+
+static inline unsigned int latency_histogram_bucket(uint64_t latency_ns) {
+  uint64_t us = latency_ns / 1000;
+  if (us < (1 << LATENCY_HISTOGRAM_SUB_BUCKET_BITS)) return us;
+
+  unsigned int exp = 63 - __builtin_clzll(us);
+  unsigned int sub = (us >> (exp - LATENCY_HISTOGRAM_SUB_BUCKET_BITS)) & ((1 << LATENCY_HISTOGRAM_SUB_BUCKET_BITS) - 1);
+  unsigned int bucket = ((exp - LATENCY_HISTOGRAM_SUB_BUCKET_BITS + 1) << LATENCY_HISTOGRAM_SUB_BUCKET_BITS) + sub;
+  return bucket < LATENCY_HISTOGRAM_BUCKETS ? bucket : LATENCY_HISTOGRAM_BUCKETS - 1;
+}
+
+// Returns the (exclusive) upper bound of the given bucket in microseconds.
+static inline uint64_t latency_histogram_bucket_limit(unsigned int bucket) {
+  if (bucket < (1 << LATENCY_HISTOGRAM_SUB_BUCKET_BITS)) return bucket + 1;
+
+  unsigned int exp = (bucket >> LATENCY_HISTOGRAM_SUB_BUCKET_BITS) + LATENCY_HISTOGRAM_SUB_BUCKET_BITS - 1;
+  uint64_t sub = bucket & ((1 << LATENCY_HISTOGRAM_SUB_BUCKET_BITS) - 1);
+  return ((1ULL << LATENCY_HISTOGRAM_SUB_BUCKET_BITS) + sub + 1) << (exp - LATENCY_HISTOGRAM_SUB_BUCKET_BITS);
+}
+
+// Records a completed op. A start time of 0 means the op latency is unknown
+// (e.g. for multishot op completions).
+void backend_stats_record_op(struct Backend_base *base, enum op_type type, uint64_t start_time, long result) {
+  struct backend_extended_stats *stats = base->extended_stats;
+  struct backend_op_stats *op_stats = stats->ops + type;
+  op_stats->count++;
+
+  if (start_time) {
+    uint64_t latency = current_time_ns() - start_time;
+    op_stats->latency_count++;
+    op_stats->latency_sum += latency;
+    if (latency > op_stats->latency_max) op_stats->latency_max = latency;
+    op_stats->latency_buckets[latency_histogram_bucket(latency)]++;
+  }
+
+  if (result <= 0) return;
+  switch (type) {
+    case OP_READ:
+    case OP_READV:
+    case OP_RECV:
+    case OP_RECVMSG:
+      stats->bytes_read += result;
+      break;
+    case OP_WRITE:
+    case OP_WRITEV:
+    case OP_SEND:
+    case OP_SEND_ZC:
+    case OP_SENDMSG:
+      stats->bytes_written += result;
+      break;
+    default:
+      break;
+  }
+}
+
+static inline VALUE ns_to_seconds(uint64_t ns) {
+  return DBL2NUM((double)ns / 1e9);
+}
+
+// Returns a hash with the latency histogram of the given op type. Buckets are
+// cumulative, given as [upper_bound_in_seconds, count] pairs, and only buckets
+// in which latency counts were recorded are included.
+static VALUE backend_op_stats_hash(struct backend_op_stats *op_stats) {
+  VALUE hash = rb_hash_new();
+  VALUE buckets = rb_ary_new();
+  uint64_t cumulative = 0;
+
+  for (unsigned int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+    if (!op_stats->latency_buckets[i]) continue;
+
+    cumulative += op_stats->latency_buckets[i];
+    VALUE bucket = rb_ary_new_from_args(2,
+      DBL2NUM((double)latency_histogram_bucket_limit(i) / 1e6), ULL2NUM(cumulative)
+    );
+    rb_obj_freeze(bucket);
+    rb_ary_push(buckets, bucket);
+  }
+  rb_obj_freeze(buckets);
+
+  rb_hash_aset(hash, SYM_count, ULL2NUM(op_stats->count));
+  rb_hash_aset(hash, SYM_latency_sum, ns_to_seconds(op_stats->latency_sum));
+  rb_hash_aset(hash, SYM_latency_max, ns_to_seconds(op_stats->latency_max));
+  rb_hash_aset(hash, SYM_latency_buckets, buckets);
+  return rb_obj_freeze(hash);
+}
+
+// Returns the extended stats as a frozen hash, or nil if extended stats are
+// not enabled. Only op types that were used are included in the :ops hash.
+VALUE Backend_extended_stats(VALUE self) {
+  struct Backend_base *base = RTYPEDDATA_DATA(self);
+  struct backend_extended_stats *stats = base->extended_stats;
+  if (!stats) return Qnil;
+
+  uint64_t uptime = current_time_ns() - stats->start_time;
+  VALUE hash = rb_hash_new();
+  VALUE ops = rb_hash_new();
+
+  for (int i = 0; i < OP_TYPE_COUNT; i++) {
+    if (!stats->ops[i].count) continue;
+    rb_hash_aset(ops, SYM_op_types[i], backend_op_stats_hash(stats->ops + i));
+  }
+  rb_obj_freeze(ops);
+
+  rb_hash_aset(hash, SYM_uptime, ns_to_seconds(uptime));
+  rb_hash_aset(hash, SYM_bytes_read, ULL2NUM(stats->bytes_read));
+  rb_hash_aset(hash, SYM_bytes_written, ULL2NUM(stats->bytes_written));
+  rb_hash_aset(hash, SYM_poll_wait_time, ns_to_seconds(stats->poll_wait_time));
+  rb_hash_aset(hash, SYM_run_time, ns_to_seconds(uptime - stats->poll_wait_time));
+  rb_hash_aset(hash, SYM_max_run_slice, ns_to_seconds(stats->max_run_slice));
+  rb_hash_aset(hash, SYM_ops, ops);
+  RB_GC_GUARD(ops);
+  return rb_obj_freeze(hash);
+}
+
+// Enables or disables the collection of extended stats. Enabling resets the
+// collected stats.
+VALUE Backend_extended_stats_set(VALUE self, VALUE enabled) {
+  struct Backend_base *base = RTYPEDDATA_DATA(self);
+
+  if (RTEST(enabled)) {
+    if (!base->extended_stats) base->extended_stats = malloc(sizeof(struct backend_extended_stats));
+    memset(base->extended_stats, 0, sizeof(struct backend_extended_stats));
+    base->extended_stats->start_time = current_time_ns();
+  }
+  else if (base->extended_stats) {
+    free(base->extended_stats);
+    base->extended_stats = NULL;
+  }
+  return self;
+}
+
 void backend_setup_stats_symbols() {
   SYM_runqueue_size       = ID2SYM(rb_intern("runqueue_size"));
   SYM_runqueue_length     = ID2SYM(rb_intern("runqueue_length"));
@@ -375,6 +1539,17 @@ void backend_setup_stats_symbols() {
   SYM_switch_count        = ID2SYM(rb_intern("switch_count"));
   SYM_poll_count          = ID2SYM(rb_intern("poll_count"));
   SYM_pending_ops         = ID2SYM(rb_intern("pending_ops"));
+  SYM_completion_count    = ID2SYM(rb_intern("completion_count"));
+  SYM_max_poll_completions = ID2SYM(rb_intern("max_poll_completions"));
+  SYM_sq_full_count       = ID2SYM(rb_intern("sq_full_count"));
+  SYM_watchdog_hit_count  = ID2SYM(rb_intern("watchdog_hit_count"));
+  SYM_idle_gc_minor_count = ID2SYM(rb_intern("idle_gc_minor_count"));
+  SYM_idle_gc_major_count = ID2SYM(rb_intern("idle_gc_major_count"));
+  SYM_idle_gc_deferred_count = ID2SYM(rb_intern("idle_gc_deferred_count"));
+  SYM_idle_gc_time        = ID2SYM(rb_intern("idle_gc_time"));
+  SYM_min_complete        = ID2SYM(rb_intern("min_complete"));
+  SYM_max_wait            = ID2SYM(rb_intern("max_wait"));
+  SYM_busy_spin           = ID2SYM(rb_intern("busy_spin"));
 
   rb_global_variable(&SYM_runqueue_size);
   rb_global_variable(&SYM_runqueue_length);
@@ -383,4 +1558,43 @@ void backend_setup_stats_symbols() {
   rb_global_variable(&SYM_switch_count);
   rb_global_variable(&SYM_poll_count);
   rb_global_variable(&SYM_pending_ops);
+  rb_global_variable(&SYM_completion_count);
+  rb_global_variable(&SYM_max_poll_completions);
+  rb_global_variable(&SYM_sq_full_count);
+  rb_global_variable(&SYM_watchdog_hit_count);
+  rb_global_variable(&SYM_idle_gc_minor_count);
+  rb_global_variable(&SYM_idle_gc_major_count);
+  rb_global_variable(&SYM_idle_gc_deferred_count);
+  rb_global_variable(&SYM_idle_gc_time);
+  rb_global_variable(&SYM_min_complete);
+  rb_global_variable(&SYM_max_wait);
+  rb_global_variable(&SYM_busy_spin);
+
+  SYM_uptime              = ID2SYM(rb_intern("uptime"));
+  SYM_bytes_read          = ID2SYM(rb_intern("bytes_read"));
+  SYM_bytes_written       = ID2SYM(rb_intern("bytes_written"));
+  SYM_poll_wait_time      = ID2SYM(rb_intern("poll_wait_time"));
+  SYM_run_time            = ID2SYM(rb_intern("run_time"));
+  SYM_max_run_slice       = ID2SYM(rb_intern("max_run_slice"));
+  SYM_ops                 = ID2SYM(rb_intern("ops"));
+  SYM_count               = ID2SYM(rb_intern("count"));
+  SYM_latency_sum         = ID2SYM(rb_intern("latency_sum"));
+  SYM_latency_max         = ID2SYM(rb_intern("latency_max"));
+  SYM_latency_buckets     = ID2SYM(rb_intern("latency_buckets"));
+  rb_global_variable(&SYM_uptime);
+  rb_global_variable(&SYM_bytes_read);
+  rb_global_variable(&SYM_bytes_written);
+  rb_global_variable(&SYM_poll_wait_time);
+  rb_global_variable(&SYM_run_time);
+  rb_global_variable(&SYM_max_run_slice);
+  rb_global_variable(&SYM_ops);
+  rb_global_variable(&SYM_count);
+  rb_global_variable(&SYM_latency_sum);
+  rb_global_variable(&SYM_latency_max);
+  rb_global_variable(&SYM_latency_buckets);
+
+  for (int i = 0; i < OP_TYPE_COUNT; i++) {
+    SYM_op_types[i] = ID2SYM(rb_intern(op_type_names[i]));
+    rb_global_variable(&SYM_op_types[i]);
+  }
 }
\ No newline at end of file
@@ -2,8 +2,17 @@
 #define BACKEND_COMMON_H
 
 #include "ruby.h"
+#include <stdint.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
 #include "ruby/io.h"
 #include "runqueue.h"
+#include "thread_pool.h"
+#include "trace_ring.h"
+#include "native_feed.h"
+
+// default chunk size for Backend#sendfile
+#define SENDFILE_CHUNK_SIZE 65536
 
 struct backend_stats {
   unsigned int runqueue_size;
@@ -13,20 +22,210 @@ struct backend_stats {
   unsigned int switch_count;
   unsigned int poll_count;
   unsigned int pending_ops;
+  unsigned int completion_count;
+  unsigned int max_poll_completions;
+  unsigned int sq_full_count;
+  unsigned int watchdog_hit_count;
+  unsigned int idle_gc_minor_count;
+  unsigned int idle_gc_major_count;
+  unsigned int idle_gc_deferred_count;
+  double idle_gc_time;
+};
+
+// Op types, used by the io_uring backend for op contexts, and by both backends
+// for collecting extended stats
+enum op_type {
+  OP_NONE,
+  OP_READ,
+  OP_READV,
+  OP_WRITEV,
+  OP_WRITE,
+  OP_RECV,
+  OP_SEND,
+  OP_SEND_ZC,
+  OP_RECVMSG,
+  OP_SENDMSG,
+  OP_SPLICE,
+  OP_TIMEOUT,
+  OP_POLL,
+  OP_ACCEPT,
+  OP_CONNECT,
+  OP_CLOSE,
+  OP_SHUTDOWN,
+  OP_CHAIN,
+  OP_CHAIN_LINK,
+  OP_TYPE_COUNT
+};
+
+const char *op_type_to_str(enum op_type type);
+
+// Latency histograms are log-linear (as in HDR histograms): each power of 2
+// (in microseconds) is divided into 4 sub-buckets, covering latencies of up to
+// about 67 seconds with a relative error of up to 25%.
+#define LATENCY_HISTOGRAM_SUB_BUCKET_BITS 2
+#define LATENCY_HISTOGRAM_BUCKETS 104
+
+struct backend_op_stats {
+  uint64_t count;
+  uint64_t latency_count;
+  uint64_t latency_sum;
+  uint64_t latency_max;
+  uint32_t latency_buckets[LATENCY_HISTOGRAM_BUCKETS];
+};
+
+// Extended stats are collected only if enabled with Backend#extended_stats=.
+// All times are in nanoseconds.
+struct backend_extended_stats {
+  uint64_t start_time;
+  uint64_t bytes_read;
+  uint64_t bytes_written;
+  uint64_t poll_wait_time;
+  uint64_t run_slice_start;
+  uint64_t max_run_slice;
+  struct backend_op_stats ops[OP_TYPE_COUNT];
+};
+
+// An entry in a backend's inbox, used for scheduling fibers from other threads.
+typedef struct backend_inbox_entry {
+  struct backend_inbox_entry *next;
+  VALUE fiber;
+  VALUE value;
+  int prioritize;
+} backend_inbox_entry;
+
+// An idle deadline, set with Backend#idle_timeout (see idle_deadline.c). Idle
+// deadlines are allocated on the stack of their fiber, and are linked in a
+// list held by the backend. Nested idle deadlines of the same fiber are linked
+// through outer.
+typedef struct idle_deadline {
+  struct idle_deadline *prev;
+  struct idle_deadline *next;
+  struct idle_deadline *outer;
+  VALUE fiber;
+  VALUE timeout;
+  double interval;
+  double last_active;
+  int expired;
+} idle_deadline_t;
+
+// Budgeting state for idle GC, allocated by Backend#idle_gc_max_defer= (see
+// idle_gc.c). All durations are in seconds.
+struct backend_idle_gc {
+  double max_defer;
+  double idle_window;   // moving average of blocking poll wait durations
+  double minor_cost;    // moving average of idle minor GC durations
+  double major_cost;    // moving average of idle major GC durations
+};
+
+// The backend implementation interface. Both backends may be compiled into the
+// extension, each with its functions prefixed (see backend_namespace.h), and
+// calls into the backend public interface (polyphony.h) are dispatched through
+// the interface of the given backend instance (see backend.c).
+struct backend_interface {
+  VALUE (*accept)(VALUE self, VALUE server_socket, VALUE socket_class);
+  VALUE (*accept_loop)(VALUE self, VALUE server_socket, VALUE socket_class);
+  VALUE (*connect)(VALUE self, VALUE io, VALUE addr, VALUE port);
+  VALUE (*connect_racing)(VALUE self, VALUE addrinfos, VALUE stagger_delay);
+  VALUE (*close)(VALUE self, VALUE io);
+  VALUE (*shutdown)(VALUE self, VALUE io, VALUE how);
+  VALUE (*feed_loop)(VALUE self, VALUE io, VALUE receiver, VALUE method);
+  VALUE (*read)(VALUE self, VALUE io, VALUE str, VALUE length, VALUE to_eof, VALUE pos);
+  VALUE (*read_loop)(VALUE self, VALUE io, VALUE maxlen);
+  VALUE (*gets_loop)(VALUE self, VALUE io, VALUE sep, VALUE chomp, VALUE buffer);
+  VALUE (*readv)(VALUE self, VALUE io, VALUE buffers);
+  VALUE (*recv)(VALUE self, VALUE io, VALUE str, VALUE length, VALUE pos);
+  VALUE (*recv_loop)(VALUE self, VALUE io, VALUE maxlen);
+  VALUE (*recv_feed_loop)(VALUE self, VALUE io, VALUE receiver, VALUE method);
+  VALUE (*send)(VALUE self, VALUE io, VALUE msg, VALUE flags);
+  VALUE (*recvfrom)(VALUE self, VALUE io, VALUE maxlen, VALUE flags);
+  VALUE (*sendto)(VALUE self, VALUE io, VALUE msg, VALUE flags, VALUE addr);
+  VALUE (*recvmmsg)(VALUE self, VALUE io, VALUE count, VALUE maxlen);
+  VALUE (*sendmmsg)(VALUE self, VALUE io, VALUE msgs, VALUE addr);
+  VALUE (*sleep)(VALUE self, VALUE duration);
+  VALUE (*splice)(VALUE self, VALUE src, VALUE dest, VALUE maxlen);
+  VALUE (*splice_to_eof)(VALUE self, VALUE src, VALUE dest, VALUE chunksize);
+  VALUE (*timeout)(int argc, VALUE *argv, VALUE self);
+  VALUE (*timer_loop)(VALUE self, VALUE interval);
+  VALUE (*wait_io)(VALUE self, VALUE io, VALUE write);
+  VALUE (*waitpid)(VALUE self, VALUE pid);
+  VALUE (*write_m)(int argc, VALUE *argv, VALUE self);
+  VALUE (*chain)(int argc, VALUE *argv, VALUE self);
+  VALUE (*sendfile)(int argc, VALUE *argv, VALUE self);
+  VALUE (*splice_chunks)(VALUE self, VALUE src, VALUE dest, VALUE prefix, VALUE postfix, VALUE chunk_prefix, VALUE chunk_postfix, VALUE chunk_size);
+
+  VALUE (*poll)(VALUE self, VALUE blocking);
+  VALUE (*wait_event)(VALUE self, VALUE raise_on_exception);
+  VALUE (*wakeup)(VALUE self);
+  VALUE (*switch_fiber)(VALUE self);
+  void (*schedule_fiber)(VALUE thread, VALUE self, VALUE fiber, VALUE value, int prioritize);
+  void (*unschedule_fiber)(VALUE self, VALUE fiber);
+  void (*park_fiber)(VALUE self, VALUE fiber);
+  void (*unpark_fiber)(VALUE self, VALUE fiber);
+  int (*fiber_runnable_p)(VALUE self, VALUE fiber);
+  void (*watch_thread_pool_job)(VALUE self, struct thread_pool_job *job);
+
+  // Arms the backend's idle deadline sweep timer for the given time, unless
+  // an earlier sweep is pending. When the timer fires, the backend should call
+  // backend_idle_deadlines_sweep, and rearm the timer for the time it returns.
+  void (*arm_idle_sweep)(struct Backend_base *base, double time);
+
+  // optional, called from backend_run_idle_tasks
+  void (*trim)(struct Backend_base *base);
+
+  // optional, returns true if completions are ready to be processed without
+  // blocking. Used to cut idle tasks short when work has arrived.
+  int (*completions_ready)(struct Backend_base *base);
 };
 
 struct Backend_base {
+  // must be set on allocation by the backend implementation
+  const struct backend_interface *interface;
+
   runqueue_t runqueue;
   runqueue_t parked_runqueue;
+  unsigned int parked_count;
   unsigned int currently_polling;
   unsigned int op_count;
   unsigned int switch_count;
   unsigned int poll_count;
   unsigned int pending_count;
+  unsigned int completion_count;
+  unsigned int max_poll_completions;
+  unsigned int sq_full_count;
+  unsigned int watchdog_hit_count;
+  unsigned int idle_gc_minor_count;
+  unsigned int idle_gc_major_count;
+  unsigned int idle_gc_deferred_count;
+  double idle_gc_time;
+  struct backend_extended_stats *extended_stats;
+  struct backend_watchdog *watchdog;
+  idle_deadline_t *idle_deadlines;
+  unsigned int idle_deadline_count;
+
+  // poll policy
+  unsigned int poll_min_complete;
+  double poll_max_wait;
+  double poll_busy_spin;
+
   double idle_gc_period;
   double idle_gc_last_time;
+  struct backend_idle_gc *idle_gc;
   VALUE idle_proc;
   VALUE trace_proc;
+  trace_ring_t *trace_ring;
+  VALUE scheduler_group;
+
+  // corked sockets with buffered data, flushed on switchpoints (see cork.c)
+  VALUE pending_corks;
+  unsigned int cork_flushers;
+
+  // cross-thread scheduling inbox
+  backend_inbox_entry *inbox;
+  int inbox_wakeup_pending;
+
+  // jobs completed by native thread pools (see thread_pool.h)
+  backend_completions_t *completions;
+  unsigned int completions_in_flight;
 };
 
 void backend_base_initialize(struct Backend_base *base);
@@ -35,16 +234,66 @@ void backend_base_mark(struct Backend_base *base);
 void backend_base_reset(struct Backend_base *base);
 VALUE backend_base_switch_fiber(VALUE backend, struct Backend_base *base);
 void backend_base_schedule_fiber(VALUE thread, VALUE backend, struct Backend_base *base, VALUE fiber, VALUE value, int prioritize);
+void backend_base_drain_inbox(struct Backend_base *base);
+int backend_base_watch_job(struct Backend_base *base, thread_pool_job_t *job);
+void backend_base_drain_completions(struct Backend_base *base);
 void backend_base_park_fiber(struct Backend_base *base, VALUE fiber);
 void backend_base_unpark_fiber(struct Backend_base *base, VALUE fiber);
+int backend_base_fiber_runnable_p(struct Backend_base *base, VALUE fiber);
+void backend_base_unschedule_fiber(struct Backend_base *base, VALUE fiber);
 void backend_trace(struct Backend_base *base, int argc, VALUE *argv);
 struct backend_stats backend_base_stats(struct Backend_base *base);
+void backend_base_set_poll_policy(struct Backend_base *base, VALUE policy);
+VALUE backend_base_poll_policy(struct Backend_base *base);
+
+// run-slice watchdog (see watchdog.c)
+void backend_watchdog_slice_start(struct Backend_base *base, VALUE fiber);
+void backend_watchdog_slice_end(struct Backend_base *base);
+void backend_watchdog_mark(struct Backend_base *base);
+void backend_watchdog_stop(struct Backend_base *base);
+void backend_watchdog_reset(struct Backend_base *base);
+
+// idle deadlines (see idle_deadline.c)
+void backend_idle_deadline_touch(struct Backend_base *base, VALUE fiber, enum op_type type);
+double backend_idle_deadlines_sweep(struct Backend_base *base, double now);
+void backend_idle_deadlines_mark(struct Backend_base *base);
+
+// idle GC budgeting (see idle_gc.c)
+void backend_idle_gc_record_poll_wait(struct Backend_base *base, double duration);
+void backend_idle_gc_run_budgeted(struct Backend_base *base, double now, double elapsed);
+
+// socket corking (see cork.c)
+void backend_corks_flush_nonblock(struct Backend_base *base);
+void backend_corks_reset(struct Backend_base *base);
+void backend_cork_flush_io(VALUE backend, VALUE io);
+long socket_cork_write(VALUE io, int argc, VALUE *argv);
+
+// Sends the data buffered for the given io, if corked, before performing
+// another op on it. This includes awaiting any flusher fiber sending the data
+// in the background.
+#define BACKEND_CORK_FLUSH(backend, base, io) \
+  if ((base)->pending_corks != Qnil || (base)->cork_flushers) backend_cork_flush_io(backend, io)
+
+// Pushes back the idle deadline of the given fiber, if any, on the completion
+// of an op that has transferred data. The fiber is evaluated only if the
+// backend has any idle deadlines.
+#define BACKEND_TOUCH_IDLE_DEADLINE(base, fiber, type, result) \
+  if ((base)->idle_deadline_count && (result) > 0) backend_idle_deadline_touch(base, fiber, type)
+
+static inline void backend_base_record_completions(struct Backend_base *base, unsigned int count) {
+  base->completion_count += count;
+  if (count > base->max_poll_completions) base->max_poll_completions = count;
+}
 
 // tracing
 #define SHOULD_TRACE(base) ((base)->trace_proc != Qnil)
 #define TRACE(base, ...)  rb_funcall((base)->trace_proc, ID_call, __VA_ARGS__)
 #define COND_TRACE(base, ...) if (SHOULD_TRACE(base)) { TRACE(base, __VA_ARGS__); }
 
+// Writes a record into the native trace ring, if enabled
+#define TRACE_RING_RECORD(base, event, fiber, op_type, op_id, fd, length, result) \
+  if ((base)->trace_ring) trace_ring_push((base)->trace_ring, event, fiber, op_type, op_id, fd, length, result)
+
 
 
 #ifdef POLYPHONY_USE_PIDFD_OPEN
@@ -68,6 +317,34 @@ void io_shrink_read_string(VALUE str, long n);
 void io_set_read_length(VALUE str, long n, int shrinkable);
 rb_encoding* io_read_encoding(rb_io_t *fptr);
 VALUE io_enc_str(VALUE str, rb_io_t *fptr);
+struct iovec *io_readv_setup(VALUE buffers, VALUE strs, int *count);
+void io_readv_set_lengths(VALUE strs, struct iovec *iov, long total, rb_io_t *fptr);
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+#define GETS_LOOP_READ_SIZE 8192
+
+// State for a native gets loop. Data is read into the end of the buffer, and
+// lines are consumed from the front by advancing pos, so the unconsumed tail
+// is moved to the front of the buffer at most once per read.
+struct gets_loop_ctx {
+  VALUE     backend;
+  VALUE     io;
+  rb_io_t   *fptr;
+  VALUE     buffer;
+  VALUE     sep;
+  long      sep_len;
+  int       chomp;
+  long      pos;
+  long      scan_pos;
+};
+
+void io_gets_loop_setup(struct gets_loop_ctx *ctx, VALUE backend, VALUE io, rb_io_t *fptr, VALUE buffer, VALUE sep, VALUE chomp);
+char *io_gets_loop_reserve(struct gets_loop_ctx *ctx, long *len);
+void io_gets_loop_commit(struct gets_loop_ctx *ctx, long n);
+void io_gets_loop_finish(struct gets_loop_ctx *ctx);
+VALUE io_gets_loop_cleanup(VALUE arg);
 
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
@@ -99,15 +376,104 @@ VALUE backend_snooze();
   READ_LOOP_PREPARE_STR(); \
 }
 
+// Feeds the data read to the receiver of a feed loop. A native receiver is fed
+// directly from the read buffer, which is then reused for the next read (see
+// native_feed.h). Stops the loop if the native receiver's feed function
+// returns non-zero.
+#define READ_LOOP_FEED_RECEIVER(native_feed, receiver, method_id) \
+  if (native_feed) { \
+    if (native_feed->feed(receiver, RTYPEDDATA_DATA(receiver), buf, total)) break; \
+  } \
+  else READ_LOOP_PASS_STR_TO_RECEIVER(receiver, method_id)
+
+extern VALUE mNativeFeed;
+const polyphony_native_feed_t *backend_native_feed(VALUE receiver);
+
 void rectify_io_file_pos(rb_io_t *fptr);
 double current_time();
+uint64_t current_time_ns();
 VALUE backend_timeout_exception(VALUE exception);
 VALUE Backend_timeout_ensure_safe(VALUE arg);
 VALUE Backend_timeout_ensure_safe(VALUE arg);
 VALUE Backend_sendv(VALUE self, VALUE io, VALUE ary, VALUE flags);
 VALUE Backend_stats(VALUE self);
+VALUE Backend_extended_stats(VALUE self);
+VALUE Backend_extended_stats_set(VALUE self, VALUE enabled);
+void backend_stats_record_op(struct Backend_base *base, enum op_type type, uint64_t start_time, long result);
+
+// Returns the start time of an op, if extended stats are enabled.
+#define BACKEND_STATS_OP_START(base) ((base)->extended_stats ? current_time_ns() : 0)
+
+// Records a completed op in the extended stats and the trace ring, if enabled.
+// For ops that transfer data, result is the number of bytes transferred.
+// The idle deadline of the current fiber is also pushed back for ops that have
+// transferred data.
+#define BACKEND_RECORD_OP(base, type, start_time, fd, result) { \
+  if ((base)->extended_stats) backend_stats_record_op(base, type, start_time, result); \
+  BACKEND_TOUCH_IDLE_DEADLINE(base, rb_fiber_current(), type, result); \
+  TRACE_RING_RECORD(base, TRACE_OP_COMPLETE, rb_fiber_current(), type, 0, fd, 0, result); \
+}
 void backend_run_idle_tasks(struct Backend_base *base);
 void io_verify_blocking_mode(rb_io_t *fptr, VALUE io, VALUE blocking);
+
+// A batch of datagrams, used for UDP receive and send (see backend_common.c).
+#define UDP_BATCH_MAX_COUNT 1024
+#define UDP_BATCH_MAX_LEN 65536
+
+typedef struct udp_batch {
+  VALUE         scratch;
+  VALUE         msgs;
+  unsigned int  count;
+  long          maxlen;
+  int           flags;
+} udp_batch_t;
+
+VALUE backend_scratch_buffer(size_t size, char **ptr);
+void udp_batch_init_recv(udp_batch_t *batch, VALUE count, VALUE maxlen, int flags);
+void udp_batch_init_send(udp_batch_t *batch, VALUE msgs, VALUE addr, int flags);
+struct msghdr *udp_batch_msghdr(udp_batch_t *batch, unsigned int idx);
+void udp_batch_set_len(udp_batch_t *batch, unsigned int idx, unsigned int len);
+int udp_batch_recv_nonblock(int fd, udp_batch_t *batch, unsigned int offset);
+int udp_batch_send_nonblock(int fd, udp_batch_t *batch, unsigned int offset);
+long udp_batch_total_len(udp_batch_t *batch, unsigned int offset, unsigned int count);
+VALUE udp_batch_recv_result(udp_batch_t *batch, unsigned int received);
+
+socklen_t backend_sockaddr(VALUE host, VALUE port, struct sockaddr_storage *addr);
+
+// A connection race for Backend#connect_racing (see backend_common.c). Each
+// backend starts the attempts, waits on them, and cancels the losers.
+typedef struct connect_attempt {
+  int                     fd;
+  int                     family;
+  int                     socktype;
+  int                     protocol;
+  int                     done;
+  int                     result;
+  void                    *op;
+  socklen_t               addrlen;
+  struct sockaddr_storage addr;
+} connect_attempt_t;
+
+typedef struct connect_race {
+  VALUE             scratch;
+  connect_attempt_t *attempts;
+  unsigned int      count;
+  unsigned int      started;
+  unsigned int      pending;
+  double            stagger_delay;
+  int               last_error;
+} connect_race_t;
+
+void connect_race_init(connect_race_t *race, VALUE addrinfos, VALUE stagger_delay);
+connect_attempt_t *connect_race_next_attempt(connect_race_t *race, int nonblock);
+void connect_race_attempt_done(connect_race_t *race, connect_attempt_t *attempt, int result);
+void connect_race_close_losers(connect_race_t *race, connect_attempt_t *winner);
+VALUE connect_race_winner_socket(connect_race_t *race, connect_attempt_t *winner);
+NORETURN(void connect_race_fail(connect_race_t *race));
+
+int backend_io_detach_fd(VALUE io, int *may_block);
+int backend_shutdown_how(VALUE how);
+
 void backend_setup_stats_symbols();
 
 #endif /* BACKEND_COMMON_H */
\ No newline at end of file
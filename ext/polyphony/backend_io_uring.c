@@ -12,18 +12,32 @@
 #include <sys/eventfd.h>
 #include <sys/wait.h>
 #include <errno.h>
-
+#include <signal.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sched.h>
+
+#define BACKEND_NAMESPACE(name) io_uring_##name
+#include "backend_namespace.h"
 #include "polyphony.h"
 #include "../liburing/liburing.h"
 #include "backend_io_uring_context.h"
+#include "deadline_heap.h"
 #include "ruby/thread.h"
 #include "ruby/io.h"
 #include "backend_common.h"
 
-VALUE SYM_io_uring;
-VALUE SYM_send;
-VALUE SYM_splice;
-VALUE SYM_write;
+static VALUE SYM_io_uring;
+static VALUE SYM_send;
+static VALUE SYM_splice;
+static VALUE SYM_write;
+static VALUE SYM_read;
+static VALUE SYM_recv;
+static VALUE SYM_poll;
+static VALUE SYM_timeout;
+static VALUE SYM_close;
+static VALUE SYM_shutdown;
 
 VALUE eArgumentError;
 
@@ -33,6 +47,8 @@ VALUE eArgumentError;
 #define io_unset_nonblock(fptr, io)
 #endif
 
+#define PIPE_CACHE_MAX 16
+
 typedef struct Backend_t {
   struct Backend_base base;
 
@@ -41,18 +57,98 @@ typedef struct Backend_t {
   op_context_store_t  store;
   unsigned int        pending_sqes;
   unsigned int        prepared_limit;
+  unsigned int        sq_entries;
+  unsigned int        cq_entries;
   int                 event_fd;
+  unsigned int        ring_features;
+  char                *buffer_pool;
+  int                 buffer_pool_state;
+  int                 multishot_accept_unsupported;
+  int                 send_zc_unsupported;
+  int                 shutdown_unsupported;
+  long                send_zc_threshold;
+
+  // setup options
+  unsigned int        setup_flags;
+  unsigned int        sq_thread_idle;
+  unsigned int        sq_thread_cpu;
+
+  // registered files table, indexed by fd. Registered ios are kept alive until
+  // unregistered, which happens at the latest when they are closed.
+  VALUE               *registered_ios;
+  unsigned int        registered_ios_size;
+  // one past the highest fd registered, bounding the marking of the table
+  unsigned int        registered_ios_limit;
+
+  // timeouts and sleeps are kept in a deadline heap, with only the soonest
+  // deadline armed in the kernel
+  deadline_heap       deadlines;
+  double              armed_deadline;
+  struct __kernel_timespec armed_deadline_ts;
+  // the idle deadline sweep is held in the deadline heap, with no fiber
+  deadline_entry      idle_sweep;
+
+  // thread pool completions are signalled through an eventfd polled by the ring
+  int                 completion_poll_armed;
+
+  // pipes used by sendfile are kept for reuse
+  int                 pipe_cache[PIPE_CACHE_MAX][2];
+  unsigned int        pipe_cache_count;
 } Backend_t;
 
+// The registered files table is indexed by fd, so it's sized to hold any fd
+// the process may open (as limited by RLIMIT_NOFILE), up to a maximum. Older
+// kernels allow smaller tables, so the size is halved down to a minimum until
+// registering succeeds.
+#define REGISTERED_FILES_MAX 65536
+#define REGISTERED_FILES_MIN 1024
+
+// The buffer pool is a group of fixed-size buffers provided to the kernel
+// using IORING_OP_PROVIDE_BUFFERS. Read and recv loops submit their ops with
+// IOSQE_BUFFER_SELECT, so a buffer is picked by the kernel only once data
+// actually arrives, instead of each waiting fiber pinning its own buffer.
+#define BUFFER_POOL_GROUP_ID    1
+#define BUFFER_POOL_COUNT       256
+#define BUFFER_POOL_BUFFER_SIZE 8192
+
+#define BUFFER_POOL_STATE_UNINITIALIZED  0
+#define BUFFER_POOL_STATE_READY          1
+#define BUFFER_POOL_STATE_PENDING        2
+#define BUFFER_POOL_STATE_UNSUPPORTED   -1
+
+static inline void io_uring_backend_buffer_pool_recycle(Backend_t *backend, unsigned int cqe_flags);
+void io_uring_backend_defer_submit(Backend_t *backend);
+
+// multishot definitions missing from the bundled liburing headers
+#ifndef IORING_CQE_F_MORE
+#define IORING_CQE_F_MORE       (1U << 1)
+#endif
+#ifndef IORING_ACCEPT_MULTISHOT
+#define IORING_ACCEPT_MULTISHOT (1U << 0)
+#endif
+
+// zero-copy send definitions missing from the bundled liburing headers. The
+// opcode is defined separately since it's an enum value in newer kernel
+// headers.
+#define POLYPHONY_IORING_OP_SEND_ZC 47
+#ifndef IORING_CQE_F_NOTIF
+#define IORING_CQE_F_NOTIF      (1U << 3)
+#endif
+
 static void Backend_mark(void *ptr) {
   Backend_t *backend = ptr;
   backend_base_mark(&backend->base);
   context_store_mark_taken_buffers(&backend->store);
+  deadline_heap_mark(&backend->deadlines);
+  if (backend->registered_ios)
+    for (unsigned int i = 0; i < backend->registered_ios_limit; i++)
+      if (backend->registered_ios[i] != Qnil) rb_gc_mark(backend->registered_ios[i]);
 }
 
 static void Backend_free(void *ptr) {
   Backend_t *backend = ptr;
   backend_base_finalize(&backend->base);
+  deadline_heap_free(&backend->deadlines);
 }
 
 static size_t Backend_size(const void *ptr) {
@@ -65,8 +161,11 @@ static const rb_data_type_t Backend_type = {
     0, 0, RUBY_TYPED_FREE_IMMEDIATELY
 };
 
+static const struct backend_interface backend_interface;
+
 static VALUE Backend_allocate(VALUE klass) {
   Backend_t *backend = ALLOC(Backend_t);
+  backend->base.interface = &backend_interface;
 
   return TypedData_Wrap_Struct(klass, &Backend_type, backend);
 }
@@ -74,17 +173,249 @@ static VALUE Backend_allocate(VALUE klass) {
 #define GetBackend(obj, backend) \
   TypedData_Get_Struct((obj), Backend_t, &Backend_type, (backend))
 
-static VALUE Backend_initialize(VALUE self) {
+inline struct __kernel_timespec double_to_timespec(double duration);
+
+unsigned int io_uring_backend_handle_ready_cqes(Backend_t *backend);
+
+static inline void io_uring_backend_queue_init(Backend_t *backend) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  params.flags = backend->setup_flags;
+  params.sq_thread_idle = backend->sq_thread_idle;
+  params.sq_thread_cpu = backend->sq_thread_cpu;
+  if (backend->cq_entries > backend->sq_entries) {
+    params.flags |= IORING_SETUP_CQSIZE;
+    params.cq_entries = backend->cq_entries;
+  }
+
+  int ret = io_uring_queue_init_params(backend->sq_entries, &backend->ring, &params);
+  if (ret < 0) rb_syserr_fail(-ret, strerror(-ret));
+  backend->ring_features = params.features;
+  // the kernel rounds the ring sizes up to a power of 2
+  backend->sq_entries = params.sq_entries;
+  backend->cq_entries = params.cq_entries;
+  if (backend->prepared_limit > backend->sq_entries) backend->prepared_limit = backend->sq_entries;
+}
+
+struct sq_space_wait_ctx {
+  struct io_uring *ring;
+  int result;
+};
+
+static void *io_uring_backend_wait_sq_space_without_gvl(void *ptr) {
+  struct sq_space_wait_ctx *ctx = ptr;
+  if (ctx->ring->flags & IORING_SETUP_SQPOLL) {
+    ctx->result = io_uring_sqring_wait(ctx->ring);
+    // waiting on the SQ thread requires Linux 5.10
+    if (ctx->result == -EINVAL) sched_yield();
+  }
+  else {
+    struct io_uring_cqe *cqe;
+    ctx->result = io_uring_wait_cqe(ctx->ring, &cqe);
+  }
+  return NULL;
+}
+
+// Called when submitting pending SQEs did not make enough room in the SQ ring,
+// with the result of the submission. With SQPOLL, SQEs are consumed by the
+// kernel thread, so we wait for it to catch up. Otherwise, SQEs are consumed
+// on submission, which can fail if the CQ ring is full, in which case ready
+// CQEs are handled, waiting for one if needed. The GVL is released while
+// waiting.
+static void io_uring_backend_wait_sq_space(Backend_t *backend, int ret) {
+  if (ret < 0 && ret != -EBUSY && ret != -EAGAIN && ret != -EINTR)
+    rb_syserr_fail(-ret, strerror(-ret));
+
+  int sqpoll = backend->ring.flags & IORING_SETUP_SQPOLL;
+  // without SQPOLL, a successful or interrupted submission is just retried
+  if (!sqpoll && (ret >= 0 || ret == -EINTR)) return;
+
+  // the SQ thread might be held up by a full CQ ring, so CQEs are handled
+  // before waiting on it
+  if (io_uring_backend_handle_ready_cqes(backend) && !sqpoll) return;
+  if (!sqpoll && !backend->base.pending_count) rb_syserr_fail(-ret, strerror(-ret));
+
+  struct sq_space_wait_ctx ctx = {&backend->ring, 0};
+  rb_thread_call_without_gvl(io_uring_backend_wait_sq_space_without_gvl, (void *)&ctx, RUBY_UBF_IO, 0);
+  if (!sqpoll) io_uring_backend_handle_ready_cqes(backend);
+}
+
+// Called when the SQ ring is full. Pending SQEs are submitted to make room,
+// waiting for room to be made if needed.
+static struct io_uring_sqe *io_uring_backend_get_sqe_slow(Backend_t *backend) {
+  struct io_uring_sqe *sqe;
+  backend->base.sq_full_count++;
+
+  while (1) {
+    backend->pending_sqes = 0;
+    int ret = io_uring_submit(&backend->ring);
+    sqe = io_uring_get_sqe(&backend->ring);
+    if (sqe) return sqe;
+
+    io_uring_backend_wait_sq_space(backend, ret);
+  }
+}
+
+// Returns an SQE, never NULL. If the SQ ring is full, pending SQEs are
+// submitted first.
+static inline struct io_uring_sqe *io_uring_backend_get_sqe(Backend_t *backend) {
+  struct io_uring_sqe *sqe = io_uring_get_sqe(&backend->ring);
+  return sqe ? sqe : io_uring_backend_get_sqe_slow(backend);
+}
+
+// Associates the op context with the SQE. The SQE should be fully prepared,
+// since the op submission is traced with the SQE's fd and length.
+static inline void io_uring_backend_sqe_set_data(Backend_t *backend, struct io_uring_sqe *sqe, op_context_t *ctx) {
+  io_uring_sqe_set_data(sqe, ctx);
+  ctx->fd = sqe->fd;
+  TRACE_RING_RECORD(&backend->base, TRACE_OP_SUBMIT, ctx->fiber, ctx->type, ctx->id, sqe->fd, sqe->len, 0);
+}
+
+// Makes sure the given number of SQEs can be prepared without the SQ ring
+// filling up. This is used before preparing linked SQEs, since a link chain is
+// broken if it is split across submissions.
+static inline void io_uring_backend_reserve_sqes(Backend_t *backend, unsigned int count) {
+  if (io_uring_sq_space_left(&backend->ring) >= count) return;
+
+  backend->base.sq_full_count++;
+  while (1) {
+    backend->pending_sqes = 0;
+    int ret = io_uring_submit(&backend->ring);
+    if (io_uring_sq_space_left(&backend->ring) >= count) return;
+
+    io_uring_backend_wait_sq_space(backend, ret);
+  }
+}
+
+// Opcodes required by the backend. IORING_OP_SPLICE (Linux 5.7) is the most
+// recent of these.
+static const int io_uring_backend_required_ops[] = {
+  IORING_OP_READ, IORING_OP_WRITE, IORING_OP_SEND, IORING_OP_RECV,
+  IORING_OP_ACCEPT, IORING_OP_CONNECT, IORING_OP_POLL_ADD, IORING_OP_TIMEOUT,
+  IORING_OP_LINK_TIMEOUT, IORING_OP_ASYNC_CANCEL, IORING_OP_SPLICE
+};
+
+// Returns true if io_uring is usable, i.e. a ring can be set up (io_uring might
+// be disabled, e.g. through seccomp or the io_uring_disabled sysctl), and all
+// required opcodes are supported. The result is cached.
+int io_uring_backend_supported() {
+  static int supported = -1;
+  if (supported != -1) return supported;
+
+  struct io_uring ring;
+  supported = 0;
+  if (io_uring_queue_init(2, &ring, 0) < 0) return supported;
+
+  struct io_uring_probe *probe = io_uring_get_probe_ring(&ring);
+  if (probe) {
+    supported = 1;
+    int count = sizeof(io_uring_backend_required_ops) / sizeof(int);
+    for (int i = 0; i < count; i++)
+      if (!io_uring_opcode_supported(probe, io_uring_backend_required_ops[i])) supported = 0;
+    io_uring_free_probe(probe);
+  }
+  io_uring_queue_exit(&ring);
+  return supported;
+}
+
+static inline void io_uring_backend_registered_files_free(Backend_t *backend) {
+  if (!backend->registered_ios) return;
+
+  free(backend->registered_ios);
+  backend->registered_ios = NULL;
+  backend->registered_ios_size = 0;
+  backend->registered_ios_limit = 0;
+}
+
+static VALUE SYM_sqpoll;
+static VALUE SYM_sqpoll_idle;
+static VALUE SYM_sqpoll_cpu;
+static VALUE SYM_sq_entries;
+static VALUE SYM_cq_entries;
+static VALUE SYM_op_context_watermark;
+static VALUE SYM_op_context_trim_interval;
+
+// The SQ ring is kept small, since it only needs to hold SQEs prepared between
+// submissions, and a full SQ ring is handled by submitting pending SQEs. The CQ
+// ring should be able to hold the completions of all ops in flight.
+#define DEFAULT_SQ_ENTRIES 256
+#define DEFAULT_CQ_ENTRIES 4096
+
+static inline unsigned int io_uring_backend_entries_option(VALUE opts, VALUE key, unsigned int value) {
+  VALUE entries = rb_hash_aref(opts, key);
+  if (entries == Qnil) return value;
+
+  int count = NUM2INT(entries);
+  if (count <= 0) rb_raise(rb_eArgError, "invalid ring size");
+  return count;
+}
+
+// Parses backend options:
+// - sq_entries: size of the submission queue ring
+// - cq_entries: size of the completion queue ring
+// - op_context_watermark: number of op contexts kept allocated when idle
+// - op_context_trim_interval: minimum interval in seconds between trimming
+//   unused op contexts
+// - sqpoll: use a kernel thread for polling the submission queue
+// - sqpoll_idle: idle time in seconds before the SQ thread goes to sleep
+// - sqpoll_cpu: CPU the SQ thread is bound to
+static void io_uring_backend_parse_options(Backend_t *backend, VALUE opts) {
+  backend->setup_flags = 0;
+  backend->sq_thread_idle = 0;
+  backend->sq_thread_cpu = 0;
+  backend->sq_entries = DEFAULT_SQ_ENTRIES;
+  backend->cq_entries = DEFAULT_CQ_ENTRIES;
+  if (opts == Qnil) return;
+
+  Check_Type(opts, T_HASH);
+  backend->sq_entries = io_uring_backend_entries_option(opts, SYM_sq_entries, backend->sq_entries);
+  backend->cq_entries = io_uring_backend_entries_option(opts, SYM_cq_entries, backend->cq_entries);
+  VALUE watermark = rb_hash_aref(opts, SYM_op_context_watermark);
+  if (watermark != Qnil) backend->store.watermark = NUM2UINT(watermark);
+  VALUE trim_interval = rb_hash_aref(opts, SYM_op_context_trim_interval);
+  if (trim_interval != Qnil) backend->store.trim_interval = NUM2DBL(trim_interval);
+  if (!RTEST(rb_hash_aref(opts, SYM_sqpoll))) return;
+
+  backend->setup_flags |= IORING_SETUP_SQPOLL;
+  VALUE idle = rb_hash_aref(opts, SYM_sqpoll_idle);
+  if (idle != Qnil) backend->sq_thread_idle = (unsigned int)(NUM2DBL(idle) * 1000);
+  VALUE cpu = rb_hash_aref(opts, SYM_sqpoll_cpu);
+  if (cpu != Qnil) {
+    backend->setup_flags |= IORING_SETUP_SQ_AFF;
+    backend->sq_thread_cpu = NUM2UINT(cpu);
+  }
+}
+
+static VALUE Backend_initialize(int argc, VALUE *argv, VALUE self) {
   Backend_t *backend;
+  VALUE opts = Qnil;
   GetBackend(self, backend);
+  rb_scan_args(argc, argv, "01", &opts);
 
   backend_base_initialize(&backend->base);
   backend->pending_sqes = 0;
   backend->prepared_limit = 2048;
-
-  context_store_initialize(&backend->store);
-  io_uring_queue_init(backend->prepared_limit, &backend->ring, 0);
+  backend->registered_ios = NULL;
+  backend->registered_ios_size = 0;
+  backend->registered_ios_limit = 0;
+  context_store_initialize(&backend->store, &backend->base);
+  // initialized before parsing options and setting up the ring, so the backend
+  // can be freed if either fails
+  deadline_heap_init(&backend->deadlines);
+  backend->idle_sweep = (deadline_entry){0, Qnil, Qnil, -1};
+
+  io_uring_backend_parse_options(backend, opts);
+  io_uring_backend_queue_init(backend);
   backend->event_fd = -1;
+  backend->buffer_pool = NULL;
+  backend->buffer_pool_state = BUFFER_POOL_STATE_UNINITIALIZED;
+  backend->multishot_accept_unsupported = 0;
+  backend->send_zc_unsupported = 0;
+  backend->shutdown_unsupported = 0;
+  backend->send_zc_threshold = 0;
+  backend->armed_deadline = 0;
+  backend->completion_poll_armed = 0;
+  backend->pipe_cache_count = 0;
 
   return Qnil;
 }
@@ -95,6 +426,14 @@ VALUE Backend_finalize(VALUE self) {
 
   io_uring_queue_exit(&backend->ring);
   if (backend->event_fd != -1) close(backend->event_fd);
+  while (backend->pipe_cache_count) {
+    int *pipefd = backend->pipe_cache[--backend->pipe_cache_count];
+    close(pipefd[0]);
+    close(pipefd[1]);
+  }
+  if (backend->buffer_pool) free(backend->buffer_pool);
+  backend->buffer_pool = NULL;
+  io_uring_backend_registered_files_free(backend);
   context_store_free(&backend->store);
   return self;
 }
@@ -104,24 +443,73 @@ VALUE Backend_post_fork(VALUE self) {
   GetBackend(self, backend);
 
   io_uring_queue_exit(&backend->ring);
-  io_uring_queue_init(backend->prepared_limit, &backend->ring, 0);
-  context_store_free(&backend->store);
+  io_uring_backend_queue_init(backend);
+  context_store_reset(&backend->store);
   backend_base_reset(&backend->base);
 
+  // buffers were provided to the old ring, they need to be provided again
+  if (backend->buffer_pool) free(backend->buffer_pool);
+  backend->buffer_pool = NULL;
+  backend->buffer_pool_state = BUFFER_POOL_STATE_UNINITIALIZED;
+  io_uring_backend_registered_files_free(backend);
+  deadline_heap_clear(&backend->deadlines);
+  backend->armed_deadline = 0;
+  backend->completion_poll_armed = 0;
+
   return self;
 }
 
 typedef struct poll_context {
-  struct io_uring     *ring;
-  struct io_uring_cqe *cqe;
-  int                 result;
+  struct io_uring           *ring;
+  unsigned int              to_submit;
+  unsigned int              wait_nr;
+  struct __kernel_timespec  *ts;
+  int                       result;
 } poll_context_t;
 
 extern int __sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, sigset_t *sig);
+extern int __io_uring_flush_sq(struct io_uring *ring);
+
+// definitions missing from the bundled liburing headers, used for passing a
+// timeout to io_uring_enter (available since Linux 5.11)
+#ifndef IORING_FEAT_EXT_ARG
+#define IORING_FEAT_EXT_ARG   (1U << 8)
+#endif
+#ifndef IORING_ENTER_EXT_ARG
+#define IORING_ENTER_EXT_ARG  (1U << 3)
+#endif
+
+struct polyphony_io_uring_getevents_arg {
+  __u64 sigmask;
+  __u32 sigmask_sz;
+  __u32 pad;
+  __u64 ts;
+};
 
 void *io_uring_backend_poll_without_gvl(void *ptr) {
   poll_context_t *ctx = (poll_context_t *)ptr;
-  ctx->result = io_uring_wait_cqe(ctx->ring, &ctx->cqe);
+  unsigned int flags = IORING_ENTER_GETEVENTS;
+  if ((ctx->ring->flags & IORING_SETUP_SQPOLL) && ctx->to_submit) {
+    // SQEs are submitted by the SQ thread, which needs to be woken up if idle
+    ctx->to_submit = 0;
+    if (IO_URING_READ_ONCE(*ctx->ring->sq.kflags) & IORING_SQ_NEED_WAKEUP)
+      flags |= IORING_ENTER_SQ_WAKEUP;
+  }
+
+  if (ctx->ts) {
+    struct polyphony_io_uring_getevents_arg arg = {
+      .sigmask = 0,
+      .sigmask_sz = _NSIG / 8,
+      .pad = 0,
+      .ts = (__u64)(uintptr_t)ctx->ts
+    };
+    ctx->result = syscall(
+      __NR_io_uring_enter, ctx->ring->ring_fd, ctx->to_submit, ctx->wait_nr,
+      flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg)
+    );
+  }
+  else
+    ctx->result = __sys_io_uring_enter(ctx->ring->ring_fd, ctx->to_submit, ctx->wait_nr, flags, NULL);
   return NULL;
 }
 
@@ -130,25 +518,219 @@ static inline bool cq_ring_needs_flush(struct io_uring *ring) {
 	return IO_URING_READ_ONCE(*ring->sq.kflags) & IORING_SQ_CQ_OVERFLOW;
 }
 
+static inline void io_uring_backend_multishot_discard(Backend_t *backend, op_context_t *ctx, int result, unsigned int flags) {
+  if (flags & IORING_CQE_F_BUFFER)
+    io_uring_backend_buffer_pool_recycle(backend, flags);
+  else if (ctx->type == OP_ACCEPT && result >= 0)
+    close(result);
+}
+
+// A multishot op produces CQEs until a CQE without IORING_CQE_F_MORE is
+// received. CQEs are queued on the context and the fiber is made runnable only
+// if it is waiting for them. CQEs received after the fiber is done with the op
+// are discarded.
+static inline void io_uring_backend_handle_multishot_completion(struct io_uring_cqe *cqe, Backend_t *backend, op_context_t *ctx) {
+  if (ctx->ref_count == 2) {
+    context_multishot_push(ctx, cqe->res, cqe->flags);
+    if (ctx->multishot->waiting) {
+      ctx->multishot->waiting = 0;
+      Fiber_make_runnable(ctx->fiber, Qnil);
+    }
+  }
+  else
+    io_uring_backend_multishot_discard(backend, ctx, cqe->res, cqe->flags);
+
+  if (!(cqe->flags & IORING_CQE_F_MORE))
+    context_store_release(&backend->store, ctx);
+}
+
+#define DEADLINE_UDATA (LIBURING_UDATA_TIMEOUT - 1)
+#define COMPLETION_UDATA (LIBURING_UDATA_TIMEOUT - 2)
+#define BUFFER_POOL_UDATA (LIBURING_UDATA_TIMEOUT - 3)
+
+// Arms an absolute kernel timeout for the soonest deadline, unless an earlier
+// or equal one is already armed. Kernel timeouts are never cancelled: when a
+// timeout fires, expired deadlines are processed and the next one is armed.
+static void io_uring_backend_arm_deadline(Backend_t *backend) {
+  deadline_entry *next = deadline_heap_peek(&backend->deadlines);
+  if (!next) return;
+  if (backend->armed_deadline && backend->armed_deadline <= next->deadline) return;
+
+  struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
+  backend->armed_deadline = next->deadline;
+  backend->armed_deadline_ts = double_to_timespec(next->deadline);
+  io_uring_prep_timeout(sqe, &backend->armed_deadline_ts, 0, IORING_TIMEOUT_ABS);
+  sqe->user_data = DEADLINE_UDATA;
+  io_uring_backend_defer_submit(backend);
+}
+
+static void io_uring_backend_expire_deadlines(Backend_t *backend) {
+  if (!backend->deadlines.count) return;
+
+  double now = current_time();
+  deadline_entry *entry;
+  int sweep = 0;
+  while ((entry = deadline_heap_pop_expired(&backend->deadlines, now))) {
+    if (entry == &backend->idle_sweep)
+      sweep = 1;
+    else
+      Fiber_make_runnable(entry->fiber, entry->value);
+  }
+  if (sweep) {
+    double next = backend_idle_deadlines_sweep(&backend->base, now);
+    if (next) {
+      backend->idle_sweep.deadline = next;
+      deadline_heap_push(&backend->deadlines, &backend->idle_sweep);
+    }
+  }
+  io_uring_backend_arm_deadline(backend);
+}
+
+static inline void io_uring_backend_add_deadline(Backend_t *backend, deadline_entry *entry) {
+  deadline_heap_push(&backend->deadlines, entry);
+  io_uring_backend_arm_deadline(backend);
+}
+
+static void io_uring_backend_arm_idle_sweep(struct Backend_base *base, double time) {
+  Backend_t *backend = (Backend_t *)base;
+  deadline_entry *entry = &backend->idle_sweep;
+  if (deadline_entry_pending_p(entry)) {
+    if (entry->deadline <= time) return;
+    deadline_heap_remove(&backend->deadlines, entry);
+  }
+  entry->deadline = time;
+  io_uring_backend_add_deadline(backend, entry);
+}
+
+// The completion fd is polled only while thread pool jobs are in flight.
+static void io_uring_backend_arm_completion_poll(Backend_t *backend) {
+  if (backend->completion_poll_armed) return;
+
+  struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
+  io_uring_prep_poll_add(sqe, backend->base.completions->fd, POLLIN);
+  sqe->user_data = COMPLETION_UDATA;
+  backend->completion_poll_armed = 1;
+  io_uring_backend_defer_submit(backend);
+}
+
+inline void Backend_watch_thread_pool_job(VALUE self, thread_pool_job_t *job) {
+  Backend_t *backend;
+  GetBackend(self, backend);
+
+  backend_base_watch_job(&backend->base, job);
+  io_uring_backend_arm_completion_poll(backend);
+}
+
+// A zero-copy send context holds three references: the fiber's, the send
+// result's and the notification's. The notification CQE is posted once the
+// kernel is done with the buffer, and it is only then that the context, and
+// the string attached to it, are released.
+static inline void io_uring_backend_handle_send_zc_completion(struct io_uring_cqe *cqe, Backend_t *backend, op_context_t *ctx) {
+  if (cqe->flags & IORING_CQE_F_NOTIF) {
+    context_store_release(&backend->store, ctx);
+    return;
+  }
+
+  ctx->result = cqe->res;
+  if (ctx->ref_count == 3 && ctx->result != -ECANCELED && ctx->fiber)
+    Fiber_make_runnable(ctx->fiber, ctx->resume_value);
+  // no notification is posted if the send has failed
+  if (!(cqe->flags & IORING_CQE_F_MORE)) context_store_release(&backend->store, ctx);
+  context_store_release(&backend->store, ctx);
+}
+
+// Per-chain data, allocated as a single block and freed along with the chain
+// context. The links array holds the contexts of links not yet completed, so
+// they can be cancelled. The close_fds array holds the detached descriptors of
+// close links (or -1 for other links).
+struct chain_data {
+  struct __kernel_timespec  *timeouts;
+  op_context_t              **links;
+  int                       *results;
+  int                       *close_fds;
+};
+
+// Handles the completion of a single chain link. The chain context holds a
+// reference for each link, plus one for the waiting fiber, which is resumed
+// once the last link is completed.
+static inline void io_uring_backend_handle_chain_link_completion(struct io_uring_cqe *cqe, Backend_t *backend, op_context_t *ctx) {
+  op_context_t *chain = ctx->chain;
+  struct chain_data *data = chain->chain_data;
+
+  data->results[ctx->chain_index] = cqe->res;
+  data->links[ctx->chain_index] = NULL;
+  // a cancelled close link would otherwise leak its detached descriptor
+  if (cqe->res == -ECANCELED && data->close_fds[ctx->chain_index] >= 0)
+    close(data->close_fds[ctx->chain_index]);
+  context_store_release(&backend->store, ctx);
+
+  if (chain->ref_count == 2 && chain->fiber)
+    Fiber_make_runnable(chain->fiber, chain->resume_value);
+  context_store_release(&backend->store, chain);
+}
+
 static inline void io_uring_backend_handle_completion(struct io_uring_cqe *cqe, Backend_t *backend) {
   op_context_t *ctx = io_uring_cqe_get_data(cqe);
-  if (!ctx) return;
+  if (cqe->user_data == DEADLINE_UDATA) {
+    backend->armed_deadline = 0;
+    return;
+  }
+  if (cqe->user_data == BUFFER_POOL_UDATA) {
+    // If buffers could not be provided, the pool is not used for any further
+    // ops. Buffers already provided are still recycled.
+    if (cqe->res < 0)
+      backend->buffer_pool_state = BUFFER_POOL_STATE_UNSUPPORTED;
+    else if (backend->buffer_pool_state == BUFFER_POOL_STATE_PENDING)
+      backend->buffer_pool_state = BUFFER_POOL_STATE_READY;
+    return;
+  }
+  if (cqe->user_data == COMPLETION_UDATA) {
+    backend->completion_poll_armed = 0;
+    backend_base_drain_completions(&backend->base);
+    if (backend->base.completions_in_flight) io_uring_backend_arm_completion_poll(backend);
+    return;
+  }
+  if (!ctx || cqe->user_data == LIBURING_UDATA_TIMEOUT) return;
+  if (backend->base.extended_stats && !(cqe->flags & IORING_CQE_F_NOTIF))
+    // latencies are not recorded for multishot ops
+    backend_stats_record_op(&backend->base, ctx->type, ctx->multishot ? 0 : ctx->start_time, cqe->res);
+  TRACE_RING_RECORD(&backend->base, TRACE_OP_COMPLETE, ctx->fiber, ctx->type, ctx->id, ctx->fd, 0, cqe->res);
+  BACKEND_TOUCH_IDLE_DEADLINE(&backend->base, ctx->fiber, ctx->type, cqe->res);
+
+  if (ctx->multishot) {
+    io_uring_backend_handle_multishot_completion(cqe, backend, ctx);
+    return;
+  }
+  if (ctx->type == OP_SEND_ZC) {
+    io_uring_backend_handle_send_zc_completion(cqe, backend, ctx);
+    return;
+  }
+  if (ctx->type == OP_CHAIN_LINK) {
+    io_uring_backend_handle_chain_link_completion(cqe, backend, ctx);
+    return;
+  }
 
   // printf("cqe ctx %p id: %d result: %d (%s, ref_count: %d)\n", ctx, ctx->id, cqe->res, op_type_to_str(ctx->type), ctx->ref_count);
   ctx->result = cqe->res;
-  if (ctx->ref_count == 2 && ctx->result != -ECANCELED && ctx->fiber)
+  ctx->cqe_flags = cqe->flags;
+  if (ctx->ref_count == 2 && ctx->fiber && (ctx->result != -ECANCELED || ctx->cancel_waiting))
     Fiber_make_runnable(ctx->fiber, ctx->resume_value);
+  else if (cqe->flags & IORING_CQE_F_BUFFER)
+    // the op was abandoned, so the selected buffer is returned to the pool
+    io_uring_backend_buffer_pool_recycle(backend, cqe->flags);
   context_store_release(&backend->store, ctx);
 }
 
 // adapted from io_uring_peek_batch_cqe in queue.c
-// this peeks at cqes and handles each available cqe
-void io_uring_backend_handle_ready_cqes(Backend_t *backend) {
+// this peeks at cqes and handles each available cqe, returns the number of
+// handled cqes
+unsigned int io_uring_backend_handle_ready_cqes(Backend_t *backend) {
   struct io_uring *ring = &backend->ring;
 	bool overflow_checked = false;
   struct io_uring_cqe *cqe;
 	unsigned head;
   unsigned cqe_count;
+  unsigned total = 0;
 
 again:
   cqe_count = 0;
@@ -157,6 +739,7 @@ again:
     io_uring_backend_handle_completion(cqe, backend);
   }
   io_uring_cq_advance(ring, cqe_count);
+  total += cqe_count;
 
 	if (overflow_checked) goto done;
 
@@ -167,24 +750,62 @@ again:
 	}
 
 done:
-	return;
+	return total;
+}
+
+// Busy-waits for completions for the duration specified in the poll policy.
+// Returns true if any completion is ready.
+static inline int io_uring_backend_busy_spin(Backend_t *backend) {
+  io_uring_submit(&backend->ring);
+
+  double deadline = current_time() + backend->base.poll_busy_spin;
+  do {
+    if (io_uring_cq_ready(&backend->ring)) return 1;
+  } while (current_time() < deadline);
+  return 0;
 }
 
+// Waits for completions according to the poll policy. By default, the poll
+// waits for a single completion. If min_complete is greater than one, the poll
+// waits for up to min_complete completions (but not more than the number of
+// pending ops), or until max_wait has elapsed, so a single io_uring_enter
+// call can reap multiple completions.
 void io_uring_backend_poll(Backend_t *backend) {
-  poll_context_t poll_ctx;
-  poll_ctx.ring = &backend->ring;
-  if (backend->pending_sqes) {
-    backend->pending_sqes = 0;
-    io_uring_submit(&backend->ring);
+  struct Backend_base *base = &backend->base;
+  struct io_uring *ring = &backend->ring;
+  struct __kernel_timespec ts;
+  poll_context_t poll_ctx = {ring, 0, 1, NULL, 0};
+
+  backend->pending_sqes = 0;
+  if (base->poll_busy_spin > 0 && io_uring_backend_busy_spin(backend)) return;
+
+  if (base->poll_min_complete > 1) {
+    unsigned int pending = base->pending_count ? base->pending_count : 1;
+    poll_ctx.wait_nr = base->poll_min_complete < pending ? base->poll_min_complete : pending;
   }
 
-  backend->base.currently_polling = 1;
-  rb_thread_call_without_gvl(io_uring_backend_poll_without_gvl, (void *)&poll_ctx, RUBY_UBF_IO, 0);
-  backend->base.currently_polling = 0;
-  if (poll_ctx.result < 0) return;
+  if (io_uring_cq_ready(ring) >= poll_ctx.wait_nr) {
+    io_uring_submit(ring);
+    return;
+  }
 
-  io_uring_backend_handle_completion(poll_ctx.cqe, backend);
-  io_uring_cqe_seen(&backend->ring, poll_ctx.cqe);
+  if (poll_ctx.wait_nr > 1) {
+    ts = double_to_timespec(base->poll_max_wait);
+    if (backend->ring_features & IORING_FEAT_EXT_ARG)
+      poll_ctx.ts = &ts;
+    else {
+      // older kernels: use a timeout op that completes after wait_nr
+      // completions or after max_wait has elapsed
+      struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
+      io_uring_prep_timeout(sqe, &ts, poll_ctx.wait_nr, 0);
+      sqe->user_data = LIBURING_UDATA_TIMEOUT;
+    }
+  }
+  poll_ctx.to_submit = __io_uring_flush_sq(ring);
+
+  base->currently_polling = 1;
+  rb_thread_call_without_gvl(io_uring_backend_poll_without_gvl, (void *)&poll_ctx, RUBY_UBF_IO, 0);
+  base->currently_polling = 0;
 }
 
 inline VALUE Backend_poll(VALUE self, VALUE blocking) {
@@ -200,11 +821,14 @@ inline VALUE Backend_poll(VALUE self, VALUE blocking) {
   }
 
   COND_TRACE(&backend->base, 2, SYM_fiber_event_poll_enter, rb_fiber_current());
+  TRACE_RING_RECORD(&backend->base, TRACE_POLL_ENTER, rb_fiber_current(), 0, 0, -1, 0, 0);
   
   if (is_blocking) io_uring_backend_poll(backend);
-  io_uring_backend_handle_ready_cqes(backend);
+  backend_base_record_completions(&backend->base, io_uring_backend_handle_ready_cqes(backend));
+  io_uring_backend_expire_deadlines(backend);
   
   COND_TRACE(&backend->base, 2, SYM_fiber_event_poll_leave, rb_fiber_current());
+  TRACE_RING_RECORD(&backend->base, TRACE_POLL_LEAVE, rb_fiber_current(), 0, 0, -1, 0, 0);
 
   return self;
 }
@@ -220,7 +844,7 @@ inline void Backend_unschedule_fiber(VALUE self, VALUE fiber) {
   Backend_t *backend;
   GetBackend(self, backend);
 
-  runqueue_delete(&backend->base.runqueue, fiber);
+  backend_base_unschedule_fiber(&backend->base, fiber);
 }
 
 inline VALUE Backend_switch_fiber(VALUE self) {
@@ -230,13 +854,6 @@ inline VALUE Backend_switch_fiber(VALUE self) {
   return backend_base_switch_fiber(self, &backend->base);
 }
 
-inline struct backend_stats backend_get_stats(VALUE self) {
-  Backend_t *backend;
-  GetBackend(self, backend);
-
-  return backend_base_stats(&backend->base);
-}
-
 VALUE Backend_wakeup(VALUE self) {
   Backend_t *backend;
   GetBackend(self, backend);
@@ -244,7 +861,7 @@ VALUE Backend_wakeup(VALUE self) {
   if (backend->base.currently_polling) {
     // Since we're currently blocking while waiting for a completion, we add a
     // NOP which would cause the io_uring_enter syscall to return
-    struct io_uring_sqe *sqe = io_uring_get_sqe(&backend->ring);
+    struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
     io_uring_prep_nop(sqe);
     backend->pending_sqes = 0;
     io_uring_submit(&backend->ring);
@@ -255,6 +872,21 @@ VALUE Backend_wakeup(VALUE self) {
   return Qnil;
 }
 
+// Sets the given SQE to use the registered file for the given io, if the io
+// was registered with the backend. Since registered files are indexed by fd,
+// the SQE's fd field does not need to be changed.
+static inline void io_uring_backend_fixed_file(Backend_t *backend, VALUE io, rb_io_t *fptr, struct io_uring_sqe *sqe) {
+  if (backend->registered_ios && (unsigned int)fptr->fd < backend->registered_ios_size &&
+      backend->registered_ios[fptr->fd] == io)
+    sqe->flags |= IOSQE_FIXED_FILE;
+}
+
+static inline void io_uring_backend_fixed_splice_src(Backend_t *backend, VALUE io, rb_io_t *fptr, struct io_uring_sqe *sqe) {
+  if (backend->registered_ios && (unsigned int)fptr->fd < backend->registered_ios_size &&
+      backend->registered_ios[fptr->fd] == io)
+    sqe->splice_flags |= SPLICE_F_FD_IN_FIXED;
+}
+
 inline void io_uring_backend_defer_submit(Backend_t *backend) {
   backend->pending_sqes += 1;
   if (backend->pending_sqes >= backend->prepared_limit) {
@@ -263,6 +895,60 @@ inline void io_uring_backend_defer_submit(Backend_t *backend) {
   }
 }
 
+// Returns true if the buffer pool is available. The buffers are provided
+// synchronously, so if the kernel fails to take them, the caller may fall back
+// to reading into its own buffer, instead of having all ops fail with ENOBUFS.
+static int io_uring_backend_buffer_pool_setup(Backend_t *backend) {
+  if (backend->buffer_pool_state != BUFFER_POOL_STATE_UNINITIALIZED)
+    return backend->buffer_pool_state == BUFFER_POOL_STATE_READY;
+
+  struct io_uring_probe *probe = io_uring_get_probe_ring(&backend->ring);
+  int supported = probe && io_uring_opcode_supported(probe, IORING_OP_PROVIDE_BUFFERS);
+  if (probe) io_uring_free_probe(probe);
+  if (!supported) {
+    backend->buffer_pool_state = BUFFER_POOL_STATE_UNSUPPORTED;
+    return 0;
+  }
+
+  backend->buffer_pool = malloc(BUFFER_POOL_COUNT * BUFFER_POOL_BUFFER_SIZE);
+  if (!backend->buffer_pool) {
+    backend->buffer_pool_state = BUFFER_POOL_STATE_UNSUPPORTED;
+    return 0;
+  }
+
+  struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
+  io_uring_prep_provide_buffers(
+    sqe, backend->buffer_pool, BUFFER_POOL_BUFFER_SIZE, BUFFER_POOL_COUNT, BUFFER_POOL_GROUP_ID, 0
+  );
+  sqe->user_data = BUFFER_POOL_UDATA;
+  backend->buffer_pool_state = BUFFER_POOL_STATE_PENDING;
+  backend->pending_sqes = 0;
+  io_uring_submit(&backend->ring);
+
+  // The op completes without blocking, so its CQE is normally already posted.
+  // Any other CQEs are handled along the way.
+  while (backend->buffer_pool_state == BUFFER_POOL_STATE_PENDING) {
+    struct io_uring_cqe *cqe;
+    if (!io_uring_backend_handle_ready_cqes(backend) && io_uring_wait_cqe(&backend->ring, &cqe) < 0)
+      backend->buffer_pool_state = BUFFER_POOL_STATE_UNSUPPORTED;
+  }
+  return backend->buffer_pool_state == BUFFER_POOL_STATE_READY;
+}
+
+static inline char *io_uring_backend_buffer_pool_ptr(Backend_t *backend, unsigned int cqe_flags) {
+  return backend->buffer_pool + (cqe_flags >> IORING_CQE_BUFFER_SHIFT) * BUFFER_POOL_BUFFER_SIZE;
+}
+
+static inline void io_uring_backend_buffer_pool_recycle(Backend_t *backend, unsigned int cqe_flags) {
+  int bid = cqe_flags >> IORING_CQE_BUFFER_SHIFT;
+  struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
+  io_uring_prep_provide_buffers(
+    sqe, io_uring_backend_buffer_pool_ptr(backend, cqe_flags), BUFFER_POOL_BUFFER_SIZE, 1, BUFFER_POOL_GROUP_ID, bid
+  );
+  sqe->user_data = BUFFER_POOL_UDATA;
+  io_uring_backend_defer_submit(backend);
+}
+
 int io_uring_backend_defer_submit_and_await(
   Backend_t *backend,
   struct io_uring_sqe *sqe,
@@ -274,8 +960,8 @@ int io_uring_backend_defer_submit_and_await(
 
   backend->base.op_count++;
   if (sqe) {
-    io_uring_sqe_set_data(sqe, ctx);
-    io_uring_sqe_set_flags(sqe, IOSQE_ASYNC);
+    io_uring_backend_sqe_set_data(backend, sqe, ctx);
+    sqe->flags |= IOSQE_ASYNC;
   }
   io_uring_backend_defer_submit(backend);
 
@@ -284,7 +970,7 @@ int io_uring_backend_defer_submit_and_await(
   if (ctx->ref_count > 1) {
     // op was not completed (an exception was raised), so we need to cancel it
     ctx->result = -ECANCELED;
-    struct io_uring_sqe *sqe = io_uring_get_sqe(&backend->ring);
+    struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
     io_uring_prep_cancel(sqe, ctx, 0);
     backend->pending_sqes = 0;
     io_uring_submit(&backend->ring);
@@ -296,11 +982,24 @@ int io_uring_backend_defer_submit_and_await(
   return ctx->result;
 }
 
+// Waits for an op that was interrupted, and is being cancelled, to terminate,
+// returning its result. This is used for ops that might still complete before
+// being cancelled, with a result that must not be lost (an accepted
+// connection). Values the fiber is resumed with in the meantime are ignored.
+static int io_uring_backend_await_cancellation(Backend_t *backend, op_context_t *ctx) {
+  ctx->cancel_waiting = 1;
+  while (ctx->ref_count > 1) {
+    VALUE resume_value = backend_await((struct Backend_base *)backend);
+    RB_GC_GUARD(resume_value);
+  }
+  return ctx->result;
+}
+
 VALUE io_uring_backend_wait_fd(Backend_t *backend, int fd, int write) {
   op_context_t *ctx = context_store_acquire(&backend->store, OP_POLL);
   VALUE resumed_value = Qnil;
 
-  struct io_uring_sqe *sqe = io_uring_get_sqe(&backend->ring);
+  struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
   io_uring_prep_poll_add(sqe, fd, write ? POLLOUT : POLLIN);
 
   io_uring_backend_defer_submit_and_await(backend, sqe, ctx, &resumed_value);
@@ -310,6 +1009,182 @@ VALUE io_uring_backend_wait_fd(Backend_t *backend, int fd, int write) {
   return resumed_value;
 }
 
+static inline VALUE io_uring_backend_make_socket(int fd, VALUE socket_class) {
+  rb_io_t *fp;
+
+  VALUE socket = rb_obj_alloc(socket_class);
+  MakeOpenFile(socket, fp);
+  rb_update_max_fd(fd);
+  fp->fd = fd;
+  fp->mode = FMODE_READWRITE | FMODE_DUPLEX;
+  rb_io_ascii8bit_binmode(socket);
+  rb_io_synchronized(fp);
+
+  // if (rsock_do_not_reverse_lookup) {
+  //   fp->mode |= FMODE_NOREVLOOKUP;
+  // }
+  return socket;
+}
+
+// Connections accepted by a multishot accept after its loop is done are kept
+// on the server socket, in an internal instance variable that is not visible
+// from Ruby, and are served first by the next accept. Multishot accept is not
+// used on frozen server sockets.
+static ID ID_pending_sockets;
+
+static void io_uring_backend_push_pending_socket(VALUE io, VALUE socket) {
+  VALUE pending = rb_ivar_get(io, ID_pending_sockets);
+  if (pending == Qnil) {
+    pending = rb_ary_new();
+    rb_ivar_set(io, ID_pending_sockets, pending);
+  }
+  rb_ary_push(pending, socket);
+}
+
+static inline VALUE io_uring_backend_shift_pending_socket(VALUE io) {
+  VALUE pending = rb_ivar_get(io, ID_pending_sockets);
+  return (pending == Qnil) ? Qnil : rb_ary_shift(pending);
+}
+
+struct multishot_accept_ctx {
+  Backend_t     *backend;
+  op_context_t  *ctx;
+  VALUE         server_socket;
+  rb_io_t       *fptr;
+  VALUE         socket_class;
+  int           unsupported;
+};
+
+static inline void io_uring_backend_multishot_accept_arm(struct multishot_accept_ctx *mctx) {
+  Backend_t *backend = mctx->backend;
+  struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
+  io_uring_prep_accept(sqe, mctx->fptr->fd, NULL, NULL, 0);
+  sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+  io_uring_backend_fixed_file(backend, mctx->server_socket, mctx->fptr, sqe);
+  io_uring_backend_sqe_set_data(backend, sqe, mctx->ctx);
+  mctx->ctx->ref_count = 2;
+  backend->base.op_count++;
+  io_uring_backend_defer_submit(backend);
+}
+
+// Cancels a multishot accept and waits for it to terminate, yielding any
+// connection accepted in the meantime, so that no connection is dropped when
+// the accept loop is interrupted.
+static void io_uring_backend_multishot_accept_drain(struct multishot_accept_ctx *mctx) {
+  Backend_t *backend = mctx->backend;
+  op_context_t *ctx = mctx->ctx;
+  int result;
+  unsigned int flags;
+
+  if (ctx->ref_count > 1) {
+    struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
+    io_uring_prep_cancel(sqe, ctx, 0);
+    backend->pending_sqes = 0;
+    io_uring_submit(&backend->ring);
+  }
+  while (1) {
+    while (context_multishot_shift(ctx, &result, &flags))
+      if (result >= 0) rb_yield(io_uring_backend_make_socket(result, mctx->socket_class));
+    if (ctx->ref_count == 1) return;
+
+    ctx->multishot->waiting = 1;
+    VALUE resume_value = backend_await((struct Backend_base *)backend);
+    ctx->multishot->waiting = 0;
+    RB_GC_GUARD(resume_value);
+  }
+}
+
+static VALUE io_uring_backend_multishot_accept_body(VALUE arg) {
+  struct multishot_accept_ctx *mctx = (struct multishot_accept_ctx *)arg;
+  op_context_t *ctx = mctx->ctx;
+  int first = 1;
+  int result;
+  unsigned int flags;
+
+  io_uring_backend_multishot_accept_arm(mctx);
+  while (1) {
+    if (!context_multishot_shift(ctx, &result, &flags)) {
+      ctx->multishot->waiting = 1;
+      VALUE resume_value = backend_await((struct Backend_base *)mctx->backend);
+      ctx->multishot->waiting = 0;
+      if (TEST_EXCEPTION(resume_value) || !ctx->multishot->count) {
+        // the fiber was interrupted or resumed for some other reason
+        io_uring_backend_multishot_accept_drain(mctx);
+        RAISE_IF_EXCEPTION(resume_value);
+        return resume_value;
+      }
+      RB_GC_GUARD(resume_value);
+      continue;
+    }
+
+    int last = !(flags & IORING_CQE_F_MORE);
+    if (result < 0) {
+      if (result == -EINVAL && first && last) {
+        // multishot mode is not supported by the kernel
+        mctx->unsupported = 1;
+        return Qnil;
+      }
+      rb_syserr_fail(-result, strerror(-result));
+    }
+    first = 0;
+
+    rb_yield(io_uring_backend_make_socket(result, mctx->socket_class));
+
+    if (last) {
+      io_uring_backend_multishot_accept_arm(mctx);
+      first = 1;
+    }
+  }
+}
+
+// Stops a multishot accept when its loop is done, whether by break or by an
+// exception. The op is cancelled and awaited before its queued CQEs are
+// drained, and connections accepted by the kernel in the meantime are kept for
+// the next accept on the server socket.
+static VALUE io_uring_backend_multishot_accept_ensure(VALUE arg) {
+  struct multishot_accept_ctx *mctx = (struct multishot_accept_ctx *)arg;
+  Backend_t *backend = mctx->backend;
+  op_context_t *ctx = mctx->ctx;
+  int result;
+  unsigned int flags;
+
+  if (ctx->ref_count > 1) {
+    // op is still active, so we need to cancel it
+    struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
+    io_uring_prep_cancel(sqe, ctx, 0);
+    backend->pending_sqes = 0;
+    io_uring_submit(&backend->ring);
+    while (ctx->ref_count > 1) {
+      ctx->multishot->waiting = 1;
+      VALUE resume_value = backend_await((struct Backend_base *)backend);
+      ctx->multishot->waiting = 0;
+      RB_GC_GUARD(resume_value);
+    }
+  }
+
+  while (context_multishot_shift(ctx, &result, &flags))
+    if (result >= 0)
+      io_uring_backend_push_pending_socket(mctx->server_socket, io_uring_backend_make_socket(result, mctx->socket_class));
+
+  context_store_release(&backend->store, ctx);
+  return Qnil;
+}
+
+// Runs an accept loop using a single multishot accept. Sets *unsupported if
+// the kernel does not support multishot accept.
+static VALUE io_uring_backend_multishot_accept_loop(Backend_t *backend, VALUE server_socket, rb_io_t *fptr, VALUE socket_class, int *unsupported) {
+  op_context_t *ctx = context_store_acquire(&backend->store, OP_ACCEPT);
+  context_multishot_setup(ctx);
+
+  struct multishot_accept_ctx mctx = {backend, ctx, server_socket, fptr, socket_class, 0};
+  VALUE ret = rb_ensure(
+    io_uring_backend_multishot_accept_body, (VALUE)&mctx,
+    io_uring_backend_multishot_accept_ensure, (VALUE)&mctx
+  );
+  *unsupported = mctx.unsupported;
+  return ret;
+}
+
 VALUE Backend_read(VALUE self, VALUE io, VALUE str, VALUE length, VALUE to_eof, VALUE pos) {
   Backend_t *backend;
   rb_io_t *fptr;
@@ -338,8 +1213,9 @@ VALUE Backend_read(VALUE self, VALUE io, VALUE str, VALUE length, VALUE to_eof,
   while (1) {
     VALUE resume_value = Qnil;
     op_context_t *ctx = context_store_acquire(&backend->store, OP_READ);
-    struct io_uring_sqe *sqe = io_uring_get_sqe(&backend->ring);
+    struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
     io_uring_prep_read(sqe, fptr->fd, buf, buffer_size - total, -1);
+    io_uring_backend_fixed_file(backend, io, fptr, sqe);
 
     int result = io_uring_backend_defer_submit_and_await(backend, sqe, ctx, &resume_value);
     int completed = context_store_release(&backend->store, ctx);
@@ -380,6 +1256,61 @@ VALUE Backend_read(VALUE self, VALUE io, VALUE str, VALUE length, VALUE to_eof,
   return str;
 }
 
+// Performs a read or recv loop using buffers selected by the kernel from the
+// backend's buffer pool. Each chunk is copied into a new string, and the buffer
+// is returned to the pool before yielding.
+VALUE io_uring_backend_pooled_read_loop(Backend_t *backend, VALUE io, rb_io_t *fptr, long maxlen, enum op_type type) {
+  long len = maxlen < BUFFER_POOL_BUFFER_SIZE ? maxlen : BUFFER_POOL_BUFFER_SIZE;
+  VALUE str = Qnil;
+
+  while (1) {
+    VALUE resume_value = Qnil;
+    op_context_t *ctx = context_store_acquire(&backend->store, type);
+    struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
+    if (type == OP_RECV)
+      io_uring_prep_recv(sqe, fptr->fd, NULL, len, 0);
+    else
+      io_uring_prep_read(sqe, fptr->fd, NULL, len, -1);
+    io_uring_backend_fixed_file(backend, io, fptr, sqe);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_POOL_GROUP_ID;
+
+    int result = io_uring_backend_defer_submit_and_await(backend, sqe, ctx, &resume_value);
+    unsigned int cqe_flags = ctx->cqe_flags;
+    int completed = context_store_release(&backend->store, ctx);
+    if (!completed) {
+      RAISE_IF_EXCEPTION(resume_value);
+      return resume_value;
+    }
+    RB_GC_GUARD(resume_value);
+
+    if (cqe_flags & IORING_CQE_F_BUFFER) {
+      if (result > 0) str = rb_str_new(io_uring_backend_buffer_pool_ptr(backend, cqe_flags), result);
+      io_uring_backend_buffer_pool_recycle(backend, cqe_flags);
+    }
+
+    if (result == -ENOBUFS) {
+      // All buffers are taken by chunks that were not yet consumed. Those are
+      // returned to the pool as soon as their fibers run, so we let them run.
+      resume_value = backend_snooze();
+      RAISE_IF_EXCEPTION(resume_value);
+      continue;
+    }
+    else if (result < 0)
+      rb_syserr_fail(-result, strerror(-result));
+    else if (!result)
+      break; // EOF
+    else {
+      io_enc_str(str, fptr);
+      rb_yield(str);
+      str = Qnil;
+    }
+  }
+
+  RB_GC_GUARD(str);
+  return io;
+}
+
 VALUE Backend_read_loop(VALUE self, VALUE io, VALUE maxlen) {
   Backend_t *backend;
   rb_io_t *fptr;
@@ -390,8 +1321,6 @@ VALUE Backend_read_loop(VALUE self, VALUE io, VALUE maxlen) {
   char *buf;
   VALUE underlying_io = rb_ivar_get(io, ID_ivar_io);
 
-  READ_LOOP_PREPARE_STR();
-
   GetBackend(self, backend);
   if (underlying_io != Qnil) io = underlying_io;
   GetOpenFile(io, fptr);
@@ -399,11 +1328,17 @@ VALUE Backend_read_loop(VALUE self, VALUE io, VALUE maxlen) {
   io_unset_nonblock(fptr, io);
   rectify_io_file_pos(fptr);
 
+  if (io_uring_backend_buffer_pool_setup(backend))
+    return io_uring_backend_pooled_read_loop(backend, io, fptr, len, OP_READ);
+
+  READ_LOOP_PREPARE_STR();
+
   while (1) {
     VALUE resume_value = Qnil;
     op_context_t *ctx = context_store_acquire(&backend->store, OP_READ);
-    struct io_uring_sqe *sqe = io_uring_get_sqe(&backend->ring);
+    struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
     io_uring_prep_read(sqe, fptr->fd, buf, len, -1);
+    io_uring_backend_fixed_file(backend, io, fptr, sqe);
 
     ssize_t result = io_uring_backend_defer_submit_and_await(backend, sqe, ctx, &resume_value);
     int completed = context_store_release(&backend->store, ctx);
@@ -429,6 +1364,59 @@ VALUE Backend_read_loop(VALUE self, VALUE io, VALUE maxlen) {
   return io;
 }
 
+static VALUE io_uring_backend_gets_loop(VALUE arg) {
+  struct gets_loop_ctx *gctx = (struct gets_loop_ctx *)arg;
+  Backend_t *backend;
+  GetBackend(gctx->backend, backend);
+
+  while (1) {
+    VALUE resume_value = Qnil;
+    long len;
+    char *buf = io_gets_loop_reserve(gctx, &len);
+    op_context_t *ctx = context_store_acquire(&backend->store, OP_READ);
+    struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
+    io_uring_prep_read(sqe, gctx->fptr->fd, buf, len, -1);
+    io_uring_backend_fixed_file(backend, gctx->io, gctx->fptr, sqe);
+
+    ssize_t result = io_uring_backend_defer_submit_and_await(backend, sqe, ctx, &resume_value);
+    int completed = context_store_release(&backend->store, ctx);
+    if (!completed) {
+      context_attach_buffers(ctx, 1, &gctx->buffer);
+      RAISE_IF_EXCEPTION(resume_value);
+      return resume_value;
+    }
+    RB_GC_GUARD(resume_value);
+
+    if (result < 0)
+      rb_syserr_fail(-result, strerror(-result));
+    else if (!result)
+      break; // EOF
+    else
+      io_gets_loop_commit(gctx, result);
+  }
+
+  io_gets_loop_finish(gctx);
+  return gctx->io;
+}
+
+VALUE Backend_gets_loop(VALUE self, VALUE io, VALUE sep, VALUE chomp, VALUE buffer) {
+  struct gets_loop_ctx ctx;
+  rb_io_t *fptr;
+  VALUE underlying_io = rb_ivar_get(io, ID_ivar_io);
+
+  if (underlying_io != Qnil) io = underlying_io;
+  GetOpenFile(io, fptr);
+  rb_io_check_byte_readable(fptr);
+  io_unset_nonblock(fptr, io);
+  rectify_io_file_pos(fptr);
+
+  io_gets_loop_setup(&ctx, self, io, fptr, buffer, sep, chomp);
+  rb_ensure(io_uring_backend_gets_loop, (VALUE)&ctx, io_gets_loop_cleanup, (VALUE)&ctx);
+  RB_GC_GUARD(ctx.buffer);
+  RB_GC_GUARD(ctx.sep);
+  return io;
+}
+
 VALUE Backend_feed_loop(VALUE self, VALUE io, VALUE receiver, VALUE method) {
   Backend_t *backend;
   rb_io_t *fptr;
@@ -439,6 +1427,7 @@ VALUE Backend_feed_loop(VALUE self, VALUE io, VALUE receiver, VALUE method) {
   char *buf;
   VALUE underlying_io = rb_ivar_get(io, ID_ivar_io);
   ID method_id = SYM2ID(method);
+  const polyphony_native_feed_t *native_feed = backend_native_feed(receiver);
 
   READ_LOOP_PREPARE_STR();
 
@@ -452,8 +1441,9 @@ VALUE Backend_feed_loop(VALUE self, VALUE io, VALUE receiver, VALUE method) {
   while (1) {
     VALUE resume_value = Qnil;
     op_context_t *ctx = context_store_acquire(&backend->store, OP_READ);
-    struct io_uring_sqe *sqe = io_uring_get_sqe(&backend->ring);
+    struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
     io_uring_prep_read(sqe, fptr->fd, buf, len, -1);
+    io_uring_backend_fixed_file(backend, io, fptr, sqe);
 
     ssize_t result = io_uring_backend_defer_submit_and_await(backend, sqe, ctx, &resume_value);
     int completed = context_store_release(&backend->store, ctx);
@@ -470,7 +1460,7 @@ VALUE Backend_feed_loop(VALUE self, VALUE io, VALUE receiver, VALUE method) {
       break; // EOF
     else {
       total = result;
-      READ_LOOP_PASS_STR_TO_RECEIVER(receiver, method_id);
+      READ_LOOP_FEED_RECEIVER(native_feed, receiver, method_id);
     }
   }
 
@@ -498,8 +1488,9 @@ VALUE Backend_write(VALUE self, VALUE io, VALUE str) {
   while (left > 0) {
     VALUE resume_value = Qnil;
     op_context_t *ctx = context_store_acquire(&backend->store, OP_WRITE);
-    struct io_uring_sqe *sqe = io_uring_get_sqe(&backend->ring);
+    struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
     io_uring_prep_write(sqe, fptr->fd, buf, left, 0);
+    io_uring_backend_fixed_file(backend, io, fptr, sqe);
 
     int result = io_uring_backend_defer_submit_and_await(backend, sqe, ctx, &resume_value);
     int completed = context_store_release(&backend->store, ctx);
@@ -550,8 +1541,9 @@ VALUE Backend_writev(VALUE self, VALUE io, int argc, VALUE *argv) {
   while (1) {
     VALUE resume_value = Qnil;
     op_context_t *ctx = context_store_acquire(&backend->store, OP_WRITEV);
-    struct io_uring_sqe *sqe = io_uring_get_sqe(&backend->ring);
+    struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
     io_uring_prep_writev(sqe, fptr->fd, iov_ptr, iov_count, -1);
+    io_uring_backend_fixed_file(backend, io, fptr, sqe);
 
     int result = io_uring_backend_defer_submit_and_await(backend, sqe, ctx, &resume_value);
     int completed = context_store_release(&backend->store, ctx);
@@ -590,6 +1582,46 @@ VALUE Backend_writev(VALUE self, VALUE io, int argc, VALUE *argv) {
   return INT2NUM(total_written);
 }
 
+// Reads into the given buffers using a single readv op, returning the total
+// number of bytes read, or nil on EOF.
+VALUE Backend_readv(VALUE self, VALUE io, VALUE buffers) {
+  Backend_t *backend;
+  rb_io_t *fptr;
+  int iov_count;
+  VALUE strs = rb_ary_new();
+  VALUE underlying_io = rb_ivar_get(io, ID_ivar_io);
+
+  GetBackend(self, backend);
+  if (underlying_io != Qnil) io = underlying_io;
+  GetOpenFile(io, fptr);
+  rb_io_check_byte_readable(fptr);
+  io_unset_nonblock(fptr, io);
+  rectify_io_file_pos(fptr);
+
+  struct iovec *iov = io_readv_setup(buffers, strs, &iov_count);
+
+  VALUE resume_value = Qnil;
+  op_context_t *ctx = context_store_acquire(&backend->store, OP_READV);
+  struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
+  io_uring_prep_readv(sqe, fptr->fd, iov, iov_count, -1);
+  io_uring_backend_fixed_file(backend, io, fptr, sqe);
+
+  int result = io_uring_backend_defer_submit_and_await(backend, sqe, ctx, &resume_value);
+  int completed = context_store_release(&backend->store, ctx);
+  if (!completed) {
+    context_attach_buffers(ctx, 1, &strs);
+    RAISE_IF_EXCEPTION(resume_value);
+    return resume_value;
+  }
+  RB_GC_GUARD(resume_value);
+
+  if (result < 0) rb_syserr_fail(-result, strerror(-result));
+
+  io_readv_set_lengths(strs, iov, result, fptr);
+  RB_GC_GUARD(strs);
+  return result ? INT2NUM(result) : Qnil;
+}
+
 VALUE Backend_write_m(int argc, VALUE *argv, VALUE self) {
   if (argc < 2)
     rb_raise(eArgumentError, "(wrong number of arguments (expected 2 or more))");
@@ -626,8 +1658,9 @@ VALUE Backend_recv(VALUE self, VALUE io, VALUE str, VALUE length, VALUE pos) {
   while (1) {
     VALUE resume_value = Qnil;
     op_context_t *ctx = context_store_acquire(&backend->store, OP_RECV);
-    struct io_uring_sqe *sqe = io_uring_get_sqe(&backend->ring);
+    struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
     io_uring_prep_recv(sqe, fptr->fd, buf, len - total, 0);
+    io_uring_backend_fixed_file(backend, io, fptr, sqe);
 
     int result = io_uring_backend_defer_submit_and_await(backend, sqe, ctx, &resume_value);
     int completed = context_store_release(&backend->store, ctx);
@@ -664,8 +1697,6 @@ VALUE Backend_recv_loop(VALUE self, VALUE io, VALUE maxlen) {
   char *buf;
   VALUE underlying_io = rb_ivar_get(io, ID_ivar_io);
 
-  READ_LOOP_PREPARE_STR();
-
   GetBackend(self, backend);
   if (underlying_io != Qnil) io = underlying_io;
   GetOpenFile(io, fptr);
@@ -673,11 +1704,20 @@ VALUE Backend_recv_loop(VALUE self, VALUE io, VALUE maxlen) {
   io_unset_nonblock(fptr, io);
   rectify_io_file_pos(fptr);
 
+  // Multishot recv is not used, as it keeps receiving data into the buffer
+  // pool after the loop is left, which would then be out of reach of any
+  // other reader of the socket (e.g. an SSL socket wrapping it).
+  if (io_uring_backend_buffer_pool_setup(backend))
+    return io_uring_backend_pooled_read_loop(backend, io, fptr, len, OP_RECV);
+
+  READ_LOOP_PREPARE_STR();
+
   while (1) {
     VALUE resume_value = Qnil;
     op_context_t *ctx = context_store_acquire(&backend->store, OP_RECV);
-    struct io_uring_sqe *sqe = io_uring_get_sqe(&backend->ring);
+    struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
     io_uring_prep_recv(sqe, fptr->fd, buf, len, 0);
+    io_uring_backend_fixed_file(backend, io, fptr, sqe);
 
     int result = io_uring_backend_defer_submit_and_await(backend, sqe, ctx, &resume_value);
     int completed = context_store_release(&backend->store, ctx);
@@ -712,6 +1752,7 @@ VALUE Backend_recv_feed_loop(VALUE self, VALUE io, VALUE receiver, VALUE method)
   char *buf;
   VALUE underlying_io = rb_ivar_get(io, ID_ivar_io);
   ID method_id = SYM2ID(method);
+  const polyphony_native_feed_t *native_feed = backend_native_feed(receiver);
 
   READ_LOOP_PREPARE_STR();
 
@@ -725,8 +1766,9 @@ VALUE Backend_recv_feed_loop(VALUE self, VALUE io, VALUE receiver, VALUE method)
   while (1) {
     VALUE resume_value = Qnil;
     op_context_t *ctx = context_store_acquire(&backend->store, OP_RECV);
-    struct io_uring_sqe *sqe = io_uring_get_sqe(&backend->ring);
+    struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
     io_uring_prep_recv(sqe, fptr->fd, buf, len, 0);
+    io_uring_backend_fixed_file(backend, io, fptr, sqe);
 
     int result = io_uring_backend_defer_submit_and_await(backend, sqe, ctx, &resume_value);
     int completed = context_store_release(&backend->store, ctx);
@@ -743,7 +1785,7 @@ VALUE Backend_recv_feed_loop(VALUE self, VALUE io, VALUE receiver, VALUE method)
       break; // EOF
     else {
       total = result;
-      READ_LOOP_PASS_STR_TO_RECEIVER(receiver, method_id);
+      READ_LOOP_FEED_RECEIVER(native_feed, receiver, method_id);
     }
   }
 
@@ -751,6 +1793,185 @@ VALUE Backend_recv_feed_loop(VALUE self, VALUE io, VALUE receiver, VALUE method)
   return io;
 }
 
+// Submits a RECVMSG or SENDMSG op for the message at the given index of the
+// given batch, and waits for it to complete. If the op was not completed (the
+// fiber was resumed with an exception or some other value), the batch's memory
+// is kept alive by attaching it to the op context, and the resume value is
+// returned in resume_value.
+static int io_uring_backend_udp_msg_op(Backend_t *backend, VALUE io, rb_io_t *fptr,
+  udp_batch_t *batch, unsigned int idx, enum op_type type, int *completed, VALUE *resume_value) {
+  op_context_t *ctx = context_store_acquire(&backend->store, type);
+  struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
+  if (type == OP_RECVMSG)
+    io_uring_prep_recvmsg(sqe, fptr->fd, udp_batch_msghdr(batch, idx), batch->flags);
+  else
+    io_uring_prep_sendmsg(sqe, fptr->fd, udp_batch_msghdr(batch, idx), batch->flags);
+  io_uring_backend_fixed_file(backend, io, fptr, sqe);
+
+  int result = io_uring_backend_defer_submit_and_await(backend, sqe, ctx, resume_value);
+  *completed = context_store_release(&backend->store, ctx);
+  if (!*completed) context_attach_buffers_v(ctx, 2, batch->scratch, batch->msgs);
+  return result;
+}
+
+// Receives datagrams into the given batch. The first datagram is received with
+// a RECVMSG op, and any further datagrams already queued on the socket are
+// then drained with a single non-blocking recvmmsg call. Returns the number of
+// datagrams received, or -1 if the op was interrupted with a non-exception
+// resume value.
+static int io_uring_backend_udp_batch_recv(Backend_t *backend, VALUE io, udp_batch_t *batch, VALUE *resume_value) {
+  rb_io_t *fptr;
+  int completed;
+  VALUE underlying_io = rb_ivar_get(io, ID_ivar_io);
+
+  if (underlying_io != Qnil) io = underlying_io;
+  GetOpenFile(io, fptr);
+  rb_io_check_byte_readable(fptr);
+  io_unset_nonblock(fptr, io);
+
+  int result = io_uring_backend_udp_msg_op(backend, io, fptr, batch, 0, OP_RECVMSG, &completed, resume_value);
+  if (!completed) {
+    RAISE_IF_EXCEPTION(*resume_value);
+    return -1;
+  }
+  if (result < 0) rb_syserr_fail(-result, strerror(-result));
+  udp_batch_set_len(batch, 0, result);
+  if (batch->count == 1) return 1;
+
+  uint64_t op_start = BACKEND_STATS_OP_START(&backend->base);
+  backend->base.op_count++;
+  int n = udp_batch_recv_nonblock(fptr->fd, batch, 1);
+  // errors other than EAGAIN will be reported on the next receive
+  if (n <= 0) return 1;
+
+  BACKEND_RECORD_OP(&backend->base, OP_RECVMSG, op_start, fptr->fd, udp_batch_total_len(batch, 1, n));
+  return n + 1;
+}
+
+// Sends all datagrams in the given batch. Each datagram that cannot be sent
+// without blocking is sent with a SENDMSG op, and the following datagrams are
+// then sent with a single non-blocking sendmmsg call. Returns 0, or -1 if an
+// op was interrupted with a non-exception resume value.
+static int io_uring_backend_udp_batch_send(Backend_t *backend, VALUE io, udp_batch_t *batch, VALUE *resume_value) {
+  rb_io_t *fptr;
+  int completed;
+  unsigned int sent = 0;
+  VALUE underlying_io = rb_ivar_get(io, ID_ivar_io);
+
+  if (underlying_io != Qnil) io = underlying_io;
+  io = rb_io_get_write_io(io);
+  GetOpenFile(io, fptr);
+  io_unset_nonblock(fptr, io);
+
+  while (sent < batch->count) {
+    int result = io_uring_backend_udp_msg_op(backend, io, fptr, batch, sent, OP_SENDMSG, &completed, resume_value);
+    if (!completed) {
+      RAISE_IF_EXCEPTION(*resume_value);
+      return -1;
+    }
+    if (result < 0) rb_syserr_fail(-result, strerror(-result));
+    udp_batch_set_len(batch, sent, result);
+    sent++;
+    if (sent == batch->count) break;
+
+    uint64_t op_start = BACKEND_STATS_OP_START(&backend->base);
+    backend->base.op_count++;
+    int n = udp_batch_send_nonblock(fptr->fd, batch, sent);
+    if (n < 0) {
+      int e = errno;
+      if (e != EWOULDBLOCK && e != EAGAIN) rb_syserr_fail(e, strerror(e));
+      continue;
+    }
+    BACKEND_RECORD_OP(&backend->base, OP_SENDMSG, op_start, fptr->fd, udp_batch_total_len(batch, sent, n));
+    sent += n;
+  }
+  return 0;
+}
+
+VALUE Backend_recvfrom(VALUE self, VALUE io, VALUE maxlen, VALUE flags) {
+  Backend_t *backend;
+  udp_batch_t batch;
+  VALUE resume_value = Qnil;
+
+  GetBackend(self, backend);
+  udp_batch_init_recv(&batch, INT2FIX(1), maxlen, NUM2INT(flags));
+  if (io_uring_backend_udp_batch_recv(backend, io, &batch, &resume_value) < 0) return resume_value;
+  RB_GC_GUARD(resume_value);
+  return RARRAY_AREF(udp_batch_recv_result(&batch, 1), 0);
+}
+
+VALUE Backend_sendto(VALUE self, VALUE io, VALUE msg, VALUE flags, VALUE addr) {
+  Backend_t *backend;
+  udp_batch_t batch;
+  VALUE resume_value = Qnil;
+  VALUE msgs = rb_ary_new_from_args(1, msg);
+
+  GetBackend(self, backend);
+  udp_batch_init_send(&batch, msgs, addr, NUM2INT(flags));
+  if (io_uring_backend_udp_batch_send(backend, io, &batch, &resume_value) < 0) return resume_value;
+  RB_GC_GUARD(batch.scratch);
+  RB_GC_GUARD(batch.msgs);
+  RB_GC_GUARD(resume_value);
+  return LONG2NUM(udp_batch_total_len(&batch, 0, 1));
+}
+
+VALUE Backend_recvmmsg(VALUE self, VALUE io, VALUE count, VALUE maxlen) {
+  Backend_t *backend;
+  udp_batch_t batch;
+  VALUE resume_value = Qnil;
+
+  GetBackend(self, backend);
+  udp_batch_init_recv(&batch, count, maxlen, 0);
+  int received = io_uring_backend_udp_batch_recv(backend, io, &batch, &resume_value);
+  if (received < 0) return resume_value;
+  RB_GC_GUARD(resume_value);
+  return udp_batch_recv_result(&batch, received);
+}
+
+VALUE Backend_sendmmsg(VALUE self, VALUE io, VALUE msgs, VALUE addr) {
+  Backend_t *backend;
+  udp_batch_t batch;
+  VALUE resume_value = Qnil;
+
+  GetBackend(self, backend);
+  udp_batch_init_send(&batch, msgs, addr, 0);
+  if (io_uring_backend_udp_batch_send(backend, io, &batch, &resume_value) < 0) return resume_value;
+  RB_GC_GUARD(batch.scratch);
+  RB_GC_GUARD(batch.msgs);
+  RB_GC_GUARD(resume_value);
+  return UINT2NUM(batch.count);
+}
+
+// Sends the given buffer using IORING_OP_SEND_ZC, returning the send result.
+static int io_uring_backend_send_zc(Backend_t *backend, VALUE io, rb_io_t *fptr, VALUE str,
+  char *buf, long len, int flags, VALUE *resume_value) {
+  op_context_t *ctx = context_store_acquire(&backend->store, OP_SEND_ZC);
+  ctx->ref_count++;
+  context_attach_buffers(ctx, 1, &str);
+
+  struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
+  io_uring_prep_send(sqe, fptr->fd, buf, len, flags);
+  sqe->opcode = POLYPHONY_IORING_OP_SEND_ZC;
+  io_uring_backend_fixed_file(backend, io, fptr, sqe);
+  io_uring_backend_sqe_set_data(backend, sqe, ctx);
+  backend->base.op_count++;
+  io_uring_backend_defer_submit(backend);
+
+  *resume_value = backend_await((struct Backend_base *)backend);
+  if (ctx->ref_count == 3) {
+    // op was not completed (an exception was raised), so we need to cancel it
+    ctx->result = -ECANCELED;
+    sqe = io_uring_backend_get_sqe(backend);
+    io_uring_prep_cancel(sqe, ctx, 0);
+    backend->pending_sqes = 0;
+    io_uring_submit(&backend->ring);
+  }
+
+  int result = ctx->result;
+  context_store_release(&backend->store, ctx);
+  return result;
+}
+
 VALUE Backend_send(VALUE self, VALUE io, VALUE str, VALUE flags) {
   Backend_t *backend;
   rb_io_t *fptr;
@@ -763,16 +1984,40 @@ VALUE Backend_send(VALUE self, VALUE io, VALUE str, VALUE flags) {
   GetOpenFile(io, fptr);
   io_unset_nonblock(fptr, io);
 
-  char *buf = StringValuePtr(str);
+  StringValue(str);
   long len = RSTRING_LEN(str);
   long left = len;
   int flags_int = NUM2INT(flags);
+  int zero_copy = backend->send_zc_threshold && len >= backend->send_zc_threshold &&
+    !backend->send_zc_unsupported;
+  // The kernel reads the buffer of a zero-copy send until the notification
+  // CQE is posted, after the send has returned, so the data is sent from a
+  // frozen copy sharing the string's contents, which is attached to the op. Any
+  // later change to the string is then made on a new buffer.
+  if (zero_copy) str = rb_str_new_frozen(str);
+  char *buf = RSTRING_PTR(str);
 
   while (left > 0) {
     VALUE resume_value = Qnil;
+    if (zero_copy) {
+      int result = io_uring_backend_send_zc(backend, io, fptr, str, buf, left, flags_int, &resume_value);
+      RAISE_IF_EXCEPTION(resume_value);
+      if (left == len && (result == -EINVAL || result == -EOPNOTSUPP)) {
+        // zero-copy sends are not supported by the kernel, or by the socket
+        if (result == -EINVAL) backend->send_zc_unsupported = 1;
+        zero_copy = 0;
+        continue;
+      }
+      if (result < 0) rb_syserr_fail(-result, strerror(-result));
+      buf += result;
+      left -= result;
+      continue;
+    }
+
     op_context_t *ctx = context_store_acquire(&backend->store, OP_SEND);
-    struct io_uring_sqe *sqe = io_uring_get_sqe(&backend->ring);
+    struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
     io_uring_prep_send(sqe, fptr->fd, buf, left, flags_int);
+    io_uring_backend_fixed_file(backend, io, fptr, sqe);
 
     int result = io_uring_backend_defer_submit_and_await(backend, sqe, ctx, &resume_value);
     int completed = context_store_release(&backend->store, ctx);
@@ -805,40 +2050,45 @@ VALUE io_uring_backend_accept(Backend_t *backend, VALUE server_socket, VALUE soc
   GetOpenFile(server_socket, fptr);
   io_unset_nonblock(fptr, server_socket);
 
+  while ((socket = io_uring_backend_shift_pending_socket(server_socket)) != Qnil) {
+    if (!loop) return socket;
+    rb_yield(socket);
+  }
+
   while (1) {
     VALUE resume_value = Qnil;
     op_context_t *ctx = context_store_acquire(&backend->store, OP_ACCEPT);
-    struct io_uring_sqe *sqe = io_uring_get_sqe(&backend->ring);
+    struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
     io_uring_prep_accept(sqe, fptr->fd, &addr, &len, 0);
 
     int fd = io_uring_backend_defer_submit_and_await(backend, sqe, ctx, &resume_value);
-    int completed = context_store_release(&backend->store, ctx);
-    RAISE_IF_EXCEPTION(resume_value);
-    if (!completed) return resume_value;
+    // An interrupted accept might still complete before being cancelled. An
+    // accepted connection is never dropped: it is handed over before the
+    // interrupt takes effect.
+    int interrupted = ctx->ref_count > 1;
+    if (interrupted) fd = io_uring_backend_await_cancellation(backend, ctx);
+    context_store_release(&backend->store, ctx);
     RB_GC_GUARD(resume_value);
 
-    if (fd < 0)
+    if (fd < 0) {
+      RAISE_IF_EXCEPTION(resume_value);
+      if (interrupted) return resume_value;
       rb_syserr_fail(-fd, strerror(-fd));
-    else {
-      rb_io_t *fp;
-
-      socket = rb_obj_alloc(socket_class);
-      MakeOpenFile(socket, fp);
-      rb_update_max_fd(fd);
-      fp->fd = fd;
-      fp->mode = FMODE_READWRITE | FMODE_DUPLEX;
-      rb_io_ascii8bit_binmode(socket);
-      rb_io_synchronized(fp);
-
-      // if (rsock_do_not_reverse_lookup) {
-	    //   fp->mode |= FMODE_NOREVLOOKUP;
-      // }
-      if (loop) {
-        rb_yield(socket);
-        socket = Qnil;
-      }
-      else
-        return socket;
+    }
+
+    socket = io_uring_backend_make_socket(fd, socket_class);
+    interrupted = interrupted || TEST_EXCEPTION(resume_value);
+    if (!loop) {
+      // the interrupt is delivered at the next switchpoint
+      if (interrupted) Fiber_make_runnable(rb_fiber_current(), resume_value);
+      return socket;
+    }
+
+    rb_yield(socket);
+    socket = Qnil;
+    if (interrupted) {
+      RAISE_IF_EXCEPTION(resume_value);
+      return resume_value;
     }
   }
   RB_GC_GUARD(socket);
@@ -853,7 +2103,25 @@ VALUE Backend_accept(VALUE self, VALUE server_socket, VALUE socket_class) {
 
 VALUE Backend_accept_loop(VALUE self, VALUE server_socket, VALUE socket_class) {
   Backend_t *backend;
+  VALUE underlying_sock = rb_ivar_get(server_socket, ID_ivar_io);
   GetBackend(self, backend);
+  if (underlying_sock != Qnil) server_socket = underlying_sock;
+
+  if (!backend->multishot_accept_unsupported && !OBJ_FROZEN(server_socket)) {
+    rb_io_t *fptr;
+    int unsupported;
+    VALUE socket;
+    GetOpenFile(server_socket, fptr);
+    io_unset_nonblock(fptr, server_socket);
+
+    while ((socket = io_uring_backend_shift_pending_socket(server_socket)) != Qnil)
+      rb_yield(socket);
+
+    io_uring_backend_multishot_accept_loop(backend, server_socket, fptr, socket_class, &unsupported);
+    if (!unsupported) return self;
+    backend->multishot_accept_unsupported = 1;
+  }
+
   io_uring_backend_accept(backend, server_socket, socket_class, 1);
   return self;
 }
@@ -879,8 +2147,10 @@ VALUE io_uring_backend_splice(Backend_t *backend, VALUE src, VALUE dest, VALUE m
 
   while (1) {
     op_context_t *ctx = context_store_acquire(&backend->store, OP_SPLICE);
-    struct io_uring_sqe *sqe = io_uring_get_sqe(&backend->ring);
+    struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
     io_uring_prep_splice(sqe, src_fptr->fd, -1, dest_fptr->fd, -1, NUM2INT(maxlen), 0);
+    io_uring_backend_fixed_splice_src(backend, src, src_fptr, sqe);
+    io_uring_backend_fixed_file(backend, dest, dest_fptr, sqe);
 
     int result = io_uring_backend_defer_submit_and_await(backend, sqe, ctx, &resume_value);
     int completed = context_store_release(&backend->store, ctx);
@@ -915,8 +2185,8 @@ VALUE Backend_splice_to_eof(VALUE self, VALUE src, VALUE dest, VALUE chunksize)
 VALUE Backend_connect(VALUE self, VALUE sock, VALUE host, VALUE port) {
   Backend_t *backend;
   rb_io_t *fptr;
-  struct sockaddr_in addr;
-  char *host_buf = StringValueCStr(host);
+  struct sockaddr_storage addr;
+  socklen_t addrlen = backend_sockaddr(host, port, &addr);
   VALUE underlying_sock = rb_ivar_get(sock, ID_ivar_io);
   if (underlying_sock != Qnil) sock = underlying_sock;
 
@@ -924,14 +2194,10 @@ VALUE Backend_connect(VALUE self, VALUE sock, VALUE host, VALUE port) {
   GetOpenFile(sock, fptr);
   io_unset_nonblock(fptr, sock);
 
-  addr.sin_family = AF_INET;
-  addr.sin_addr.s_addr = inet_addr(host_buf);
-  addr.sin_port = htons(NUM2INT(port));
-
   VALUE resume_value = Qnil;
   op_context_t *ctx = context_store_acquire(&backend->store, OP_CONNECT);
-  struct io_uring_sqe *sqe = io_uring_get_sqe(&backend->ring);
-  io_uring_prep_connect(sqe, fptr->fd, (struct sockaddr *)&addr, sizeof(addr));
+  struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
+  io_uring_prep_connect(sqe, fptr->fd, (struct sockaddr *)&addr, addrlen);
   int result = io_uring_backend_defer_submit_and_await(backend, sqe, ctx, &resume_value);
   int completed = context_store_release(&backend->store, ctx);
   RAISE_IF_EXCEPTION(resume_value);
@@ -942,6 +2208,94 @@ VALUE Backend_connect(VALUE self, VALUE sock, VALUE host, VALUE port) {
   return sock;
 }
 
+static inline void io_uring_backend_connect_race_start(Backend_t *backend, connect_race_t *race) {
+  connect_attempt_t *attempt = connect_race_next_attempt(race, 0);
+  if (!attempt) return;
+
+  op_context_t *ctx = context_store_acquire(&backend->store, OP_CONNECT);
+  struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
+  io_uring_prep_connect(sqe, attempt->fd, (struct sockaddr *)&attempt->addr, attempt->addrlen);
+  io_uring_backend_sqe_set_data(backend, sqe, ctx);
+  attempt->op = ctx;
+  backend->base.op_count++;
+  io_uring_backend_defer_submit(backend);
+}
+
+// Cancels the connect ops of all pending attempts other than the winner. The
+// scratch string holding the attempts (and their addresses) is attached to the
+// cancelled ops.
+static inline void io_uring_backend_connect_race_cancel(Backend_t *backend, connect_race_t *race, connect_attempt_t *winner) {
+  for (unsigned int i = 0; i < race->started; i++) {
+    connect_attempt_t *attempt = race->attempts + i;
+    if (attempt == winner || attempt->done) continue;
+
+    op_context_t *ctx = attempt->op;
+    ctx->result = -ECANCELED;
+    context_attach_buffers(ctx, 1, &race->scratch);
+    struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
+    io_uring_prep_cancel(sqe, ctx, 0);
+    context_store_release(&backend->store, ctx);
+    attempt->done = 1;
+  }
+  backend->pending_sqes = 0;
+  io_uring_submit(&backend->ring);
+}
+
+// Connects to the first of the given addrinfos to accept the connection, and
+// returns the connected socket. Attempts are started in order, each one after
+// the given delay or as soon as all previous attempts have failed, and are
+// left to race each other (as in Happy Eyeballs, RFC 8305). Once an attempt
+// succeeds, the connect ops of the losers are cancelled.
+VALUE Backend_connect_racing(VALUE self, VALUE addrinfos, VALUE stagger_delay) {
+  Backend_t *backend;
+  connect_race_t race;
+  connect_attempt_t *winner = NULL;
+  VALUE resume_value = Qnil;
+
+  GetBackend(self, backend);
+  connect_race_init(&race, addrinfos, stagger_delay);
+
+  while (1) {
+    while (!race.pending && race.started < race.count)
+      io_uring_backend_connect_race_start(backend, &race);
+    if (!race.pending) break;
+
+    int staggered = race.started < race.count;
+    deadline_entry entry = {current_time() + race.stagger_delay, rb_fiber_current(), Qnil, -1};
+    if (staggered) io_uring_backend_add_deadline(backend, &entry);
+    resume_value = backend_await((struct Backend_base *)backend);
+    int expired = staggered && !deadline_entry_pending_p(&entry);
+    if (staggered && !expired) deadline_heap_remove(&backend->deadlines, &entry);
+
+    if (TEST_EXCEPTION(resume_value)) {
+      io_uring_backend_connect_race_cancel(backend, &race, NULL);
+      connect_race_close_losers(&race, NULL);
+      RAISE_EXCEPTION(resume_value);
+    }
+
+    for (unsigned int i = 0; i < race.started && !winner; i++) {
+      connect_attempt_t *attempt = race.attempts + i;
+      op_context_t *ctx = attempt->op;
+      // the op is completed once its CQE has been handled
+      if (attempt->done || ctx->ref_count > 1) continue;
+
+      int result = ctx->result;
+      context_store_release(&backend->store, ctx);
+      connect_race_attempt_done(&race, attempt, result < 0 ? -result : 0);
+      if (!result) winner = attempt;
+    }
+    if (winner) break;
+    if (expired) io_uring_backend_connect_race_start(backend, &race);
+  }
+  RB_GC_GUARD(resume_value);
+
+  if (!winner) connect_race_fail(&race);
+  io_uring_backend_connect_race_cancel(backend, &race, winner);
+  VALUE sock = connect_race_winner_socket(&race, winner);
+  RB_GC_GUARD(race.scratch);
+  return sock;
+}
+
 VALUE Backend_wait_io(VALUE self, VALUE io, VALUE write) {
   Backend_t *backend;
   rb_io_t *fptr;
@@ -949,7 +2303,8 @@ VALUE Backend_wait_io(VALUE self, VALUE io, VALUE write) {
   if (underlying_io != Qnil) io = underlying_io;
   GetBackend(self, backend);
   GetOpenFile(io, fptr);
-  io_unset_nonblock(fptr, io);
+  // The blocking mode is left as is, since wait_io is used mostly along with
+  // non-blocking I/O (e.g. OpenSSL's *_nonblock methods).
 
   VALUE resume_value = io_uring_backend_wait_fd(backend, fptr->fd, RTEST(write));
   RAISE_IF_EXCEPTION(resume_value);
@@ -966,19 +2321,17 @@ inline struct __kernel_timespec double_to_timespec(double duration) {
   return ts;
 }
 
-inline struct __kernel_timespec duration_to_timespec(VALUE duration) {
-  return double_to_timespec(NUM2DBL(duration));
-}
-
 // returns true if completed, 0 otherwise
-int io_uring_backend_submit_timeout_and_await(Backend_t *backend, double duration, VALUE *resume_value) {
-  struct __kernel_timespec ts = double_to_timespec(duration);
-  struct io_uring_sqe *sqe = io_uring_get_sqe(&backend->ring);
+int io_uring_backend_deadline_await(Backend_t *backend, double duration, VALUE *resume_value) {
+  deadline_entry entry = {current_time() + duration, rb_fiber_current(), Qnil, -1};
+
+  backend->base.op_count++;
+  io_uring_backend_add_deadline(backend, &entry);
+  *resume_value = backend_await((struct Backend_base *)backend);
+  if (!deadline_entry_pending_p(&entry)) return 1;
 
-  op_context_t *ctx = context_store_acquire(&backend->store, OP_TIMEOUT);
-  io_uring_prep_timeout(sqe, &ts, 0, 0);
-  io_uring_backend_defer_submit_and_await(backend, sqe, ctx, resume_value);
-  return context_store_release(&backend->store, ctx);
+  deadline_heap_remove(&backend->deadlines, &entry);
+  return 0;
 }
 
 VALUE Backend_sleep(VALUE self, VALUE duration) {
@@ -986,7 +2339,7 @@ VALUE Backend_sleep(VALUE self, VALUE duration) {
   GetBackend(self, backend);
 
   VALUE resume_value = Qnil;
-  io_uring_backend_submit_timeout_and_await(backend, NUM2DBL(duration), &resume_value);
+  io_uring_backend_deadline_await(backend, NUM2DBL(duration), &resume_value);
   RAISE_IF_EXCEPTION(resume_value);
   RB_GC_GUARD(resume_value);
   return resume_value;
@@ -1005,7 +2358,7 @@ VALUE Backend_timer_loop(VALUE self, VALUE interval) {
     if (sleep_duration < 0) sleep_duration = 0;
 
     VALUE resume_value = Qnil;
-    int completed = io_uring_backend_submit_timeout_and_await(backend, sleep_duration, &resume_value);
+    int completed = io_uring_backend_deadline_await(backend, sleep_duration, &resume_value);
     RAISE_IF_EXCEPTION(resume_value);
     if (!completed) return resume_value;
     RB_GC_GUARD(resume_value);
@@ -1021,21 +2374,13 @@ VALUE Backend_timer_loop(VALUE self, VALUE interval) {
 
 struct Backend_timeout_ctx {
   Backend_t *backend;
-  op_context_t *ctx;
+  deadline_entry *entry;
 };
 
 VALUE Backend_timeout_ensure(VALUE arg) {
-    struct Backend_timeout_ctx *timeout_ctx = (struct Backend_timeout_ctx *)arg;
-    if (timeout_ctx->ctx->ref_count) {
-    timeout_ctx->ctx->result = -ECANCELED;
-
-    // op was not completed, so we need to cancel it
-    struct io_uring_sqe *sqe = io_uring_get_sqe(&timeout_ctx->backend->ring);
-    io_uring_prep_cancel(sqe, timeout_ctx->ctx, 0);
-    timeout_ctx->backend->pending_sqes = 0;
-    io_uring_submit(&timeout_ctx->backend->ring);
-  }
-  context_store_release(&timeout_ctx->backend->store, timeout_ctx->ctx);
+  struct Backend_timeout_ctx *timeout_ctx = (struct Backend_timeout_ctx *)arg;
+  // the armed kernel timeout, if any, is left to fire
+  deadline_heap_remove(&timeout_ctx->backend->deadlines, timeout_ctx->entry);
   return Qnil;
 }
 
@@ -1045,22 +2390,16 @@ VALUE Backend_timeout(int argc, VALUE *argv, VALUE self) {
   VALUE move_on_value = Qnil;
   rb_scan_args(argc, argv, "21", &duration, &exception, &move_on_value);
 
-  struct __kernel_timespec ts = duration_to_timespec(duration);
   Backend_t *backend;
   GetBackend(self, backend);
   VALUE result = Qnil;
   VALUE timeout = rb_funcall(cTimeoutException, ID_new, 0);
 
-  struct io_uring_sqe *sqe = io_uring_get_sqe(&backend->ring);
-
-  op_context_t *ctx = context_store_acquire(&backend->store, OP_TIMEOUT);
-  ctx->resume_value = timeout;
-  io_uring_prep_timeout(sqe, &ts, 0, 0);
-  io_uring_sqe_set_data(sqe, ctx);
-  io_uring_backend_defer_submit(backend);
+  deadline_entry entry = {current_time() + NUM2DBL(duration), rb_fiber_current(), timeout, -1};
+  io_uring_backend_add_deadline(backend, &entry);
   backend->base.op_count++;
 
-  struct Backend_timeout_ctx timeout_ctx = {backend, ctx};
+  struct Backend_timeout_ctx timeout_ctx = {backend, &entry};
   result = rb_ensure(Backend_timeout_ensure_safe, Qnil, Backend_timeout_ensure, (VALUE)&timeout_ctx);
 
   if (result == timeout) {
@@ -1118,153 +2457,450 @@ VALUE Backend_wait_event(VALUE self, VALUE raise) {
   return resume_value;
 }
 
-VALUE Backend_kind(VALUE self) {
-  return SYM_io_uring;
+static inline VALUE io_uring_backend_registered_io(VALUE io, rb_io_t **fptr) {
+  VALUE underlying_io = rb_ivar_get(io, ID_ivar_io);
+  if (underlying_io != Qnil) io = underlying_io;
+  GetOpenFile(io, *fptr);
+  return io;
+}
+
+static void io_uring_backend_registered_files_setup(Backend_t *backend) {
+  struct rlimit rlim;
+  unsigned int size = REGISTERED_FILES_MAX;
+  if (!getrlimit(RLIMIT_NOFILE, &rlim) && rlim.rlim_cur < size) size = rlim.rlim_cur;
+
+  int *fds = malloc(sizeof(int) * size);
+  if (!fds) rb_memerror();
+  for (unsigned int i = 0; i < size; i++) fds[i] = -1;
+  int ret;
+  while ((ret = io_uring_register_files(&backend->ring, fds, size)) < 0 && size > REGISTERED_FILES_MIN &&
+         (ret == -EINVAL || ret == -EMFILE || ret == -ENOMEM))
+    size /= 2;
+  free(fds);
+  if (ret < 0) rb_syserr_fail(-ret, strerror(-ret));
+
+  backend->registered_ios = malloc(sizeof(VALUE) * size);
+  if (!backend->registered_ios) {
+    io_uring_unregister_files(&backend->ring);
+    rb_memerror();
+  }
+  for (unsigned int i = 0; i < size; i++) backend->registered_ios[i] = Qnil;
+  backend->registered_ios_size = size;
 }
 
-struct io_uring_sqe *Backend_chain_prepare_write(Backend_t *backend, VALUE io, VALUE str) {
+// Registers the given io with the ring, so I/O ops on the io use a registered
+// file instead of having the kernel look up the fd for each op. The kernel
+// keeps a reference to the file, so the io is unregistered when closed (see
+// backend_unregister_closing_io), which is why the registering backend is kept
+// on the io. An io registered with another backend is first unregistered from
+// it. Frozen ios are not registered. Returns true if the io was registered.
+VALUE Backend_register_io(VALUE self, VALUE io) {
+  Backend_t *backend;
   rb_io_t *fptr;
-  VALUE underlying_io;
+  GetBackend(self, backend);
+  io = io_uring_backend_registered_io(io, &fptr);
 
-  underlying_io = rb_ivar_get(io, ID_ivar_io);
-  if (underlying_io != Qnil) io = underlying_io;
-  io = rb_io_get_write_io(io);
-  GetOpenFile(io, fptr);
-  io_unset_nonblock(fptr, io);
+  if (OBJ_FROZEN(io)) return Qfalse;
+  VALUE owner = rb_ivar_get(io, ID_registered_backend);
+  if (owner != Qnil && owner != self) rb_funcall(owner, ID_unregister_io, 1, io);
 
-  char *buf = StringValuePtr(str);
-  long len = RSTRING_LEN(str);
+  if (!backend->registered_ios) io_uring_backend_registered_files_setup(backend);
+  if ((unsigned int)fptr->fd >= backend->registered_ios_size) return Qfalse;
 
-  struct io_uring_sqe *sqe = io_uring_get_sqe(&backend->ring);
-  io_uring_prep_write(sqe, fptr->fd, buf, len, 0);
-  return sqe;
+  int ret = io_uring_register_files_update(&backend->ring, fptr->fd, &fptr->fd, 1);
+  if (ret < 0) rb_syserr_fail(-ret, strerror(-ret));
+  backend->registered_ios[fptr->fd] = io;
+  if ((unsigned int)fptr->fd >= backend->registered_ios_limit) backend->registered_ios_limit = fptr->fd + 1;
+  rb_ivar_set(io, ID_registered_backend, self);
+  return Qtrue;
 }
 
-struct io_uring_sqe *Backend_chain_prepare_send(Backend_t *backend, VALUE io, VALUE str, VALUE flags) {
+VALUE Backend_unregister_io(VALUE self, VALUE io) {
+  Backend_t *backend;
   rb_io_t *fptr;
-  VALUE underlying_io;
+  GetBackend(self, backend);
+  io = io_uring_backend_registered_io(io, &fptr);
+
+  if (!backend->registered_ios || (unsigned int)fptr->fd >= backend->registered_ios_size ||
+      backend->registered_ios[fptr->fd] != io)
+    return Qfalse;
+
+  int fd = -1;
+  int ret = io_uring_register_files_update(&backend->ring, fptr->fd, &fd, 1);
+  if (ret < 0) rb_syserr_fail(-ret, strerror(-ret));
+  backend->registered_ios[fptr->fd] = Qnil;
+  rb_ivar_set(io, ID_registered_backend, Qnil);
+  return Qtrue;
+}
+
+// Submits the given op and waits for it to complete. Unlike
+// io_uring_backend_defer_submit_and_await, the op is not forced to run
+// asynchronously, and is not cancelled if the fiber is interrupted, so it is
+// run to completion once submitted.
+static inline int io_uring_backend_submit_uncancellable_and_await(
+  Backend_t *backend, struct io_uring_sqe *sqe, op_context_t *ctx, int async, VALUE *value_ptr
+) {
+  io_uring_backend_sqe_set_data(backend, sqe, ctx);
+  if (async) io_uring_sqe_set_flags(sqe, IOSQE_ASYNC);
+  backend->base.op_count++;
+  io_uring_backend_defer_submit(backend);
 
-  underlying_io = rb_ivar_get(io, ID_ivar_io);
+  *value_ptr = backend_await((struct Backend_base *)backend);
+  RB_GC_GUARD(ctx->fiber);
+  return ctx->result;
+}
+
+// Closes the given io using IORING_OP_CLOSE. The descriptor is first detached
+// from the io (see backend_io_detach_fd), so the close is performed by the
+// kernel. Closing a socket that has SO_LINGER set might block until unsent data
+// is transmitted, so in that case the op is run asynchronously. The op is not
+// cancelled if the fiber is interrupted, so the descriptor is always closed.
+VALUE Backend_close(VALUE self, VALUE io) {
+  Backend_t *backend;
+  int may_block = 0;
+  VALUE underlying_io = rb_ivar_get(io, ID_ivar_io);
   if (underlying_io != Qnil) io = underlying_io;
-  io = rb_io_get_write_io(io);
+  io = rb_io_get_io(io);
+
+  GetBackend(self, backend);
+  int fd = backend_io_detach_fd(io, &may_block);
+  if (fd < 0) return Qnil;
+
+  VALUE resume_value = Qnil;
+  op_context_t *ctx = context_store_acquire(&backend->store, OP_CLOSE);
+  struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
+  io_uring_prep_close(sqe, fd);
+  int result = io_uring_backend_submit_uncancellable_and_await(backend, sqe, ctx, may_block, &resume_value);
+  int completed = context_store_release(&backend->store, ctx);
+  RAISE_IF_EXCEPTION(resume_value);
+  if (!completed) return resume_value;
+  RB_GC_GUARD(resume_value);
+
+  if (result < 0) rb_syserr_fail(-result, strerror(-result));
+  return Qnil;
+}
+
+// Shuts down the given socket (see BasicSocket#shutdown) using
+// IORING_OP_SHUTDOWN, falling back to a shutdown syscall if the op is not
+// supported by the kernel.
+VALUE Backend_shutdown(VALUE self, VALUE io, VALUE how) {
+  Backend_t *backend;
+  rb_io_t *fptr;
+  int mode = backend_shutdown_how(how);
+  VALUE underlying_io = rb_ivar_get(io, ID_ivar_io);
+  if (underlying_io != Qnil) io = underlying_io;
+
+  GetBackend(self, backend);
   GetOpenFile(io, fptr);
-  io_unset_nonblock(fptr, io);
 
-  char *buf = StringValuePtr(str);
-  long len = RSTRING_LEN(str);
-  int flags_int = NUM2INT(flags);
+  if (!backend->shutdown_unsupported) {
+    VALUE resume_value = Qnil;
+    op_context_t *ctx = context_store_acquire(&backend->store, OP_SHUTDOWN);
+    struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
+    io_uring_prep_shutdown(sqe, fptr->fd, mode);
+    int result = io_uring_backend_submit_uncancellable_and_await(backend, sqe, ctx, 0, &resume_value);
+    int completed = context_store_release(&backend->store, ctx);
+    RAISE_IF_EXCEPTION(resume_value);
+    if (!completed) return resume_value;
+    RB_GC_GUARD(resume_value);
 
-  struct io_uring_sqe *sqe = io_uring_get_sqe(&backend->ring);
-  io_uring_prep_send(sqe, fptr->fd, buf, len, flags_int);
-  return sqe;
+    // the mode is already validated, so EINVAL means the op is not supported
+    if (result != -EINVAL) {
+      if (result < 0) rb_syserr_fail(-result, strerror(-result));
+      return INT2FIX(0);
+    }
+    backend->shutdown_unsupported = 1;
+  }
+
+  if (shutdown(fptr->fd, mode) < 0) rb_syserr_fail(errno, strerror(errno));
+  return INT2FIX(0);
 }
 
-struct io_uring_sqe *Backend_chain_prepare_splice(Backend_t *backend, VALUE src, VALUE dest, VALUE maxlen) {
-  rb_io_t *src_fptr;
-  rb_io_t *dest_fptr;
-  VALUE underlying_io;
+VALUE Backend_kind(VALUE self) {
+  return SYM_io_uring;
+}
 
-  underlying_io = rb_ivar_get(src, ID_ivar_io);
-  if (underlying_io != Qnil) src = underlying_io;
-  GetOpenFile(src, src_fptr);
-  io_unset_nonblock(src_fptr, src);
+enum chain_op_type {
+  CHAIN_OP_WRITE,
+  CHAIN_OP_SEND,
+  CHAIN_OP_SPLICE,
+  CHAIN_OP_READ,
+  CHAIN_OP_RECV,
+  CHAIN_OP_POLL,
+  CHAIN_OP_CLOSE,
+  CHAIN_OP_SHUTDOWN,
+  CHAIN_OP_TIMEOUT
+};
 
-  underlying_io = rb_ivar_get(dest, ID_ivar_io);
-  if (underlying_io != Qnil) dest = underlying_io;
-  dest = rb_io_get_write_io(dest);
-  GetOpenFile(dest, dest_fptr);
-  io_unset_nonblock(dest_fptr, dest);
+struct chain_op {
+  enum chain_op_type  type;
+  int                 fd;
+  int                 dest_fd;
+  VALUE               io;
+  VALUE               str;
+  long                len;
+  int                 flags;
+  double              duration;
+};
 
-  struct io_uring_sqe *sqe = io_uring_get_sqe(&backend->ring);
-  io_uring_prep_splice(sqe, src_fptr->fd, -1, dest_fptr->fd, -1, NUM2INT(maxlen), 0);
-  return sqe;
+static inline struct chain_data *chain_data_alloc(int count) {
+  struct chain_data *data = malloc(
+    sizeof(struct chain_data) +
+    count * (sizeof(struct __kernel_timespec) + sizeof(op_context_t *) + 2 * sizeof(int))
+  );
+  if (!data) rb_raise(rb_eNoMemError, "failed to allocate chain data");
+  data->timeouts = (struct __kernel_timespec *)(data + 1);
+  data->links = (op_context_t **)(data->timeouts + count);
+  data->results = (int *)(data->links + count);
+  data->close_fds = data->results + count;
+  return data;
+}
+
+static inline rb_io_t *chain_op_get_fptr(VALUE *io, int write) {
+  rb_io_t *fptr;
+  VALUE underlying_io = rb_ivar_get(*io, ID_ivar_io);
+  if (underlying_io != Qnil) *io = underlying_io;
+  if (write) *io = rb_io_get_write_io(*io);
+  GetOpenFile(*io, fptr);
+  if (write) rb_io_check_writable(fptr);
+  else rb_io_check_byte_readable(fptr);
+  io_unset_nonblock(fptr, *io);
+  return fptr;
+}
+
+// Parses and validates a chain op, before anything is submitted, so errors can
+// be raised without having to clean up.
+static void chain_op_parse(VALUE op, struct chain_op *parsed, int index) {
+  if (TYPE(op) != T_ARRAY || !RARRAY_LEN(op)) goto invalid;
+  VALUE op_type = RARRAY_AREF(op, 0);
+  long op_len = RARRAY_LEN(op);
+  rb_io_t *fptr;
+
+  parsed->str = Qnil;
+  parsed->io = Qnil;
+  if (op_type == SYM_write && op_len == 3) {
+    parsed->type = CHAIN_OP_WRITE;
+    parsed->io = RARRAY_AREF(op, 1);
+    parsed->fd = chain_op_get_fptr(&parsed->io, 1)->fd;
+    parsed->str = RARRAY_AREF(op, 2);
+    StringValue(parsed->str);
+  }
+  else if (op_type == SYM_send && op_len == 4) {
+    parsed->type = CHAIN_OP_SEND;
+    parsed->io = RARRAY_AREF(op, 1);
+    parsed->fd = chain_op_get_fptr(&parsed->io, 1)->fd;
+    parsed->str = RARRAY_AREF(op, 2);
+    StringValue(parsed->str);
+    parsed->flags = NUM2INT(RARRAY_AREF(op, 3));
+  }
+  else if (op_type == SYM_splice && op_len == 4) {
+    parsed->type = CHAIN_OP_SPLICE;
+    VALUE src = RARRAY_AREF(op, 1);
+    VALUE dest = RARRAY_AREF(op, 2);
+    parsed->fd = chain_op_get_fptr(&src, 0)->fd;
+    parsed->dest_fd = chain_op_get_fptr(&dest, 1)->fd;
+    parsed->len = NUM2INT(RARRAY_AREF(op, 3));
+  }
+  else if ((op_type == SYM_read && op_len == 3) || (op_type == SYM_recv && op_len == 4)) {
+    parsed->type = op_type == SYM_read ? CHAIN_OP_READ : CHAIN_OP_RECV;
+    parsed->io = RARRAY_AREF(op, 1);
+    fptr = chain_op_get_fptr(&parsed->io, 0);
+    rectify_io_file_pos(fptr);
+    parsed->fd = fptr->fd;
+    parsed->len = NUM2LONG(RARRAY_AREF(op, 2));
+    if (parsed->len <= 0) rb_raise(rb_eArgError, "invalid read length");
+    parsed->str = rb_str_buf_new(parsed->len);
+    parsed->flags = op_len == 4 ? NUM2INT(RARRAY_AREF(op, 3)) : 0;
+  }
+  else if (op_type == SYM_poll && op_len == 3) {
+    parsed->type = CHAIN_OP_POLL;
+    parsed->io = RARRAY_AREF(op, 1);
+    VALUE mode = RARRAY_AREF(op, 2);
+    if (mode != SYM_read && mode != SYM_write) rb_raise(rb_eArgError, "expected :read or :write poll mode");
+    parsed->flags = mode == SYM_write ? POLLOUT : POLLIN;
+    parsed->fd = chain_op_get_fptr(&parsed->io, mode == SYM_write)->fd;
+  }
+  else if ((op_type == SYM_close && op_len == 2) || (op_type == SYM_shutdown && op_len == 3)) {
+    parsed->type = op_type == SYM_close ? CHAIN_OP_CLOSE : CHAIN_OP_SHUTDOWN;
+    parsed->io = RARRAY_AREF(op, 1);
+    VALUE underlying_io = rb_ivar_get(parsed->io, ID_ivar_io);
+    if (underlying_io != Qnil) parsed->io = underlying_io;
+    GetOpenFile(parsed->io, fptr);
+    parsed->fd = fptr->fd;
+    parsed->flags = op_len == 3 ? backend_shutdown_how(RARRAY_AREF(op, 2)) : 0;
+  }
+  else if (op_type == SYM_timeout && op_len == 2) {
+    if (!index) rb_raise(rb_eRuntimeError, "timeout must follow another op");
+    parsed->type = CHAIN_OP_TIMEOUT;
+    parsed->duration = NUM2DBL(RARRAY_AREF(op, 1));
+  }
+  else
+    goto invalid;
+  return;
+invalid:
+  rb_raise(rb_eRuntimeError, "Invalid op specified or bad op arity");
 }
 
-void Backend_chain_ctx_attach_buffers(op_context_t *ctx, int argc, VALUE *argv) {
-  int count = 0;
-  if (argc > 1) ctx->buffers = malloc(sizeof(VALUE) * (argc - 1));
+static void chain_op_prep(Backend_t *backend, struct chain_op *op, struct chain_data *data, int i, struct io_uring_sqe *sqe) {
+  switch (op->type) {
+    case CHAIN_OP_WRITE:
+      io_uring_prep_write(sqe, op->fd, RSTRING_PTR(op->str), RSTRING_LEN(op->str), -1);
+      break;
+    case CHAIN_OP_SEND:
+      io_uring_prep_send(sqe, op->fd, RSTRING_PTR(op->str), RSTRING_LEN(op->str), op->flags);
+      break;
+    case CHAIN_OP_SPLICE:
+      io_uring_prep_splice(sqe, op->fd, -1, op->dest_fd, -1, op->len, 0);
+      break;
+    case CHAIN_OP_READ:
+      io_uring_prep_read(sqe, op->fd, RSTRING_PTR(op->str), op->len, -1);
+      break;
+    case CHAIN_OP_RECV:
+      io_uring_prep_recv(sqe, op->fd, RSTRING_PTR(op->str), op->len, op->flags);
+      break;
+    case CHAIN_OP_POLL:
+      io_uring_prep_poll_add(sqe, op->fd, op->flags);
+      break;
+    case CHAIN_OP_CLOSE:
+      // the io was already closed (see chain_ops_detach_close_fds)
+      if (op->fd < 0) io_uring_prep_nop(sqe);
+      else io_uring_prep_close(sqe, op->fd);
+      break;
+    case CHAIN_OP_SHUTDOWN:
+      io_uring_prep_shutdown(sqe, op->fd, op->flags);
+      break;
+    case CHAIN_OP_TIMEOUT:
+      data->timeouts[i] = double_to_timespec(op->duration);
+      io_uring_prep_link_timeout(sqe, &data->timeouts[i], 0);
+      break;
+  }
+}
 
-  for (int i = 0; i < argc; i++) {
-    VALUE op = argv[i];
-    VALUE op_type = RARRAY_AREF(op, 0);
+static VALUE chain_op_result(struct chain_op *op, int result) {
+  if (op->type == CHAIN_OP_TIMEOUT) return result == -ETIME ? Qtrue : Qfalse;
+  if (result == -ECANCELED || result == -EINTR) return Qnil;
+  if (result < 0) return rb_syserr_new(-result, strerror(-result));
+
+  switch (op->type) {
+    case CHAIN_OP_READ:
+    case CHAIN_OP_RECV:
+      if (!result) return Qnil;
+      rb_str_set_len(op->str, result);
+      rb_enc_associate(op->str, rb_default_external_encoding());
+      return op->str;
+    case CHAIN_OP_POLL:
+    case CHAIN_OP_CLOSE:
+    case CHAIN_OP_SHUTDOWN:
+      return Qtrue;
+    default:
+      return INT2NUM(result);
+  }
+}
 
-    if (op_type == SYM_write || op_type == SYM_send) {
-      if (!count) ctx->buffer0 = RARRAY_AREF(op, 2);
-      else        ctx->buffers[count - 1] = RARRAY_AREF(op, 2);
-      count++;
+// Detaches the descriptors of ios closed by close ops, substituting the
+// detached descriptors in all ops referring to the same descriptors, so ops
+// preceding a close are performed on the same file. If the io was already
+// closed (e.g. by a preceding close op), the close op is turned into a no-op.
+static void chain_ops_detach_close_fds(struct chain_op *ops, int count) {
+  for (int i = 0; i < count; i++) {
+    if (ops[i].type != CHAIN_OP_CLOSE) continue;
+
+    int may_block = 0;
+    int fd = ops[i].fd;
+    int detached = backend_io_detach_fd(ops[i].io, &may_block);
+    for (int j = 0; j < count; j++) {
+      if (ops[j].type == CHAIN_OP_TIMEOUT) continue;
+      if (ops[j].fd == fd) ops[j].fd = detached;
+      if (ops[j].type == CHAIN_OP_SPLICE && ops[j].dest_fd == fd) ops[j].dest_fd = detached;
     }
+    ops[i].flags = may_block;
   }
-  ctx->buffer_count = count;
 }
 
-
+// Submits the given ops as a chain of linked SQEs, and returns an array of
+// per-op results. Write, send and splice ops return the number of bytes
+// transferred, read and recv ops return the data read (or nil on EOF), poll,
+// close and shutdown ops return true, and timeout ops, which apply to the
+// preceding op, return whether the timeout has expired. Close ops are performed
+// on detached descriptors (see backend_io_detach_fd), so the closed ios are
+// marked as closed immediately. Ops that were cancelled, either because a
+// preceding op has failed or because of a timeout, return nil. Ops that have
+// failed return the corresponding SystemCallError.
 VALUE Backend_chain(int argc,VALUE *argv, VALUE self) {
   VALUE resume_value = Qnil;
-  unsigned int sqe_count = 0;
-  struct io_uring_sqe *last_sqe = 0;
   Backend_t *backend;
   GetBackend(self, backend);
-  if (argc == 0) return resume_value;
+  if (argc == 0) return rb_ary_new();
 
-  op_context_t *ctx = context_store_acquire(&backend->store, OP_CHAIN);
+  struct chain_op *ops = ALLOCA_N(struct chain_op, argc);
+  VALUE buffers = rb_ary_new();
   for (int i = 0; i < argc; i++) {
-    VALUE op = argv[i];
-    VALUE op_type = RARRAY_AREF(op, 0);
-    VALUE op_len = RARRAY_LEN(op);
+    chain_op_parse(argv[i], &ops[i], i);
+    if (ops[i].type == CHAIN_OP_TIMEOUT && ops[i - 1].type == CHAIN_OP_TIMEOUT)
+      rb_raise(rb_eRuntimeError, "timeout must follow another op");
+    if (ops[i].str != Qnil) rb_ary_push(buffers, ops[i].str);
+  }
+  if ((unsigned int)argc > backend->sq_entries)
+    rb_raise(rb_eArgError, "chain of %d ops exceeds SQ ring size (%d)", argc, backend->sq_entries);
+  // all linked SQEs must be submitted together
+  io_uring_backend_reserve_sqes(backend, argc);
+  chain_ops_detach_close_fds(ops, argc);
 
-    if (op_type == SYM_write && op_len == 3) {
-      last_sqe = Backend_chain_prepare_write(backend, RARRAY_AREF(op, 1), RARRAY_AREF(op, 2));
-    }
-    else if (op_type == SYM_send && op_len == 4)
-      last_sqe = Backend_chain_prepare_send(backend, RARRAY_AREF(op, 1), RARRAY_AREF(op, 2), RARRAY_AREF(op, 3));
-    else if (op_type == SYM_splice && op_len == 4)
-      last_sqe = Backend_chain_prepare_splice(backend, RARRAY_AREF(op, 1), RARRAY_AREF(op, 2), RARRAY_AREF(op, 3));
-    else {
-      if (sqe_count) {
-        io_uring_sqe_set_data(last_sqe, ctx);
-        io_uring_sqe_set_flags(last_sqe, IOSQE_ASYNC);
-
-        ctx->ref_count = sqe_count;
-        ctx->result = -ECANCELED;
-        struct io_uring_sqe *sqe = io_uring_get_sqe(&backend->ring);
-        io_uring_prep_cancel(sqe, ctx, 0);
-        backend->pending_sqes = 0;
-        io_uring_submit(&backend->ring);
-      }
-      else {
-        ctx->ref_count = 1;
-        context_store_release(&backend->store, ctx);
-      }
-      rb_raise(rb_eRuntimeError, "Invalid op specified or bad op arity");
-    }
+  struct chain_data *data = chain_data_alloc(argc);
+  op_context_t *ctx = context_store_acquire(&backend->store, OP_CHAIN);
+  ctx->chain_data = data;
+  ctx->ref_count = argc + 1;
+  // buffers are kept alive until all links are completed
+  context_attach_buffers(ctx, 1, &buffers);
 
-    io_uring_sqe_set_data(last_sqe, ctx);
-    unsigned int flags = (i == (argc - 1)) ? IOSQE_ASYNC : IOSQE_ASYNC | IOSQE_IO_LINK;
-    io_uring_sqe_set_flags(last_sqe, flags);
-    sqe_count++;
+  for (int i = 0; i < argc; i++) {
+    op_context_t *link = context_store_acquire(&backend->store, OP_CHAIN_LINK);
+    link->ref_count = 1;
+    link->chain = ctx;
+    link->chain_index = i;
+    data->links[i] = link;
+    data->results[i] = -ECANCELED;
+    data->close_fds[i] = ops[i].type == CHAIN_OP_CLOSE ? ops[i].fd : -1;
+
+    struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
+    chain_op_prep(backend, &ops[i], data, i, sqe);
+    io_uring_backend_sqe_set_data(backend, sqe, link);
+
+    unsigned int flags = (i == (argc - 1)) ? 0 : IOSQE_IO_LINK;
+    if (ops[i].type <= CHAIN_OP_SPLICE || (ops[i].type == CHAIN_OP_CLOSE && ops[i].flags))
+      flags |= IOSQE_ASYNC;
+    io_uring_sqe_set_flags(sqe, flags);
   }
 
-  backend->base.op_count += sqe_count;
-  ctx->ref_count = sqe_count + 1;
+  backend->base.op_count += argc;
   io_uring_backend_defer_submit(backend);
   resume_value = backend_await((struct Backend_base *)backend);
-  int result = ctx->result;
-  int completed = context_store_release(&backend->store, ctx);
-  if (!completed) {
-    Backend_chain_ctx_attach_buffers(ctx, argc, argv);
 
-    // op was not completed (an exception was raised), so we need to cancel it
-    ctx->result = -ECANCELED;
-    struct io_uring_sqe *sqe = io_uring_get_sqe(&backend->ring);
-    io_uring_prep_cancel(sqe, ctx, 0);
+  if (ctx->ref_count > 1) {
+    // the chain was not completed (an exception was raised), so any pending
+    // links are cancelled
+    ctx->fiber = 0;
+    for (int i = 0; i < argc; i++) {
+      if (!data->links[i]) continue;
+      struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
+      io_uring_prep_cancel(sqe, data->links[i], 0);
+      io_uring_sqe_set_data(sqe, NULL);
+    }
     backend->pending_sqes = 0;
     io_uring_submit(&backend->ring);
+    context_store_release(&backend->store, ctx);
     RAISE_IF_EXCEPTION(resume_value);
     return resume_value;
   }
 
+  VALUE results = rb_ary_new_capa(argc);
+  for (int i = 0; i < argc; i++)
+    rb_ary_push(results, chain_op_result(&ops[i], data->results[i]));
+  context_store_release(&backend->store, ctx);
+
   RB_GC_GUARD(resume_value);
-  return INT2NUM(result);
+  RB_GC_GUARD(buffers);
+  return results;
 }
 
 VALUE Backend_idle_gc_period_set(VALUE self, VALUE period) {
@@ -1275,6 +2911,19 @@ VALUE Backend_idle_gc_period_set(VALUE self, VALUE period) {
   return self;
 }
 
+VALUE Backend_poll_policy_set(VALUE self, VALUE policy) {
+  Backend_t *backend;
+  GetBackend(self, backend);
+  backend_base_set_poll_policy(&backend->base, policy);
+  return self;
+}
+
+VALUE Backend_poll_policy_get(VALUE self) {
+  Backend_t *backend;
+  GetBackend(self, backend);
+  return backend_base_poll_policy(&backend->base);
+}
+
 VALUE Backend_idle_proc_set(VALUE self, VALUE block) {
   Backend_t *backend;
   GetBackend(self, backend);
@@ -1282,6 +2931,22 @@ VALUE Backend_idle_proc_set(VALUE self, VALUE block) {
   return self;
 }
 
+// Sets the minimum length of strings sent using zero-copy sends. A value of
+// nil or 0 disables zero-copy sends.
+VALUE Backend_send_zc_threshold_set(VALUE self, VALUE threshold) {
+  Backend_t *backend;
+  GetBackend(self, backend);
+  backend->send_zc_threshold = NIL_P(threshold) ? 0 : NUM2LONG(threshold);
+  return self;
+}
+
+VALUE Backend_scheduler_group_set(VALUE self, VALUE group) {
+  Backend_t *backend;
+  GetBackend(self, backend);
+  backend->base.scheduler_group = group;
+  return self;
+}
+
 inline VALUE Backend_run_idle_tasks(VALUE self) {
   Backend_t *backend;
   GetBackend(self, backend);
@@ -1289,17 +2954,17 @@ inline VALUE Backend_run_idle_tasks(VALUE self) {
   return self;
 }
 
-static inline void splice_chunks_prep_write(op_context_t *ctx, struct io_uring_sqe *sqe, int fd, VALUE str) {
+static inline void splice_chunks_prep_write(Backend_t *backend, op_context_t *ctx, struct io_uring_sqe *sqe, int fd, VALUE str) {
   char *buf = RSTRING_PTR(str);
   int len = RSTRING_LEN(str);
   io_uring_prep_write(sqe, fd, buf, len, 0);
   // io_uring_prep_send(sqe, fd, buf, len, 0);
-  io_uring_sqe_set_data(sqe, ctx);
+  io_uring_backend_sqe_set_data(backend, sqe, ctx);
 }
 
-static inline void splice_chunks_prep_splice(op_context_t *ctx, struct io_uring_sqe *sqe, int src, int dest, int maxlen) {
+static inline void splice_chunks_prep_splice(Backend_t *backend, op_context_t *ctx, struct io_uring_sqe *sqe, int src, int dest, int maxlen) {
   io_uring_prep_splice(sqe, src, -1, dest, -1, maxlen, 0);
-  io_uring_sqe_set_data(sqe, ctx);
+  io_uring_backend_sqe_set_data(backend, sqe, ctx);
 }
 
 static inline void splice_chunks_get_sqe(
@@ -1313,14 +2978,17 @@ static inline void splice_chunks_get_sqe(
     if (*sqe) (*sqe)->flags |= IOSQE_IO_LINK;
     (*ctx)->ref_count++;
   }
-  else
+  else {
+    // a chunk is submitted as at most 4 linked SQEs
+    io_uring_backend_reserve_sqes(backend, 4);
     *ctx = context_store_acquire(&backend->store, type);
-  (*sqe) = io_uring_get_sqe(&backend->ring);
+  }
+  (*sqe) = io_uring_backend_get_sqe(backend);
 }
 
 static inline void splice_chunks_cancel(Backend_t *backend, op_context_t *ctx) {
   ctx->result = -ECANCELED;
-  struct io_uring_sqe *sqe = io_uring_get_sqe(&backend->ring);
+  struct io_uring_sqe *sqe = io_uring_backend_get_sqe(backend);
   io_uring_prep_cancel(sqe, ctx, 0);
   backend->pending_sqes = 0;
   io_uring_submit(&backend->ring);
@@ -1382,7 +3050,7 @@ VALUE Backend_splice_chunks(VALUE self, VALUE src, VALUE dest, VALUE prefix, VAL
 
   if (prefix != Qnil) {
     splice_chunks_get_sqe(backend, &ctx, &sqe, OP_WRITE);
-    splice_chunks_prep_write(ctx, sqe, dest_fptr->fd, prefix);
+    splice_chunks_prep_write(backend, ctx, sqe, dest_fptr->fd, prefix);
     backend->base.op_count++;
   }
 
@@ -1392,7 +3060,7 @@ VALUE Backend_splice_chunks(VALUE self, VALUE src, VALUE dest, VALUE prefix, VAL
     VALUE chunk_postfix_str = Qnil;
 
     splice_chunks_get_sqe(backend, &ctx, &sqe, OP_SPLICE);
-    splice_chunks_prep_splice(ctx, sqe, src_fptr->fd, pipefd[1], maxlen);
+    splice_chunks_prep_splice(backend, ctx, sqe, src_fptr->fd, pipefd[1], maxlen);
     backend->base.op_count++;
 
     SPLICE_CHUNKS_AWAIT_OPS(backend, &ctx, &chunk_len, &switchpoint_result);
@@ -1405,18 +3073,18 @@ VALUE Backend_splice_chunks(VALUE self, VALUE src, VALUE dest, VALUE prefix, VAL
     if (chunk_prefix != Qnil) {
       chunk_prefix_str = (TYPE(chunk_prefix) == T_STRING) ? chunk_prefix : rb_funcall(chunk_prefix, ID_call, 1, chunk_len_value);
       splice_chunks_get_sqe(backend, &ctx, &sqe, OP_WRITE);
-      splice_chunks_prep_write(ctx, sqe, dest_fptr->fd, chunk_prefix_str);
+      splice_chunks_prep_write(backend, ctx, sqe, dest_fptr->fd, chunk_prefix_str);
       backend->base.op_count++;
     }
 
     splice_chunks_get_sqe(backend, &ctx, &sqe, OP_SPLICE);
-    splice_chunks_prep_splice(ctx, sqe, pipefd[0], dest_fptr->fd, chunk_len);
+    splice_chunks_prep_splice(backend, ctx, sqe, pipefd[0], dest_fptr->fd, chunk_len);
     backend->base.op_count++;
 
     if (chunk_postfix != Qnil) {
       chunk_postfix_str = (TYPE(chunk_postfix) == T_STRING) ? chunk_postfix : rb_funcall(chunk_postfix, ID_call, 1, chunk_len_value);
       splice_chunks_get_sqe(backend, &ctx, &sqe, OP_WRITE);
-      splice_chunks_prep_write(ctx, sqe, dest_fptr->fd, chunk_postfix_str);
+      splice_chunks_prep_write(backend, ctx, sqe, dest_fptr->fd, chunk_postfix_str);
       backend->base.op_count++;
     }
 
@@ -1426,7 +3094,7 @@ VALUE Backend_splice_chunks(VALUE self, VALUE src, VALUE dest, VALUE prefix, VAL
 
   if (postfix != Qnil) {
     splice_chunks_get_sqe(backend, &ctx, &sqe, OP_WRITE);
-    splice_chunks_prep_write(ctx, sqe, dest_fptr->fd, postfix);
+    splice_chunks_prep_write(backend, ctx, sqe, dest_fptr->fd, postfix);
     backend->base.op_count++;
   }
   if (ctx) {
@@ -1450,6 +3118,131 @@ error:
   return RAISE_EXCEPTION(switchpoint_result);
 }
 
+static inline int io_uring_backend_pipe_acquire(Backend_t *backend, int pipefd[2]) {
+  if (backend->pipe_cache_count) {
+    int *cached = backend->pipe_cache[--backend->pipe_cache_count];
+    pipefd[0] = cached[0];
+    pipefd[1] = cached[1];
+    return 0;
+  }
+  return pipe(pipefd);
+}
+
+// Only drained pipes may be reused, so a pipe is returned to the cache only
+// after a transfer was completed.
+static inline void io_uring_backend_pipe_release(Backend_t *backend, int pipefd[2], int reuse) {
+  if (reuse && backend->pipe_cache_count < PIPE_CACHE_MAX) {
+    int *cached = backend->pipe_cache[backend->pipe_cache_count++];
+    cached[0] = pipefd[0];
+    cached[1] = pipefd[1];
+    return;
+  }
+  close(pipefd[0]);
+  close(pipefd[1]);
+}
+
+// Sends length bytes (or up to EOF if length is nil) from the given file
+// offset to dest, splicing through a cached pipe. If chunk_prefix or
+// chunk_postfix is given, each chunk is framed as in splice_chunks.
+VALUE Backend_sendfile(int argc, VALUE *argv, VALUE self) {
+  Backend_t *backend;
+  VALUE src, dest, offset, length, chunk_prefix, chunk_postfix, chunk_size;
+  GetBackend(self, backend);
+  rb_scan_args(argc, argv, "43", &src, &dest, &offset, &length, &chunk_prefix, &chunk_postfix, &chunk_size);
+
+  long total = 0;
+  int err = 0;
+  VALUE switchpoint_result = Qnil;
+  op_context_t *ctx = 0;
+  struct io_uring_sqe *sqe = 0;
+  rb_io_t *src_fptr;
+  rb_io_t *dest_fptr;
+
+  VALUE underlying_io = rb_ivar_get(src, ID_ivar_io);
+  if (underlying_io != Qnil) src = underlying_io;
+  GetOpenFile(src, src_fptr);
+
+  underlying_io = rb_ivar_get(dest, ID_ivar_io);
+  if (underlying_io != Qnil) dest = underlying_io;
+  dest = rb_io_get_write_io(dest);
+  GetOpenFile(dest, dest_fptr);
+  io_verify_blocking_mode(dest_fptr, dest, Qtrue);
+
+  int64_t pos = NUM2LL(offset);
+  long remaining = NIL_P(length) ? -1 : NUM2LONG(length);
+  int maxlen = NIL_P(chunk_size) ? SENDFILE_CHUNK_SIZE : NUM2INT(chunk_size);
+  VALUE chunk_len_value = Qnil;
+
+  int pipefd[2];
+  if (io_uring_backend_pipe_acquire(backend, pipefd) == -1) rb_syserr_fail(errno, strerror(errno));
+
+  while (remaining) {
+    int chunk_len;
+    VALUE chunk_prefix_str = Qnil;
+    VALUE chunk_postfix_str = Qnil;
+    int len = (remaining > 0 && remaining < maxlen) ? remaining : maxlen;
+
+    splice_chunks_get_sqe(backend, &ctx, &sqe, OP_SPLICE);
+    io_uring_prep_splice(sqe, src_fptr->fd, pos, pipefd[1], -1, len, 0);
+    io_uring_backend_sqe_set_data(backend, sqe, ctx);
+    backend->base.op_count++;
+
+    SPLICE_CHUNKS_AWAIT_OPS(backend, &ctx, &chunk_len, &switchpoint_result);
+    if (chunk_len < 0) {
+      err = -chunk_len;
+      goto syscallerror;
+    }
+    if (chunk_len == 0) break;
+
+    total += chunk_len;
+    pos += chunk_len;
+    if (remaining > 0) remaining -= chunk_len;
+    chunk_len_value = INT2NUM(chunk_len);
+
+    if (chunk_prefix != Qnil) {
+      chunk_prefix_str = (TYPE(chunk_prefix) == T_STRING) ? chunk_prefix : rb_funcall(chunk_prefix, ID_call, 1, chunk_len_value);
+      splice_chunks_get_sqe(backend, &ctx, &sqe, OP_WRITE);
+      splice_chunks_prep_write(backend, ctx, sqe, dest_fptr->fd, chunk_prefix_str);
+      backend->base.op_count++;
+    }
+
+    splice_chunks_get_sqe(backend, &ctx, &sqe, OP_SPLICE);
+    splice_chunks_prep_splice(backend, ctx, sqe, pipefd[0], dest_fptr->fd, chunk_len);
+    backend->base.op_count++;
+
+    if (chunk_postfix != Qnil) {
+      chunk_postfix_str = (TYPE(chunk_postfix) == T_STRING) ? chunk_postfix : rb_funcall(chunk_postfix, ID_call, 1, chunk_len_value);
+      splice_chunks_get_sqe(backend, &ctx, &sqe, OP_WRITE);
+      splice_chunks_prep_write(backend, ctx, sqe, dest_fptr->fd, chunk_postfix_str);
+      backend->base.op_count++;
+    }
+
+    RB_GC_GUARD(chunk_prefix_str);
+    RB_GC_GUARD(chunk_postfix_str);
+  }
+
+  if (ctx) {
+    int result;
+    SPLICE_CHUNKS_AWAIT_OPS(backend, &ctx, &result, &switchpoint_result);
+    if (result < 0) {
+      err = -result;
+      goto syscallerror;
+    }
+  }
+
+  RB_GC_GUARD(chunk_len_value);
+  RB_GC_GUARD(switchpoint_result);
+  io_uring_backend_pipe_release(backend, pipefd, 1);
+  return LONG2NUM(total);
+syscallerror:
+  io_uring_backend_pipe_release(backend, pipefd, 0);
+  rb_syserr_fail(err, strerror(err));
+error:
+  context_attach_buffers_v(ctx, 2, chunk_prefix, chunk_postfix);
+  io_uring_backend_pipe_release(backend, pipefd, 0);
+  return RAISE_EXCEPTION(switchpoint_result);
+}
+
 VALUE Backend_trace(int argc, VALUE *argv, VALUE self) {
   Backend_t *backend;
   GetBackend(self, backend);
@@ -1479,50 +3272,129 @@ void Backend_unpark_fiber(VALUE self, VALUE fiber) {
   backend_base_unpark_fiber(&backend->base, fiber);
 }
 
-void Init_Backend() {
-  VALUE cBackend = rb_define_class_under(mPolyphony, "Backend", rb_cObject);
-  rb_define_alloc_func(cBackend, Backend_allocate);
-
-  rb_define_method(cBackend, "initialize", Backend_initialize, 0);
-  rb_define_method(cBackend, "finalize", Backend_finalize, 0);
-  rb_define_method(cBackend, "post_fork", Backend_post_fork, 0);
-  rb_define_method(cBackend, "trace", Backend_trace, -1);
-  rb_define_method(cBackend, "trace_proc=", Backend_trace_proc_set, 1);
-  rb_define_method(cBackend, "stats", Backend_stats, 0);
-
-  rb_define_method(cBackend, "poll", Backend_poll, 1);
-  rb_define_method(cBackend, "break", Backend_wakeup, 0);
-  rb_define_method(cBackend, "kind", Backend_kind, 0);
-  rb_define_method(cBackend, "chain", Backend_chain, -1);
-  rb_define_method(cBackend, "idle_gc_period=", Backend_idle_gc_period_set, 1);
-  rb_define_method(cBackend, "idle_proc=", Backend_idle_proc_set, 1);
-  rb_define_method(cBackend, "splice_chunks", Backend_splice_chunks, 7);
-
-  rb_define_method(cBackend, "accept", Backend_accept, 2);
-  rb_define_method(cBackend, "accept_loop", Backend_accept_loop, 2);
-  rb_define_method(cBackend, "connect", Backend_connect, 3);
-  rb_define_method(cBackend, "feed_loop", Backend_feed_loop, 3);
-  rb_define_method(cBackend, "read", Backend_read, 5);
-  rb_define_method(cBackend, "read_loop", Backend_read_loop, 2);
-  rb_define_method(cBackend, "recv", Backend_recv, 4);
-  rb_define_method(cBackend, "recv_feed_loop", Backend_recv_feed_loop, 3);
-  rb_define_method(cBackend, "recv_loop", Backend_recv_loop, 2);
-  rb_define_method(cBackend, "send", Backend_send, 3);
-  rb_define_method(cBackend, "sendv", Backend_sendv, 3);
-  rb_define_method(cBackend, "sleep", Backend_sleep, 1);
-  rb_define_method(cBackend, "splice", Backend_splice, 3);
-  rb_define_method(cBackend, "splice_to_eof", Backend_splice_to_eof, 3);
-  rb_define_method(cBackend, "timeout", Backend_timeout, -1);
-  rb_define_method(cBackend, "timer_loop", Backend_timer_loop, 1);
-  rb_define_method(cBackend, "wait_event", Backend_wait_event, 1);
-  rb_define_method(cBackend, "wait_io", Backend_wait_io, 2);
-  rb_define_method(cBackend, "waitpid", Backend_waitpid, 1);
-  rb_define_method(cBackend, "write", Backend_write_m, -1);
+int Backend_fiber_runnable_p(VALUE self, VALUE fiber) {
+  Backend_t *backend;
+  GetBackend(self, backend);
+
+  return backend_base_fiber_runnable_p(&backend->base, fiber);
+}
+
+static void io_uring_backend_trim(struct Backend_base *base) {
+  context_store_trim(&((Backend_t *)base)->store);
+}
+
+static int io_uring_backend_completions_ready(struct Backend_base *base) {
+  return io_uring_cq_ready(&((Backend_t *)base)->ring) > 0;
+}
+
+static VALUE SYM_op_context_count;
+static VALUE SYM_op_context_taken_count;
+
+// Extends the common backend stats with the occupancy of the op context store.
+static VALUE Backend_io_uring_stats(VALUE self) {
+  Backend_t *backend;
+  GetBackend(self, backend);
+
+  VALUE stats = Backend_stats(self);
+  rb_hash_aset(stats, SYM_op_context_count, UINT2NUM(backend->store.slab_count * OP_CONTEXT_SLAB_SIZE));
+  rb_hash_aset(stats, SYM_op_context_taken_count, UINT2NUM(backend->store.taken_count));
+  return stats;
+}
+
+static const struct backend_interface backend_interface = {
+  .accept = Backend_accept,
+  .accept_loop = Backend_accept_loop,
+  .connect = Backend_connect,
+  .connect_racing = Backend_connect_racing,
+  .close = Backend_close,
+  .shutdown = Backend_shutdown,
+  .feed_loop = Backend_feed_loop,
+  .read = Backend_read,
+  .read_loop = Backend_read_loop,
+  .gets_loop = Backend_gets_loop,
+  .readv = Backend_readv,
+  .recv = Backend_recv,
+  .recv_loop = Backend_recv_loop,
+  .recv_feed_loop = Backend_recv_feed_loop,
+  .send = Backend_send,
+  .recvfrom = Backend_recvfrom,
+  .sendto = Backend_sendto,
+  .recvmmsg = Backend_recvmmsg,
+  .sendmmsg = Backend_sendmmsg,
+  .sleep = Backend_sleep,
+  .splice = Backend_splice,
+  .splice_to_eof = Backend_splice_to_eof,
+  .timeout = Backend_timeout,
+  .timer_loop = Backend_timer_loop,
+  .wait_io = Backend_wait_io,
+  .waitpid = Backend_waitpid,
+  .write_m = Backend_write_m,
+  .chain = Backend_chain,
+  .sendfile = Backend_sendfile,
+  .splice_chunks = Backend_splice_chunks,
+
+  .poll = Backend_poll,
+  .wait_event = Backend_wait_event,
+  .wakeup = Backend_wakeup,
+  .switch_fiber = Backend_switch_fiber,
+  .schedule_fiber = Backend_schedule_fiber,
+  .unschedule_fiber = Backend_unschedule_fiber,
+  .park_fiber = Backend_park_fiber,
+  .unpark_fiber = Backend_unpark_fiber,
+  .fiber_runnable_p = Backend_fiber_runnable_p,
+  .watch_thread_pool_job = Backend_watch_thread_pool_job,
+  .arm_idle_sweep = io_uring_backend_arm_idle_sweep,
+  .trim = io_uring_backend_trim,
+  .completions_ready = io_uring_backend_completions_ready
+};
+
+void Init_IOUringBackend(VALUE cBackend) {
+  VALUE cImplementation = rb_define_class_under(cBackend, "IOUring", cBackend);
+  rb_define_alloc_func(cImplementation, Backend_allocate);
+
+  rb_define_method(cImplementation, "initialize", Backend_initialize, -1);
+  rb_define_method(cImplementation, "finalize", Backend_finalize, 0);
+  rb_define_method(cImplementation, "post_fork", Backend_post_fork, 0);
+  rb_define_method(cImplementation, "trace", Backend_trace, -1);
+  rb_define_method(cImplementation, "trace_proc=", Backend_trace_proc_set, 1);
+  rb_define_method(cImplementation, "stats", Backend_io_uring_stats, 0);
+  rb_define_method(cImplementation, "extended_stats", Backend_extended_stats, 0);
+  rb_define_method(cImplementation, "extended_stats=", Backend_extended_stats_set, 1);
+
+  rb_define_method(cImplementation, "poll", Backend_poll, 1);
+  rb_define_method(cImplementation, "break", Backend_wakeup, 0);
+  rb_define_method(cImplementation, "kind", Backend_kind, 0);
+  rb_define_method(cImplementation, "idle_gc_period=", Backend_idle_gc_period_set, 1);
+  rb_define_method(cImplementation, "idle_proc=", Backend_idle_proc_set, 1);
+  rb_define_method(cImplementation, "scheduler_group=", Backend_scheduler_group_set, 1);
+  rb_define_method(cImplementation, "send_zc_threshold=", Backend_send_zc_threshold_set, 1);
+  rb_define_method(cImplementation, "poll_policy", Backend_poll_policy_get, 0);
+  rb_define_method(cImplementation, "poll_policy=", Backend_poll_policy_set, 1);
+
+  rb_define_method(cImplementation, "register_io", Backend_register_io, 1);
+  rb_define_method(cImplementation, "unregister_io", Backend_unregister_io, 1);
+
+  ID_pending_sockets = rb_intern("__polyphony_pending_sockets__");
 
   SYM_io_uring = ID2SYM(rb_intern("io_uring"));
   SYM_send = ID2SYM(rb_intern("send"));
   SYM_splice = ID2SYM(rb_intern("splice"));
   SYM_write = ID2SYM(rb_intern("write"));
+  SYM_read = ID2SYM(rb_intern("read"));
+  SYM_recv = ID2SYM(rb_intern("recv"));
+  SYM_poll = ID2SYM(rb_intern("poll"));
+  SYM_timeout = ID2SYM(rb_intern("timeout"));
+  SYM_close = ID2SYM(rb_intern("close"));
+  SYM_shutdown = ID2SYM(rb_intern("shutdown"));
+  SYM_sqpoll = ID2SYM(rb_intern("sqpoll"));
+  SYM_sqpoll_idle = ID2SYM(rb_intern("sqpoll_idle"));
+  SYM_sqpoll_cpu = ID2SYM(rb_intern("sqpoll_cpu"));
+  SYM_sq_entries = ID2SYM(rb_intern("sq_entries"));
+  SYM_cq_entries = ID2SYM(rb_intern("cq_entries"));
+  SYM_op_context_watermark = ID2SYM(rb_intern("op_context_watermark"));
+  SYM_op_context_trim_interval = ID2SYM(rb_intern("op_context_trim_interval"));
+  SYM_op_context_count = ID2SYM(rb_intern("op_context_count"));
+  SYM_op_context_taken_count = ID2SYM(rb_intern("op_context_taken_count"));
 
   backend_setup_stats_symbols();
 
@@ -1,58 +1,72 @@
 #include <stdlib.h>
 #include <assert.h>
+#include <string.h>
 #include "ruby.h"
 #include "polyphony.h"
+#include "backend_common.h"
 #include "backend_io_uring_context.h"
 
-const char *op_type_to_str(enum op_type type) {
-  switch (type) {
-  case OP_READ: return "READ";
-  case OP_WRITEV: return "WRITEV";
-  case OP_WRITE: return "WRITE";
-  case OP_RECV: return "RECV";
-  case OP_SEND: return "SEND";
-  case OP_SPLICE: return "SPLICE";
-  case OP_TIMEOUT: return "TIMEOUT";
-  case OP_POLL: return "POLL";
-  case OP_ACCEPT: return "ACCEPT";
-  case OP_CONNECT: return "CONNECT";
-  case OP_CHAIN: return "CHAIN";
-  default: return "";
-  };
-}
+#define CONTEXT_STORE_DEFAULT_WATERMARK (4 * OP_CONTEXT_SLAB_SIZE)
+#define CONTEXT_STORE_DEFAULT_TRIM_INTERVAL 1.0
 
-void context_store_initialize(op_context_store_t *store) {
+void context_store_initialize(op_context_store_t *store, struct Backend_base *base) {
+  store->base = base;
   store->last_id = 0;
+  store->slabs = NULL;
   store->available = NULL;
-  store->taken = NULL;
-  store->available_count = 0;
+  store->slab_count = 0;
   store->taken_count = 0;
+  store->watermark = CONTEXT_STORE_DEFAULT_WATERMARK;
+  store->peak_taken_count = 0;
+  store->trim_interval = CONTEXT_STORE_DEFAULT_TRIM_INTERVAL;
+  store->last_trim_time = 0;
+}
+
+static void context_store_add_slab(op_context_store_t *store) {
+  op_context_slab_t *slab = malloc(sizeof(op_context_slab_t));
+  slab->taken_count = 0;
+  slab->trim = 0;
+  slab->next = store->slabs;
+  store->slabs = slab;
+  store->slab_count++;
+
+  // contexts are put on the available list in order, so they're taken in
+  // order of their location in memory
+  for (int i = OP_CONTEXT_SLAB_SIZE - 1; i >= 0; i--) {
+    op_context_t *ctx = slab->contexts + i;
+    ctx->slab = slab;
+    ctx->ref_count = 0;
+    ctx->next = store->available;
+    store->available = ctx;
+  }
 }
 
 inline op_context_t *context_store_acquire(op_context_store_t *store, enum op_type type) {
+  if (!store->available) context_store_add_slab(store);
+
   op_context_t *ctx = store->available;
-  if (ctx) {
-    if (ctx->next) ctx->next->prev = NULL;
-    store->available = ctx->next;
-    store->available_count--;
-  }
-  else {
-    ctx = malloc(sizeof(op_context_t));
-  }
-  ctx->id = (++store->last_id);
-  ctx->prev = NULL;
-  ctx->next = store->taken;
-  if (store->taken) store->taken->prev = ctx;
-  store->taken = ctx;
+  store->available = ctx->next;
+  ctx->next = NULL;
+  ctx->slab->taken_count++;
 
+  ctx->id = (++store->last_id);
   ctx->type = type;
   ctx->fiber = rb_fiber_current();
   ctx->resume_value = Qnil;
   ctx->ref_count = 2;
   ctx->result = 0;
+  ctx->cqe_flags = 0;
   ctx->buffer_count = 0;
+  ctx->multishot = NULL;
+  ctx->chain = NULL;
+  ctx->chain_data = NULL;
+  ctx->start_time = BACKEND_STATS_OP_START(store->base);
+  ctx->fd = -1;
+  ctx->cancel_waiting = 0;
 
   store->taken_count++;
+  if (store->taken_count > store->peak_taken_count)
+    store->peak_taken_count = store->taken_count;
 
   // printf("acquire %p %d (%s, ref_count: %d) taken: %d\n", ctx, ctx->id, op_type_to_str(type), ctx->ref_count, store->taken_count);
 
@@ -69,40 +83,129 @@ inline int context_store_release(op_context_store_t *store, op_context_t *ctx) {
   if (ctx->ref_count) return 0;
 
   if (ctx->buffer_count > 1) free(ctx->buffers);
+  ctx->buffer_count = 0;
+  if (ctx->multishot) {
+    free(ctx->multishot->entries);
+    free(ctx->multishot);
+    ctx->multishot = NULL;
+  }
+  if (ctx->chain_data) {
+    free(ctx->chain_data);
+    ctx->chain_data = NULL;
+  }
 
   store->taken_count--;
-  store->available_count++;
-
-  if (ctx->next) ctx->next->prev = ctx->prev;
-  if (ctx->prev) ctx->prev->next = ctx->next;
-  if (store->taken == ctx) store->taken = ctx->next;
-
-  ctx->prev = NULL;
+  ctx->slab->taken_count--;
   ctx->next = store->available;
-  if (ctx->next) ctx->next->prev = ctx;
   store->available = ctx;
   return 1;
 }
 
 void context_store_free(op_context_store_t *store) {
-  while (store->available) {
-    op_context_t *next = store->available->next;
-    free(store->available);
-    store->available = next;
+  while (store->slabs) {
+    op_context_slab_t *next = store->slabs->next;
+    free(store->slabs);
+    store->slabs = next;
+  }
+  unsigned int watermark = store->watermark;
+  double trim_interval = store->trim_interval;
+  context_store_initialize(store, store->base);
+  store->watermark = watermark;
+  store->trim_interval = trim_interval;
+}
+
+// Returns all contexts to the available list, keeping the allocated slabs.
+// This is used after forking, since contexts taken by the parent process refer
+// to ops submitted on the parent's ring, and will never be released in the
+// child process. Keeping the slabs lets a forked worker start with a store
+// sized for the load seen by its parent.
+void context_store_reset(op_context_store_t *store) {
+  store->available = NULL;
+  for (op_context_slab_t *slab = store->slabs; slab; slab = slab->next) {
+    for (int i = OP_CONTEXT_SLAB_SIZE - 1; i >= 0; i--) {
+      op_context_t *ctx = slab->contexts + i;
+      if (ctx->ref_count) {
+        if (ctx->buffer_count > 1) free(ctx->buffers);
+        ctx->buffer_count = 0;
+        if (ctx->multishot) {
+          free(ctx->multishot->entries);
+          free(ctx->multishot);
+          ctx->multishot = NULL;
+        }
+        if (ctx->chain_data) {
+          free(ctx->chain_data);
+          ctx->chain_data = NULL;
+        }
+        ctx->ref_count = 0;
+      }
+      ctx->next = store->available;
+      store->available = ctx;
+    }
+    slab->taken_count = 0;
+    slab->trim = 0;
+  }
+  store->taken_count = 0;
+  store->peak_taken_count = 0;
+}
+
+// Frees unused slabs, keeping enough contexts allocated for the peak number of
+// contexts taken since the last trim (but no less than the watermark). This is
+// called when the backend is idle, so the store shrinks gradually after a
+// burst of concurrent ops.
+void context_store_trim(op_context_store_t *store) {
+  unsigned int capacity = store->slab_count * OP_CONTEXT_SLAB_SIZE;
+  if (capacity <= store->watermark) return;
+
+  double now = current_time();
+  if (now - store->last_trim_time < store->trim_interval) return;
+  store->last_trim_time = now;
+
+  unsigned int target = store->peak_taken_count;
+  if (target < store->watermark) target = store->watermark;
+  store->peak_taken_count = store->taken_count;
+
+  int trimmed = 0;
+  for (op_context_slab_t *slab = store->slabs; slab && capacity > target; slab = slab->next) {
+    if (slab->taken_count) continue;
+    slab->trim = 1;
+    capacity -= OP_CONTEXT_SLAB_SIZE;
+    trimmed = 1;
   }
-  while (store->taken) {
-    op_context_t *next = store->taken->next;
-    free(store->taken);
-    store->taken = next;
+  if (!trimmed) return;
+
+  // remove the contexts of trimmed slabs from the available list
+  op_context_t **ptr = &store->available;
+  while (*ptr) {
+    if ((*ptr)->slab->trim)
+      *ptr = (*ptr)->next;
+    else
+      ptr = &(*ptr)->next;
+  }
+
+  op_context_slab_t **slab_ptr = &store->slabs;
+  while (*slab_ptr) {
+    op_context_slab_t *slab = *slab_ptr;
+    if (slab->trim) {
+      *slab_ptr = slab->next;
+      free(slab);
+      store->slab_count--;
+    }
+    else
+      slab_ptr = &slab->next;
   }
 }
 
 inline void context_store_mark_taken_buffers(op_context_store_t *store) {
-  op_context_t *ctx = store->taken;
-  while (ctx) {
-    for (unsigned int i = 0; i < ctx->buffer_count; i++)
-      rb_gc_mark(i == 0 ? ctx->buffer0 : ctx->buffers[i - 1]);
-    ctx = ctx->next;
+  for (op_context_slab_t *slab = store->slabs; slab; slab = slab->next) {
+    if (!slab->taken_count) continue;
+
+    for (int i = 0; i < OP_CONTEXT_SLAB_SIZE; i++) {
+      op_context_t *ctx = slab->contexts + i;
+      if (!ctx->ref_count) continue;
+
+      for (unsigned int j = 0; j < ctx->buffer_count; j++)
+        rb_gc_mark(j == 0 ? ctx->buffer0 : ctx->buffers[j - 1]);
+    }
   }
 }
 
@@ -134,4 +237,43 @@ inline void context_attach_buffers_v(op_context_t *ctx, unsigned int count, ...)
     else    ctx->buffers[i - 1] = va_arg(values, VALUE);
 
   va_end(values);
-}
\ No newline at end of file
+}
+
+#define MULTISHOT_QUEUE_INITIAL_SIZE 16
+
+inline void context_multishot_setup(op_context_t *ctx) {
+  ctx->multishot = malloc(sizeof(multishot_queue_t));
+  ctx->multishot->size = MULTISHOT_QUEUE_INITIAL_SIZE;
+  ctx->multishot->entries = malloc(sizeof(multishot_cqe_t) * ctx->multishot->size);
+  ctx->multishot->head = 0;
+  ctx->multishot->count = 0;
+  ctx->multishot->waiting = 0;
+}
+
+inline void context_multishot_push(op_context_t *ctx, int result, unsigned int flags) {
+  multishot_queue_t *queue = ctx->multishot;
+  if (queue->count == queue->size) {
+    unsigned int old_size = queue->size;
+    queue->size *= 2;
+    queue->entries = realloc(queue->entries, sizeof(multishot_cqe_t) * queue->size);
+    // move wrapped-around entries to the new space
+    if (queue->head)
+      memcpy(queue->entries + old_size, queue->entries, sizeof(multishot_cqe_t) * queue->head);
+  }
+  unsigned int idx = (queue->head + queue->count) % queue->size;
+  queue->entries[idx].result = result;
+  queue->entries[idx].flags = flags;
+  queue->count++;
+}
+
+// returns true if an entry was shifted
+inline int context_multishot_shift(op_context_t *ctx, int *result, unsigned int *flags) {
+  multishot_queue_t *queue = ctx->multishot;
+  if (!queue->count) return 0;
+
+  *result = queue->entries[queue->head].result;
+  *flags = queue->entries[queue->head].flags;
+  queue->head = (queue->head + 1) % queue->size;
+  queue->count--;
+  return 1;
+}
@@ -2,52 +2,85 @@
 #define BACKEND_IO_URING_CONTEXT_H
 
 #include "ruby.h"
+#include "backend_common.h"
 
-enum op_type {
-  OP_NONE,
-  OP_READ,
-  OP_WRITEV,
-  OP_WRITE,
-  OP_RECV,
-  OP_SEND,
-  OP_SPLICE,
-  OP_TIMEOUT,
-  OP_POLL,
-  OP_ACCEPT,
-  OP_CONNECT,
-  OP_CHAIN
-};
+// CQEs received for a multishot op, waiting to be consumed by the fiber
+typedef struct multishot_cqe {
+  int           result;
+  unsigned int  flags;
+} multishot_cqe_t;
+
+typedef struct multishot_queue {
+  multishot_cqe_t *entries;
+  unsigned int    size;
+  unsigned int    head;
+  unsigned int    count;
+  int             waiting;
+} multishot_queue_t;
+
+struct op_context_slab;
 
 typedef struct op_context {
-  struct op_context *prev;
+  struct op_context_slab *slab;
   struct op_context *next;
   enum op_type      type: 16;
   unsigned int      ref_count : 16;
   int               id;
   int               result;
+  unsigned int      cqe_flags;
   VALUE             fiber;
   VALUE             resume_value;
   unsigned int      buffer_count;
   VALUE             buffer0;
   VALUE             *buffers;
+  multishot_queue_t *multishot;
+  struct op_context *chain;
+  unsigned int      chain_index;
+  void              *chain_data;
+  uint64_t          start_time;
+  int               fd;
+  // set while the fiber waits for an interrupted op to be cancelled
+  int               cancel_waiting;
 } op_context_t;
 
+#define OP_CONTEXT_SLAB_SIZE 64
+
+// Contexts are allocated in slabs. A slab is freed only when none of its
+// contexts are in use.
+typedef struct op_context_slab {
+  struct op_context_slab  *next;
+  unsigned int            taken_count;
+  int                     trim;
+  op_context_t            contexts[OP_CONTEXT_SLAB_SIZE];
+} op_context_slab_t;
+
 typedef struct op_context_store {
-  int           last_id;
-  op_context_t  *available;
-  op_context_t  *taken;
-  int           available_count;
-  int           taken_count;
+  // used for recording the op start time when extended stats are enabled
+  struct Backend_base *base;
+  int               last_id;
+  op_context_slab_t *slabs;
+  op_context_t      *available;
+  unsigned int      slab_count;
+  unsigned int      taken_count;
+  // contexts are kept allocated up to the greater of the watermark and the
+  // peak number of contexts taken since the last trim
+  unsigned int      watermark;
+  unsigned int      peak_taken_count;
+  double            trim_interval;
+  double            last_trim_time;
 } op_context_store_t;
 
-const char *op_type_to_str(enum op_type type);
-
-void context_store_initialize(op_context_store_t *store);
+void context_store_initialize(op_context_store_t *store, struct Backend_base *base);
 op_context_t *context_store_acquire(op_context_store_t *store, enum op_type type);
 int context_store_release(op_context_store_t *store, op_context_t *ctx);
 void context_store_free(op_context_store_t *store);
+void context_store_reset(op_context_store_t *store);
+void context_store_trim(op_context_store_t *store);
 void context_store_mark_taken_buffers(op_context_store_t *store);
 void context_attach_buffers(op_context_t *ctx, unsigned int count, VALUE *buffers);
 void context_attach_buffers_v(op_context_t *ctx, unsigned int count, ...);
+void context_multishot_setup(op_context_t *ctx);
+void context_multishot_push(op_context_t *ctx, int result, unsigned int flags);
+int context_multishot_shift(op_context_t *ctx, int *result, unsigned int *flags);
 
 #endif /* BACKEND_IO_URING_CONTEXT_H */
\ No newline at end of file
@@ -51,8 +51,14 @@ thread.
 #include <stdnoreturn.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
 #include <fcntl.h>
+#ifdef POLYPHONY_LINUX
+#include <sys/sendfile.h>
+#endif
 
+#define BACKEND_NAMESPACE(name) libev_##name
+#include "backend_namespace.h"
 #include "polyphony.h"
 #include "../libev/ev.h"
 #include "ruby/io.h"
@@ -60,10 +66,16 @@ thread.
 #include "../libev/ev.h"
 #include "backend_common.h"
 
-VALUE SYM_libev;
-VALUE SYM_send;
-VALUE SYM_splice;
-VALUE SYM_write;
+static VALUE SYM_libev;
+static VALUE SYM_send;
+static VALUE SYM_splice;
+static VALUE SYM_write;
+static VALUE SYM_read;
+static VALUE SYM_recv;
+static VALUE SYM_poll;
+static VALUE SYM_timeout;
+static VALUE SYM_close;
+static VALUE SYM_shutdown;
 
 typedef struct Backend_t {
   struct Backend_base base;
@@ -71,6 +83,10 @@ typedef struct Backend_t {
   // implementation-specific fields
   struct ev_loop *ev_loop;
   struct ev_async break_async;
+  struct ev_io completion_watcher;
+  struct ev_timer idle_sweep_timer;
+  double idle_sweep_time;
+  unsigned int poll_completions;
 } Backend_t;
 
 static void Backend_mark(void *ptr) {
@@ -93,8 +109,11 @@ static const rb_data_type_t Backend_type = {
     0, 0, RUBY_TYPED_FREE_IMMEDIATELY
 };
 
+static const struct backend_interface backend_interface;
+
 static VALUE Backend_allocate(VALUE klass) {
   Backend_t *backend = ALLOC(Backend_t);
+  backend->base.interface = &backend_interface;
 
   return TypedData_Wrap_Struct(klass, &Backend_type, backend);
 }
@@ -116,13 +135,67 @@ inline struct ev_loop *libev_new_loop() {
   #endif
 }
 
-static VALUE Backend_initialize(VALUE self) {
+// Counts the watchers invoked in each iteration of the event loop
+static void libev_invoke_pending(EV_P) {
+  Backend_t *backend = ev_userdata(EV_A);
+  backend->poll_completions += ev_pending_count(EV_A);
+  ev_invoke_pending(EV_A);
+}
+
+static inline void libev_setup_loop(Backend_t *backend) {
+  ev_set_userdata(backend->ev_loop, backend);
+  ev_set_invoke_pending_cb(backend->ev_loop, libev_invoke_pending);
+}
+
+// The completion watcher is active only while thread pool jobs are in flight.
+static void libev_completion_callback(EV_P_ ev_io *w, int revents) {
+  Backend_t *backend = w->data;
+  backend_base_drain_completions(&backend->base);
+  if (!backend->base.completions_in_flight) ev_io_stop(EV_A_ w);
+}
+
+static void libev_idle_sweep_callback(EV_P_ ev_timer *w, int revents) {
+  Backend_t *backend = w->data;
+  double now = current_time();
+  double next = backend_idle_deadlines_sweep(&backend->base, now);
+  if (!next) return;
+
+  backend->idle_sweep_time = next;
+  ev_timer_set(w, next - now, 0.);
+  ev_timer_start(EV_A_ w);
+}
+
+static void libev_arm_idle_sweep(struct Backend_base *base, double time) {
+  Backend_t *backend = (Backend_t *)base;
+  struct ev_timer *w = &backend->idle_sweep_timer;
+  if (ev_is_active(w)) {
+    if (backend->idle_sweep_time <= time) return;
+    ev_timer_stop(backend->ev_loop, w);
+  }
+  backend->idle_sweep_time = time;
+  ev_timer_set(w, time - current_time(), 0.);
+  ev_timer_start(backend->ev_loop, w);
+}
+
+static inline void libev_idle_sweep_timer_init(Backend_t *backend) {
+  ev_timer_init(&backend->idle_sweep_timer, libev_idle_sweep_callback, 0., 0.);
+  backend->idle_sweep_timer.data = backend;
+  backend->idle_sweep_time = 0;
+}
+
+// Backend options (sqpoll etc.) apply only to the io_uring backend and are
+// ignored here.
+static VALUE Backend_initialize(int argc, VALUE *argv, VALUE self) {
   Backend_t *backend;
+  VALUE opts = Qnil;
 
   GetBackend(self, backend);
+  rb_scan_args(argc, argv, "01", &opts);
 
   backend_base_initialize(&backend->base);
   backend->ev_loop = libev_new_loop();
+  backend->poll_completions = 0;
+  libev_setup_loop(backend);
 
   // start async watcher used for breaking a poll op (from another thread)
   ev_async_init(&backend->break_async, break_async_callback);
@@ -131,6 +204,10 @@ static VALUE Backend_initialize(VALUE self) {
   // block when no other watcher is active
   ev_unref(backend->ev_loop);
 
+  ev_io_init(&backend->completion_watcher, libev_completion_callback, -1, EV_READ);
+  backend->completion_watcher.data = backend;
+  libev_idle_sweep_timer_init(backend);
+
   return Qnil;
 }
 
@@ -139,6 +216,10 @@ VALUE Backend_finalize(VALUE self) {
   GetBackend(self, backend);
 
    ev_async_stop(backend->ev_loop, &backend->break_async);
+  if (ev_is_active(&backend->completion_watcher))
+    ev_io_stop(backend->ev_loop, &backend->completion_watcher);
+  if (ev_is_active(&backend->idle_sweep_timer))
+    ev_timer_stop(backend->ev_loop, &backend->idle_sweep_timer);
 
   if (!ev_is_default_loop(backend->ev_loop)) ev_loop_destroy(backend->ev_loop);
 
@@ -156,8 +237,12 @@ VALUE Backend_post_fork(VALUE self) {
   // always a fresh one.
   ev_loop_destroy(backend->ev_loop);
   backend->ev_loop = EV_DEFAULT;
+  libev_setup_loop(backend);
 
   backend_base_reset(&backend->base);
+  ev_io_init(&backend->completion_watcher, libev_completion_callback, -1, EV_READ);
+  backend->completion_watcher.data = backend;
+  libev_idle_sweep_timer_init(backend);
 
   return self;
 }
@@ -169,10 +254,22 @@ inline VALUE Backend_poll(VALUE self, VALUE blocking) {
   backend->base.poll_count++;
 
   COND_TRACE(&backend->base, 2, SYM_fiber_event_poll_enter, rb_fiber_current());
+  TRACE_RING_RECORD(&backend->base, TRACE_POLL_ENTER, rb_fiber_current(), 0, 0, -1, 0, 0);
+  backend->poll_completions = 0;
+  if (blocking == Qtrue && backend->base.poll_busy_spin > 0) {
+    // busy-wait for events before blocking
+    double deadline = current_time() + backend->base.poll_busy_spin;
+    do {
+      ev_run(backend->ev_loop, EVRUN_NOWAIT);
+    } while (!backend->poll_completions && current_time() < deadline);
+    if (backend->poll_completions) blocking = Qnil;
+  }
   backend->base.currently_polling = 1;
   ev_run(backend->ev_loop, blocking == Qtrue ? EVRUN_ONCE : EVRUN_NOWAIT);
   backend->base.currently_polling = 0;
+  backend_base_record_completions(&backend->base, backend->poll_completions);
   COND_TRACE(&backend->base, 2, SYM_fiber_event_poll_leave, rb_fiber_current());
+  TRACE_RING_RECORD(&backend->base, TRACE_POLL_LEAVE, rb_fiber_current(), 0, 0, -1, 0, 0);
 
   return self;
 }
@@ -188,7 +285,7 @@ inline void Backend_unschedule_fiber(VALUE self, VALUE fiber) {
   Backend_t *backend;
   GetBackend(self, backend);
 
-  runqueue_delete(&backend->base.runqueue, fiber);
+  backend_base_unschedule_fiber(&backend->base, fiber);
 }
 
 inline VALUE Backend_switch_fiber(VALUE self) {
@@ -198,6 +295,17 @@ inline VALUE Backend_switch_fiber(VALUE self) {
   return backend_base_switch_fiber(self, &backend->base);
 }
 
+inline void Backend_watch_thread_pool_job(VALUE self, thread_pool_job_t *job) {
+  Backend_t *backend;
+  GetBackend(self, backend);
+
+  int fd = backend_base_watch_job(&backend->base, job);
+  if (!ev_is_active(&backend->completion_watcher)) {
+    ev_io_set(&backend->completion_watcher, fd, EV_READ);
+    ev_io_start(backend->ev_loop, &backend->completion_watcher);
+  }
+}
+
 VALUE Backend_wakeup(VALUE self) {
   Backend_t *backend;
   GetBackend(self, backend);
@@ -215,13 +323,6 @@ VALUE Backend_wakeup(VALUE self) {
   return Qnil;
 }
 
-inline struct backend_stats backend_get_stats(VALUE self) {
-  Backend_t *backend;
-  GetBackend(self, backend);
-
-  return backend_base_stats(&backend->base);
-}
-
 struct libev_io {
   struct ev_io io;
   VALUE fiber;
@@ -261,6 +362,82 @@ VALUE libev_wait_fd(Backend_t *backend, int fd, int events, int raise_exception)
   return switchpoint_result;
 }
 
+// Regular files always report as readable, so a read from a regular file
+// might block the entire thread on disk I/O. Such reads are first attempted
+// from the page cache without blocking (using RWF_NOWAIT where available), and
+// otherwise offloaded to the native thread pool. The file type is checked once
+// per IO instance and cached in a hidden ivar, except for frozen IOs, which are
+// checked on every call.
+static inline int libev_regular_file_p(rb_io_t *fptr, VALUE io) {
+  VALUE regular_file = rb_ivar_get(io, ID_regular_file);
+  if (regular_file == Qnil) {
+    struct stat st;
+    regular_file = (!fstat(fptr->fd, &st) && S_ISREG(st.st_mode)) ? Qtrue : Qfalse;
+    if (!OBJ_FROZEN(io)) rb_ivar_set(io, ID_regular_file, regular_file);
+  }
+  return regular_file == Qtrue;
+}
+
+struct file_read_job {
+  int     fd;
+  off_t   offset;
+  size_t  len;
+  ssize_t result;
+  int     error;
+  char    buf[];
+};
+
+static void file_read_job_run(void *ptr) {
+  struct file_read_job *data = ptr;
+  data->result = pread(data->fd, data->buf, data->len, data->offset);
+  data->error = data->result < 0 ? errno : 0;
+}
+
+static void file_read_job_cleanup(void *ptr) {
+  struct file_read_job *data = ptr;
+  close(data->fd);
+}
+
+// Reads from a regular file at its current position. The job may outlive the
+// read op if the fiber is interrupted, so it reads into its own buffer, from
+// its own duplicate of the fd, at an explicit offset. The file position is
+// advanced only once the read is done and its result consumed, so an
+// abandoned read has no visible effect. Sets *offloaded if the fiber was
+// suspended while reading.
+static ssize_t libev_file_read(Backend_t *backend, int fd, char *buf, size_t len, int *offloaded) {
+  backend->base.op_count++;
+#ifdef RWF_NOWAIT
+  struct iovec iov = { buf, len };
+  ssize_t n = preadv2(fd, &iov, 1, -1, RWF_NOWAIT);
+  if (n >= 0) return n;
+  // on EAGAIN, or if RWF_NOWAIT is not supported, fall back to the thread pool
+#endif
+
+  off_t offset = lseek(fd, 0, SEEK_CUR);
+  if (offset < 0) rb_syserr_fail(errno, strerror(errno));
+  int job_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  if (job_fd < 0) rb_syserr_fail(errno, strerror(errno));
+
+  thread_pool_job_t *job = thread_pool_job_new(file_read_job_run, sizeof(struct file_read_job) + len);
+  struct file_read_job *data = (struct file_read_job *)job->data;
+  data->fd = job_fd;
+  data->offset = offset;
+  data->len = len;
+  job->cleanup = file_read_job_cleanup;
+
+  *offloaded = 1;
+  thread_pool_run(Qnil, job);
+
+  ssize_t result = data->result;
+  int e = data->error;
+  if (result > 0) memcpy(buf, data->buf, result);
+  thread_pool_job_free(job);
+
+  if (result < 0) rb_syserr_fail(e, strerror(e));
+  if (result > 0) lseek(fd, offset + result, SEEK_SET);
+  return result;
+}
+
 VALUE Backend_read(VALUE self, VALUE io, VALUE str, VALUE length, VALUE to_eof, VALUE pos) {
   Backend_t *backend;
   struct libev_io watcher;
@@ -281,6 +458,7 @@ VALUE Backend_read(VALUE self, VALUE io, VALUE str, VALUE length, VALUE to_eof,
   VALUE underlying_io = rb_ivar_get(io, ID_ivar_io);
 
   GetBackend(self, backend);
+  uint64_t op_start = BACKEND_STATS_OP_START(&backend->base);
   if (underlying_io != Qnil) io = underlying_io;
   GetOpenFile(io, fptr);
   rb_io_check_byte_readable(fptr);
@@ -288,10 +466,17 @@ VALUE Backend_read(VALUE self, VALUE io, VALUE str, VALUE length, VALUE to_eof,
   rectify_io_file_pos(fptr);
   watcher.fiber = Qnil;
   OBJ_TAINT(str);
+  int regular_file = libev_regular_file_p(fptr, io);
 
   while (1) {
-    backend->base.op_count++;
-    ssize_t n = read(fptr->fd, buf, len - total);
+    int offloaded = 0;
+    ssize_t n;
+    if (regular_file)
+      n = libev_file_read(backend, fptr->fd, buf, len - total, &offloaded);
+    else {
+      backend->base.op_count++;
+      n = read(fptr->fd, buf, len - total);
+    }
     if (n < 0) {
       int e = errno;
       if (e != EWOULDBLOCK && e != EAGAIN) rb_syserr_fail(e, strerror(e));
@@ -301,8 +486,12 @@ VALUE Backend_read(VALUE self, VALUE io, VALUE str, VALUE length, VALUE to_eof,
       if (TEST_EXCEPTION(switchpoint_result)) goto error;
     }
     else {
-      switchpoint_result = backend_snooze();
-      if (TEST_EXCEPTION(switchpoint_result)) goto error;
+      BACKEND_RECORD_OP(&backend->base, OP_READ, op_start, fptr->fd, n);
+      op_start = BACKEND_STATS_OP_START(&backend->base);
+      if (!offloaded) {
+        switchpoint_result = backend_snooze();
+        if (TEST_EXCEPTION(switchpoint_result)) goto error;
+      }
 
       if (n == 0) break; // EOF
       total = total + n;
@@ -334,6 +523,56 @@ error:
   return RAISE_EXCEPTION(switchpoint_result);
 }
 
+// Reads into the given buffers using a single readv(2) call, returning the
+// total number of bytes read, or nil on EOF.
+VALUE Backend_readv(VALUE self, VALUE io, VALUE buffers) {
+  Backend_t *backend;
+  struct libev_io watcher;
+  rb_io_t *fptr;
+  int iov_count;
+  VALUE strs = rb_ary_new();
+  VALUE switchpoint_result = Qnil;
+  VALUE underlying_io = rb_ivar_get(io, ID_ivar_io);
+
+  GetBackend(self, backend);
+  uint64_t op_start = BACKEND_STATS_OP_START(&backend->base);
+  if (underlying_io != Qnil) io = underlying_io;
+  GetOpenFile(io, fptr);
+  rb_io_check_byte_readable(fptr);
+  io_verify_blocking_mode(fptr, io, Qfalse);
+  rectify_io_file_pos(fptr);
+  watcher.fiber = Qnil;
+
+  struct iovec *iov = io_readv_setup(buffers, strs, &iov_count);
+  ssize_t n;
+
+  while (1) {
+    backend->base.op_count++;
+    n = readv(fptr->fd, iov, iov_count);
+    if (n < 0) {
+      int e = errno;
+      if (e != EWOULDBLOCK && e != EAGAIN) rb_syserr_fail(e, strerror(e));
+
+      switchpoint_result = libev_wait_fd_with_watcher(backend, fptr->fd, &watcher, EV_READ);
+      if (TEST_EXCEPTION(switchpoint_result)) goto error;
+    }
+    else {
+      BACKEND_RECORD_OP(&backend->base, OP_READV, op_start, fptr->fd, n);
+      switchpoint_result = backend_snooze();
+      if (TEST_EXCEPTION(switchpoint_result)) goto error;
+      break;
+    }
+  }
+
+  io_readv_set_lengths(strs, iov, n, fptr);
+  RB_GC_GUARD(watcher.fiber);
+  RB_GC_GUARD(switchpoint_result);
+  RB_GC_GUARD(strs);
+  return n ? INT2NUM(n) : Qnil;
+error:
+  return RAISE_EXCEPTION(switchpoint_result);
+}
+
 VALUE Backend_recv(VALUE self, VALUE io, VALUE str, VALUE length, VALUE pos) {
   return Backend_read(self, io, str, length, Qnil, pos);
 }
@@ -353,16 +592,24 @@ VALUE Backend_read_loop(VALUE self, VALUE io, VALUE maxlen) {
   READ_LOOP_PREPARE_STR();
 
   GetBackend(self, backend);
+  uint64_t op_start = BACKEND_STATS_OP_START(&backend->base);
   if (underlying_io != Qnil) io = underlying_io;
   GetOpenFile(io, fptr);
   rb_io_check_byte_readable(fptr);
   io_verify_blocking_mode(fptr, io, Qfalse);
   rectify_io_file_pos(fptr);
   watcher.fiber = Qnil;
+  int regular_file = libev_regular_file_p(fptr, io);
 
   while (1) {
-    backend->base.op_count++;
-    ssize_t n = read(fptr->fd, buf, len);
+    int offloaded = 0;
+    ssize_t n;
+    if (regular_file)
+      n = libev_file_read(backend, fptr->fd, buf, len, &offloaded);
+    else {
+      backend->base.op_count++;
+      n = read(fptr->fd, buf, len);
+    }
     if (n < 0) {
       int e = errno;
       if ((e != EWOULDBLOCK && e != EAGAIN)) rb_syserr_fail(e, strerror(e));
@@ -371,9 +618,12 @@ VALUE Backend_read_loop(VALUE self, VALUE io, VALUE maxlen) {
       if (TEST_EXCEPTION(switchpoint_result)) goto error;
     }
     else {
-      switchpoint_result = backend_snooze();
-
-      if (TEST_EXCEPTION(switchpoint_result)) goto error;
+      BACKEND_RECORD_OP(&backend->base, OP_READ, op_start, fptr->fd, n);
+      op_start = BACKEND_STATS_OP_START(&backend->base);
+      if (!offloaded) {
+        switchpoint_result = backend_snooze();
+        if (TEST_EXCEPTION(switchpoint_result)) goto error;
+      }
 
       if (n == 0) break; // EOF
       total = n;
@@ -390,6 +640,65 @@ error:
   return RAISE_EXCEPTION(switchpoint_result);
 }
 
+static VALUE libev_backend_gets_loop(VALUE arg) {
+  struct gets_loop_ctx *ctx = (struct gets_loop_ctx *)arg;
+  Backend_t *backend;
+  struct libev_io watcher;
+  VALUE switchpoint_result = Qnil;
+  GetBackend(ctx->backend, backend);
+  watcher.fiber = Qnil;
+
+  while (1) {
+    long len;
+    char *buf = io_gets_loop_reserve(ctx, &len);
+    backend->base.op_count++;
+    ssize_t n = read(ctx->fptr->fd, buf, len);
+    if (n < 0) {
+      int e = errno;
+      if ((e != EWOULDBLOCK && e != EAGAIN)) rb_syserr_fail(e, strerror(e));
+
+      switchpoint_result = libev_wait_fd_with_watcher(backend, ctx->fptr->fd, &watcher, EV_READ);
+      if (TEST_EXCEPTION(switchpoint_result)) goto error;
+    }
+    else {
+      BACKEND_TOUCH_IDLE_DEADLINE(&backend->base, rb_fiber_current(), OP_READ, n);
+      switchpoint_result = backend_snooze();
+
+      if (TEST_EXCEPTION(switchpoint_result)) goto error;
+
+      if (n == 0) break; // EOF
+      io_gets_loop_commit(ctx, n);
+    }
+  }
+
+  io_gets_loop_finish(ctx);
+
+  RB_GC_GUARD(watcher.fiber);
+  RB_GC_GUARD(switchpoint_result);
+
+  return ctx->io;
+error:
+  return RAISE_EXCEPTION(switchpoint_result);
+}
+
+VALUE Backend_gets_loop(VALUE self, VALUE io, VALUE sep, VALUE chomp, VALUE buffer) {
+  struct gets_loop_ctx ctx;
+  rb_io_t *fptr;
+  VALUE underlying_io = rb_ivar_get(io, ID_ivar_io);
+
+  if (underlying_io != Qnil) io = underlying_io;
+  GetOpenFile(io, fptr);
+  rb_io_check_byte_readable(fptr);
+  io_verify_blocking_mode(fptr, io, Qfalse);
+  rectify_io_file_pos(fptr);
+
+  io_gets_loop_setup(&ctx, self, io, fptr, buffer, sep, chomp);
+  rb_ensure(libev_backend_gets_loop, (VALUE)&ctx, io_gets_loop_cleanup, (VALUE)&ctx);
+  RB_GC_GUARD(ctx.buffer);
+  RB_GC_GUARD(ctx.sep);
+  return io;
+}
+
 VALUE Backend_feed_loop(VALUE self, VALUE io, VALUE receiver, VALUE method) {
   Backend_t *backend;
   struct libev_io watcher;
@@ -402,6 +711,7 @@ VALUE Backend_feed_loop(VALUE self, VALUE io, VALUE receiver, VALUE method) {
   VALUE switchpoint_result = Qnil;
   VALUE underlying_io = rb_ivar_get(io, ID_ivar_io);
   ID method_id = SYM2ID(method);
+  const polyphony_native_feed_t *native_feed = backend_native_feed(receiver);
 
   READ_LOOP_PREPARE_STR();
 
@@ -424,13 +734,14 @@ VALUE Backend_feed_loop(VALUE self, VALUE io, VALUE receiver, VALUE method) {
       if (TEST_EXCEPTION(switchpoint_result)) goto error;
     }
     else {
+      BACKEND_TOUCH_IDLE_DEADLINE(&backend->base, rb_fiber_current(), OP_READ, n);
       switchpoint_result = backend_snooze();
 
       if (TEST_EXCEPTION(switchpoint_result)) goto error;
 
       if (n == 0) break; // EOF
       total = n;
-      READ_LOOP_PASS_STR_TO_RECEIVER(receiver, method_id);
+      READ_LOOP_FEED_RECEIVER(native_feed, receiver, method_id);
     }
   }
 
@@ -456,6 +767,7 @@ VALUE Backend_write(VALUE self, VALUE io, VALUE str) {
   underlying_io = rb_ivar_get(io, ID_ivar_io);
   if (underlying_io != Qnil) io = underlying_io;
   GetBackend(self, backend);
+  uint64_t op_start = BACKEND_STATS_OP_START(&backend->base);
   io = rb_io_get_write_io(io);
   GetOpenFile(io, fptr);
   io_verify_blocking_mode(fptr, io, Qfalse);
@@ -473,6 +785,8 @@ VALUE Backend_write(VALUE self, VALUE io, VALUE str) {
       if (TEST_EXCEPTION(switchpoint_result)) goto error;
     }
     else {
+      BACKEND_RECORD_OP(&backend->base, OP_WRITE, op_start, fptr->fd, n);
+      op_start = BACKEND_STATS_OP_START(&backend->base);
       buf += n;
       left -= n;
     }
@@ -507,6 +821,7 @@ VALUE Backend_writev(VALUE self, VALUE io, int argc, VALUE *argv) {
   underlying_io = rb_ivar_get(io, ID_ivar_io);
   if (underlying_io != Qnil) io = underlying_io;
   GetBackend(self, backend);
+  uint64_t op_start = BACKEND_STATS_OP_START(&backend->base);
   io = rb_io_get_write_io(io);
   GetOpenFile(io, fptr);
   io_verify_blocking_mode(fptr, io, Qfalse);
@@ -536,6 +851,8 @@ VALUE Backend_writev(VALUE self, VALUE io, int argc, VALUE *argv) {
       if (TEST_EXCEPTION(switchpoint_result)) goto error;
     }
     else {
+      BACKEND_RECORD_OP(&backend->base, OP_WRITEV, op_start, fptr->fd, n);
+      op_start = BACKEND_STATS_OP_START(&backend->base);
       total_written += n;
       if (total_written == total_length) break;
 
@@ -590,9 +907,16 @@ VALUE Backend_accept(VALUE self, VALUE server_socket, VALUE socket_class) {
   if (underlying_sock != Qnil) server_socket = underlying_sock;
 
   GetBackend(self, backend);
+  uint64_t op_start = BACKEND_STATS_OP_START(&backend->base);
   GetOpenFile(server_socket, fptr);
   io_verify_blocking_mode(fptr, server_socket, Qfalse);
   watcher.fiber = Qnil;
+
+  // Switchpoints only happen while no connection is held, so an interrupted
+  // accept never drops an accepted connection.
+  switchpoint_result = backend_snooze();
+  if (TEST_EXCEPTION(switchpoint_result)) goto error;
+
   while (1) {
     backend->base.op_count++;
     fd = accept(fptr->fd, &addr, &len);
@@ -605,14 +929,9 @@ VALUE Backend_accept(VALUE self, VALUE server_socket, VALUE socket_class) {
       if (TEST_EXCEPTION(switchpoint_result)) goto error;
     }
     else {
+      BACKEND_RECORD_OP(&backend->base, OP_ACCEPT, op_start, fptr->fd, fd);
       VALUE socket;
       rb_io_t *fp;
-      switchpoint_result = backend_snooze();
-
-      if (TEST_EXCEPTION(switchpoint_result)) {
-        close(fd); // close fd since we're raising an exception
-        goto error;
-      }
 
       socket = rb_obj_alloc(socket_class);
       MakeOpenFile(socket, fp);
@@ -648,6 +967,7 @@ VALUE Backend_accept_loop(VALUE self, VALUE server_socket, VALUE socket_class) {
   if (underlying_sock != Qnil) server_socket = underlying_sock;
 
   GetBackend(self, backend);
+  uint64_t op_start = BACKEND_STATS_OP_START(&backend->base);
   GetOpenFile(server_socket, fptr);
   io_verify_blocking_mode(fptr, server_socket, Qfalse);
   watcher.fiber = Qnil;
@@ -664,13 +984,9 @@ VALUE Backend_accept_loop(VALUE self, VALUE server_socket, VALUE socket_class) {
       if (TEST_EXCEPTION(switchpoint_result)) goto error;
     }
     else {
+      BACKEND_RECORD_OP(&backend->base, OP_ACCEPT, op_start, fptr->fd, fd);
+      op_start = BACKEND_STATS_OP_START(&backend->base);
       rb_io_t *fp;
-      switchpoint_result = backend_snooze();
-
-      if (TEST_EXCEPTION(switchpoint_result)) {
-        close(fd); // close fd since we're raising an exception
-        goto error;
-      }
 
       socket = rb_obj_alloc(socket_class);
       MakeOpenFile(socket, fp);
@@ -683,6 +999,10 @@ VALUE Backend_accept_loop(VALUE self, VALUE server_socket, VALUE socket_class) {
 
       rb_yield(socket);
       socket = Qnil;
+
+      // snooze between accepts, so an interrupt never drops a connection
+      switchpoint_result = backend_snooze();
+      if (TEST_EXCEPTION(switchpoint_result)) goto error;
     }
   }
 
@@ -694,12 +1014,21 @@ error:
   return RAISE_EXCEPTION(switchpoint_result);
 }
 
+// Returns the pending error (e.g. of a non-blocking connect) on the given
+// socket.
+static inline int libev_socket_error(int fd) {
+  int error = 0;
+  socklen_t len = sizeof(error);
+  if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) return errno;
+  return error;
+}
+
 VALUE Backend_connect(VALUE self, VALUE sock, VALUE host, VALUE port) {
   Backend_t *backend;
   struct libev_io watcher;
   rb_io_t *fptr;
-  struct sockaddr_in addr;
-  char *host_buf = StringValueCStr(host);
+  struct sockaddr_storage addr;
+  socklen_t addrlen = backend_sockaddr(host, port, &addr);
   VALUE switchpoint_result = Qnil;
   VALUE underlying_sock = rb_ivar_get(sock, ID_ivar_io);
   if (underlying_sock != Qnil) sock = underlying_sock;
@@ -709,12 +1038,9 @@ VALUE Backend_connect(VALUE self, VALUE sock, VALUE host, VALUE port) {
   io_verify_blocking_mode(fptr, sock, Qfalse);
   watcher.fiber = Qnil;
 
-  addr.sin_family = AF_INET;
-  addr.sin_addr.s_addr = inet_addr(host_buf);
-  addr.sin_port = htons(NUM2INT(port));
-
+  uint64_t op_start = BACKEND_STATS_OP_START(&backend->base);
   backend->base.op_count++;
-  int result = connect(fptr->fd, (struct sockaddr *)&addr, sizeof(addr));
+  int result = connect(fptr->fd, (struct sockaddr *)&addr, addrlen);
   if (result < 0) {
     int e = errno;
     if (e != EINPROGRESS) rb_syserr_fail(e, strerror(e));
@@ -722,12 +1048,15 @@ VALUE Backend_connect(VALUE self, VALUE sock, VALUE host, VALUE port) {
     switchpoint_result = libev_wait_fd_with_watcher(backend, fptr->fd, &watcher, EV_WRITE);
 
     if (TEST_EXCEPTION(switchpoint_result)) goto error;
+    e = libev_socket_error(fptr->fd);
+    if (e) rb_syserr_fail(e, strerror(e));
   }
   else {
     switchpoint_result = backend_snooze();
 
     if (TEST_EXCEPTION(switchpoint_result)) goto error;
   }
+  BACKEND_RECORD_OP(&backend->base, OP_CONNECT, op_start, fptr->fd, 0);
   RB_GC_GUARD(switchpoint_result);
   return sock;
 error:
@@ -748,6 +1077,7 @@ VALUE Backend_send(VALUE self, VALUE io, VALUE str, VALUE flags) {
   underlying_io = rb_ivar_get(io, ID_ivar_io);
   if (underlying_io != Qnil) io = underlying_io;
   GetBackend(self, backend);
+  uint64_t op_start = BACKEND_STATS_OP_START(&backend->base);
   io = rb_io_get_write_io(io);
   GetOpenFile(io, fptr);
   io_verify_blocking_mode(fptr, io, Qfalse);
@@ -765,6 +1095,8 @@ VALUE Backend_send(VALUE self, VALUE io, VALUE str, VALUE flags) {
       if (TEST_EXCEPTION(switchpoint_result)) goto error;
     }
     else {
+      BACKEND_RECORD_OP(&backend->base, OP_SEND, op_start, fptr->fd, n);
+      op_start = BACKEND_STATS_OP_START(&backend->base);
       buf += n;
       left -= n;
     }
@@ -784,6 +1116,128 @@ error:
   return RAISE_EXCEPTION(switchpoint_result);
 }
 
+// Receives datagrams into the given batch, waiting for the socket to become
+// readable if none are available. Returns the number of datagrams received.
+static unsigned int libev_udp_batch_recv(Backend_t *backend, VALUE io, udp_batch_t *batch) {
+  struct libev_io watcher;
+  rb_io_t *fptr;
+  VALUE switchpoint_result = Qnil;
+  VALUE underlying_io = rb_ivar_get(io, ID_ivar_io);
+  uint64_t op_start = BACKEND_STATS_OP_START(&backend->base);
+
+  if (underlying_io != Qnil) io = underlying_io;
+  GetOpenFile(io, fptr);
+  rb_io_check_byte_readable(fptr);
+  io_verify_blocking_mode(fptr, io, Qfalse);
+  watcher.fiber = Qnil;
+
+  while (1) {
+    backend->base.op_count++;
+    int n = udp_batch_recv_nonblock(fptr->fd, batch, 0);
+    if (n < 0) {
+      int e = errno;
+      if ((e != EWOULDBLOCK && e != EAGAIN)) rb_syserr_fail(e, strerror(e));
+
+      switchpoint_result = libev_wait_fd_with_watcher(backend, fptr->fd, &watcher, EV_READ);
+      RAISE_IF_EXCEPTION(switchpoint_result);
+    }
+    else {
+      BACKEND_RECORD_OP(&backend->base, OP_RECVMSG, op_start, fptr->fd, udp_batch_total_len(batch, 0, n));
+      if (watcher.fiber == Qnil) {
+        switchpoint_result = backend_snooze();
+        RAISE_IF_EXCEPTION(switchpoint_result);
+      }
+      RB_GC_GUARD(switchpoint_result);
+      return n;
+    }
+  }
+}
+
+// Sends all datagrams in the given batch, waiting for the socket to become
+// writable as needed.
+static void libev_udp_batch_send(Backend_t *backend, VALUE io, udp_batch_t *batch) {
+  struct libev_io watcher;
+  rb_io_t *fptr;
+  VALUE switchpoint_result = Qnil;
+  VALUE underlying_io = rb_ivar_get(io, ID_ivar_io);
+  uint64_t op_start = BACKEND_STATS_OP_START(&backend->base);
+  unsigned int sent = 0;
+
+  if (underlying_io != Qnil) io = underlying_io;
+  io = rb_io_get_write_io(io);
+  GetOpenFile(io, fptr);
+  io_verify_blocking_mode(fptr, io, Qfalse);
+  watcher.fiber = Qnil;
+
+  while (sent < batch->count) {
+    backend->base.op_count++;
+    int n = udp_batch_send_nonblock(fptr->fd, batch, sent);
+    if (n < 0) {
+      int e = errno;
+      if ((e != EWOULDBLOCK && e != EAGAIN)) rb_syserr_fail(e, strerror(e));
+
+      switchpoint_result = libev_wait_fd_with_watcher(backend, fptr->fd, &watcher, EV_WRITE);
+      RAISE_IF_EXCEPTION(switchpoint_result);
+    }
+    else {
+      BACKEND_RECORD_OP(&backend->base, OP_SENDMSG, op_start, fptr->fd, udp_batch_total_len(batch, sent, n));
+      op_start = BACKEND_STATS_OP_START(&backend->base);
+      sent += n;
+    }
+  }
+
+  if (watcher.fiber == Qnil) {
+    switchpoint_result = backend_snooze();
+    RAISE_IF_EXCEPTION(switchpoint_result);
+  }
+  RB_GC_GUARD(switchpoint_result);
+}
+
+VALUE Backend_recvfrom(VALUE self, VALUE io, VALUE maxlen, VALUE flags) {
+  Backend_t *backend;
+  udp_batch_t batch;
+
+  GetBackend(self, backend);
+  udp_batch_init_recv(&batch, INT2FIX(1), maxlen, NUM2INT(flags));
+  libev_udp_batch_recv(backend, io, &batch);
+  return RARRAY_AREF(udp_batch_recv_result(&batch, 1), 0);
+}
+
+VALUE Backend_sendto(VALUE self, VALUE io, VALUE msg, VALUE flags, VALUE addr) {
+  Backend_t *backend;
+  udp_batch_t batch;
+  VALUE msgs = rb_ary_new_from_args(1, msg);
+
+  GetBackend(self, backend);
+  udp_batch_init_send(&batch, msgs, addr, NUM2INT(flags));
+  libev_udp_batch_send(backend, io, &batch);
+  RB_GC_GUARD(batch.scratch);
+  RB_GC_GUARD(batch.msgs);
+  return LONG2NUM(udp_batch_total_len(&batch, 0, 1));
+}
+
+VALUE Backend_recvmmsg(VALUE self, VALUE io, VALUE count, VALUE maxlen) {
+  Backend_t *backend;
+  udp_batch_t batch;
+
+  GetBackend(self, backend);
+  udp_batch_init_recv(&batch, count, maxlen, 0);
+  unsigned int received = libev_udp_batch_recv(backend, io, &batch);
+  return udp_batch_recv_result(&batch, received);
+}
+
+VALUE Backend_sendmmsg(VALUE self, VALUE io, VALUE msgs, VALUE addr) {
+  Backend_t *backend;
+  udp_batch_t batch;
+
+  GetBackend(self, backend);
+  udp_batch_init_send(&batch, msgs, addr, 0);
+  libev_udp_batch_send(backend, io, &batch);
+  RB_GC_GUARD(batch.scratch);
+  RB_GC_GUARD(batch.msgs);
+  return UINT2NUM(batch.count);
+}
+
 struct libev_rw_ctx {
   int ref_count;
   VALUE fiber;
@@ -1109,8 +1563,11 @@ VALUE Backend_wait_io(VALUE self, VALUE io, VALUE write) {
   GetBackend(self, backend);
   GetOpenFile(io, fptr);
 
+  uint64_t op_start = BACKEND_STATS_OP_START(&backend->base);
   backend->base.op_count++;
-  return libev_wait_fd(backend, fptr->fd, events, 1);
+  VALUE ret = libev_wait_fd(backend, fptr->fd, events, 1);
+  BACKEND_RECORD_OP(&backend->base, OP_POLL, op_start, fptr->fd, 0);
+  return ret;
 }
 
 struct libev_timer {
@@ -1124,6 +1581,166 @@ void Backend_timer_callback(EV_P_ ev_timer *w, int revents)
   Fiber_make_runnable(watcher->fiber, Qnil);
 }
 
+struct libev_connect_attempt {
+  struct ev_io io;
+  VALUE fiber;
+  int ready;
+};
+
+void Backend_connect_attempt_callback(EV_P_ ev_io *w, int revents) {
+  struct libev_connect_attempt *watcher = (struct libev_connect_attempt *)w;
+  ev_io_stop(EV_A_ w);
+  watcher->ready = 1;
+  Fiber_make_runnable(watcher->fiber, Qnil);
+}
+
+static inline void libev_connect_race_start(Backend_t *backend, connect_race_t *race, struct libev_connect_attempt *watchers) {
+  connect_attempt_t *attempt = connect_race_next_attempt(race, 1);
+  if (!attempt) return;
+
+  backend->base.op_count++;
+  if (!connect(attempt->fd, (struct sockaddr *)&attempt->addr, attempt->addrlen)) {
+    connect_race_attempt_done(race, attempt, 0);
+    return;
+  }
+  if (errno != EINPROGRESS) {
+    connect_race_attempt_done(race, attempt, errno);
+    return;
+  }
+
+  struct libev_connect_attempt *watcher = watchers + (attempt - race->attempts);
+  watcher->fiber = rb_fiber_current();
+  watcher->ready = 0;
+  ev_io_init(&watcher->io, Backend_connect_attempt_callback, attempt->fd, EV_WRITE);
+  ev_io_start(backend->ev_loop, &watcher->io);
+  attempt->op = watcher;
+}
+
+static inline void libev_connect_race_stop(Backend_t *backend, connect_race_t *race) {
+  for (unsigned int i = 0; i < race->started; i++) {
+    connect_attempt_t *attempt = race->attempts + i;
+    if (attempt->op) ev_io_stop(backend->ev_loop, &((struct libev_connect_attempt *)attempt->op)->io);
+  }
+}
+
+// Connects to the first of the given addrinfos to accept the connection, and
+// returns the connected socket. Attempts are started in order, each one after
+// the given delay or as soon as all previous attempts have failed, and are
+// left to race each other (as in Happy Eyeballs, RFC 8305). Once an attempt
+// succeeds, the losers are closed.
+VALUE Backend_connect_racing(VALUE self, VALUE addrinfos, VALUE stagger_delay) {
+  Backend_t *backend;
+  connect_race_t race;
+  connect_attempt_t *winner = NULL;
+  struct libev_timer timer;
+  VALUE switchpoint_result = Qnil;
+
+  GetBackend(self, backend);
+  connect_race_init(&race, addrinfos, stagger_delay);
+  // watchers are kept in a scratch string, as are the attempts
+  char *ptr;
+  VALUE watchers_scratch = backend_scratch_buffer(race.count * sizeof(struct libev_connect_attempt), &ptr);
+  struct libev_connect_attempt *watchers = (struct libev_connect_attempt *)ptr;
+  timer.fiber = rb_fiber_current();
+  uint64_t op_start = BACKEND_STATS_OP_START(&backend->base);
+
+  while (1) {
+    while (!race.pending && race.started < race.count)
+      libev_connect_race_start(backend, &race, watchers);
+    // connects might succeed immediately
+    for (unsigned int i = 0; i < race.started && !winner; i++)
+      if (race.attempts[i].done && race.attempts[i].fd >= 0) winner = race.attempts + i;
+    if (winner || !race.pending) break;
+
+    int staggered = race.started < race.count;
+    if (staggered) {
+      ev_timer_init(&timer.timer, Backend_timer_callback, race.stagger_delay, 0.);
+      ev_timer_start(backend->ev_loop, &timer.timer);
+    }
+    switchpoint_result = backend_await((struct Backend_base *)backend);
+    int expired = staggered && !ev_is_active(&timer.timer);
+    if (staggered) ev_timer_stop(backend->ev_loop, &timer.timer);
+
+    if (TEST_EXCEPTION(switchpoint_result)) {
+      libev_connect_race_stop(backend, &race);
+      connect_race_close_losers(&race, NULL);
+      RAISE_EXCEPTION(switchpoint_result);
+    }
+
+    for (unsigned int i = 0; i < race.started && !winner; i++) {
+      connect_attempt_t *attempt = race.attempts + i;
+      struct libev_connect_attempt *watcher = attempt->op;
+      if (attempt->done || !watcher->ready) continue;
+
+      attempt->op = NULL;
+      int e = libev_socket_error(attempt->fd);
+      connect_race_attempt_done(&race, attempt, e);
+      if (!e) winner = attempt;
+    }
+    if (winner) break;
+    if (expired) libev_connect_race_start(backend, &race, watchers);
+  }
+  RB_GC_GUARD(switchpoint_result);
+
+  libev_connect_race_stop(backend, &race);
+  if (!winner) connect_race_fail(&race);
+  BACKEND_RECORD_OP(&backend->base, OP_CONNECT, op_start, winner->fd, 0);
+  VALUE sock = connect_race_winner_socket(&race, winner);
+  RB_GC_GUARD(race.scratch);
+  RB_GC_GUARD(watchers_scratch);
+  return sock;
+}
+
+static void close_job_run(void *ptr) {
+  close(*(int *)ptr);
+}
+
+// Closes the given io. Closing a socket that has SO_LINGER set might block
+// until unsent data is transmitted, so the descriptor is detached from the io
+// and closed on the native thread pool. If the fiber is interrupted while
+// waiting, the descriptor is still closed once the job is done. Otherwise the
+// close never blocks, and is done inline.
+VALUE Backend_close(VALUE self, VALUE io) {
+  Backend_t *backend;
+  int may_block = 0;
+  GetBackend(self, backend);
+
+  uint64_t op_start = BACKEND_STATS_OP_START(&backend->base);
+  int fd = backend_io_detach_fd(io, &may_block);
+  if (fd < 0) return Qnil;
+
+  backend->base.op_count++;
+  if (may_block) {
+    thread_pool_job_t *job = thread_pool_job_new(close_job_run, sizeof(int));
+    *(int *)job->data = fd;
+    thread_pool_run(Qnil, job);
+    thread_pool_job_free(job);
+  }
+  else
+    close(fd);
+  BACKEND_RECORD_OP(&backend->base, OP_CLOSE, op_start, fd, 0);
+  return Qnil;
+}
+
+// Shuts down the given socket (see BasicSocket#shutdown). Shutting down a
+// socket never blocks, so this is done inline.
+VALUE Backend_shutdown(VALUE self, VALUE io, VALUE how) {
+  Backend_t *backend;
+  rb_io_t *fptr;
+  int mode = backend_shutdown_how(how);
+  VALUE underlying_io = rb_ivar_get(io, ID_ivar_io);
+  if (underlying_io != Qnil) io = underlying_io;
+
+  GetBackend(self, backend);
+  GetOpenFile(io, fptr);
+
+  uint64_t op_start = BACKEND_STATS_OP_START(&backend->base);
+  backend->base.op_count++;
+  if (shutdown(fptr->fd, mode) < 0) rb_syserr_fail(errno, strerror(errno));
+  BACKEND_RECORD_OP(&backend->base, OP_SHUTDOWN, op_start, fptr->fd, 0);
+  return INT2FIX(0);
+}
+
 VALUE Backend_sleep(VALUE self, VALUE duration) {
   Backend_t *backend;
   struct libev_timer watcher;
@@ -1134,10 +1751,12 @@ VALUE Backend_sleep(VALUE self, VALUE duration) {
   ev_timer_init(&watcher.timer, Backend_timer_callback, NUM2DBL(duration), 0.);
   ev_timer_start(backend->ev_loop, &watcher.timer);
   backend->base.op_count++;
+  uint64_t op_start = BACKEND_STATS_OP_START(&backend->base);
 
   switchpoint_result = backend_await((struct Backend_base *)backend);
 
   ev_timer_stop(backend->ev_loop, &watcher.timer);
+  BACKEND_RECORD_OP(&backend->base, OP_TIMEOUT, op_start, -1, 0);
   RAISE_IF_EXCEPTION(switchpoint_result);
   RB_GC_GUARD(watcher.fiber);
   RB_GC_GUARD(switchpoint_result);
@@ -1315,31 +1934,137 @@ VALUE Backend_wait_event(VALUE self, VALUE raise) {
   return switchpoint_result;
 }
 
+// Registered files are not supported by libev.
+VALUE Backend_register_io(VALUE self, VALUE io) {
+  return Qfalse;
+}
+
+VALUE Backend_unregister_io(VALUE self, VALUE io) {
+  return Qfalse;
+}
+
 VALUE Backend_kind(VALUE self) {
   return SYM_libev;
 }
 
+static inline int chain_op_valid_p(VALUE op) {
+  if (TYPE(op) != T_ARRAY || !RARRAY_LEN(op)) return 0;
+
+  VALUE op_type = RARRAY_AREF(op, 0);
+  long op_len = RARRAY_LEN(op);
+  return (op_type == SYM_write && op_len == 3) ||
+    (op_type == SYM_send && op_len == 4) ||
+    (op_type == SYM_splice && op_len == 4) ||
+    (op_type == SYM_read && op_len == 3) ||
+    (op_type == SYM_recv && op_len == 4) ||
+    (op_type == SYM_poll && op_len == 3) ||
+    (op_type == SYM_close && op_len == 2) ||
+    (op_type == SYM_shutdown && op_len == 3) ||
+    (op_type == SYM_timeout && op_len == 2);
+}
+
+struct chain_op_call {
+  VALUE backend;
+  VALUE op;
+};
+
+static VALUE Backend_chain_op_call(VALUE arg) {
+  struct chain_op_call *call = (struct chain_op_call *)arg;
+  VALUE self = call->backend;
+  VALUE op = call->op;
+  VALUE op_type = RARRAY_AREF(op, 0);
+
+  if (op_type == SYM_write)
+    return Backend_write(self, RARRAY_AREF(op, 1), RARRAY_AREF(op, 2));
+  else if (op_type == SYM_send)
+    return Backend_send(self, RARRAY_AREF(op, 1), RARRAY_AREF(op, 2), RARRAY_AREF(op, 3));
+  else if (op_type == SYM_splice)
+    return Backend_splice(self, RARRAY_AREF(op, 1), RARRAY_AREF(op, 2), RARRAY_AREF(op, 3));
+  else if (op_type == SYM_read)
+    return Backend_read(self, RARRAY_AREF(op, 1), Qnil, RARRAY_AREF(op, 2), Qfalse, INT2FIX(0));
+  else if (op_type == SYM_recv)
+    return Backend_recv(self, RARRAY_AREF(op, 1), Qnil, RARRAY_AREF(op, 2), INT2FIX(0));
+  else if (op_type == SYM_close) {
+    Backend_close(self, RARRAY_AREF(op, 1));
+    return Qtrue;
+  }
+  else if (op_type == SYM_shutdown) {
+    Backend_shutdown(self, RARRAY_AREF(op, 1), RARRAY_AREF(op, 2));
+    return Qtrue;
+  }
+  else {
+    Backend_wait_io(self, RARRAY_AREF(op, 1), RARRAY_AREF(op, 2) == SYM_write ? Qtrue : Qfalse);
+    return Qtrue;
+  }
+}
+
+static VALUE Backend_chain_op_timeout_block(RB_BLOCK_CALL_FUNC_ARGLIST(_, arg)) {
+  return Backend_chain_op_call(arg);
+}
+
+static VALUE Backend_chain_op_call_with_timeout(VALUE arg) {
+  struct chain_op_call *call = (struct chain_op_call *)arg;
+  VALUE timeout_op = rb_ary_entry(call[1].op, 1);
+  VALUE args[3] = { timeout_op, Qnil, SYM_timeout };
+  return rb_block_call(call->backend, rb_intern("timeout"), 3, args, Backend_chain_op_timeout_block, arg);
+}
+
+static VALUE Backend_chain_op_rescue(VALUE arg, VALUE exception) {
+  return exception;
+}
+
+// Since libev has no equivalent of linked SQEs, the chain ops are performed
+// sequentially, with the same per-op results as with io_uring. A failed op
+// returns the raised SystemCallError, and causes the following ops to be
+// skipped (returning nil), except that the ios of skipped close ops are still
+// closed.
 VALUE Backend_chain(int argc,VALUE *argv, VALUE self) {
-  VALUE result = Qnil;
-  if (argc == 0) return result;
+  if (argc == 0) return rb_ary_new();
 
   for (int i = 0; i < argc; i++) {
-    VALUE op = argv[i];
-    VALUE op_type = RARRAY_AREF(op, 0);
-    VALUE op_len = RARRAY_LEN(op);
-
-    if (op_type == SYM_write && op_len == 3)
-      result = Backend_write(self, RARRAY_AREF(op, 1), RARRAY_AREF(op, 2));
-    else if (op_type == SYM_send && op_len == 4)
-      result = Backend_send(self, RARRAY_AREF(op, 1), RARRAY_AREF(op, 2), RARRAY_AREF(op, 3));
-    else if (op_type == SYM_splice && op_len == 4)
-      result = Backend_splice(self, RARRAY_AREF(op, 1), RARRAY_AREF(op, 2), RARRAY_AREF(op, 3));
-    else
+    if (!chain_op_valid_p(argv[i]))
       rb_raise(rb_eRuntimeError, "Invalid op specified or bad op arity");
+    if (RARRAY_AREF(argv[i], 0) == SYM_timeout && (!i || RARRAY_AREF(argv[i - 1], 0) == SYM_timeout))
+      rb_raise(rb_eRuntimeError, "timeout must follow another op");
   }
 
-  RB_GC_GUARD(result);
-  return result;
+  VALUE results = rb_ary_new_capa(argc);
+  int failed = 0;
+  for (int i = 0; i < argc; i++) {
+    int timeout = (i < argc - 1) && RARRAY_AREF(argv[i + 1], 0) == SYM_timeout;
+    if (failed) {
+      // as with io_uring, the io of a skipped close op is still closed
+      if (RARRAY_AREF(argv[i], 0) == SYM_close) Backend_close(self, RARRAY_AREF(argv[i], 1));
+      rb_ary_push(results, Qnil);
+      if (timeout) {
+        rb_ary_push(results, Qfalse);
+        i++;
+      }
+      continue;
+    }
+
+    struct chain_op_call call[2] = {{self, argv[i]}, {self, timeout ? argv[i + 1] : Qnil}};
+    VALUE result = rb_rescue2(
+      timeout ? Backend_chain_op_call_with_timeout : Backend_chain_op_call, (VALUE)call,
+      Backend_chain_op_rescue, Qnil, rb_eSystemCallError, (VALUE)0
+    );
+    if (result == SYM_timeout) {
+      rb_ary_push(results, Qnil);
+      failed = 1;
+    }
+    else {
+      rb_ary_push(results, result);
+      if (rb_obj_is_kind_of(result, rb_eSystemCallError) == Qtrue) failed = 1;
+    }
+    if (timeout) {
+      rb_ary_push(results, result == SYM_timeout ? Qtrue : Qfalse);
+      i++;
+    }
+    RB_GC_GUARD(result);
+  }
+
+  RB_GC_GUARD(results);
+  return results;
 }
 
 VALUE Backend_idle_gc_period_set(VALUE self, VALUE period) {
@@ -1350,6 +2075,25 @@ VALUE Backend_idle_gc_period_set(VALUE self, VALUE period) {
   return self;
 }
 
+// The libev backend cannot wait for a minimum number of events, but it can
+// delay collecting events in order to handle more events per iteration.
+VALUE Backend_poll_policy_set(VALUE self, VALUE policy) {
+  Backend_t *backend;
+  GetBackend(self, backend);
+  backend_base_set_poll_policy(&backend->base, policy);
+  ev_set_io_collect_interval(
+    backend->ev_loop,
+    backend->base.poll_min_complete > 1 ? backend->base.poll_max_wait : 0.
+  );
+  return self;
+}
+
+VALUE Backend_poll_policy_get(VALUE self) {
+  Backend_t *backend;
+  GetBackend(self, backend);
+  return backend_base_poll_policy(&backend->base);
+}
+
 VALUE Backend_idle_proc_set(VALUE self, VALUE block) {
   Backend_t *backend;
   GetBackend(self, backend);
@@ -1357,6 +2101,19 @@ VALUE Backend_idle_proc_set(VALUE self, VALUE block) {
   return self;
 }
 
+// Zero-copy sends are supported only by the io_uring backend, the threshold is
+// ignored.
+VALUE Backend_send_zc_threshold_set(VALUE self, VALUE threshold) {
+  return self;
+}
+
+VALUE Backend_scheduler_group_set(VALUE self, VALUE group) {
+  Backend_t *backend;
+  GetBackend(self, backend);
+  backend->base.scheduler_group = group;
+  return self;
+}
+
 inline VALUE Backend_run_idle_tasks(VALUE self) {
   Backend_t *backend;
   GetBackend(self, backend);
@@ -1540,6 +2297,136 @@ error:
   return RAISE_EXCEPTION(result);
 }
 
+// Sends up to len bytes from the given file offset, waiting for dest to become
+// writable as needed. Returns 0 on success, -1 on exception, or an errno.
+// *sent is less than len only if EOF was reached.
+static inline int sendfile_send(Backend_t *backend, int src_fd, int dest_fd, off_t *pos, long len,
+  struct libev_rw_io *watcher, VALUE *result, long *sent) {
+  *sent = 0;
+  while (*sent < len) {
+    ssize_t n;
+    backend->base.op_count++;
+#ifdef POLYPHONY_LINUX
+    n = sendfile(dest_fd, src_fd, pos, len - *sent);
+#else
+    char buf[SENDFILE_CHUNK_SIZE];
+    size_t count = len - *sent < SENDFILE_CHUNK_SIZE ? len - *sent : SENDFILE_CHUNK_SIZE;
+    n = pread(src_fd, buf, count, *pos);
+    if (n > 0) {
+      ssize_t left = n;
+      char *ptr = buf;
+      while (left > 0) {
+        ssize_t written = write(dest_fd, ptr, left);
+        if (written < 0) {
+          int err = errno;
+          if (err != EWOULDBLOCK && err != EAGAIN) return err;
+
+          *result = libev_wait_rw_fd_with_watcher(backend, -1, dest_fd, watcher);
+          if (TEST_EXCEPTION(*result)) return -1;
+        }
+        else {
+          ptr += written;
+          left -= written;
+        }
+      }
+      *pos += n;
+    }
+#endif
+    if (n == 0) return 0;
+    if (n < 0) {
+      int err = errno;
+      if (err != EWOULDBLOCK && err != EAGAIN) return err;
+
+      *result = libev_wait_rw_fd_with_watcher(backend, -1, dest_fd, watcher);
+      if (TEST_EXCEPTION(*result)) return -1;
+      continue;
+    }
+    *sent += n;
+  }
+  return 0;
+}
+
+// Sends length bytes (or up to EOF if length is nil) from the given file
+// offset to dest using sendfile(2). If chunk_prefix or chunk_postfix is given,
+// each chunk is framed as in splice_chunks.
+VALUE Backend_sendfile(int argc, VALUE *argv, VALUE self) {
+  Backend_t *backend;
+  VALUE src, dest, offset, length, chunk_prefix, chunk_postfix, chunk_size;
+  GetBackend(self, backend);
+  rb_scan_args(argc, argv, "43", &src, &dest, &offset, &length, &chunk_prefix, &chunk_postfix, &chunk_size);
+
+  long total = 0;
+  int err = 0;
+  VALUE result = Qnil;
+  rb_io_t *src_fptr;
+  rb_io_t *dest_fptr;
+
+  VALUE underlying_io = rb_ivar_get(src, ID_ivar_io);
+  if (underlying_io != Qnil) src = underlying_io;
+  GetOpenFile(src, src_fptr);
+
+  underlying_io = rb_ivar_get(dest, ID_ivar_io);
+  if (underlying_io != Qnil) dest = underlying_io;
+  dest = rb_io_get_write_io(dest);
+  GetOpenFile(dest, dest_fptr);
+  io_verify_blocking_mode(dest_fptr, dest, Qfalse);
+
+  struct libev_rw_io watcher;
+  watcher.ctx.fiber = Qnil;
+  off_t pos = NUM2OFFT(offset);
+  struct stat st;
+  if (fstat(src_fptr->fd, &st) == -1) {
+    err = errno;
+    goto syscallerror;
+  }
+  long available = st.st_size > pos ? st.st_size - pos : 0;
+  long remaining = NIL_P(length) ? available : NUM2LONG(length);
+  // Each chunk's framing is written before the chunk is sent, so the length is
+  // clamped to the file size in order for the framing to match the data sent.
+  if (S_ISREG(st.st_mode) && remaining > available) remaining = available;
+
+  // without framing the file is sent in a single chunk
+  int framed = chunk_prefix != Qnil || chunk_postfix != Qnil;
+  long maxlen = !framed ? remaining : (NIL_P(chunk_size) ? SENDFILE_CHUNK_SIZE : NUM2INT(chunk_size));
+  VALUE chunk_len_value = Qnil;
+
+  while (remaining > 0) {
+    long chunk_len = remaining < maxlen ? remaining : maxlen;
+    long sent;
+    chunk_len_value = LONG2NUM(chunk_len);
+
+    if (chunk_prefix != Qnil) {
+      VALUE str = (TYPE(chunk_prefix) == T_STRING) ? chunk_prefix : rb_funcall(chunk_prefix, ID_call, 1, chunk_len_value);
+      err = splice_chunks_write(backend, dest_fptr->fd, str, &watcher, &result);
+      if (err == -1) goto error; else if (err) goto syscallerror;
+    }
+
+    err = sendfile_send(backend, src_fptr->fd, dest_fptr->fd, &pos, chunk_len, &watcher, &result, &sent);
+    if (err == -1) goto error; else if (err) goto syscallerror;
+    total += sent;
+    remaining -= sent;
+
+    if (chunk_postfix != Qnil) {
+      VALUE str = (TYPE(chunk_postfix) == T_STRING) ? chunk_postfix : rb_funcall(chunk_postfix, ID_call, 1, chunk_len_value);
+      err = splice_chunks_write(backend, dest_fptr->fd, str, &watcher, &result);
+      if (err == -1) goto error; else if (err) goto syscallerror;
+    }
+    if (sent < chunk_len) break;
+  }
+
+  if (watcher.ctx.fiber == Qnil) {
+    result = backend_snooze();
+    if (TEST_EXCEPTION(result)) goto error;
+  }
+  RB_GC_GUARD(chunk_len_value);
+  RB_GC_GUARD(result);
+  return LONG2NUM(total);
+syscallerror:
+  rb_syserr_fail(err, strerror(err));
+error:
+  return RAISE_EXCEPTION(result);
+}
+
 VALUE Backend_trace(int argc, VALUE *argv, VALUE self) {
   Backend_t *backend;
   GetBackend(self, backend);
@@ -1569,55 +2456,99 @@ void Backend_unpark_fiber(VALUE self, VALUE fiber) {
   backend_base_unpark_fiber(&backend->base, fiber);
 }
 
-void Init_Backend() {
+int Backend_fiber_runnable_p(VALUE self, VALUE fiber) {
+  Backend_t *backend;
+  GetBackend(self, backend);
+
+  return backend_base_fiber_runnable_p(&backend->base, fiber);
+}
+
+static const struct backend_interface backend_interface = {
+  .accept = Backend_accept,
+  .accept_loop = Backend_accept_loop,
+  .connect = Backend_connect,
+  .connect_racing = Backend_connect_racing,
+  .close = Backend_close,
+  .shutdown = Backend_shutdown,
+  .feed_loop = Backend_feed_loop,
+  .read = Backend_read,
+  .read_loop = Backend_read_loop,
+  .gets_loop = Backend_gets_loop,
+  .readv = Backend_readv,
+  .recv = Backend_recv,
+  .recv_loop = Backend_read_loop,
+  .recv_feed_loop = Backend_feed_loop,
+  .send = Backend_send,
+  .recvfrom = Backend_recvfrom,
+  .sendto = Backend_sendto,
+  .recvmmsg = Backend_recvmmsg,
+  .sendmmsg = Backend_sendmmsg,
+  .sleep = Backend_sleep,
+  .splice = Backend_splice,
+  .splice_to_eof = Backend_splice_to_eof,
+  .timeout = Backend_timeout,
+  .timer_loop = Backend_timer_loop,
+  .wait_io = Backend_wait_io,
+  .waitpid = Backend_waitpid,
+  .write_m = Backend_write_m,
+  .chain = Backend_chain,
+  .sendfile = Backend_sendfile,
+  .splice_chunks = Backend_splice_chunks,
+
+  .poll = Backend_poll,
+  .wait_event = Backend_wait_event,
+  .wakeup = Backend_wakeup,
+  .switch_fiber = Backend_switch_fiber,
+  .schedule_fiber = Backend_schedule_fiber,
+  .unschedule_fiber = Backend_unschedule_fiber,
+  .park_fiber = Backend_park_fiber,
+  .unpark_fiber = Backend_unpark_fiber,
+  .fiber_runnable_p = Backend_fiber_runnable_p,
+  .watch_thread_pool_job = Backend_watch_thread_pool_job,
+  .arm_idle_sweep = libev_arm_idle_sweep
+};
+
+void Init_LibevBackend(VALUE cBackend) {
   ev_set_allocator(xrealloc);
 
-  VALUE cBackend = rb_define_class_under(mPolyphony, "Backend", rb_cObject);
-  rb_define_alloc_func(cBackend, Backend_allocate);
-
-  rb_define_method(cBackend, "initialize", Backend_initialize, 0);
-  rb_define_method(cBackend, "finalize", Backend_finalize, 0);
-  rb_define_method(cBackend, "post_fork", Backend_post_fork, 0);
-  rb_define_method(cBackend, "trace", Backend_trace, -1);
-  rb_define_method(cBackend, "trace_proc=", Backend_trace_proc_set, 1);
-  rb_define_method(cBackend, "stats", Backend_stats, 0);
-
-  rb_define_method(cBackend, "poll", Backend_poll, 1);
-  rb_define_method(cBackend, "break", Backend_wakeup, 0);
-  rb_define_method(cBackend, "kind", Backend_kind, 0);
-  rb_define_method(cBackend, "chain", Backend_chain, -1);
-  rb_define_method(cBackend, "idle_gc_period=", Backend_idle_gc_period_set, 1);
-  rb_define_method(cBackend, "idle_proc=", Backend_idle_proc_set, 1);
-  rb_define_method(cBackend, "splice_chunks", Backend_splice_chunks, 7);
-
-  rb_define_method(cBackend, "accept", Backend_accept, 2);
-  rb_define_method(cBackend, "accept_loop", Backend_accept_loop, 2);
-  rb_define_method(cBackend, "connect", Backend_connect, 3);
-  rb_define_method(cBackend, "feed_loop", Backend_feed_loop, 3);
-  rb_define_method(cBackend, "read", Backend_read, 5);
-  rb_define_method(cBackend, "read_loop", Backend_read_loop, 2);
-  rb_define_method(cBackend, "recv", Backend_recv, 4);
-  rb_define_method(cBackend, "recv_loop", Backend_read_loop, 2);
-  rb_define_method(cBackend, "recv_feed_loop", Backend_feed_loop, 3);
-  rb_define_method(cBackend, "send", Backend_send, 3);
-  rb_define_method(cBackend, "sendv", Backend_sendv, 3);
-  rb_define_method(cBackend, "sleep", Backend_sleep, 1);
-
-  rb_define_method(cBackend, "splice", Backend_splice, 3);
-  rb_define_method(cBackend, "splice_to_eof", Backend_splice_to_eof, 3);
-
-  rb_define_method(cBackend, "timeout", Backend_timeout, -1);
-  rb_define_method(cBackend, "timer_loop", Backend_timer_loop, 1);
-  rb_define_method(cBackend, "wait_event", Backend_wait_event, 1);
-  rb_define_method(cBackend, "wait_io", Backend_wait_io, 2);
-  rb_define_method(cBackend, "waitpid", Backend_waitpid, 1);
-  rb_define_method(cBackend, "write", Backend_write_m, -1);
+  VALUE cImplementation = rb_define_class_under(cBackend, "Libev", cBackend);
+  rb_define_alloc_func(cImplementation, Backend_allocate);
+
+  rb_define_method(cImplementation, "initialize", Backend_initialize, -1);
+  rb_define_method(cImplementation, "finalize", Backend_finalize, 0);
+  rb_define_method(cImplementation, "post_fork", Backend_post_fork, 0);
+  rb_define_method(cImplementation, "trace", Backend_trace, -1);
+  rb_define_method(cImplementation, "trace_proc=", Backend_trace_proc_set, 1);
+  rb_define_method(cImplementation, "stats", Backend_stats, 0);
+  rb_define_method(cImplementation, "extended_stats", Backend_extended_stats, 0);
+  rb_define_method(cImplementation, "extended_stats=", Backend_extended_stats_set, 1);
+
+  rb_define_method(cImplementation, "poll", Backend_poll, 1);
+  rb_define_method(cImplementation, "break", Backend_wakeup, 0);
+  rb_define_method(cImplementation, "kind", Backend_kind, 0);
+  rb_define_method(cImplementation, "idle_gc_period=", Backend_idle_gc_period_set, 1);
+  rb_define_method(cImplementation, "idle_proc=", Backend_idle_proc_set, 1);
+  rb_define_method(cImplementation, "scheduler_group=", Backend_scheduler_group_set, 1);
+  rb_define_method(cImplementation, "send_zc_threshold=", Backend_send_zc_threshold_set, 1);
+  rb_define_method(cImplementation, "poll_policy", Backend_poll_policy_get, 0);
+  rb_define_method(cImplementation, "poll_policy=", Backend_poll_policy_set, 1);
+
+  rb_define_method(cImplementation, "register_io", Backend_register_io, 1);
+  rb_define_method(cImplementation, "unregister_io", Backend_unregister_io, 1);
+
+
 
   SYM_libev = ID2SYM(rb_intern("libev"));
 
   SYM_send = ID2SYM(rb_intern("send"));
   SYM_splice = ID2SYM(rb_intern("splice"));
   SYM_write = ID2SYM(rb_intern("write"));
+  SYM_read = ID2SYM(rb_intern("read"));
+  SYM_recv = ID2SYM(rb_intern("recv"));
+  SYM_poll = ID2SYM(rb_intern("poll"));
+  SYM_timeout = ID2SYM(rb_intern("timeout"));
+  SYM_close = ID2SYM(rb_intern("close"));
+  SYM_shutdown = ID2SYM(rb_intern("shutdown"));
 
   backend_setup_stats_symbols();
 }
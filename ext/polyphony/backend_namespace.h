@@ -0,0 +1,72 @@
+#ifndef BACKEND_NAMESPACE_H
+#define BACKEND_NAMESPACE_H
+
+// Both backends implement the same set of functions. Since both can be
+// compiled into the extension, each backend defines BACKEND_NAMESPACE before
+// including this file, which prefixes its public functions, e.g. Backend_read
+// becomes libev_Backend_read. Calls from outside the backend implementations
+// are dispatched through struct backend_interface (see backend.c).
+
+#ifndef BACKEND_NAMESPACE
+#error "BACKEND_NAMESPACE must be defined"
+#endif
+
+#define Backend_accept                BACKEND_NAMESPACE(Backend_accept)
+#define Backend_accept_loop           BACKEND_NAMESPACE(Backend_accept_loop)
+#define Backend_chain                 BACKEND_NAMESPACE(Backend_chain)
+#define Backend_close                 BACKEND_NAMESPACE(Backend_close)
+#define Backend_connect               BACKEND_NAMESPACE(Backend_connect)
+#define Backend_connect_racing        BACKEND_NAMESPACE(Backend_connect_racing)
+#define Backend_feed_loop             BACKEND_NAMESPACE(Backend_feed_loop)
+#define Backend_fiber_runnable_p      BACKEND_NAMESPACE(Backend_fiber_runnable_p)
+#define Backend_finalize              BACKEND_NAMESPACE(Backend_finalize)
+#define Backend_gets_loop             BACKEND_NAMESPACE(Backend_gets_loop)
+#define Backend_idle_gc_period_set    BACKEND_NAMESPACE(Backend_idle_gc_period_set)
+#define Backend_idle_proc_set         BACKEND_NAMESPACE(Backend_idle_proc_set)
+#define Backend_kind                  BACKEND_NAMESPACE(Backend_kind)
+#define Backend_park_fiber            BACKEND_NAMESPACE(Backend_park_fiber)
+#define Backend_poll                  BACKEND_NAMESPACE(Backend_poll)
+#define Backend_poll_policy_get       BACKEND_NAMESPACE(Backend_poll_policy_get)
+#define Backend_poll_policy_set       BACKEND_NAMESPACE(Backend_poll_policy_set)
+#define Backend_post_fork             BACKEND_NAMESPACE(Backend_post_fork)
+#define Backend_read                  BACKEND_NAMESPACE(Backend_read)
+#define Backend_read_loop             BACKEND_NAMESPACE(Backend_read_loop)
+#define Backend_readv                 BACKEND_NAMESPACE(Backend_readv)
+#define Backend_recv                  BACKEND_NAMESPACE(Backend_recv)
+#define Backend_recv_feed_loop        BACKEND_NAMESPACE(Backend_recv_feed_loop)
+#define Backend_recv_loop             BACKEND_NAMESPACE(Backend_recv_loop)
+#define Backend_recvfrom              BACKEND_NAMESPACE(Backend_recvfrom)
+#define Backend_recvmmsg              BACKEND_NAMESPACE(Backend_recvmmsg)
+#define Backend_register_io           BACKEND_NAMESPACE(Backend_register_io)
+#define Backend_run_idle_tasks        BACKEND_NAMESPACE(Backend_run_idle_tasks)
+#define Backend_schedule_fiber        BACKEND_NAMESPACE(Backend_schedule_fiber)
+#define Backend_scheduler_group_set   BACKEND_NAMESPACE(Backend_scheduler_group_set)
+#define Backend_send                  BACKEND_NAMESPACE(Backend_send)
+#define Backend_send_zc_threshold_set BACKEND_NAMESPACE(Backend_send_zc_threshold_set)
+#define Backend_sendfile              BACKEND_NAMESPACE(Backend_sendfile)
+#define Backend_sendmmsg              BACKEND_NAMESPACE(Backend_sendmmsg)
+#define Backend_sendto                BACKEND_NAMESPACE(Backend_sendto)
+#define Backend_shutdown              BACKEND_NAMESPACE(Backend_shutdown)
+#define Backend_sleep                 BACKEND_NAMESPACE(Backend_sleep)
+#define Backend_splice                BACKEND_NAMESPACE(Backend_splice)
+#define Backend_splice_chunks         BACKEND_NAMESPACE(Backend_splice_chunks)
+#define Backend_splice_to_eof         BACKEND_NAMESPACE(Backend_splice_to_eof)
+#define Backend_switch_fiber          BACKEND_NAMESPACE(Backend_switch_fiber)
+#define Backend_timeout               BACKEND_NAMESPACE(Backend_timeout)
+#define Backend_timeout_ensure        BACKEND_NAMESPACE(Backend_timeout_ensure)
+#define Backend_timer_loop            BACKEND_NAMESPACE(Backend_timer_loop)
+#define Backend_trace                 BACKEND_NAMESPACE(Backend_trace)
+#define Backend_trace_proc_set        BACKEND_NAMESPACE(Backend_trace_proc_set)
+#define Backend_unpark_fiber          BACKEND_NAMESPACE(Backend_unpark_fiber)
+#define Backend_unregister_io         BACKEND_NAMESPACE(Backend_unregister_io)
+#define Backend_unschedule_fiber      BACKEND_NAMESPACE(Backend_unschedule_fiber)
+#define Backend_wait_event            BACKEND_NAMESPACE(Backend_wait_event)
+#define Backend_wait_io               BACKEND_NAMESPACE(Backend_wait_io)
+#define Backend_waitpid               BACKEND_NAMESPACE(Backend_waitpid)
+#define Backend_wakeup                BACKEND_NAMESPACE(Backend_wakeup)
+#define Backend_watch_thread_pool_job BACKEND_NAMESPACE(Backend_watch_thread_pool_job)
+#define Backend_write                 BACKEND_NAMESPACE(Backend_write)
+#define Backend_write_m               BACKEND_NAMESPACE(Backend_write_m)
+#define Backend_writev                BACKEND_NAMESPACE(Backend_writev)
+
+#endif /* BACKEND_NAMESPACE_H */
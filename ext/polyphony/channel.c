@@ -0,0 +1,431 @@
+#include "polyphony.h"
+#include "backend_common.h"
+#include "ring_buffer.h"
+
+// A Go-style channel. An unbuffered channel (with a capacity of 0) is a
+// rendezvous point: a send completes only once a receiver has taken the value.
+// Blocked senders and receivers are represented by waiter structs allocated on
+// their stack and linked into the channel's sender or receiver list. A waiter
+// points to a select struct, which is shared by all the waiters of a single
+// blocking operation, so that a fiber can wait on multiple channels at once.
+//
+// When a value is sent to a parked receiver, it is passed directly to the
+// receiver, which is scheduled ahead of all other runnable fibers, and the
+// sender yields, so the receiver runs right away.
+
+typedef struct channel_select {
+  VALUE fiber;
+  int   done;
+  int   index;
+  VALUE value;
+} channel_select_t;
+
+typedef struct channel_waiter {
+  struct channel_waiter *prev;
+  struct channel_waiter *next;
+  channel_select_t      *select;
+  VALUE                 value;
+  int                   index;
+  int                   linked;
+} channel_waiter_t;
+
+typedef struct channel_waiter_list {
+  channel_waiter_t *head;
+  channel_waiter_t *tail;
+} channel_waiter_list_t;
+
+typedef struct channel {
+  ring_buffer           values;
+  unsigned int          capacity;
+  int                   closed;
+  channel_waiter_list_t receivers;
+  channel_waiter_list_t senders;
+} Channel_t;
+
+VALUE cChannel = Qnil;
+VALUE cChannelClosedError = Qnil;
+
+static void channel_waiter_list_mark(channel_waiter_list_t *list) {
+  for (channel_waiter_t *w = list->head; w; w = w->next) {
+    rb_gc_mark(w->value);
+    rb_gc_mark(w->select->fiber);
+  }
+}
+
+static void Channel_mark(void *ptr) {
+  Channel_t *channel = ptr;
+  ring_buffer_mark(&channel->values);
+  channel_waiter_list_mark(&channel->receivers);
+  channel_waiter_list_mark(&channel->senders);
+}
+
+static void Channel_free(void *ptr) {
+  Channel_t *channel = ptr;
+  ring_buffer_free(&channel->values);
+  xfree(ptr);
+}
+
+static size_t Channel_size(const void *ptr) {
+  return sizeof(Channel_t);
+}
+
+static const rb_data_type_t Channel_type = {
+  "Channel",
+  {Channel_mark, Channel_free, Channel_size,},
+  0, 0, 0
+};
+
+static VALUE Channel_allocate(VALUE klass) {
+  Channel_t *channel;
+
+  channel = ALLOC(Channel_t);
+  memset(channel, 0, sizeof(Channel_t));
+  ring_buffer_init(&channel->values);
+  return TypedData_Wrap_Struct(klass, &Channel_type, channel);
+}
+
+#define GetChannel(obj, channel) \
+  TypedData_Get_Struct((obj), Channel_t, &Channel_type, (channel))
+
+static VALUE Channel_initialize(int argc, VALUE *argv, VALUE self) {
+  Channel_t *channel;
+  GetChannel(self, channel);
+
+  rb_check_arity(argc, 0, 1);
+  channel->capacity = (argc == 1) ? NUM2UINT(argv[0]) : 0;
+  return self;
+}
+
+static inline void channel_waiter_link(channel_waiter_list_t *list, channel_waiter_t *w) {
+  w->next = NULL;
+  w->prev = list->tail;
+  if (list->tail) list->tail->next = w;
+  else list->head = w;
+  list->tail = w;
+  w->linked = 1;
+}
+
+static inline void channel_waiter_unlink(channel_waiter_list_t *list, channel_waiter_t *w) {
+  if (!w->linked) return;
+
+  if (w->prev) w->prev->next = w->next;
+  else list->head = w->next;
+  if (w->next) w->next->prev = w->prev;
+  else list->tail = w->prev;
+  w->prev = w->next = NULL;
+  w->linked = 0;
+}
+
+// Removes and returns the first waiter whose operation has not yet completed.
+// Waiters of completed select operations are left linked until their owner
+// fiber runs, so they are removed here. Waiters whose fiber is already
+// runnable (e.g. because it was interrupted) are skipped, since scheduling
+// them again would override the value they were scheduled with.
+static inline channel_waiter_t *channel_waiter_take(channel_waiter_list_t *list) {
+  channel_waiter_t *w = list->head;
+  while (w) {
+    channel_waiter_t *next = w->next;
+    if (w->select->done)
+      channel_waiter_unlink(list, w);
+    else if (!Fiber_runnable_p(w->select->fiber)) {
+      channel_waiter_unlink(list, w);
+      return w;
+    }
+    w = next;
+  }
+  return NULL;
+}
+
+static inline void channel_waiter_complete(channel_waiter_t *w, VALUE value) {
+  w->select->done = 1;
+  w->select->index = w->index;
+  w->select->value = value;
+}
+
+// Passes control to the given fiber, which has just been given a value. If
+// the fiber belongs to the current thread, it is scheduled first and the
+// current fiber yields, handing over execution immediately.
+static inline void channel_handoff(VALUE fiber) {
+  if (Fiber_state_thread(fiber) != rb_thread_current()) {
+    Fiber_make_runnable(fiber, Qnil);
+    return;
+  }
+
+  Fiber_make_runnable_with_priority(fiber, Qnil);
+  VALUE switchpoint_result = backend_snooze();
+  RAISE_IF_EXCEPTION(switchpoint_result);
+  RB_GC_GUARD(switchpoint_result);
+}
+
+static inline void channel_check_open(Channel_t *channel) {
+  if (channel->closed) rb_raise(cChannelClosedError, "channel is closed");
+}
+
+// Tries to send a value without blocking. Returns the receiving fiber if the
+// value was handed to a parked receiver, Qtrue if it was put in the buffer,
+// or Qfalse if the send would block.
+static VALUE channel_try_send(Channel_t *channel, VALUE value) {
+  channel_check_open(channel);
+
+  channel_waiter_t *w = channel_waiter_take(&channel->receivers);
+  if (w) {
+    channel_waiter_complete(w, value);
+    return w->select->fiber;
+  }
+  if (channel->values.count < channel->capacity) {
+    ring_buffer_push(&channel->values, value);
+    return Qtrue;
+  }
+  return Qfalse;
+}
+
+// Tries to receive a value without blocking. Returns 1 if a value was
+// received, 0 if the receive would block, or -1 if the channel is closed.
+static int channel_try_receive(Channel_t *channel, VALUE *value) {
+  channel_waiter_t *w;
+
+  if (channel->values.count) {
+    *value = ring_buffer_shift(&channel->values);
+    // move the first blocked sender's value into the freed buffer slot
+    if ((w = channel_waiter_take(&channel->senders))) {
+      ring_buffer_push(&channel->values, w->value);
+      channel_waiter_complete(w, Qnil);
+      Fiber_make_runnable(w->select->fiber, Qnil);
+    }
+    return 1;
+  }
+  if ((w = channel_waiter_take(&channel->senders))) {
+    *value = w->value;
+    channel_waiter_complete(w, Qnil);
+    Fiber_make_runnable(w->select->fiber, Qnil);
+    return 1;
+  }
+  return channel->closed ? -1 : 0;
+}
+
+// Puts back a value that was received by a fiber which was interrupted before
+// it could resume, so it is not lost.
+static void channel_redeliver(Channel_t *channel, VALUE value) {
+  channel_waiter_t *w = channel_waiter_take(&channel->receivers);
+  if (w) {
+    channel_waiter_complete(w, value);
+    Fiber_make_runnable(w->select->fiber, Qnil);
+  }
+  else
+    ring_buffer_unshift(&channel->values, value);
+}
+
+static inline VALUE channel_wait(void) {
+  VALUE backend = rb_ivar_get(rb_thread_current(), ID_ivar_backend);
+  return Backend_wait_event(backend, Qnil);
+}
+
+VALUE Channel_push(VALUE self, VALUE value) {
+  Channel_t *channel;
+  GetChannel(self, channel);
+
+  VALUE result = channel_try_send(channel, value);
+  if (result == Qtrue) return self;
+  if (result != Qfalse) {
+    channel_handoff(result);
+    return self;
+  }
+
+  channel_select_t select = {rb_fiber_current(), 0, 0, Qnil};
+  channel_waiter_t waiter = {NULL, NULL, &select, value, 0, 0};
+  channel_waiter_link(&channel->senders, &waiter);
+
+  while (1) {
+    VALUE switchpoint_result = channel_wait();
+    if (select.done) {
+      RAISE_IF_EXCEPTION(switchpoint_result);
+      return self;
+    }
+    if (TEST_EXCEPTION(switchpoint_result) || channel->closed) {
+      channel_waiter_unlink(&channel->senders, &waiter);
+      RAISE_IF_EXCEPTION(switchpoint_result);
+      channel_check_open(channel);
+    }
+    RB_GC_GUARD(switchpoint_result);
+  }
+}
+
+VALUE Channel_receive(VALUE self) {
+  Channel_t *channel;
+  VALUE value;
+  GetChannel(self, channel);
+
+  switch (channel_try_receive(channel, &value)) {
+    case 1:   return value;
+    case -1:  channel_check_open(channel);
+  }
+
+  channel_select_t select = {rb_fiber_current(), 0, 0, Qnil};
+  channel_waiter_t waiter = {NULL, NULL, &select, Qnil, 0, 0};
+  channel_waiter_link(&channel->receivers, &waiter);
+
+  while (1) {
+    VALUE switchpoint_result = channel_wait();
+    if (select.done) {
+      if (TEST_EXCEPTION(switchpoint_result)) {
+        channel_redeliver(channel, select.value);
+        RAISE_EXCEPTION(switchpoint_result);
+      }
+      return select.value;
+    }
+    if (TEST_EXCEPTION(switchpoint_result) || channel->closed) {
+      channel_waiter_unlink(&channel->receivers, &waiter);
+      RAISE_IF_EXCEPTION(switchpoint_result);
+      channel_check_open(channel);
+    }
+    RB_GC_GUARD(switchpoint_result);
+  }
+}
+
+static void channel_wake_all(channel_waiter_list_t *list) {
+  channel_waiter_t *w;
+  while ((w = channel_waiter_take(list))) Fiber_make_runnable(w->select->fiber, Qnil);
+}
+
+// Closes the channel. Blocked senders and receivers are woken up and raise a
+// ClosedError. Values already in the buffer can still be received.
+VALUE Channel_close(VALUE self) {
+  Channel_t *channel;
+  GetChannel(self, channel);
+
+  if (channel->closed) return self;
+
+  channel->closed = 1;
+  channel_wake_all(&channel->receivers);
+  channel_wake_all(&channel->senders);
+  return self;
+}
+
+VALUE Channel_closed_p(VALUE self) {
+  Channel_t *channel;
+  GetChannel(self, channel);
+
+  return channel->closed ? Qtrue : Qfalse;
+}
+
+VALUE Channel_size_m(VALUE self) {
+  Channel_t *channel;
+  GetChannel(self, channel);
+
+  return INT2FIX(channel->values.count);
+}
+
+VALUE Channel_capacity(VALUE self) {
+  Channel_t *channel;
+  GetChannel(self, channel);
+
+  return UINT2NUM(channel->capacity);
+}
+
+struct select_op {
+  VALUE     channel;
+  Channel_t *ptr;
+  VALUE     value;
+  int       send;
+};
+
+static void channel_select_parse_ops(int argc, VALUE *argv, struct select_op *ops) {
+  for (int i = 0; i < argc; i++) {
+    VALUE op = argv[i];
+    if (TYPE(op) == T_ARRAY) {
+      if (RARRAY_LEN(op) != 2) rb_raise(rb_eArgError, "expected [channel, value] for send operation");
+      ops[i].channel = RARRAY_AREF(op, 0);
+      ops[i].value = RARRAY_AREF(op, 1);
+      ops[i].send = 1;
+    }
+    else {
+      ops[i].channel = op;
+      ops[i].value = Qnil;
+      ops[i].send = 0;
+    }
+    GetChannel(ops[i].channel, ops[i].ptr);
+  }
+}
+
+static void channel_select_unlink_all(int argc, struct select_op *ops, channel_waiter_t *waiters) {
+  for (int i = 0; i < argc; i++) {
+    channel_waiter_list_t *list = ops[i].send ? &ops[i].ptr->senders : &ops[i].ptr->receivers;
+    channel_waiter_unlink(list, &waiters[i]);
+  }
+}
+
+// Performs the first operation that can proceed, out of the given receive
+// operations (given as channels) and send operations (given as [channel,
+// value] pairs). Operations are tried in order. If none can proceed, waits
+// until one of them does. Returns [channel, value] for a receive operation,
+// or [channel, nil] for a send operation.
+VALUE Channel_s_select(int argc, VALUE *argv, VALUE self) {
+  if (!argc) rb_raise(rb_eArgError, "no operations given");
+
+  struct select_op *ops = ALLOCA_N(struct select_op, argc);
+  channel_select_parse_ops(argc, argv, ops);
+
+  for (int i = 0; i < argc; i++) {
+    if (ops[i].send) {
+      VALUE result = channel_try_send(ops[i].ptr, ops[i].value);
+      if (result == Qfalse) continue;
+      if (result != Qtrue) channel_handoff(result);
+      return rb_ary_new_from_args(2, ops[i].channel, Qnil);
+    }
+    VALUE value;
+    switch (channel_try_receive(ops[i].ptr, &value)) {
+      case 1:   return rb_ary_new_from_args(2, ops[i].channel, value);
+      case -1:  channel_check_open(ops[i].ptr);
+    }
+  }
+
+  channel_select_t select = {rb_fiber_current(), 0, 0, Qnil};
+  channel_waiter_t *waiters = ALLOCA_N(channel_waiter_t, argc);
+  for (int i = 0; i < argc; i++) {
+    waiters[i] = (channel_waiter_t){NULL, NULL, &select, ops[i].value, i, 0};
+    channel_waiter_link(ops[i].send ? &ops[i].ptr->senders : &ops[i].ptr->receivers, &waiters[i]);
+  }
+
+  while (1) {
+    VALUE switchpoint_result = channel_wait();
+    if (select.done) {
+      channel_select_unlink_all(argc, ops, waiters);
+      struct select_op *op = &ops[select.index];
+      if (TEST_EXCEPTION(switchpoint_result)) {
+        if (!op->send) channel_redeliver(op->ptr, select.value);
+        RAISE_EXCEPTION(switchpoint_result);
+      }
+      return rb_ary_new_from_args(2, op->channel, op->send ? Qnil : select.value);
+    }
+    if (TEST_EXCEPTION(switchpoint_result)) {
+      channel_select_unlink_all(argc, ops, waiters);
+      RAISE_EXCEPTION(switchpoint_result);
+    }
+    for (int i = 0; i < argc; i++) {
+      if (ops[i].ptr->closed) {
+        channel_select_unlink_all(argc, ops, waiters);
+        channel_check_open(ops[i].ptr);
+      }
+    }
+    RB_GC_GUARD(switchpoint_result);
+  }
+}
+
+void Init_Channel() {
+  cChannel = rb_define_class_under(mPolyphony, "Channel", rb_cObject);
+  rb_define_alloc_func(cChannel, Channel_allocate);
+
+  cChannelClosedError = rb_define_class_under(cChannel, "ClosedError", rb_eStandardError);
+
+  rb_define_method(cChannel, "initialize", Channel_initialize, -1);
+  rb_define_method(cChannel, "push", Channel_push, 1);
+  rb_define_method(cChannel, "<<", Channel_push, 1);
+  rb_define_method(cChannel, "receive", Channel_receive, 0);
+  rb_define_method(cChannel, "shift", Channel_receive, 0);
+  rb_define_method(cChannel, "close", Channel_close, 0);
+  rb_define_method(cChannel, "closed?", Channel_closed_p, 0);
+  rb_define_method(cChannel, "size", Channel_size_m, 0);
+  rb_define_method(cChannel, "capacity", Channel_capacity, 0);
+
+  rb_define_singleton_method(cChannel, "select", Channel_s_select, -1);
+}
@@ -0,0 +1,225 @@
+#include "polyphony.h"
+#include "backend_common.h"
+#include "ruby/st.h"
+
+// A child watcher monitors any number of child processes with a single poll.
+// Each watched child is represented by a pidfd registered with an epoll fd,
+// and the epoll fd itself is waited on using Backend#wait_io, so waiting for
+// the next child to terminate involves a single backend op, regardless of the
+// number of watched children. This is only available where pidfd_open is
+// supported (Linux 5.3+). Elsewhere, Polyphony::ChildWatcher is implemented in
+// Ruby, using a fiber per child (see lib/polyphony/core/prefork.rb).
+
+#ifdef POLYPHONY_USE_PIDFD_OPEN
+
+#include <sys/epoll.h>
+#include <sys/wait.h>
+
+typedef struct child_watcher {
+  int       epoll_fd;
+  VALUE     io;
+  st_table  *pidfds;
+} ChildWatcher_t;
+
+VALUE cChildWatcher = Qnil;
+static ID ID_for_fd;
+
+static void ChildWatcher_mark(void *ptr) {
+  ChildWatcher_t *watcher = ptr;
+  rb_gc_mark(watcher->io);
+}
+
+static int child_watcher_close_pidfd(st_data_t key, st_data_t value, st_data_t arg) {
+  close((int)value);
+  return ST_CONTINUE;
+}
+
+static void child_watcher_close(ChildWatcher_t *watcher) {
+  if (!watcher->pidfds) return;
+
+  st_foreach(watcher->pidfds, child_watcher_close_pidfd, 0);
+  st_free_table(watcher->pidfds);
+  watcher->pidfds = NULL;
+}
+
+static void ChildWatcher_free(void *ptr) {
+  // the epoll fd is closed along with the IO object wrapping it
+  child_watcher_close(ptr);
+  xfree(ptr);
+}
+
+static size_t ChildWatcher_size(const void *ptr) {
+  return sizeof(ChildWatcher_t);
+}
+
+static const rb_data_type_t ChildWatcher_type = {
+  "ChildWatcher",
+  {ChildWatcher_mark, ChildWatcher_free, ChildWatcher_size,},
+  0, 0, 0
+};
+
+static VALUE ChildWatcher_allocate(VALUE klass) {
+  ChildWatcher_t *watcher;
+
+  watcher = ALLOC(ChildWatcher_t);
+  watcher->epoll_fd = -1;
+  watcher->io = Qnil;
+  watcher->pidfds = NULL;
+  return TypedData_Wrap_Struct(klass, &ChildWatcher_type, watcher);
+}
+
+#define GetChildWatcher(obj, watcher) \
+  TypedData_Get_Struct((obj), ChildWatcher_t, &ChildWatcher_type, (watcher))
+
+static inline ChildWatcher_t *get_open_child_watcher(VALUE self) {
+  ChildWatcher_t *watcher;
+  GetChildWatcher(self, watcher);
+  if (!watcher->pidfds) rb_raise(rb_eIOError, "closed child watcher");
+  return watcher;
+}
+
+static VALUE ChildWatcher_initialize(VALUE self) {
+  ChildWatcher_t *watcher;
+  GetChildWatcher(self, watcher);
+
+  int fd = epoll_create1(EPOLL_CLOEXEC);
+  if (fd < 0) rb_syserr_fail(errno, strerror(errno));
+
+  watcher->epoll_fd = fd;
+  watcher->pidfds = st_init_numtable();
+  watcher->io = rb_funcall(rb_cIO, ID_for_fd, 1, INT2NUM(fd));
+  return self;
+}
+
+// Starts watching the given child process. Raises Errno::ESRCH if no such
+// process exists.
+static VALUE ChildWatcher_add(VALUE self, VALUE pid) {
+  ChildWatcher_t *watcher = get_open_child_watcher(self);
+  int pid_int = NUM2INT(pid);
+  st_data_t existing;
+  if (st_lookup(watcher->pidfds, (st_data_t)pid_int, &existing)) return self;
+
+  int fd = pidfd_open(pid_int, 0);
+  if (fd < 0) rb_syserr_fail(errno, strerror(errno));
+
+  struct epoll_event event = { .events = EPOLLIN, .data = { .u64 = (uint64_t)pid_int } };
+  if (epoll_ctl(watcher->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+    int e = errno;
+    close(fd);
+    rb_syserr_fail(e, strerror(e));
+  }
+  st_insert(watcher->pidfds, (st_data_t)pid_int, (st_data_t)fd);
+  return self;
+}
+
+static int child_watcher_remove(ChildWatcher_t *watcher, int pid) {
+  st_data_t key = (st_data_t)pid;
+  st_data_t fd;
+  if (!st_delete(watcher->pidfds, &key, &fd)) return 0;
+
+  // The pidfd is explicitly removed from the epoll set, since it might have
+  // been inherited by a forked process, in which case closing it would not
+  // remove it.
+  epoll_ctl(watcher->epoll_fd, EPOLL_CTL_DEL, (int)fd, NULL);
+  close((int)fd);
+  return 1;
+}
+
+// Stops watching the given child process. The child is not reaped.
+static VALUE ChildWatcher_delete(VALUE self, VALUE pid) {
+  ChildWatcher_t *watcher = get_open_child_watcher(self);
+  return child_watcher_remove(watcher, NUM2INT(pid)) ? pid : Qnil;
+}
+
+// Waits for any of the watched children to terminate, reaps it and returns an
+// array containing its pid and exit status, in the same manner as
+// Polyphony.backend_waitpid. For a child terminated by a signal, the negated
+// signal number is returned instead of the exit status. Returns nil if no
+// child is being watched.
+static VALUE ChildWatcher_wait(VALUE self) {
+  ChildWatcher_t *watcher = get_open_child_watcher(self);
+  VALUE backend = BACKEND();
+  struct epoll_event event;
+
+  while (1) {
+    if (!watcher->pidfds || !watcher->pidfds->num_entries) return Qnil;
+
+    int ret = epoll_wait(watcher->epoll_fd, &event, 1, 0);
+    if (ret < 0) {
+      int e = errno;
+      if (e == EINTR) continue;
+      rb_syserr_fail(e, strerror(e));
+    }
+    if (!ret) {
+      Backend_wait_io(backend, watcher->io, Qfalse);
+      continue;
+    }
+
+    int pid = (int)event.data.u64;
+    if (!child_watcher_remove(watcher, pid)) continue;
+
+    int status = 0;
+    pid_t reaped = waitpid(pid, &status, WNOHANG);
+    if (reaped < 0 && errno != ECHILD) rb_syserr_fail(errno, strerror(errno));
+    int exit_status = WIFSIGNALED(status) ? -WTERMSIG(status) : WEXITSTATUS(status);
+    return rb_ary_new_from_args(2, INT2NUM(pid), INT2NUM(exit_status));
+  }
+}
+
+static VALUE ChildWatcher_size_m(VALUE self) {
+  ChildWatcher_t *watcher = get_open_child_watcher(self);
+  return INT2NUM(watcher->pidfds->num_entries);
+}
+
+static int child_watcher_push_pid(st_data_t key, st_data_t value, st_data_t arg) {
+  rb_ary_push((VALUE)arg, INT2NUM((int)key));
+  return ST_CONTINUE;
+}
+
+static VALUE ChildWatcher_pids(VALUE self) {
+  ChildWatcher_t *watcher = get_open_child_watcher(self);
+  VALUE pids = rb_ary_new_capa(watcher->pidfds->num_entries);
+  st_foreach(watcher->pidfds, child_watcher_push_pid, (st_data_t)pids);
+  return pids;
+}
+
+// Stops watching all children and closes the epoll fd.
+static VALUE ChildWatcher_close_m(VALUE self) {
+  ChildWatcher_t *watcher;
+  GetChildWatcher(self, watcher);
+  if (!watcher->pidfds) return self;
+
+  child_watcher_close(watcher);
+  rb_io_close(watcher->io);
+  watcher->epoll_fd = -1;
+  return self;
+}
+
+static VALUE ChildWatcher_closed_p(VALUE self) {
+  ChildWatcher_t *watcher;
+  GetChildWatcher(self, watcher);
+  return watcher->pidfds ? Qfalse : Qtrue;
+}
+
+void Init_ChildWatcher() {
+  cChildWatcher = rb_define_class_under(mPolyphony, "ChildWatcher", rb_cObject);
+  rb_define_alloc_func(cChildWatcher, ChildWatcher_allocate);
+
+  rb_define_method(cChildWatcher, "initialize", ChildWatcher_initialize, 0);
+  rb_define_method(cChildWatcher, "add", ChildWatcher_add, 1);
+  rb_define_method(cChildWatcher, "delete", ChildWatcher_delete, 1);
+  rb_define_method(cChildWatcher, "wait", ChildWatcher_wait, 0);
+  rb_define_method(cChildWatcher, "size", ChildWatcher_size_m, 0);
+  rb_define_method(cChildWatcher, "pids", ChildWatcher_pids, 0);
+  rb_define_method(cChildWatcher, "close", ChildWatcher_close_m, 0);
+  rb_define_method(cChildWatcher, "closed?", ChildWatcher_closed_p, 0);
+
+  ID_for_fd = rb_intern("for_fd");
+}
+
+#else
+
+void Init_ChildWatcher() {
+}
+
+#endif /* POLYPHONY_USE_PIDFD_OPEN */
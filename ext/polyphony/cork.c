@@ -0,0 +1,337 @@
+#include "polyphony.h"
+#include "backend_common.h"
+
+// Write coalescing (corking) for sockets. A socket corked with Socket#cork!
+// buffers strings written to it using #<<, #write or #send (with no flags),
+// and sends the buffered strings using a single writev when:
+//
+// - the buffered length reaches the cork threshold, or CORK_MAX_IOV strings are
+//   buffered.
+// - any other backend op is performed on the socket, e.g. a read.
+// - the socket is flushed using #flush, or uncorked using #uncork!.
+// - a switchpoint is reached, i.e. the writing fiber yields control.
+//
+// Written strings are not copied: frozen strings are buffered as is, and other
+// strings are buffered as frozen strings sharing their contents, so any later
+// change to a written string does not affect the buffered data.
+//
+// At a switchpoint, the buffered strings are sent using a non-blocking
+// sendmsg, which does not involve suspending the fiber. If the socket is not
+// writable, the remainder is sent by a flusher fiber, and any further writes
+// are buffered until the flusher is done. Errors occurring in the background
+// are raised on the next write or flush.
+
+#define CORK_DEFAULT_THRESHOLD 16384
+#define CORK_MAX_IOV 64
+
+typedef struct cork {
+  VALUE io;
+  VALUE strs;
+  long  length;
+  long  threshold;
+  int   pending;
+  VALUE flusher;
+  VALUE error;
+} Cork_t;
+
+static ID ID_cork;
+static ID ID_spin;
+static ID ID_await;
+
+static void Cork_mark(void *ptr) {
+  Cork_t *cork = ptr;
+  rb_gc_mark(cork->io);
+  rb_gc_mark(cork->strs);
+  rb_gc_mark(cork->flusher);
+  rb_gc_mark(cork->error);
+}
+
+static size_t Cork_size(const void *ptr) {
+  return sizeof(Cork_t);
+}
+
+static const rb_data_type_t Cork_type = {
+  "Cork",
+  {Cork_mark, RUBY_DEFAULT_FREE, Cork_size,},
+  0, 0, 0
+};
+
+static inline Cork_t *cork_get(VALUE obj) {
+  Cork_t *cork;
+  TypedData_Get_Struct(obj, Cork_t, &Cork_type, cork);
+  return cork;
+}
+
+// Corking state is held by the underlying socket of TCPSocket instances.
+static inline VALUE cork_io(VALUE io) {
+  VALUE underlying_io = rb_ivar_get(io, ID_ivar_io);
+  return underlying_io == Qnil ? io : underlying_io;
+}
+
+static inline VALUE cork_for_io(VALUE io) {
+  return rb_attr_get(cork_io(io), ID_cork);
+}
+
+static inline struct Backend_base *cork_backend_base(VALUE backend) {
+  return RTYPEDDATA_DATA(backend);
+}
+
+static void cork_set_pending(VALUE backend, VALUE obj, Cork_t *cork, int pending) {
+  struct Backend_base *base = cork_backend_base(backend);
+  if (cork->pending == pending) return;
+
+  cork->pending = pending;
+  if (pending) {
+    if (base->pending_corks == Qnil) base->pending_corks = rb_ary_new();
+    rb_ary_push(base->pending_corks, obj);
+  }
+  else if (base->pending_corks != Qnil)
+    rb_ary_delete(base->pending_corks, obj);
+}
+
+static inline void cork_raise_error(Cork_t *cork) {
+  VALUE error = cork->error;
+  if (error == Qnil) return;
+
+  cork->error = Qnil;
+  rb_exc_raise(error);
+}
+
+// Sends all buffered strings, suspending the current fiber as needed. If a
+// flusher fiber is sending in the background, it is awaited first.
+static void cork_flush(VALUE backend, VALUE obj) {
+  Cork_t *cork = cork_get(obj);
+
+  if (cork->flusher != Qnil && cork->flusher != rb_fiber_current())
+    rb_funcall(cork->flusher, ID_await, 0);
+  cork_set_pending(backend, obj, cork, 0);
+
+  while (RARRAY_LEN(cork->strs)) {
+    VALUE args = rb_ary_new_capa(RARRAY_LEN(cork->strs) + 1);
+    rb_ary_push(args, cork->io);
+    rb_ary_concat(args, cork->strs);
+    rb_ary_clear(cork->strs);
+    cork->length = 0;
+
+    Backend_write_m(RARRAY_LEN(args), (VALUE *)RARRAY_CONST_PTR(args), backend);
+    RB_GC_GUARD(args);
+  }
+  cork_raise_error(cork);
+}
+
+static VALUE cork_flusher_run(VALUE obj) {
+  cork_flush(BACKEND(), obj);
+  return Qnil;
+}
+
+static VALUE cork_flusher_rescue(VALUE obj, VALUE error) {
+  Cork_t *cork = cork_get(obj);
+  rb_ary_clear(cork->strs);
+  cork->length = 0;
+  cork->error = error;
+  return Qnil;
+}
+
+static VALUE cork_flusher_ensure(VALUE obj) {
+  struct Backend_base *base = cork_backend_base(BACKEND());
+  cork_get(obj)->flusher = Qnil;
+  if (base->cork_flushers) base->cork_flushers--;
+  return Qnil;
+}
+
+static VALUE cork_flusher_protected(VALUE obj) {
+  return rb_rescue2(cork_flusher_run, obj, cork_flusher_rescue, obj, rb_eIOError, rb_eSystemCallError, (VALUE)0);
+}
+
+static VALUE cork_flusher_block(RB_BLOCK_CALL_FUNC_ARGLIST(_, obj)) {
+  return rb_ensure(cork_flusher_protected, obj, cork_flusher_ensure, obj);
+}
+
+// Drops the first len bytes of the buffered strings. A partially sent string
+// is replaced with a substring sharing its contents.
+static void cork_consume(Cork_t *cork, long len) {
+  long count = 0;
+  long strs_len = RARRAY_LEN(cork->strs);
+
+  cork->length -= len;
+  while (count < strs_len) {
+    VALUE str = RARRAY_AREF(cork->strs, count);
+    long str_len = RSTRING_LEN(str);
+    if (len < str_len) {
+      if (len) RARRAY_ASET(cork->strs, count, rb_str_substr(str, len, str_len - len));
+      break;
+    }
+    len -= str_len;
+    count++;
+  }
+  if (count) rb_ary_replace(cork->strs, rb_ary_subseq(cork->strs, count, strs_len - count));
+}
+
+// Tries to send all buffered strings without blocking. Returns 0 if all strings
+// have been sent, or an error has occurred, or -1 if the socket is not
+// writable.
+static int cork_flush_nonblock(Cork_t *cork) {
+  struct iovec iov[CORK_MAX_IOV];
+  rb_io_t *fptr;
+
+  if (RB_TYPE_P(cork->io, T_FILE) && (fptr = RFILE(cork->io)->fptr) && fptr->fd >= 0) {
+    while (RARRAY_LEN(cork->strs)) {
+      int count = RARRAY_LEN(cork->strs) < CORK_MAX_IOV ? RARRAY_LEN(cork->strs) : CORK_MAX_IOV;
+      for (int i = 0; i < count; i++) {
+        VALUE str = RARRAY_AREF(cork->strs, i);
+        iov[i].iov_base = RSTRING_PTR(str);
+        iov[i].iov_len = RSTRING_LEN(str);
+      }
+      struct msghdr msg = { .msg_iov = iov, .msg_iovlen = count };
+      ssize_t ret = sendmsg(fptr->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (ret < 0) {
+        int e = errno;
+        if (e == EINTR) continue;
+        if (e == EAGAIN || e == EWOULDBLOCK) return -1;
+
+        cork->error = rb_syserr_new(e, strerror(e));
+        break;
+      }
+      cork_consume(cork, ret);
+      if (RARRAY_LEN(cork->strs) && !ret) return -1;
+    }
+  }
+  rb_ary_clear(cork->strs);
+  cork->length = 0;
+  return 0;
+}
+
+// Called on switchpoints, sends the buffered strings of all pending corks.
+void backend_corks_flush_nonblock(struct Backend_base *base) {
+  VALUE corks = base->pending_corks;
+  base->pending_corks = Qnil;
+
+  for (long i = 0; i < RARRAY_LEN(corks); i++) {
+    VALUE obj = RARRAY_AREF(corks, i);
+    Cork_t *cork = cork_get(obj);
+    cork->pending = 0;
+    if (cork_flush_nonblock(cork) == 0) continue;
+
+    VALUE main_fiber = rb_ivar_get(rb_thread_current(), ID_ivar_main_fiber);
+    cork->flusher = rb_block_call(main_fiber, ID_spin, 0, 0, cork_flusher_block, obj);
+    base->cork_flushers++;
+  }
+  RB_GC_GUARD(corks);
+}
+
+// Called after forking. Data buffered in the parent process is discarded.
+void backend_corks_reset(struct Backend_base *base) {
+  VALUE corks = base->pending_corks;
+  base->pending_corks = Qnil;
+  base->cork_flushers = 0;
+  if (corks == Qnil) return;
+
+  for (long i = 0; i < RARRAY_LEN(corks); i++) {
+    Cork_t *cork = cork_get(RARRAY_AREF(corks, i));
+    cork->pending = 0;
+    rb_ary_clear(cork->strs);
+    cork->length = 0;
+  }
+  RB_GC_GUARD(corks);
+}
+
+// Called before any backend op on the given io, sends its buffered strings,
+// or waits for its flusher fiber to send them.
+void backend_cork_flush_io(VALUE backend, VALUE io) {
+  VALUE obj = cork_for_io(io);
+  if (obj == Qnil) return;
+
+  Cork_t *cork = cork_get(obj);
+  if (cork->pending || (cork->flusher != Qnil && cork->flusher != rb_fiber_current()))
+    cork_flush(backend, obj);
+}
+
+static long cork_write(VALUE obj, int argc, VALUE *argv) {
+  VALUE backend = BACKEND();
+  Cork_t *cork = cork_get(obj);
+  long written = 0;
+  cork_raise_error(cork);
+
+  for (int i = 0; i < argc; i++) {
+    VALUE str = rb_str_new_frozen(rb_obj_as_string(argv[i]));
+    if (!RSTRING_LEN(str)) continue;
+
+    rb_ary_push(cork->strs, str);
+    written += RSTRING_LEN(str);
+  }
+  cork->length += written;
+
+  if (cork->length >= cork->threshold || RARRAY_LEN(cork->strs) >= CORK_MAX_IOV)
+    cork_flush(backend, obj);
+  else if (RARRAY_LEN(cork->strs) && cork->flusher == Qnil)
+    cork_set_pending(backend, obj, cork, 1);
+  return written;
+}
+
+// Buffers the given strings if the socket is corked, returning the number of
+// bytes written, or -1 if the socket is not corked.
+long socket_cork_write(VALUE io, int argc, VALUE *argv) {
+  VALUE obj = cork_for_io(io);
+  return obj == Qnil ? -1 : cork_write(obj, argc, argv);
+}
+
+// Starts buffering data written to the socket, up to the given threshold (in
+// bytes). If already corked, the threshold is updated.
+VALUE Socket_cork(int argc, VALUE *argv, VALUE self) {
+  VALUE threshold;
+  rb_scan_args(argc, argv, "01", &threshold);
+  long threshold_int = NIL_P(threshold) ? CORK_DEFAULT_THRESHOLD : NUM2LONG(threshold);
+  if (threshold_int <= 0) rb_raise(rb_eArgError, "threshold must be positive");
+
+  VALUE io = cork_io(self);
+  VALUE obj = rb_attr_get(io, ID_cork);
+  if (obj == Qnil) {
+    Cork_t *cork;
+    obj = TypedData_Make_Struct(rb_cObject, Cork_t, &Cork_type, cork);
+    cork->io = io;
+    cork->strs = rb_ary_new();
+    cork->length = 0;
+    cork->pending = 0;
+    cork->flusher = Qnil;
+    cork->error = Qnil;
+    rb_ivar_set(io, ID_cork, obj);
+  }
+  cork_get(obj)->threshold = threshold_int;
+  return self;
+}
+
+// Sends any buffered data and stops corking.
+VALUE Socket_uncork(VALUE self) {
+  VALUE io = cork_io(self);
+  VALUE obj = rb_attr_get(io, ID_cork);
+  if (obj == Qnil) return self;
+
+  // data written while the buffered data is sent is still buffered
+  cork_flush(BACKEND(), obj);
+  rb_ivar_set(io, ID_cork, Qnil);
+  return self;
+}
+
+VALUE Socket_corked_p(VALUE self) {
+  return cork_for_io(self) == Qnil ? Qfalse : Qtrue;
+}
+
+// Sends any buffered data.
+VALUE Socket_flush(VALUE self) {
+  VALUE obj = cork_for_io(self);
+  if (obj != Qnil) cork_flush(BACKEND(), obj);
+  return self;
+}
+
+void Init_Cork() {
+  VALUE cBasicSocket = rb_const_get(rb_cObject, rb_intern("BasicSocket"));
+
+  rb_define_method(cBasicSocket, "cork!", Socket_cork, -1);
+  rb_define_method(cBasicSocket, "uncork!", Socket_uncork, 0);
+  rb_define_method(cBasicSocket, "corked?", Socket_corked_p, 0);
+  rb_define_method(cBasicSocket, "flush", Socket_flush, 0);
+
+  ID_cork   = rb_intern("__cork__");
+  ID_spin   = rb_intern("spin");
+  ID_await  = rb_intern("await");
+}
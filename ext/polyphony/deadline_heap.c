@@ -0,0 +1,91 @@
+#include "polyphony.h"
+#include "deadline_heap.h"
+
+void deadline_heap_init(deadline_heap *heap) {
+  heap->size = 16;
+  heap->count = 0;
+  heap->entries = malloc(heap->size * sizeof(deadline_entry *));
+}
+
+void deadline_heap_free(deadline_heap *heap) {
+  free(heap->entries);
+  heap->entries = NULL;
+  heap->size = 0;
+  heap->count = 0;
+}
+
+void deadline_heap_mark(deadline_heap *heap) {
+  for (unsigned int i = 0; i < heap->count; i++) {
+    rb_gc_mark(heap->entries[i]->fiber);
+    rb_gc_mark(heap->entries[i]->value);
+  }
+}
+
+void deadline_heap_clear(deadline_heap *heap) {
+  for (unsigned int i = 0; i < heap->count; i++) heap->entries[i]->index = -1;
+  heap->count = 0;
+}
+
+static inline void deadline_heap_set(deadline_heap *heap, unsigned int idx, deadline_entry *entry) {
+  heap->entries[idx] = entry;
+  entry->index = idx;
+}
+
+static void deadline_heap_sift_up(deadline_heap *heap, unsigned int idx) {
+  deadline_entry *entry = heap->entries[idx];
+  while (idx > 0) {
+    unsigned int parent = (idx - 1) / 2;
+    if (heap->entries[parent]->deadline <= entry->deadline) break;
+    deadline_heap_set(heap, idx, heap->entries[parent]);
+    idx = parent;
+  }
+  deadline_heap_set(heap, idx, entry);
+}
+
+static void deadline_heap_sift_down(deadline_heap *heap, unsigned int idx) {
+  deadline_entry *entry = heap->entries[idx];
+  while (1) {
+    unsigned int child = idx * 2 + 1;
+    if (child >= heap->count) break;
+    if (child + 1 < heap->count && heap->entries[child + 1]->deadline < heap->entries[child]->deadline)
+      child++;
+    if (entry->deadline <= heap->entries[child]->deadline) break;
+    deadline_heap_set(heap, idx, heap->entries[child]);
+    idx = child;
+  }
+  deadline_heap_set(heap, idx, entry);
+}
+
+void deadline_heap_push(deadline_heap *heap, deadline_entry *entry) {
+  if (heap->count == heap->size) {
+    heap->size *= 2;
+    heap->entries = realloc(heap->entries, heap->size * sizeof(deadline_entry *));
+  }
+  heap->entries[heap->count] = entry;
+  entry->index = heap->count++;
+  deadline_heap_sift_up(heap, entry->index);
+}
+
+void deadline_heap_remove(deadline_heap *heap, deadline_entry *entry) {
+  if (entry->index < 0) return;
+
+  unsigned int idx = entry->index;
+  entry->index = -1;
+  if (idx == --heap->count) return;
+
+  deadline_heap_set(heap, idx, heap->entries[heap->count]);
+  if (idx > 0 && heap->entries[(idx - 1) / 2]->deadline > heap->entries[idx]->deadline)
+    deadline_heap_sift_up(heap, idx);
+  else
+    deadline_heap_sift_down(heap, idx);
+}
+
+// Removes and returns the soonest entry if its deadline is not later than
+// now, otherwise returns NULL.
+deadline_entry *deadline_heap_pop_expired(deadline_heap *heap, double now) {
+  if (!heap->count || heap->entries[0]->deadline > now) return NULL;
+
+  deadline_entry *entry = heap->entries[0];
+  deadline_heap_remove(heap, entry);
+  return entry;
+}
@@ -0,0 +1,39 @@
+#ifndef DEADLINE_HEAP_H
+#define DEADLINE_HEAP_H
+
+#include "ruby.h"
+
+// A deadline heap entry is normally allocated on the stack of the fiber
+// waiting on it, and is held in the heap until it either expires or is
+// removed.
+typedef struct deadline_entry {
+  double deadline;
+  VALUE fiber;
+  VALUE value;
+  int index;
+} deadline_entry;
+
+typedef struct deadline_heap {
+  deadline_entry **entries;
+  unsigned int size;
+  unsigned int count;
+} deadline_heap;
+
+void deadline_heap_init(deadline_heap *heap);
+void deadline_heap_free(deadline_heap *heap);
+void deadline_heap_mark(deadline_heap *heap);
+void deadline_heap_clear(deadline_heap *heap);
+
+void deadline_heap_push(deadline_heap *heap, deadline_entry *entry);
+void deadline_heap_remove(deadline_heap *heap, deadline_entry *entry);
+deadline_entry *deadline_heap_pop_expired(deadline_heap *heap, double now);
+
+static inline deadline_entry *deadline_heap_peek(deadline_heap *heap) {
+  return heap->count ? heap->entries[0] : NULL;
+}
+
+static inline int deadline_entry_pending_p(deadline_entry *entry) {
+  return entry->index >= 0;
+}
+
+#endif /* DEADLINE_HEAP_H */
@@ -0,0 +1,208 @@
+#include <string.h>
+#include <arpa/inet.h>
+#include "polyphony.h"
+
+// Native DNS message encoder and decoder, used by Polyphony::Resolver. Queries
+// are encoded with a single question, and an EDNS0 OPT record advertising the
+// UDP payload size accepted by the resolver. Only the answer section of
+// responses is decoded, and only A, AAAA and CNAME records are returned.
+
+#define DNS_HEADER_SIZE       12
+#define DNS_MAX_NAME_LEN      255
+#define DNS_MAX_POINTERS      64
+#define DNS_UDP_PAYLOAD_SIZE  1232
+
+#define DNS_TYPE_A            1
+#define DNS_TYPE_CNAME        5
+#define DNS_TYPE_AAAA         28
+#define DNS_TYPE_OPT          41
+#define DNS_CLASS_IN          1
+
+#define DNS_FLAG_QR           0x80
+#define DNS_FLAG_TC           0x02
+#define DNS_FLAG_RD           0x01
+
+VALUE mDNS = Qnil;
+VALUE cDNSProtocolError = Qnil;
+
+static inline void dns_put16(unsigned char *ptr, unsigned int value) {
+  ptr[0] = (value >> 8) & 0xff;
+  ptr[1] = value & 0xff;
+}
+
+static inline unsigned int dns_get16(const unsigned char *ptr) {
+  return (ptr[0] << 8) | ptr[1];
+}
+
+static inline unsigned long dns_get32(const unsigned char *ptr) {
+  return ((unsigned long)ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) | ptr[3];
+}
+
+// Encodes a query for the given name and record type, with the recursion
+// desired flag set.
+VALUE DNS_encode_query(VALUE self, VALUE id, VALUE name, VALUE type) {
+  StringValue(name);
+  const char *ptr = RSTRING_PTR(name);
+  long len = RSTRING_LEN(name);
+  if (len && ptr[len - 1] == '.') len--;
+  if (!len || len > DNS_MAX_NAME_LEN - 2) rb_raise(rb_eArgError, "invalid domain name");
+
+  // header, encoded name, question type and class, and OPT record
+  VALUE query = rb_str_buf_new(DNS_HEADER_SIZE + len + 2 + 4 + 11);
+  unsigned char *buf = (unsigned char *)RSTRING_PTR(query);
+  memset(buf, 0, DNS_HEADER_SIZE);
+  dns_put16(buf, NUM2UINT(id));
+  buf[2] = DNS_FLAG_RD;
+  dns_put16(buf + 4, 1);
+  dns_put16(buf + 10, 1);
+
+  unsigned char *pos = buf + DNS_HEADER_SIZE;
+  long label_start = 0;
+  for (long i = 0; i <= len; i++) {
+    if (i < len && ptr[i] != '.') continue;
+
+    long label_len = i - label_start;
+    if (!label_len || label_len > 63) rb_raise(rb_eArgError, "invalid domain name");
+    *pos++ = label_len;
+    memcpy(pos, ptr + label_start, label_len);
+    pos += label_len;
+    label_start = i + 1;
+  }
+  *pos++ = 0;
+  dns_put16(pos, NUM2UINT(type));
+  dns_put16(pos + 2, DNS_CLASS_IN);
+  pos += 4;
+
+  // the OPT record has an empty (root) name, and its class is the payload size
+  *pos++ = 0;
+  dns_put16(pos, DNS_TYPE_OPT);
+  dns_put16(pos + 2, DNS_UDP_PAYLOAD_SIZE);
+  memset(pos + 4, 0, 6);
+  pos += 10;
+
+  rb_str_set_len(query, pos - buf);
+  return query;
+}
+
+// Reads the (possibly compressed) name at *pos into buf, which should be at
+// least DNS_MAX_NAME_LEN bytes long, and advances *pos past the name. Returns
+// the length of the name.
+static long dns_read_name(const unsigned char *msg, long len, long *pos, char *buf) {
+  long ptr = *pos;
+  long name_len = 0;
+  int pointers = 0;
+
+  while (1) {
+    if (ptr >= len) goto invalid;
+
+    unsigned int label_len = msg[ptr];
+    if ((label_len & 0xc0) == 0xc0) {
+      if (ptr + 1 >= len || ++pointers > DNS_MAX_POINTERS) goto invalid;
+      if (pointers == 1) *pos = ptr + 2;
+      ptr = ((label_len & 0x3f) << 8) | msg[ptr + 1];
+      continue;
+    }
+    if (label_len & 0xc0) goto invalid;
+
+    ptr++;
+    if (!label_len) break;
+    if (ptr + label_len > len || name_len + label_len + 1 > DNS_MAX_NAME_LEN) goto invalid;
+    if (name_len) buf[name_len++] = '.';
+    memcpy(buf + name_len, msg + ptr, label_len);
+    name_len += label_len;
+    ptr += label_len;
+  }
+  if (!pointers) *pos = ptr;
+  return name_len;
+invalid:
+  rb_raise(cDNSProtocolError, "invalid name");
+}
+
+static inline VALUE dns_record_value(const unsigned char *msg, long len, long pos, unsigned int type, unsigned int rdlen) {
+  char buf[DNS_MAX_NAME_LEN + 1];
+
+  switch (type) {
+    case DNS_TYPE_A:
+      if (rdlen != 4 || !inet_ntop(AF_INET, msg + pos, buf, sizeof(buf))) break;
+      return rb_usascii_str_new_cstr(buf);
+    case DNS_TYPE_AAAA:
+      if (rdlen != 16 || !inet_ntop(AF_INET6, msg + pos, buf, sizeof(buf))) break;
+      return rb_usascii_str_new_cstr(buf);
+    case DNS_TYPE_CNAME: {
+      long name_len = dns_read_name(msg, len, &pos, buf);
+      return rb_usascii_str_new(buf, name_len);
+    }
+  }
+  return Qnil;
+}
+
+// Decodes the given response, returning an array containing the message id,
+// the response code, whether the response was truncated, the A, AAAA and
+// CNAME records found in the answer section, as [type, ttl, value] tuples, and
+// the question, as a [name, type, class] tuple (or nil if the response does not
+// have a single question). Record values are the address or canonical name, as
+// a string. The records of truncated responses are not decoded.
+VALUE DNS_decode_response(VALUE self, VALUE data) {
+  StringValue(data);
+  const unsigned char *msg = (const unsigned char *)RSTRING_PTR(data);
+  long len = RSTRING_LEN(data);
+  char name[DNS_MAX_NAME_LEN + 1];
+
+  if (len < DNS_HEADER_SIZE) rb_raise(cDNSProtocolError, "message too short");
+  if (!(msg[2] & DNS_FLAG_QR)) rb_raise(cDNSProtocolError, "not a response");
+
+  VALUE id = UINT2NUM(dns_get16(msg));
+  VALUE rcode = UINT2NUM(msg[3] & 0x0f);
+  VALUE records = rb_ary_new();
+  VALUE question = Qnil;
+
+  unsigned int question_count = dns_get16(msg + 4);
+  unsigned int answer_count = dns_get16(msg + 6);
+  long pos = DNS_HEADER_SIZE;
+  for (unsigned int i = 0; i < question_count; i++) {
+    long name_len = dns_read_name(msg, len, &pos, name);
+    if (pos + 4 > len) rb_raise(cDNSProtocolError, "invalid question");
+    if (question_count == 1)
+      question = rb_ary_new_from_args(3, rb_usascii_str_new(name, name_len),
+        UINT2NUM(dns_get16(msg + pos)), UINT2NUM(dns_get16(msg + pos + 2)));
+    pos += 4;
+  }
+  if (msg[2] & DNS_FLAG_TC) return rb_ary_new_from_args(5, id, rcode, Qtrue, records, question);
+
+  for (unsigned int i = 0; i < answer_count; i++) {
+    dns_read_name(msg, len, &pos, name);
+    if (pos + 10 > len) rb_raise(cDNSProtocolError, "invalid record");
+
+    unsigned int type = dns_get16(msg + pos);
+    unsigned int klass = dns_get16(msg + pos + 2);
+    unsigned long ttl = dns_get32(msg + pos + 4);
+    unsigned int rdlen = dns_get16(msg + pos + 8);
+    pos += 10;
+    if (pos + rdlen > len) rb_raise(cDNSProtocolError, "invalid record");
+    // TTLs with the high bit set are treated as zero (RFC 2181)
+    if (ttl & 0x80000000) ttl = 0;
+
+    VALUE value = klass == DNS_CLASS_IN ? dns_record_value(msg, len, pos, type, rdlen) : Qnil;
+    if (value != Qnil)
+      rb_ary_push(records, rb_ary_new_from_args(3, UINT2NUM(type), ULONG2NUM(ttl), value));
+    pos += rdlen;
+  }
+
+  RB_GC_GUARD(records);
+  RB_GC_GUARD(question);
+  return rb_ary_new_from_args(5, id, rcode, Qfalse, records, question);
+}
+
+void Init_DNS() {
+  mDNS = rb_define_module_under(mPolyphony, "DNS");
+  rb_define_singleton_method(mDNS, "encode_query", DNS_encode_query, 3);
+  rb_define_singleton_method(mDNS, "decode_response", DNS_decode_response, 1);
+
+  rb_define_const(mDNS, "TYPE_A", INT2FIX(DNS_TYPE_A));
+  rb_define_const(mDNS, "TYPE_CNAME", INT2FIX(DNS_TYPE_CNAME));
+  rb_define_const(mDNS, "TYPE_AAAA", INT2FIX(DNS_TYPE_AAAA));
+  rb_define_const(mDNS, "CLASS_IN", INT2FIX(DNS_CLASS_IN));
+  rb_define_const(mDNS, "UDP_PAYLOAD_SIZE", INT2FIX(DNS_UDP_PAYLOAD_SIZE));
+
+  cDNSProtocolError = rb_define_class_under(mDNS, "ProtocolError", rb_eRuntimeError);
+}
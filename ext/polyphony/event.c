@@ -1,23 +1,29 @@
 #include "polyphony.h"
 #include "ring_buffer.h"
 
+// An event may be awaited by any number of fibers. Signalling the event
+// resumes all fibers currently waiting on it.
 typedef struct event {
-  VALUE waiting_fiber;
+  ring_buffer waiters;
 } Event_t;
 
 VALUE cEvent = Qnil;
+static ID ID_timeout;
 
 static void Event_mark(void *ptr) {
   Event_t *event = ptr;
-  rb_gc_mark(event->waiting_fiber);
+  ring_buffer_mark(&event->waiters);
 }
 
 static void Event_free(void *ptr) {
+  Event_t *event = ptr;
+  ring_buffer_free(&event->waiters);
   xfree(ptr);
 }
 
 static size_t Event_size(const void *ptr) {
-  return sizeof(Event_t);
+  const Event_t *event = ptr;
+  return sizeof(Event_t) + event->waiters.size * sizeof(VALUE);
 }
 
 static const rb_data_type_t Event_type = {
@@ -30,6 +36,7 @@ static VALUE Event_allocate(VALUE klass) {
   Event_t *event;
 
   event = ALLOC(Event_t);
+  ring_buffer_init(&event->waiters);
   return TypedData_Wrap_Struct(klass, &Event_type, event);
 }
 
@@ -37,11 +44,6 @@ static VALUE Event_allocate(VALUE klass) {
   TypedData_Get_Struct((obj), Event_t, &Event_type, (event))
 
 static VALUE Event_initialize(VALUE self) {
-  Event_t *event;
-  GetEvent(self, event);
-
-  event->waiting_fiber = Qnil;
-
   return self;
 }
 
@@ -50,24 +52,21 @@ VALUE Event_signal(int argc, VALUE *argv, VALUE self) {
   Event_t *event;
   GetEvent(self, event);
 
-  if (event->waiting_fiber != Qnil) {
-    Fiber_make_runnable(event->waiting_fiber, value);
-    event->waiting_fiber = Qnil;
-  }
+  while (event->waiters.count)
+    Fiber_make_runnable(ring_buffer_shift(&event->waiters), value);
   return self;
 }
 
-VALUE Event_await(VALUE self) {
+static VALUE event_wait(RB_BLOCK_CALL_FUNC_ARGLIST(yielded_arg, self)) {
   Event_t *event;
   GetEvent(self, event);
 
-  if (event->waiting_fiber != Qnil)
-    rb_raise(rb_eRuntimeError, "Event is already awaited by another fiber");
-
   VALUE backend = rb_ivar_get(rb_thread_current(), ID_ivar_backend);
-  event->waiting_fiber = rb_fiber_current();
+  VALUE fiber = rb_fiber_current();
+  ring_buffer_push(&event->waiters, fiber);
   VALUE switchpoint_result = Backend_wait_event(backend, Qnil);
-  event->waiting_fiber = Qnil;
+  // the fiber might have been resumed by something other than the event
+  ring_buffer_delete(&event->waiters, fiber);
 
   RAISE_IF_EXCEPTION(switchpoint_result);
   RB_GC_GUARD(backend);
@@ -76,11 +75,36 @@ VALUE Event_await(VALUE self) {
   return switchpoint_result;
 }
 
+// Waits for the event to be signalled, returning the signalled value. If a
+// timeout is given and the event is not signalled within the given interval,
+// returns nil.
+VALUE Event_await(int argc, VALUE *argv, VALUE self) {
+  VALUE timeout = Qnil;
+  rb_scan_args(argc, argv, "01", &timeout);
+
+  if (timeout == Qnil) return event_wait(Qnil, self, 0, 0, Qnil);
+
+  VALUE backend = rb_ivar_get(rb_thread_current(), ID_ivar_backend);
+  VALUE args[2] = {timeout, Qnil};
+  return rb_block_call(backend, ID_timeout, 2, args, event_wait, self);
+}
+
+// Returns the number of fibers waiting on the event.
+VALUE Event_waiting_count(VALUE self) {
+  Event_t *event;
+  GetEvent(self, event);
+
+  return UINT2NUM(event->waiters.count);
+}
+
 void Init_Event() {
   cEvent = rb_define_class_under(mPolyphony, "Event", rb_cObject);
   rb_define_alloc_func(cEvent, Event_allocate);
 
   rb_define_method(cEvent, "initialize", Event_initialize, 0);
-  rb_define_method(cEvent, "await", Event_await, 0);
+  rb_define_method(cEvent, "await", Event_await, -1);
   rb_define_method(cEvent, "signal", Event_signal, -1);
+  rb_define_method(cEvent, "waiting_count", Event_waiting_count, 0);
+
+  ID_timeout = rb_intern("timeout");
 }
@@ -8,10 +8,12 @@ use_pidfd_open = false
 force_use_libev = ENV['POLYPHONY_USE_LIBEV'] != nil
 linux = RUBY_PLATFORM =~ /linux/
 
-if linux && `uname -sr` =~ /Linux 5\.(\d+)/
-  kernel_minor_version = $1.to_i
-  use_liburing = !force_use_libev && kernel_minor_version >= 6
-  use_pidfd_open = kernel_minor_version >= 3
+# Both backends are compiled on Linux, and the backend is selected at runtime
+# (see backend.c). The libev backend is always compiled, as a fallback.
+if linux && `uname -r` =~ /^(\d+)\.(\d+)/
+  kernel_version = [$1.to_i, $2.to_i]
+  use_liburing = !force_use_libev && (kernel_version <=> [5, 6]) >= 0
+  use_pidfd_open = (kernel_version <=> [5, 3]) >= 0
 end
 
 $defs << '-DPOLYPHONY_USE_PIDFD_OPEN' if use_pidfd_open
@@ -19,23 +21,25 @@ if use_liburing
   $defs << "-DPOLYPHONY_BACKEND_LIBURING"
   $defs << "-DPOLYPHONY_UNSET_NONBLOCK" if RUBY_VERSION =~ /^3/
   $CFLAGS << " -Wno-pointer-arith"
-else
-  $defs << "-DPOLYPHONY_BACKEND_LIBEV"
-  $defs << "-DPOLYPHONY_LINUX" if linux
-  $defs << '-DEV_USE_LINUXAIO'     if have_header('linux/aio_abi.h')
-  $defs << '-DEV_USE_SELECT'       if have_header('sys/select.h')
-  $defs << '-DEV_USE_POLL'         if have_type('port_event_t', 'poll.h')
-  $defs << '-DEV_USE_EPOLL'        if have_header('sys/epoll.h')
-  $defs << '-DEV_USE_KQUEUE'       if have_header('sys/event.h') && have_header('sys/queue.h')
-  $defs << '-DEV_USE_PORT'         if have_type('port_event_t', 'port.h')
-  $defs << '-DHAVE_SYS_RESOURCE_H' if have_header('sys/resource.h')
-
-  $CFLAGS << " -Wno-comment"
-  $CFLAGS << " -Wno-unused-result"
-  $CFLAGS << " -Wno-dangling-else"
-  $CFLAGS << " -Wno-parentheses"
 end
 
+$defs << "-DPOLYPHONY_BACKEND_LIBEV"
+$defs << "-DPOLYPHONY_LINUX" if linux
+$defs << '-DEV_USE_LINUXAIO'     if have_header('linux/aio_abi.h')
+$defs << '-DEV_USE_SELECT'       if have_header('sys/select.h')
+$defs << '-DEV_USE_POLL'         if have_type('port_event_t', 'poll.h')
+$defs << '-DEV_USE_EPOLL'        if have_header('sys/epoll.h')
+$defs << '-DEV_USE_KQUEUE'       if have_header('sys/event.h') && have_header('sys/queue.h')
+$defs << '-DEV_USE_PORT'         if have_type('port_event_t', 'port.h')
+$defs << '-DHAVE_SYS_RESOURCE_H' if have_header('sys/resource.h')
+$defs << '-DPOLYPHONY_ZLIB'       if have_library('z', 'deflate', 'zlib.h')
+have_header('linux/tls.h') if linux
+
+$CFLAGS << " -Wno-comment"
+$CFLAGS << " -Wno-unused-result"
+$CFLAGS << " -Wno-dangling-else"
+$CFLAGS << " -Wno-parentheses"
+
 $defs << '-DPOLYPHONY_PLAYGROUND' if ENV['POLYPHONY_PLAYGROUND']
 
 CONFIG['optflags'] << ' -fno-strict-aliasing' unless RUBY_PLATFORM =~ /mswin/
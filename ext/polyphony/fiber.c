@@ -1,14 +1,19 @@
 #include "polyphony.h"
+#include "runqueue.h"
 
 ID ID_ivar_auto_watcher;
 ID ID_ivar_mailbox;
 ID ID_ivar_result;
 ID ID_ivar_waiting_fibers;
+ID ID_fiber_state;
 
 VALUE SYM_dead;
 VALUE SYM_running;
 VALUE SYM_runnable;
 VALUE SYM_waiting;
+VALUE SYM_high;
+VALUE SYM_normal;
+VALUE SYM_low;
 
 VALUE SYM_fiber_create;
 VALUE SYM_fiber_event_poll_enter;
@@ -18,6 +23,78 @@ VALUE SYM_fiber_schedule;
 VALUE SYM_fiber_switchpoint;
 VALUE SYM_fiber_terminate;
 
+// Scheduling state is kept in a native struct attached to each fiber (using a
+// hidden attribute), so scheduling a fiber looks up a single attribute instead
+// of a number of instance variables. The attribute is moved along with the
+// fiber by the GC, so the state is always found in constant time. The fiber's
+// backend is cached, and is looked up again whenever any thread's backend is
+// changed.
+typedef struct fiber_state {
+  VALUE thread;
+  VALUE backend;
+  unsigned int backend_generation;
+  int parked;
+  int priority;
+  // innermost idle deadline, see idle_deadline.c
+  void *idle_deadline;
+  // position in the runqueue, see runqueue_ring_buffer.h
+  runqueue_slot runqueue_slot;
+} fiber_state_t;
+
+// number of fibers with a non-default priority, used to skip the priority
+// lookup when scheduling fibers
+static unsigned int fiber_priority_count = 0;
+
+static void FiberState_mark(void *ptr) {
+  fiber_state_t *state = ptr;
+  rb_gc_mark(state->thread);
+  rb_gc_mark(state->backend);
+}
+
+static void FiberState_free(void *ptr) {
+  fiber_state_t *state = ptr;
+  if (state->priority != RUNQUEUE_LEVEL_NORMAL) fiber_priority_count--;
+  xfree(ptr);
+}
+
+static size_t FiberState_size(const void *ptr) {
+  return sizeof(fiber_state_t);
+}
+
+static const rb_data_type_t FiberState_type = {
+  "FiberState",
+  {FiberState_mark, FiberState_free, FiberState_size,},
+  0, 0, 0
+};
+
+static inline fiber_state_t *fiber_state_get(VALUE fiber, int create) {
+  VALUE obj = rb_attr_get(fiber, ID_fiber_state);
+  if (obj != Qnil) return RTYPEDDATA_DATA(obj);
+  if (!create) return NULL;
+
+  fiber_state_t *state = ALLOC(fiber_state_t);
+  state->thread = Qnil;
+  state->backend = Qnil;
+  state->backend_generation = 0;
+  state->parked = 0;
+  state->priority = RUNQUEUE_LEVEL_NORMAL;
+  state->idle_deadline = NULL;
+  state->runqueue_slot.buffer = NULL;
+  state->runqueue_slot.pos = 0;
+  obj = TypedData_Wrap_Struct(rb_cObject, &FiberState_type, state);
+  rb_ivar_set(fiber, ID_fiber_state, obj);
+  RB_GC_GUARD(obj);
+  return state;
+}
+
+static inline VALUE fiber_state_backend(fiber_state_t *state) {
+  if (state->backend == Qnil || state->backend_generation != thread_backend_generation) {
+    state->backend = rb_ivar_get(state->thread, ID_ivar_backend);
+    state->backend_generation = thread_backend_generation;
+  }
+  return state->backend;
+}
+
 static VALUE Fiber_safe_transfer(int argc, VALUE *argv, VALUE self) {
   VALUE arg = (argc == 0) ? Qnil : argv[0];
   VALUE ret = FIBER_TRANSFER(self, arg);
@@ -38,26 +115,100 @@ inline VALUE Fiber_auto_watcher(VALUE self) {
   return watcher;
 }
 
-void Fiber_make_runnable(VALUE fiber, VALUE value) {
-  VALUE thread = rb_ivar_get(fiber, ID_ivar_thread);
-  if (thread == Qnil) {
+static inline void fiber_make_runnable(VALUE fiber, VALUE value, int prioritize) {
+  fiber_state_t *state = fiber_state_get(fiber, 0);
+  if (!state || state->thread == Qnil) {
     rb_raise(rb_eRuntimeError, "No thread set for fiber");
     // rb_warn("No thread set for fiber");
     return;
   }
 
-  Thread_schedule_fiber(thread, fiber, value);
+  Backend_schedule_fiber(state->thread, fiber_state_backend(state), fiber, value, prioritize);
+}
+
+void Fiber_make_runnable(VALUE fiber, VALUE value) {
+  fiber_make_runnable(fiber, value, 0);
 }
 
 void Fiber_make_runnable_with_priority(VALUE fiber, VALUE value) {
-  VALUE thread = rb_ivar_get(fiber, ID_ivar_thread);
-  if (thread == Qnil) {
-    rb_raise(rb_eRuntimeError, "No thread set for fiber");
-    // rb_warn("No thread set for fiber");
-    return;
+  fiber_make_runnable(fiber, value, 1);
+}
+
+VALUE Fiber_state_thread(VALUE fiber) {
+  fiber_state_t *state = fiber_state_get(fiber, 0);
+  return state ? state->thread : Qnil;
+}
+
+int Fiber_runnable_p(VALUE fiber) {
+  fiber_state_t *state = fiber_state_get(fiber, 0);
+  if (!state || state->thread == Qnil) return 0;
+
+  // the fiber's thread might not have a backend
+  VALUE backend = fiber_state_backend(state);
+  return backend != Qnil && Backend_fiber_runnable_p(backend, fiber);
+}
+
+void *Fiber_idle_deadline(VALUE fiber) {
+  fiber_state_t *state = fiber_state_get(fiber, 0);
+  return state ? state->idle_deadline : NULL;
+}
+
+void Fiber_set_idle_deadline(VALUE fiber, void *idle_deadline) {
+  fiber_state_get(fiber, 1)->idle_deadline = idle_deadline;
+}
+
+int Fiber_parked_state(VALUE fiber) {
+  fiber_state_t *state = fiber_state_get(fiber, 0);
+  return state && state->parked;
+}
+
+runqueue_slot *Fiber_runqueue_slot(VALUE fiber, int create) {
+  fiber_state_t *state = fiber_state_get(fiber, create);
+  return state ? &state->runqueue_slot : NULL;
+}
+
+int Fiber_priority_state(VALUE fiber) {
+  if (!fiber_priority_count) return RUNQUEUE_LEVEL_NORMAL;
+
+  fiber_state_t *state = fiber_state_get(fiber, 0);
+  return state ? state->priority : RUNQUEUE_LEVEL_NORMAL;
+}
+
+static VALUE Fiber_priority(VALUE self) {
+  switch (Fiber_priority_state(self)) {
+    case RUNQUEUE_LEVEL_HIGH: return SYM_high;
+    case RUNQUEUE_LEVEL_LOW:  return SYM_low;
+    default:                  return SYM_normal;
   }
+}
+
+// Sets the fiber's priority, which takes effect the next time the fiber is
+// scheduled.
+static VALUE Fiber_set_priority(VALUE self, VALUE priority) {
+  int level;
+  if (priority == SYM_high)         level = RUNQUEUE_LEVEL_HIGH;
+  else if (priority == SYM_normal)  level = RUNQUEUE_LEVEL_NORMAL;
+  else if (priority == SYM_low)     level = RUNQUEUE_LEVEL_LOW;
+  else
+    rb_raise(rb_eArgError, "invalid priority (expected :high, :normal or :low)");
+
+  fiber_state_t *state = fiber_state_get(self, 1);
+  if (state->priority != RUNQUEUE_LEVEL_NORMAL) fiber_priority_count--;
+  if (level != RUNQUEUE_LEVEL_NORMAL) fiber_priority_count++;
+  state->priority = level;
+  return priority;
+}
 
-  Thread_schedule_fiber_with_priority(thread, fiber, value);
+static VALUE Fiber_thread(VALUE self) {
+  fiber_state_t *state = fiber_state_get(self, 0);
+  return state ? state->thread : Qnil;
+}
+
+static VALUE Fiber_set_thread(VALUE self, VALUE thread) {
+  fiber_state_t *state = fiber_state_get(self, 1);
+  state->thread = thread;
+  state->backend = Qnil;
+  return thread;
 }
 
 static VALUE Fiber_schedule(int argc, VALUE *argv, VALUE self) {
@@ -76,7 +227,8 @@ static VALUE Fiber_state(VALUE self) {
   if (!rb_fiber_alive_p(self) || (rb_ivar_get(self, ID_ivar_running) == Qfalse))
     return SYM_dead;
   if (rb_fiber_current() == self) return SYM_running;
-  if (rb_ivar_get(self, ID_ivar_runnable) != Qnil) return SYM_runnable;
+
+  if (Fiber_runnable_p(self)) return SYM_runnable;
 
   return SYM_waiting;
 }
@@ -115,19 +267,25 @@ VALUE Fiber_receive_all_pending(VALUE self) {
 }
 
 VALUE Fiber_park(VALUE self) {
-  rb_ivar_set(self, ID_ivar_parked, Qtrue);
+  fiber_state_t *state = fiber_state_get(self, 1);
+  if (state->parked) return self;
+
+  state->parked = 1;
   Backend_park_fiber(BACKEND(), self);
   return self;
 }
 
 VALUE Fiber_unpark(VALUE self) {
-  rb_ivar_set(self, ID_ivar_parked, Qnil);
+  fiber_state_t *state = fiber_state_get(self, 1);
+  if (!state->parked) return self;
+
+  state->parked = 0;
   Backend_unpark_fiber(BACKEND(), self);
   return self;
 }
 
 VALUE Fiber_parked_p(VALUE self) {
-  return rb_ivar_get(self, ID_ivar_parked);
+  return Fiber_parked_state(self) ? Qtrue : Qnil;
 }
 
 void Init_Fiber() {
@@ -136,6 +294,10 @@ void Init_Fiber() {
   rb_define_method(cFiber, "schedule", Fiber_schedule, -1);
   rb_define_method(cFiber, "schedule_with_priority", Fiber_schedule_with_priority, -1);
   rb_define_method(cFiber, "state", Fiber_state, 0);
+  rb_define_method(cFiber, "thread", Fiber_thread, 0);
+  rb_define_method(cFiber, "thread=", Fiber_set_thread, 1);
+  rb_define_method(cFiber, "priority", Fiber_priority, 0);
+  rb_define_method(cFiber, "priority=", Fiber_set_priority, 1);
   rb_define_method(cFiber, "auto_watcher", Fiber_auto_watcher, 0);
 
   rb_define_method(cFiber, "<<", Fiber_send, 1);
@@ -157,6 +319,14 @@ void Init_Fiber() {
   rb_global_variable(&SYM_runnable);
   rb_global_variable(&SYM_waiting);
 
+  SYM_high = ID2SYM(rb_intern("high"));
+  SYM_normal = ID2SYM(rb_intern("normal"));
+  SYM_low = ID2SYM(rb_intern("low"));
+  rb_global_variable(&SYM_high);
+  rb_global_variable(&SYM_normal);
+  rb_global_variable(&SYM_low);
+
+  ID_fiber_state              = rb_intern("__fiber_state__");
   ID_ivar_auto_watcher        = rb_intern("@auto_watcher");
   ID_ivar_mailbox             = rb_intern("@mailbox");
   ID_ivar_result              = rb_intern("@result");
@@ -0,0 +1,164 @@
+#include "polyphony.h"
+#include "backend_common.h"
+
+// Idle deadlines implement connection-scoped idle timeouts without a timer op
+// per read or write. An idle deadline is associated with a fiber for the
+// duration of a Backend#idle_timeout block, and is pushed back whenever an op
+// performed by the fiber transfers data (see BACKEND_TOUCH_IDLE_DEADLINE),
+// which only involves reading the clock. A single timer per backend sweeps
+// the idle deadlines, interrupting fibers whose deadline has passed. Sweeps
+// are coalesced by allowing deadlines to expire late by up to 1/8 of their
+// interval, capped at IDLE_SWEEP_MAX_SLACK.
+
+#define IDLE_SWEEP_MAX_SLACK 0.05
+
+static inline double idle_deadline_slack(idle_deadline_t *entry) {
+  double slack = entry->interval / 8;
+  return slack < IDLE_SWEEP_MAX_SLACK ? slack : IDLE_SWEEP_MAX_SLACK;
+}
+
+static inline int op_type_transfers_data(enum op_type type) {
+  switch (type) {
+    case OP_READ:
+    case OP_READV:
+    case OP_WRITE:
+    case OP_WRITEV:
+    case OP_RECV:
+    case OP_SEND:
+    case OP_SEND_ZC:
+    case OP_RECVMSG:
+    case OP_SENDMSG:
+    case OP_SPLICE:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+// Nested idle deadlines are all pushed back.
+static inline void idle_deadline_touch_fiber(VALUE fiber) {
+  idle_deadline_t *entry = Fiber_idle_deadline(fiber);
+  if (!entry) return;
+
+  double now = current_time();
+  for (; entry; entry = entry->outer) entry->last_active = now;
+}
+
+void backend_idle_deadline_touch(struct Backend_base *base, VALUE fiber, enum op_type type) {
+  if (RTEST(fiber) && op_type_transfers_data(type)) idle_deadline_touch_fiber(fiber);
+}
+
+// Interrupts the fibers of all expired idle deadlines, and returns the time of
+// the next sweep, or 0 if no idle deadline is pending.
+double backend_idle_deadlines_sweep(struct Backend_base *base, double now) {
+  double next = 0;
+
+  for (idle_deadline_t *entry = base->idle_deadlines; entry; entry = entry->next) {
+    if (entry->expired) continue;
+
+    double deadline = entry->last_active + entry->interval;
+    if (deadline <= now) {
+      entry->expired = 1;
+      Fiber_make_runnable(entry->fiber, entry->timeout);
+      continue;
+    }
+    deadline += idle_deadline_slack(entry);
+    if (!next || deadline < next) next = deadline;
+  }
+  return next;
+}
+
+void backend_idle_deadlines_mark(struct Backend_base *base) {
+  for (idle_deadline_t *entry = base->idle_deadlines; entry; entry = entry->next) {
+    rb_gc_mark(entry->fiber);
+    rb_gc_mark(entry->timeout);
+  }
+}
+
+static void idle_deadline_add(struct Backend_base *base, idle_deadline_t *entry) {
+  entry->prev = NULL;
+  entry->next = base->idle_deadlines;
+  if (entry->next) entry->next->prev = entry;
+  base->idle_deadlines = entry;
+  base->idle_deadline_count++;
+
+  entry->outer = Fiber_idle_deadline(entry->fiber);
+  Fiber_set_idle_deadline(entry->fiber, entry);
+
+  base->interface->arm_idle_sweep(base, entry->last_active + entry->interval + idle_deadline_slack(entry));
+}
+
+struct idle_timeout_ctx {
+  struct Backend_base *base;
+  idle_deadline_t *entry;
+};
+
+static VALUE idle_deadline_remove(VALUE arg) {
+  struct idle_timeout_ctx *ctx = (struct idle_timeout_ctx *)arg;
+  struct Backend_base *base = ctx->base;
+  idle_deadline_t *entry = ctx->entry;
+
+  if (entry->prev)
+    entry->prev->next = entry->next;
+  else
+    base->idle_deadlines = entry->next;
+  if (entry->next) entry->next->prev = entry->prev;
+  base->idle_deadline_count--;
+
+  Fiber_set_idle_deadline(entry->fiber, entry->outer);
+  // the sweep timer is left to fire
+  return Qnil;
+}
+
+// Runs the given block with an idle deadline for the current fiber. If no op
+// performed by the fiber transfers any data for the given interval, the fiber
+// is interrupted, in the same manner as Backend#timeout: the given exception
+// is raised, or if exception is nil, the block is exited and move_on_value is
+// returned.
+VALUE Backend_idle_timeout(int argc, VALUE *argv, VALUE self) {
+  struct Backend_base *base = RTYPEDDATA_DATA(self);
+  VALUE interval;
+  VALUE exception;
+  VALUE move_on_value = Qnil;
+  rb_scan_args(argc, argv, "21", &interval, &exception, &move_on_value);
+
+  double interval_d = NUM2DBL(interval);
+  if (interval_d <= 0) rb_raise(rb_eArgError, "invalid idle timeout interval");
+
+  VALUE timeout = rb_funcall(cTimeoutException, ID_new, 0);
+  idle_deadline_t entry = {
+    .fiber = rb_fiber_current(),
+    .timeout = timeout,
+    .interval = interval_d,
+    .last_active = current_time(),
+    .expired = 0
+  };
+  idle_deadline_add(base, &entry);
+  base->op_count++;
+
+  struct idle_timeout_ctx ctx = {base, &entry};
+  VALUE result = rb_ensure(Backend_timeout_ensure_safe, Qnil, idle_deadline_remove, (VALUE)&ctx);
+
+  if (result == timeout) {
+    if (exception == Qnil) return move_on_value;
+    RAISE_EXCEPTION(backend_timeout_exception(exception));
+  }
+
+  RAISE_IF_EXCEPTION(result);
+  RB_GC_GUARD(result);
+  RB_GC_GUARD(timeout);
+  return result;
+}
+
+// Pushes back the idle deadline of the current fiber, e.g. on activity not
+// involving any I/O.
+VALUE Backend_touch_idle_timeout(VALUE self) {
+  struct Backend_base *base = RTYPEDDATA_DATA(self);
+  if (base->idle_deadline_count) idle_deadline_touch_fiber(rb_fiber_current());
+  return self;
+}
+
+void Init_IdleDeadline(VALUE cBackend) {
+  rb_define_method(cBackend, "idle_timeout", Backend_idle_timeout, -1);
+  rb_define_method(cBackend, "touch_idle_timeout", Backend_touch_idle_timeout, 0);
+}
@@ -0,0 +1,160 @@
+#include "polyphony.h"
+#include "backend_common.h"
+
+// Budgeted idle GC runs garbage collection only when the backend is expected
+// to remain idle long enough for the GC to complete, so incoming work is not
+// held up by a long GC pause. The expected idle window is estimated from
+// recent blocking poll wait durations, and is compared with the estimated
+// cost of the GC, as measured on previous idle GCs. A minor GC is run, unless
+// a major GC is due, i.e. the number of old objects has reached its limit.
+// Ruby does not expose incremental marking to extensions, so GC work is
+// bounded by preferring minor GCs, and by sweeping lazily, i.e. during
+// allocation.
+//
+// A due GC is deferred if its estimated cost exceeds the remaining idle
+// window, or if work has arrived while running idle tasks, but not for longer
+// than max_defer, after which it is run regardless.
+
+// Smoothing factor for moving averages
+#define IDLE_GC_EWMA_WEIGHT 0.125
+
+static ID ID_start;
+static VALUE SYM_old_objects;
+static VALUE SYM_old_objects_limit;
+static VALUE SYM_major_by;
+static VALUE SYM_idle_window;
+static VALUE SYM_minor_cost;
+static VALUE SYM_major_cost;
+static VALUE SYM_max_defer;
+static VALUE minor_gc_opts;
+static VALUE major_gc_opts;
+
+static inline double ewma(double avg, double value) {
+  return avg ? avg + (value - avg) * IDLE_GC_EWMA_WEIGHT : value;
+}
+
+void backend_idle_gc_record_poll_wait(struct Backend_base *base, double duration) {
+  base->idle_gc->idle_window = ewma(base->idle_gc->idle_window, duration);
+}
+
+// Returns true if fibers have been scheduled, or completions are ready to be
+// processed.
+static inline int idle_gc_work_pending(struct Backend_base *base) {
+  if (runqueue_len(&base->runqueue)) return 1;
+  if (__atomic_load_n(&base->inbox, __ATOMIC_ACQUIRE)) return 1;
+  if (base->completions && __atomic_load_n(&base->completions->head, __ATOMIC_ACQUIRE)) return 1;
+  return base->interface->completions_ready && base->interface->completions_ready(base);
+}
+
+static inline int idle_gc_major_due() {
+  return rb_gc_stat(SYM_old_objects) >= rb_gc_stat(SYM_old_objects_limit);
+}
+
+static inline void idle_gc_start(int full_mark) {
+  VALUE opts = full_mark ? major_gc_opts : minor_gc_opts;
+  rb_gc_enable();
+#ifdef RB_PASS_KEYWORDS
+  rb_funcallv_kw(rb_mGC, ID_start, 1, &opts, RB_PASS_KEYWORDS);
+#else
+  rb_funcall(rb_mGC, ID_start, 1, opts);
+#endif
+  rb_gc_disable();
+}
+
+// Runs a due idle GC if it fits in the expected idle window. now is the time
+// at which the GC period was found to have elapsed, and elapsed is the time
+// spent running other idle tasks.
+void backend_idle_gc_run_budgeted(struct Backend_base *base, double now, double elapsed) {
+  struct backend_idle_gc *gc = base->idle_gc;
+  int forced = now - (base->idle_gc_last_time + base->idle_gc_period) >= gc->max_defer;
+  int major = idle_gc_major_due();
+
+  if (!forced) {
+    double cost = major ? gc->major_cost : gc->minor_cost;
+    if (idle_gc_work_pending(base) || (gc->idle_window && cost > gc->idle_window - elapsed)) {
+      base->idle_gc_deferred_count++;
+      return;
+    }
+  }
+
+  idle_gc_start(major);
+  double duration = current_time() - now;
+
+  // a minor GC might have been upgraded by Ruby to a major one
+  if (rb_gc_latest_gc_info(SYM_major_by) != Qnil) {
+    gc->major_cost = ewma(gc->major_cost, duration);
+    base->idle_gc_major_count++;
+  }
+  else {
+    gc->minor_cost = ewma(gc->minor_cost, duration);
+    base->idle_gc_minor_count++;
+  }
+  base->idle_gc_time += duration;
+  base->idle_gc_last_time = now + duration;
+}
+
+// Enables budgeted idle GC, deferring a due GC by up to the given duration. A
+// value of nil disables budgeting, in which case a full GC is run whenever the
+// GC period has elapsed.
+VALUE Backend_idle_gc_max_defer_set(VALUE self, VALUE max_defer) {
+  struct Backend_base *base = RTYPEDDATA_DATA(self);
+
+  if (max_defer == Qnil) {
+    if (base->idle_gc) {
+      free(base->idle_gc);
+      base->idle_gc = NULL;
+    }
+    return self;
+  }
+
+  double max_defer_dbl = NUM2DBL(max_defer);
+  if (max_defer_dbl < 0) rb_raise(rb_eArgError, "max_defer must not be negative");
+
+  if (!base->idle_gc) {
+    base->idle_gc = malloc(sizeof(struct backend_idle_gc));
+    memset(base->idle_gc, 0, sizeof(struct backend_idle_gc));
+  }
+  base->idle_gc->max_defer = max_defer_dbl;
+  return self;
+}
+
+// Returns a hash containing the current idle window and GC cost estimates, or
+// nil if budgeted idle GC is disabled.
+VALUE Backend_idle_gc_budget(VALUE self) {
+  struct Backend_base *base = RTYPEDDATA_DATA(self);
+  struct backend_idle_gc *gc = base->idle_gc;
+  if (!gc) return Qnil;
+
+  VALUE budget = rb_hash_new();
+  rb_hash_aset(budget, SYM_max_defer, DBL2NUM(gc->max_defer));
+  rb_hash_aset(budget, SYM_idle_window, DBL2NUM(gc->idle_window));
+  rb_hash_aset(budget, SYM_minor_cost, DBL2NUM(gc->minor_cost));
+  rb_hash_aset(budget, SYM_major_cost, DBL2NUM(gc->major_cost));
+  RB_GC_GUARD(budget);
+  return budget;
+}
+
+static VALUE gc_opts(int full_mark) {
+  VALUE opts = rb_hash_new();
+  rb_hash_aset(opts, ID2SYM(rb_intern("full_mark")), full_mark ? Qtrue : Qfalse);
+  rb_hash_aset(opts, ID2SYM(rb_intern("immediate_sweep")), Qfalse);
+  rb_obj_freeze(opts);
+  rb_global_variable(full_mark ? &major_gc_opts : &minor_gc_opts);
+  return opts;
+}
+
+void Init_IdleGC(VALUE cBackend) {
+  rb_define_method(cBackend, "idle_gc_max_defer=", Backend_idle_gc_max_defer_set, 1);
+  rb_define_method(cBackend, "idle_gc_budget", Backend_idle_gc_budget, 0);
+
+  ID_start              = rb_intern("start");
+  SYM_old_objects       = ID2SYM(rb_intern("old_objects"));
+  SYM_old_objects_limit = ID2SYM(rb_intern("old_objects_limit"));
+  SYM_major_by          = ID2SYM(rb_intern("major_by"));
+  SYM_idle_window       = ID2SYM(rb_intern("idle_window"));
+  SYM_minor_cost        = ID2SYM(rb_intern("minor_cost"));
+  SYM_major_cost        = ID2SYM(rb_intern("major_cost"));
+  SYM_max_defer         = ID2SYM(rb_intern("max_defer"));
+  minor_gc_opts         = gc_opts(0);
+  major_gc_opts         = gc_opts(1);
+}
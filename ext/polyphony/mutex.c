@@ -0,0 +1,355 @@
+#include "polyphony.h"
+#include "ring_buffer.h"
+
+// A fiber-aware mutex. Locking an unlocked mutex involves no switching. When
+// a mutex is unlocked while fibers are waiting on it, ownership is handed
+// directly to the first waiting fiber, so the releasing fiber cannot take the
+// lock again ahead of it.
+
+typedef struct mutex {
+  VALUE         owner;
+  ring_buffer   waiters;
+
+  unsigned long acquire_count;
+  unsigned long wait_count;
+  unsigned int  max_queue_depth;
+} Mutex_t;
+
+typedef struct condition_variable {
+  ring_buffer   waiters;
+} ConditionVariable_t;
+
+VALUE cMutex = Qnil;
+VALUE cConditionVariable = Qnil;
+static ID ID_timeout;
+static VALUE SYM_acquire_count;
+static VALUE SYM_wait_count;
+static VALUE SYM_queue_depth;
+static VALUE SYM_max_queue_depth;
+
+static void Mutex_mark(void *ptr) {
+  Mutex_t *mutex = ptr;
+  rb_gc_mark(mutex->owner);
+  ring_buffer_mark(&mutex->waiters);
+}
+
+static void Mutex_free(void *ptr) {
+  Mutex_t *mutex = ptr;
+  ring_buffer_free(&mutex->waiters);
+  xfree(ptr);
+}
+
+static size_t Mutex_size(const void *ptr) {
+  return sizeof(Mutex_t);
+}
+
+static const rb_data_type_t Mutex_type = {
+  "Mutex",
+  {Mutex_mark, Mutex_free, Mutex_size,},
+  0, 0, 0
+};
+
+static VALUE Mutex_allocate(VALUE klass) {
+  Mutex_t *mutex;
+
+  mutex = ALLOC(Mutex_t);
+  mutex->owner = Qnil;
+  ring_buffer_init(&mutex->waiters);
+  mutex->acquire_count = 0;
+  mutex->wait_count = 0;
+  mutex->max_queue_depth = 0;
+  return TypedData_Wrap_Struct(klass, &Mutex_type, mutex);
+}
+
+#define GetMutex(obj, mutex) \
+  TypedData_Get_Struct((obj), Mutex_t, &Mutex_type, (mutex))
+
+// Releases the mutex, handing it over to the first waiting fiber, if any. A
+// waiting fiber that is already runnable (normally because it is being
+// interrupted) is not rescheduled, so as not to override its resume value. It
+// will release the mutex itself if it was interrupted.
+static inline void mutex_release(VALUE self, Mutex_t *mutex) {
+  while (mutex->waiters.count) {
+    VALUE fiber = ring_buffer_shift(&mutex->waiters);
+    if (fiber == Qnil) continue;
+
+    mutex->owner = fiber;
+    if (!Fiber_runnable_p(fiber)) Fiber_make_runnable(fiber, self);
+    return;
+  }
+  mutex->owner = Qnil;
+}
+
+static void mutex_acquire(VALUE self, Mutex_t *mutex) {
+  VALUE fiber = rb_fiber_current();
+
+  mutex->acquire_count++;
+  if (mutex->owner == Qnil) {
+    mutex->owner = fiber;
+    return;
+  }
+  if (mutex->owner == fiber) rb_raise(rb_eThreadError, "deadlock; recursive locking");
+
+  mutex->wait_count++;
+  ring_buffer_push(&mutex->waiters, fiber);
+  if (mutex->waiters.count > mutex->max_queue_depth)
+    mutex->max_queue_depth = mutex->waiters.count;
+
+  VALUE backend = rb_ivar_get(rb_thread_current(), ID_ivar_backend);
+  while (1) {
+    VALUE switchpoint_result = Backend_wait_event(backend, Qnil);
+    if (TEST_EXCEPTION(switchpoint_result)) {
+      // the mutex might have been handed over before the exception was raised
+      if (mutex->owner == fiber)
+        mutex_release(self, mutex);
+      else
+        ring_buffer_delete(&mutex->waiters, fiber);
+      RAISE_EXCEPTION(switchpoint_result);
+    }
+    if (mutex->owner == fiber) break;
+  }
+  RB_GC_GUARD(backend);
+}
+
+static inline void mutex_check_owner(Mutex_t *mutex) {
+  if (mutex->owner == Qnil)
+    rb_raise(rb_eThreadError, "Attempt to unlock a mutex which is not locked");
+  if (mutex->owner != rb_fiber_current())
+    rb_raise(rb_eThreadError, "Attempt to unlock a mutex which is locked by another fiber");
+}
+
+VALUE Mutex_lock(VALUE self) {
+  Mutex_t *mutex;
+  GetMutex(self, mutex);
+
+  mutex_acquire(self, mutex);
+  return self;
+}
+
+VALUE Mutex_try_lock(VALUE self) {
+  Mutex_t *mutex;
+  GetMutex(self, mutex);
+
+  if (mutex->owner != Qnil) return Qfalse;
+
+  mutex->acquire_count++;
+  mutex->owner = rb_fiber_current();
+  return Qtrue;
+}
+
+VALUE Mutex_unlock(VALUE self) {
+  Mutex_t *mutex;
+  GetMutex(self, mutex);
+
+  mutex_check_owner(mutex);
+  mutex_release(self, mutex);
+  return self;
+}
+
+static VALUE mutex_synchronize_ensure(VALUE self) {
+  Mutex_t *mutex;
+  GetMutex(self, mutex);
+
+  if (mutex->owner == rb_fiber_current()) mutex_release(self, mutex);
+  return Qnil;
+}
+
+// Locks the mutex, runs the given block and unlocks the mutex. If the mutex is
+// already held by the current fiber, the block is run without locking.
+VALUE Mutex_synchronize(VALUE self) {
+  Mutex_t *mutex;
+  GetMutex(self, mutex);
+
+  if (mutex->owner == rb_fiber_current()) return rb_yield(Qnil);
+
+  mutex_acquire(self, mutex);
+  return rb_ensure(rb_yield, Qnil, mutex_synchronize_ensure, self);
+}
+
+VALUE Mutex_owned_p(VALUE self) {
+  Mutex_t *mutex;
+  GetMutex(self, mutex);
+
+  return (mutex->owner == rb_fiber_current()) ? Qtrue : Qfalse;
+}
+
+VALUE Mutex_locked_p(VALUE self) {
+  Mutex_t *mutex;
+  GetMutex(self, mutex);
+
+  return (mutex->owner != Qnil) ? Qtrue : Qfalse;
+}
+
+VALUE Mutex_owner(VALUE self) {
+  Mutex_t *mutex;
+  GetMutex(self, mutex);
+
+  return mutex->owner;
+}
+
+// Returns contention statistics: the total number of acquisitions, the number
+// of acquisitions that had to wait, and the current and maximum number of
+// waiting fibers.
+VALUE Mutex_stats(VALUE self) {
+  Mutex_t *mutex;
+  GetMutex(self, mutex);
+
+  VALUE stats = rb_hash_new();
+  rb_hash_aset(stats, SYM_acquire_count, ULONG2NUM(mutex->acquire_count));
+  rb_hash_aset(stats, SYM_wait_count, ULONG2NUM(mutex->wait_count));
+  rb_hash_aset(stats, SYM_queue_depth, UINT2NUM(mutex->waiters.count));
+  rb_hash_aset(stats, SYM_max_queue_depth, UINT2NUM(mutex->max_queue_depth));
+  RB_GC_GUARD(stats);
+  return stats;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+static void ConditionVariable_mark(void *ptr) {
+  ConditionVariable_t *cv = ptr;
+  ring_buffer_mark(&cv->waiters);
+}
+
+static void ConditionVariable_free(void *ptr) {
+  ConditionVariable_t *cv = ptr;
+  ring_buffer_free(&cv->waiters);
+  xfree(ptr);
+}
+
+static size_t ConditionVariable_size(const void *ptr) {
+  return sizeof(ConditionVariable_t);
+}
+
+static const rb_data_type_t ConditionVariable_type = {
+  "ConditionVariable",
+  {ConditionVariable_mark, ConditionVariable_free, ConditionVariable_size,},
+  0, 0, 0
+};
+
+static VALUE ConditionVariable_allocate(VALUE klass) {
+  ConditionVariable_t *cv;
+
+  cv = ALLOC(ConditionVariable_t);
+  ring_buffer_init(&cv->waiters);
+  return TypedData_Wrap_Struct(klass, &ConditionVariable_type, cv);
+}
+
+#define GetConditionVariable(obj, cv) \
+  TypedData_Get_Struct((obj), ConditionVariable_t, &ConditionVariable_type, (cv))
+
+struct cv_wait_ctx {
+  VALUE self;
+  VALUE mutex;
+  VALUE timeout;
+};
+
+static VALUE cv_wait(RB_BLOCK_CALL_FUNC_ARGLIST(yielded_arg, self)) {
+  ConditionVariable_t *cv;
+  GetConditionVariable(self, cv);
+
+  VALUE backend = rb_ivar_get(rb_thread_current(), ID_ivar_backend);
+  VALUE fiber = rb_fiber_current();
+  ring_buffer_push(&cv->waiters, fiber);
+  VALUE switchpoint_result = Backend_wait_event(backend, Qnil);
+  ring_buffer_delete(&cv->waiters, fiber);
+
+  RAISE_IF_EXCEPTION(switchpoint_result);
+  RB_GC_GUARD(backend);
+  RB_GC_GUARD(switchpoint_result);
+  return self;
+}
+
+static VALUE cv_wait_call(VALUE arg) {
+  struct cv_wait_ctx *ctx = (struct cv_wait_ctx *)arg;
+  if (ctx->timeout == Qnil) return cv_wait(Qnil, ctx->self, 0, 0, Qnil);
+
+  VALUE backend = rb_ivar_get(rb_thread_current(), ID_ivar_backend);
+  VALUE args[2] = {ctx->timeout, Qnil};
+  return rb_block_call(backend, ID_timeout, 2, args, cv_wait, ctx->self);
+}
+
+static VALUE cv_wait_reacquire(VALUE arg) {
+  struct cv_wait_ctx *ctx = (struct cv_wait_ctx *)arg;
+  Mutex_t *mutex;
+  GetMutex(ctx->mutex, mutex);
+
+  mutex_acquire(ctx->mutex, mutex);
+  return Qnil;
+}
+
+// Releases the given mutex and waits to be signalled, then reacquires the
+// mutex. Returns self, or nil if a timeout is given and the condition variable
+// is not signalled in time. The mutex is reacquired even if the wait is
+// interrupted.
+VALUE ConditionVariable_wait(int argc, VALUE *argv, VALUE self) {
+  struct cv_wait_ctx ctx = {self, Qnil, Qnil};
+  Mutex_t *mutex;
+  rb_scan_args(argc, argv, "11", &ctx.mutex, &ctx.timeout);
+  GetMutex(ctx.mutex, mutex);
+
+  mutex_check_owner(mutex);
+  mutex_release(ctx.mutex, mutex);
+  return rb_ensure(cv_wait_call, (VALUE)&ctx, cv_wait_reacquire, (VALUE)&ctx);
+}
+
+VALUE ConditionVariable_signal(VALUE self) {
+  ConditionVariable_t *cv;
+  GetConditionVariable(self, cv);
+
+  // fibers already runnable are being woken up anyway
+  while (cv->waiters.count) {
+    VALUE fiber = ring_buffer_shift(&cv->waiters);
+    if (fiber == Qnil || Fiber_runnable_p(fiber)) continue;
+
+    Fiber_make_runnable(fiber, self);
+    break;
+  }
+  return self;
+}
+
+VALUE ConditionVariable_broadcast(VALUE self) {
+  ConditionVariable_t *cv;
+  GetConditionVariable(self, cv);
+
+  while (cv->waiters.count) {
+    VALUE fiber = ring_buffer_shift(&cv->waiters);
+    if (fiber != Qnil && !Fiber_runnable_p(fiber)) Fiber_make_runnable(fiber, self);
+  }
+  return self;
+}
+
+VALUE ConditionVariable_waiting_count(VALUE self) {
+  ConditionVariable_t *cv;
+  GetConditionVariable(self, cv);
+
+  return UINT2NUM(cv->waiters.count);
+}
+
+void Init_Mutex() {
+  cMutex = rb_define_class_under(mPolyphony, "Mutex", rb_cObject);
+  rb_define_alloc_func(cMutex, Mutex_allocate);
+
+  rb_define_method(cMutex, "lock", Mutex_lock, 0);
+  rb_define_method(cMutex, "try_lock", Mutex_try_lock, 0);
+  rb_define_method(cMutex, "unlock", Mutex_unlock, 0);
+  rb_define_method(cMutex, "synchronize", Mutex_synchronize, 0);
+  rb_define_method(cMutex, "owned?", Mutex_owned_p, 0);
+  rb_define_method(cMutex, "locked?", Mutex_locked_p, 0);
+  rb_define_method(cMutex, "owner", Mutex_owner, 0);
+  rb_define_method(cMutex, "stats", Mutex_stats, 0);
+
+  cConditionVariable = rb_define_class_under(mPolyphony, "ConditionVariable", rb_cObject);
+  rb_define_alloc_func(cConditionVariable, ConditionVariable_allocate);
+
+  rb_define_method(cConditionVariable, "wait", ConditionVariable_wait, -1);
+  rb_define_method(cConditionVariable, "signal", ConditionVariable_signal, 0);
+  rb_define_method(cConditionVariable, "broadcast", ConditionVariable_broadcast, 0);
+  rb_define_method(cConditionVariable, "waiting_count", ConditionVariable_waiting_count, 0);
+
+  ID_timeout = rb_intern("timeout");
+  SYM_acquire_count = ID2SYM(rb_intern("acquire_count"));
+  SYM_wait_count = ID2SYM(rb_intern("wait_count"));
+  SYM_queue_depth = ID2SYM(rb_intern("queue_depth"));
+  SYM_max_queue_depth = ID2SYM(rb_intern("max_queue_depth"));
+}
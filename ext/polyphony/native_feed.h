@@ -0,0 +1,60 @@
+#ifndef POLYPHONY_NATIVE_FEED_H
+#define POLYPHONY_NATIVE_FEED_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "ruby.h"
+
+// Native feed interface for IO#feed_loop and Socket#feed_loop. This header
+// has no dependency on other Polyphony headers, and may be included by other
+// extensions (it is located in the ext/polyphony directory of the installed
+// gem).
+//
+// A receiver passed to #feed_loop is normally fed by calling the given method
+// with a newly allocated string for each chunk of data read. A native receiver
+// is instead fed by calling its feed function directly with the backend's read
+// buffer, which is reused for all reads, with no string allocation and no
+// method dispatch. A native receiver must be:
+//
+// - a typed data object, the data field of its type pointing to a
+//   polyphony_native_feed_t.
+// - an instance of a class including the Polyphony::NativeFeed module.
+//
+// For example:
+//
+//   static int parser_feed(VALUE self, void *data, const char *ptr, size_t len) {
+//     parser_t *parser = data;
+//     ...
+//     return 0;
+//   }
+//
+//   static const polyphony_native_feed_t parser_native_feed = {
+//     POLYPHONY_NATIVE_FEED_MAGIC, POLYPHONY_NATIVE_FEED_VERSION, parser_feed
+//   };
+//
+//   static const rb_data_type_t parser_type = {
+//     "Parser",
+//     {parser_mark, parser_free, parser_size,},
+//     0, (void *)&parser_native_feed, 0
+//   };
+//
+//   // once Polyphony is loaded:
+//   rb_include_module(cParser, rb_path2class("Polyphony::NativeFeed"));
+//
+// The feed function is called with the receiver, its data pointer and the
+// data read. The data is valid only for the duration of the call, and must be
+// copied if it is to be retained. The feed function may yield to the block
+// given to #feed_loop using rb_yield, and may raise exceptions. It returns 0
+// in order to continue the loop, or any other value in order to stop it. The
+// method argument given to #feed_loop is ignored for native receivers.
+
+#define POLYPHONY_NATIVE_FEED_MAGIC   0x50464544 // "PFED"
+#define POLYPHONY_NATIVE_FEED_VERSION 1
+
+typedef struct polyphony_native_feed {
+  uint32_t magic;
+  uint32_t version;
+  int (*feed)(VALUE receiver, void *data, const char *ptr, size_t len);
+} polyphony_native_feed_t;
+
+#endif /* POLYPHONY_NATIVE_FEED_H */
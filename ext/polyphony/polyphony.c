@@ -10,16 +10,16 @@ ID ID_each;
 ID ID_inspect;
 ID ID_invoke;
 ID ID_new;
+ID ID_registered_backend;
+ID ID_regular_file;
 ID ID_ivar_blocking_mode;
 ID ID_ivar_io;
-ID ID_ivar_parked;
-ID ID_ivar_runnable;
 ID ID_ivar_running;
-ID ID_ivar_thread;
 ID ID_size;
 ID ID_signal;
 ID ID_switch_fiber;
 ID ID_transfer;
+ID ID_unregister_io;
 ID ID_R;
 ID ID_W;
 ID ID_RW;
@@ -55,6 +55,23 @@ VALUE Polyphony_backend_connect(VALUE self, VALUE io, VALUE addr, VALUE port) {
   return Backend_connect(BACKEND(), io, addr, port);
 }
 
+VALUE Polyphony_backend_connect_racing(VALUE self, VALUE addrinfos, VALUE stagger_delay) {
+  return Backend_connect_racing(BACKEND(), addrinfos, stagger_delay);
+}
+
+VALUE Polyphony_backend_close(VALUE self, VALUE io) {
+  return Backend_close(BACKEND(), io);
+}
+
+VALUE Polyphony_unregister_closing_io(VALUE self, VALUE io) {
+  backend_unregister_closing_io(io);
+  return Qnil;
+}
+
+VALUE Polyphony_backend_shutdown(VALUE self, VALUE io, VALUE how) {
+  return Backend_shutdown(BACKEND(), io, how);
+}
+
 VALUE Polyphony_backend_feed_loop(VALUE self, VALUE io, VALUE receiver, VALUE method) {
   return Backend_feed_loop(BACKEND(), io, receiver, method);
 }
@@ -63,10 +80,18 @@ VALUE Polyphony_backend_read(VALUE self, VALUE io, VALUE str, VALUE length, VALU
   return Backend_read(BACKEND(), io, str, length, to_eof, pos);
 }
 
+VALUE Polyphony_backend_readv(VALUE self, VALUE io, VALUE buffers) {
+  return Backend_readv(BACKEND(), io, buffers);
+}
+
 VALUE Polyphony_backend_read_loop(VALUE self, VALUE io, VALUE maxlen) {
   return Backend_read_loop(BACKEND(), io, maxlen);
 }
 
+VALUE Polyphony_backend_gets_loop(VALUE self, VALUE io, VALUE sep, VALUE chomp, VALUE buffer) {
+  return Backend_gets_loop(BACKEND(), io, sep, chomp, buffer);
+}
+
 VALUE Polyphony_backend_recv(VALUE self, VALUE io, VALUE str, VALUE length, VALUE pos) {
   return Backend_recv(BACKEND(), io, str, length, pos);
 }
@@ -87,6 +112,22 @@ VALUE Polyphony_backend_sendv(VALUE self, VALUE io, VALUE ary, VALUE flags) {
   return Backend_sendv(BACKEND(), io, ary, flags);
 }
 
+VALUE Polyphony_backend_recvfrom(VALUE self, VALUE io, VALUE maxlen, VALUE flags) {
+  return Backend_recvfrom(BACKEND(), io, maxlen, flags);
+}
+
+VALUE Polyphony_backend_sendto(VALUE self, VALUE io, VALUE msg, VALUE flags, VALUE addr) {
+  return Backend_sendto(BACKEND(), io, msg, flags, addr);
+}
+
+VALUE Polyphony_backend_recvmmsg(VALUE self, VALUE io, VALUE count, VALUE maxlen) {
+  return Backend_recvmmsg(BACKEND(), io, count, maxlen);
+}
+
+VALUE Polyphony_backend_sendmmsg(VALUE self, VALUE io, VALUE msgs, VALUE addr) {
+  return Backend_sendmmsg(BACKEND(), io, msgs, addr);
+}
+
 VALUE Polyphony_backend_sleep(VALUE self, VALUE duration) {
   return Backend_sleep(BACKEND(), duration);
 }
@@ -103,6 +144,10 @@ VALUE Polyphony_backend_timeout(int argc,VALUE *argv, VALUE self) {
   return Backend_timeout(argc, argv, BACKEND());
 }
 
+VALUE Polyphony_backend_idle_timeout(int argc, VALUE *argv, VALUE self) {
+  return Backend_idle_timeout(argc, argv, BACKEND());
+}
+
 VALUE Polyphony_backend_timer_loop(VALUE self, VALUE interval) {
   return Backend_timer_loop(BACKEND(), interval);
 }
@@ -130,23 +175,34 @@ void Init_Polyphony() {
   rb_define_singleton_method(mPolyphony, "backend_accept", Polyphony_backend_accept, 2);
   rb_define_singleton_method(mPolyphony, "backend_accept_loop", Polyphony_backend_accept_loop, 2);
   rb_define_singleton_method(mPolyphony, "backend_connect", Polyphony_backend_connect, 3);
+  rb_define_singleton_method(mPolyphony, "backend_connect_racing", Polyphony_backend_connect_racing, 2);
+  rb_define_singleton_method(mPolyphony, "backend_close", Polyphony_backend_close, 1);
+  rb_define_singleton_method(mPolyphony, "backend_shutdown", Polyphony_backend_shutdown, 2);
   rb_define_singleton_method(mPolyphony, "backend_feed_loop", Polyphony_backend_feed_loop, 3);
   rb_define_singleton_method(mPolyphony, "backend_read", Polyphony_backend_read, 5);
   rb_define_singleton_method(mPolyphony, "backend_read_loop", Polyphony_backend_read_loop, 2);
+  rb_define_singleton_method(mPolyphony, "backend_gets_loop", Polyphony_backend_gets_loop, 4);
+  rb_define_singleton_method(mPolyphony, "backend_readv", Polyphony_backend_readv, 2);
   rb_define_singleton_method(mPolyphony, "backend_recv", Polyphony_backend_recv, 4);
   rb_define_singleton_method(mPolyphony, "backend_recv_loop", Polyphony_backend_recv_loop, 2);
   rb_define_singleton_method(mPolyphony, "backend_recv_feed_loop", Polyphony_backend_recv_feed_loop, 3);
   rb_define_singleton_method(mPolyphony, "backend_send", Polyphony_backend_send, 3);
   rb_define_singleton_method(mPolyphony, "backend_sendv", Polyphony_backend_sendv, 3);
+  rb_define_singleton_method(mPolyphony, "backend_recvfrom", Polyphony_backend_recvfrom, 3);
+  rb_define_singleton_method(mPolyphony, "backend_sendto", Polyphony_backend_sendto, 4);
+  rb_define_singleton_method(mPolyphony, "backend_recvmmsg", Polyphony_backend_recvmmsg, 3);
+  rb_define_singleton_method(mPolyphony, "backend_sendmmsg", Polyphony_backend_sendmmsg, 3);
   rb_define_singleton_method(mPolyphony, "backend_sleep", Polyphony_backend_sleep, 1);
   rb_define_singleton_method(mPolyphony, "backend_splice", Polyphony_backend_splice, 3);
   rb_define_singleton_method(mPolyphony, "backend_splice_to_eof", Polyphony_backend_splice_to_eof, 3);
   rb_define_singleton_method(mPolyphony, "backend_timeout", Polyphony_backend_timeout, -1);
+  rb_define_singleton_method(mPolyphony, "backend_idle_timeout", Polyphony_backend_idle_timeout, -1);
   rb_define_singleton_method(mPolyphony, "backend_timer_loop", Polyphony_backend_timer_loop, 1);
   rb_define_singleton_method(mPolyphony, "backend_wait_event", Polyphony_backend_wait_event, 1);
   rb_define_singleton_method(mPolyphony, "backend_wait_io", Polyphony_backend_wait_io, 2);
   rb_define_singleton_method(mPolyphony, "backend_waitpid", Polyphony_backend_waitpid, 1);
   rb_define_singleton_method(mPolyphony, "backend_write", Polyphony_backend_write, -1);
+  rb_define_singleton_method(mPolyphony, "__unregister_closing_io__", Polyphony_unregister_closing_io, 1);
 
   rb_define_global_function("snooze", Polyphony_snooze, 0);
   rb_define_global_function("suspend", Polyphony_suspend, 0);
@@ -161,13 +217,13 @@ void Init_Polyphony() {
   ID_invoke             = rb_intern("invoke");
   ID_ivar_blocking_mode = rb_intern("@blocking_mode");
   ID_ivar_io            = rb_intern("@io");
-  ID_ivar_parked        = rb_intern("@parked");
-  ID_ivar_runnable      = rb_intern("@runnable");
   ID_ivar_running       = rb_intern("@running");
-  ID_ivar_thread        = rb_intern("@thread");
   ID_new                = rb_intern("new");
+  ID_registered_backend = rb_intern("__polyphony_registered_backend__");
+  ID_regular_file       = rb_intern("__polyphony_regular_file__");
   ID_signal             = rb_intern("signal");
   ID_size               = rb_intern("size");
   ID_switch_fiber       = rb_intern("switch_fiber");
   ID_transfer           = rb_intern("transfer");
+  ID_unregister_io      = rb_intern("unregister_io");
 }
\ No newline at end of file
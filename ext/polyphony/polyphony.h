@@ -30,6 +30,9 @@
 
 #define BACKEND() (rb_ivar_get(rb_thread_current(), ID_ivar_backend))
 
+// incremented whenever a thread's backend is changed
+extern unsigned int thread_backend_generation;
+
 extern VALUE mPolyphony;
 extern VALUE cQueue;
 extern VALUE cEvent;
@@ -44,16 +47,17 @@ extern ID ID_invoke;
 extern ID ID_ivar_backend;
 extern ID ID_ivar_blocking_mode;
 extern ID ID_ivar_io;
-extern ID ID_ivar_parked;
-extern ID ID_ivar_runnable;
+extern ID ID_ivar_main_fiber;
 extern ID ID_ivar_running;
-extern ID ID_ivar_thread;
 extern ID ID_new;
 extern ID ID_raise;
+extern ID ID_registered_backend;
+extern ID ID_regular_file;
 extern ID ID_signal;
 extern ID ID_size;
 extern ID ID_switch_fiber;
 extern ID ID_transfer;
+extern ID ID_unregister_io;
 
 extern VALUE SYM_fiber_create;
 extern VALUE SYM_fiber_event_poll_enter;
@@ -65,11 +69,22 @@ extern VALUE SYM_fiber_terminate;
 
 VALUE Fiber_auto_watcher(VALUE self);
 void Fiber_make_runnable(VALUE fiber, VALUE value);
+void Fiber_make_runnable_with_priority(VALUE fiber, VALUE value);
+VALUE Fiber_state_thread(VALUE fiber);
+int Fiber_runnable_p(VALUE fiber);
+int Fiber_parked_state(VALUE fiber);
+void *Fiber_idle_deadline(VALUE fiber);
+void Fiber_set_idle_deadline(VALUE fiber, void *idle_deadline);
+int Fiber_priority_state(VALUE fiber);
+runqueue_slot *Fiber_runqueue_slot(VALUE fiber, int create);
+
+int SchedulerGroup_run_task(VALUE self);
 
 VALUE Queue_push(VALUE self, VALUE value);
 VALUE Queue_unshift(VALUE self, VALUE value);
 VALUE Queue_shift(VALUE self);
 VALUE Queue_shift_all(VALUE self);
+int Queue_push_nogvl(VALUE self, VALUE value);
 
 void Runqueue_push(VALUE self, VALUE fiber, VALUE value, int reschedule);
 void Runqueue_unshift(VALUE self, VALUE fiber, VALUE value, int reschedule);
@@ -81,33 +96,43 @@ long Runqueue_len(VALUE self);
 int Runqueue_empty_p(VALUE self);
 int Runqueue_should_poll_nonblocking(VALUE self);
 
-#ifdef POLYPHONY_BACKEND_LIBEV
-#define Backend_recv_loop Backend_read_loop
-#define Backend_recv_feed_loop Backend_feed_loop
-#endif
-
 // Backend public interface
 
 VALUE Backend_accept(VALUE self, VALUE server_socket, VALUE socket_class);
 VALUE Backend_accept_loop(VALUE self, VALUE server_socket, VALUE socket_class);
 VALUE Backend_connect(VALUE self, VALUE io, VALUE addr, VALUE port);
+VALUE Backend_connect_racing(VALUE self, VALUE addrinfos, VALUE stagger_delay);
+VALUE Backend_close(VALUE self, VALUE io);
+VALUE Backend_shutdown(VALUE self, VALUE io, VALUE how);
 VALUE Backend_feed_loop(VALUE self, VALUE io, VALUE receiver, VALUE method);
 VALUE Backend_read(VALUE self, VALUE io, VALUE str, VALUE length, VALUE to_eof, VALUE pos);
 VALUE Backend_read_loop(VALUE self, VALUE io, VALUE maxlen);
+VALUE Backend_gets_loop(VALUE self, VALUE io, VALUE sep, VALUE chomp, VALUE buffer);
+VALUE Backend_readv(VALUE self, VALUE io, VALUE buffers);
 VALUE Backend_recv(VALUE self, VALUE io, VALUE str, VALUE length, VALUE pos);
 VALUE Backend_recv_loop(VALUE self, VALUE io, VALUE maxlen);
 VALUE Backend_recv_feed_loop(VALUE self, VALUE io, VALUE receiver, VALUE method);
 VALUE Backend_send(VALUE self, VALUE io, VALUE msg, VALUE flags);
+VALUE Backend_recvfrom(VALUE self, VALUE io, VALUE maxlen, VALUE flags);
+VALUE Backend_sendto(VALUE self, VALUE io, VALUE msg, VALUE flags, VALUE addr);
+VALUE Backend_recvmmsg(VALUE self, VALUE io, VALUE count, VALUE maxlen);
+VALUE Backend_sendmmsg(VALUE self, VALUE io, VALUE msgs, VALUE addr);
 VALUE Backend_sendv(VALUE self, VALUE io, VALUE ary, VALUE flags);
 VALUE Backend_sleep(VALUE self, VALUE duration);
 VALUE Backend_splice(VALUE self, VALUE src, VALUE dest, VALUE maxlen);
 VALUE Backend_splice_to_eof(VALUE self, VALUE src, VALUE dest, VALUE chunksize);
 VALUE Backend_timeout(int argc,VALUE *argv, VALUE self);
+VALUE Backend_idle_timeout(int argc, VALUE *argv, VALUE self);
 VALUE Backend_timer_loop(VALUE self, VALUE interval);
 VALUE Backend_wait_event(VALUE self, VALUE raise);
 VALUE Backend_wait_io(VALUE self, VALUE io, VALUE write);
 VALUE Backend_waitpid(VALUE self, VALUE pid);
 VALUE Backend_write_m(int argc, VALUE *argv, VALUE self);
+VALUE Backend_chain(int argc, VALUE *argv, VALUE self);
+VALUE Backend_sendfile(int argc, VALUE *argv, VALUE self);
+VALUE Backend_splice_chunks(VALUE self, VALUE src, VALUE dest, VALUE prefix, VALUE postfix, VALUE chunk_prefix, VALUE chunk_postfix, VALUE chunk_size);
+
+struct thread_pool_job;
 
 VALUE Backend_poll(VALUE self, VALUE blocking);
 VALUE Backend_wait_event(VALUE self, VALUE raise_on_exception);
@@ -118,6 +143,9 @@ void Backend_schedule_fiber(VALUE thread, VALUE self, VALUE fiber, VALUE value,
 void Backend_unschedule_fiber(VALUE self, VALUE fiber);
 void Backend_park_fiber(VALUE self, VALUE fiber);
 void Backend_unpark_fiber(VALUE self, VALUE fiber);
+int Backend_fiber_runnable_p(VALUE self, VALUE fiber);
+void Backend_watch_thread_pool_job(VALUE self, struct thread_pool_job *job);
+void backend_unregister_closing_io(VALUE io);
 
 void Thread_schedule_fiber(VALUE thread, VALUE fiber, VALUE value);
 void Thread_schedule_fiber_with_priority(VALUE thread, VALUE fiber, VALUE value);
@@ -5,7 +5,19 @@ void Init_Polyphony();
 void Init_Backend();
 void Init_Queue();
 void Init_Event();
+void Init_WaitGroup();
+void Init_Mutex();
+void Init_RWLock();
+void Init_Channel();
+void Init_Timer();
+void Init_SchedulerGroup();
+void Init_NativeThreadPool();
+void Init_RESP();
+void Init_DNS();
+void Init_ChildWatcher();
+void Init_ResourcePool();
 void Init_SocketExtensions();
+void Init_Cork();
 void Init_Thread();
 
 #ifdef POLYPHONY_PLAYGROUND
@@ -18,10 +30,22 @@ void Init_polyphony_ext() {
   Init_Backend();
   Init_Queue();
   Init_Event();
+  Init_WaitGroup();
+  Init_Mutex();
+  Init_RWLock();
+  Init_Channel();
+  Init_Timer();
+  Init_SchedulerGroup();
+  Init_NativeThreadPool();
+  Init_RESP();
+  Init_DNS();
+  Init_ChildWatcher();
+  Init_ResourcePool();
   Init_Fiber();
   Init_Thread();
 
   Init_SocketExtensions();
+  Init_Cork();
 
   #ifdef POLYPHONY_PLAYGROUND
   playground();
@@ -1,11 +1,35 @@
+#include <pthread.h>
+#include <errno.h>
+#include <limits.h>
 #include "polyphony.h"
 #include "ring_buffer.h"
+#include "thread_pool.h"
+
+// A bounded buffer for values pushed by native threads (see
+// Queue_push_nogvl). Values are moved into the queue by consumers, under the
+// GVL. A consumer waiting on an empty queue parks a job in the waiter slot,
+// which the next producer hands back to the consumer's backend.
+//
+// Values in the inbox count against the queue's capacity. Fibers pushing to
+// the queue reserve room under the inbox lock before pushing, so native
+// producers cannot take the same room.
+typedef struct queue_inbox {
+  pthread_mutex_t lock;
+  VALUE *values;
+  unsigned int size;
+  unsigned int head;
+  unsigned int count;
+  // room reserved by a fiber about to push to the queue
+  unsigned int reserved;
+  thread_pool_job_t *waiter;
+} queue_inbox_t;
 
 typedef struct queue {
   ring_buffer values;
   ring_buffer shift_queue;
   ring_buffer push_queue;
   unsigned int capacity;
+  queue_inbox_t *inbox;
 } Queue_t;
 
 VALUE cQueue = Qnil;
@@ -15,6 +39,13 @@ static void Queue_mark(void *ptr) {
   ring_buffer_mark(&queue->values);
   ring_buffer_mark(&queue->shift_queue);
   ring_buffer_mark(&queue->push_queue);
+  if (queue->inbox) {
+    queue_inbox_t *inbox = queue->inbox;
+    pthread_mutex_lock(&inbox->lock);
+    for (unsigned int i = 0; i < inbox->count; i++)
+      rb_gc_mark(inbox->values[(inbox->head + i) % inbox->size]);
+    pthread_mutex_unlock(&inbox->lock);
+  }
 }
 
 static void Queue_free(void *ptr) {
@@ -22,6 +53,11 @@ static void Queue_free(void *ptr) {
   ring_buffer_free(&queue->values);
   ring_buffer_free(&queue->shift_queue);
   ring_buffer_free(&queue->push_queue);
+  if (queue->inbox) {
+    pthread_mutex_destroy(&queue->inbox->lock);
+    xfree(queue->inbox->values);
+    xfree(queue->inbox);
+  }
   xfree(ptr);
 }
 
@@ -39,6 +75,7 @@ static VALUE Queue_allocate(VALUE klass) {
   Queue_t *queue;
 
   queue = ALLOC(Queue_t);
+  queue->inbox = NULL;
   return TypedData_Wrap_Struct(klass, &Queue_type, queue);
 }
 
@@ -78,12 +115,109 @@ inline void queue_schedule_blocked_fibers_to_capacity(Queue_t *queue) {
   }
 }
 
+inline void queue_schedule_blocked_fibers(ring_buffer *queue, long count) {
+  while (count-- > 0 && queue->count) {
+    VALUE fiber = ring_buffer_shift(queue);
+    if (fiber != Qnil) Fiber_make_runnable(fiber, Qnil);
+  }
+}
+
+// Moves values pushed by native threads into the queue, waking up a waiting
+// fiber for each value moved. For a capped queue, only as many values as
+// there's room for are moved.
+static inline void queue_drain_inbox(Queue_t *queue) {
+  queue_inbox_t *inbox = queue->inbox;
+  if (!inbox || !__atomic_load_n(&inbox->count, __ATOMIC_RELAXED)) return;
+
+  unsigned int room = !queue->capacity ? UINT_MAX :
+    (queue->capacity > queue->values.count) ? queue->capacity - queue->values.count : 0;
+  unsigned int moved = 0;
+  pthread_mutex_lock(&inbox->lock);
+  while (inbox->count && moved < room) {
+    ring_buffer_push(&queue->values, inbox->values[inbox->head]);
+    inbox->head = (inbox->head + 1) % inbox->size;
+    inbox->count--;
+    moved++;
+  }
+  pthread_mutex_unlock(&inbox->lock);
+  queue_schedule_blocked_fibers(&queue->shift_queue, moved);
+}
+
+// Parks a job in the inbox waiter slot, so the next native producer can wake
+// up the current fiber. Returns NULL if values are pending in the inbox, or if
+// another fiber already occupies the slot.
+static inline thread_pool_job_t *queue_inbox_watch(Queue_t *queue, VALUE backend, VALUE fiber) {
+  queue_inbox_t *inbox = queue->inbox;
+  thread_pool_job_t *job = NULL;
+
+  pthread_mutex_lock(&inbox->lock);
+  if (!inbox->count && !inbox->waiter) {
+    job = thread_pool_job_new(NULL, 0);
+    job->fiber = fiber;
+    Backend_watch_thread_pool_job(backend, job);
+    inbox->waiter = job;
+  }
+  pthread_mutex_unlock(&inbox->lock);
+  return job;
+}
+
+// Releases the job parked by queue_inbox_watch. If no producer has taken the
+// job, it is completed here so the backend stops watching it. A job taken but
+// not yet reaped by the backend is freed once reaped.
+static inline void queue_inbox_unwatch(Queue_t *queue, thread_pool_job_t *job) {
+  queue_inbox_t *inbox = queue->inbox;
+  int parked;
+
+  pthread_mutex_lock(&inbox->lock);
+  parked = inbox->waiter == job;
+  if (parked) inbox->waiter = NULL;
+  pthread_mutex_unlock(&inbox->lock);
+
+  if (job->completed)
+    thread_pool_job_free(job);
+  else {
+    job->abandoned = 1;
+    if (parked) thread_pool_job_push_completion(job);
+  }
+}
+
+// Returns the number of values in the queue, including values pending in the
+// inbox.
+static inline unsigned int queue_count(Queue_t *queue) {
+  return queue->values.count +
+    (queue->inbox ? __atomic_load_n(&queue->inbox->count, __ATOMIC_RELAXED) : 0);
+}
+
+// Reserves room for up to n values in a capped queue, returning the number of
+// values there's room for. The reservation must be released with
+// queue_release once the values are pushed.
+static inline long queue_reserve(Queue_t *queue, long n) {
+  queue_inbox_t *inbox = queue->inbox;
+  if (inbox) pthread_mutex_lock(&inbox->lock);
+
+  unsigned int count = queue_count(queue);
+  long room = (queue->capacity > count) ? queue->capacity - count : 0;
+  if (n > room) n = room;
+
+  if (inbox) {
+    inbox->reserved = n;
+    pthread_mutex_unlock(&inbox->lock);
+  }
+  return n;
+}
+
+static inline void queue_release(Queue_t *queue) {
+  if (queue->inbox) __atomic_store_n(&queue->inbox->reserved, 0, __ATOMIC_RELEASE);
+}
+
+// Blocks until there's room in a capped queue, reserving room for a single
+// value.
 static inline void capped_queue_block_push(Queue_t *queue) {
   VALUE fiber = rb_fiber_current();
   VALUE backend = rb_ivar_get(rb_thread_current(), ID_ivar_backend);
   VALUE switchpoint_result;
   while (1) {
-    if (queue->capacity > queue->values.count) Fiber_make_runnable(fiber, Qnil);
+    if (queue->capacity > queue_count(queue)) Fiber_make_runnable(fiber, Qnil);
 
     ring_buffer_push(&queue->push_queue, fiber);
     switchpoint_result = Backend_wait_event(backend, Qnil);
@@ -91,7 +225,7 @@ static inline void capped_queue_block_push(Queue_t *queue) {
 
     RAISE_IF_EXCEPTION(switchpoint_result);
     RB_GC_GUARD(switchpoint_result);
-    if (queue->capacity > queue->values.count) break;
+    if (queue_reserve(queue, 1)) break;
   }
 }
 
@@ -103,10 +237,38 @@ VALUE Queue_push(VALUE self, VALUE value) {
 
   queue_schedule_first_blocked_fiber(&queue->shift_queue);
   ring_buffer_push(&queue->values, value);
+  queue_release(queue);
 
   return self;
 }
 
+// Pushes all values in the given array, waking up waiting fibers once for the
+// whole batch. For a capped queue, values are pushed as room becomes
+// available, blocking the current fiber while the queue is full.
+VALUE Queue_push_all(VALUE self, VALUE values) {
+  Queue_t *queue;
+  GetQueue(self, queue);
+  Check_Type(values, T_ARRAY);
+
+  long i = 0;
+  while (i < RARRAY_LEN(values)) {
+    long n = RARRAY_LEN(values) - i;
+    if (queue->capacity && !(n = queue_reserve(queue, n))) {
+      capped_queue_block_push(queue);
+      n = 1;
+    }
+
+    for (long j = 0; j < n; j++)
+      ring_buffer_push(&queue->values, RARRAY_AREF(values, i + j));
+    queue_release(queue);
+    queue_schedule_blocked_fibers(&queue->shift_queue, n);
+    i += n;
+  }
+
+  RB_GC_GUARD(values);
+  return self;
+}
+
 VALUE Queue_unshift(VALUE self, VALUE value) {
   Queue_t *queue;
   GetQueue(self, queue);
@@ -115,29 +277,43 @@ VALUE Queue_unshift(VALUE self, VALUE value) {
 
   queue_schedule_first_blocked_fiber(&queue->shift_queue);
   ring_buffer_unshift(&queue->values, value);
+  queue_release(queue);
 
   return self;
 }
 
-VALUE Queue_shift(VALUE self) {
-  Queue_t *queue;
-  GetQueue(self, queue);
-
+static inline void queue_wait_for_values(Queue_t *queue) {
   VALUE fiber = rb_fiber_current();
   VALUE thread = rb_thread_current();
   VALUE backend = rb_ivar_get(thread, ID_ivar_backend);
 
   while (1) {
+    queue_drain_inbox(queue);
     if (queue->values.count) Fiber_make_runnable(fiber, Qnil);
+    thread_pool_job_t *job = (queue->inbox && !queue->values.count) ?
+      queue_inbox_watch(queue, backend, fiber) : NULL;
 
     ring_buffer_push(&queue->shift_queue, fiber);
     VALUE switchpoint_result = Backend_wait_event(backend, Qnil);
     ring_buffer_delete(&queue->shift_queue, fiber);
+    if (job) queue_inbox_unwatch(queue, job);
 
-    RAISE_IF_EXCEPTION(switchpoint_result);
+    if (TEST_EXCEPTION(switchpoint_result)) {
+      // hand over watching the inbox to the next waiting fiber
+      if (job) queue_schedule_first_blocked_fiber(&queue->shift_queue);
+      RAISE_EXCEPTION(switchpoint_result);
+    }
     RB_GC_GUARD(switchpoint_result);
+    queue_drain_inbox(queue);
     if (queue->values.count) break;
   }
+}
+
+VALUE Queue_shift(VALUE self) {
+  Queue_t *queue;
+  GetQueue(self, queue);
+
+  queue_wait_for_values(queue);
   VALUE value = ring_buffer_shift(&queue->values);
   if ((queue->capacity) && (queue->capacity > queue->values.count))
     queue_schedule_first_blocked_fiber(&queue->push_queue);
@@ -145,6 +321,31 @@ VALUE Queue_shift(VALUE self) {
   return value;
 }
 
+// Shifts a value from the queue, waiting for one if the queue is empty. If a
+// count is given, waits for at least one value, then shifts up to count
+// values, returning them in an array. Fibers blocked on pushing to a capped
+// queue are woken up once for the whole batch.
+VALUE Queue_shift_m(int argc, VALUE *argv, VALUE self) {
+  Queue_t *queue;
+  GetQueue(self, queue);
+  VALUE count = Qnil;
+  rb_scan_args(argc, argv, "01", &count);
+
+  if (count == Qnil) return Queue_shift(self);
+
+  long n = NUM2LONG(count);
+  if (n < 0) rb_raise(rb_eArgError, "negative count");
+  if (!n) return rb_ary_new();
+
+  queue_wait_for_values(queue);
+  if (n > queue->values.count) n = queue->values.count;
+  VALUE result = rb_ary_new_capa(n);
+  for (long i = 0; i < n; i++)
+    rb_ary_push(result, ring_buffer_shift(&queue->values));
+  if (queue->capacity) queue_schedule_blocked_fibers_to_capacity(queue);
+  return result;
+}
+
 VALUE Queue_delete(VALUE self, VALUE value) {
   Queue_t *queue;
   GetQueue(self, queue);
@@ -191,6 +392,7 @@ VALUE Queue_clear(VALUE self) {
 long Queue_len(VALUE self) {
   Queue_t *queue;
   GetQueue(self, queue);
+  queue_drain_inbox(queue);
 
   return queue->values.count;
 }
@@ -198,6 +400,7 @@ long Queue_len(VALUE self) {
 VALUE Queue_shift_each(VALUE self) {
   Queue_t *queue;
   GetQueue(self, queue);
+  queue_drain_inbox(queue);
 
   ring_buffer_shift_each(&queue->values);
   if (queue->capacity) queue_schedule_blocked_fibers_to_capacity(queue);
@@ -207,6 +410,7 @@ VALUE Queue_shift_each(VALUE self) {
 VALUE Queue_shift_all(VALUE self) {
   Queue_t *queue;
   GetQueue(self, queue);
+  queue_drain_inbox(queue);
 
   VALUE result = ring_buffer_shift_all(&queue->values);
   if (queue->capacity) queue_schedule_blocked_fibers_to_capacity(queue);
@@ -228,6 +432,7 @@ VALUE Queue_flush_waiters(VALUE self, VALUE value) {
 VALUE Queue_empty_p(VALUE self) {
   Queue_t *queue;
   GetQueue(self, queue);
+  queue_drain_inbox(queue);
 
   return (!queue->values.count) ? Qtrue : Qfalse;
 }
@@ -242,10 +447,75 @@ VALUE Queue_pending_p(VALUE self) {
 VALUE Queue_size_m(VALUE self) {
   Queue_t *queue;
   GetQueue(self, queue);
+  queue_drain_inbox(queue);
 
   return INT2NUM(queue->values.count);
 }
 
+// Enables pushing values from native threads without holding the GVL (see
+// Queue_push_nogvl). The queue must be capped. Values pushed by native threads
+// are buffered in an inbox, and count against the queue's capacity, so the
+// queue and the inbox together hold no more than capacity values.
+VALUE Queue_enable_nogvl_push(VALUE self) {
+  Queue_t *queue;
+  GetQueue(self, queue);
+
+  if (queue->inbox) return self;
+  if (!queue->capacity) rb_raise(rb_eRuntimeError, "Queue must be capped");
+
+  queue_inbox_t *inbox = ALLOC(queue_inbox_t);
+  pthread_mutex_init(&inbox->lock, NULL);
+  inbox->size = queue->capacity;
+  inbox->values = ALLOC_N(VALUE, inbox->size);
+  inbox->head = 0;
+  inbox->count = 0;
+  inbox->reserved = 0;
+  inbox->waiter = NULL;
+  queue->inbox = inbox;
+  return self;
+}
+
+// Pushes a value to the queue from any thread, without the GVL. This function
+// never blocks and does not call into Ruby. The value must be an immediate or
+// otherwise be kept alive by the caller until it is pushed. Returns 0 on
+// success, EAGAIN if the queue is full, or EINVAL if native pushing was not
+// enabled for the queue.
+int Queue_push_nogvl(VALUE self, VALUE value) {
+  Queue_t *queue = RTYPEDDATA_DATA(self);
+  queue_inbox_t *inbox = queue->inbox;
+  if (!inbox) return EINVAL;
+
+  pthread_mutex_lock(&inbox->lock);
+  // The queue's values are counted without the GVL. Values are only added to
+  // the queue by fibers holding a reservation, and the count can only go
+  // down otherwise, so at worst the queue is wrongly considered full.
+  unsigned int capacity = __atomic_load_n(&queue->capacity, __ATOMIC_RELAXED);
+  unsigned int reserved = __atomic_load_n(&inbox->reserved, __ATOMIC_ACQUIRE);
+  unsigned int count = inbox->count + reserved + __atomic_load_n(&queue->values.count, __ATOMIC_RELAXED);
+  if (inbox->count == inbox->size || (capacity && count >= capacity)) {
+    pthread_mutex_unlock(&inbox->lock);
+    return EAGAIN;
+  }
+  inbox->values[(inbox->head + inbox->count) % inbox->size] = value;
+  inbox->count++;
+  thread_pool_job_t *job = inbox->waiter;
+  inbox->waiter = NULL;
+  pthread_mutex_unlock(&inbox->lock);
+
+  if (job) thread_pool_job_push_completion(job);
+  return 0;
+}
+
+// Pushes a value through the native inbox, returning false if it is full.
+// Can be called from any thread. Intended mainly for testing.
+VALUE Queue_try_push(VALUE self, VALUE value) {
+  Queue_t *queue;
+  GetQueue(self, queue);
+  if (!queue->inbox) rb_raise(rb_eRuntimeError, "Native pushing not enabled");
+
+  return Queue_push_nogvl(self, value) ? Qfalse : Qtrue;
+}
+
 void Init_Queue() {
   cQueue = rb_define_class_under(mPolyphony, "Queue", rb_cObject);
   rb_define_alloc_func(cQueue, Queue_allocate);
@@ -253,10 +523,13 @@ void Init_Queue() {
   rb_define_method(cQueue, "initialize", Queue_initialize, -1);
   rb_define_method(cQueue, "push", Queue_push, 1);
   rb_define_method(cQueue, "<<", Queue_push, 1);
+  rb_define_method(cQueue, "push_all", Queue_push_all, 1);
   rb_define_method(cQueue, "unshift", Queue_unshift, 1);
+  rb_define_method(cQueue, "enable_nogvl_push", Queue_enable_nogvl_push, 0);
+  rb_define_method(cQueue, "try_push", Queue_try_push, 1);
 
-  rb_define_method(cQueue, "shift", Queue_shift, 0);
-  rb_define_method(cQueue, "pop", Queue_shift, 0);
+  rb_define_method(cQueue, "shift", Queue_shift_m, -1);
+  rb_define_method(cQueue, "pop", Queue_shift_m, -1);
   rb_define_method(cQueue, "delete", Queue_delete, 1);
   rb_define_method(cQueue, "clear", Queue_clear, 0);
 
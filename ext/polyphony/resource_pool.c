@@ -0,0 +1,343 @@
+#include <time.h>
+#include "polyphony.h"
+#include "backend_common.h"
+#include "ring_buffer.h"
+#include "ruby/st.h"
+
+// A fixed-size, fiber-aware resource pool. Idle resources are kept in the
+// stock ring buffer, and fibers waiting for a resource are kept in FIFO order
+// in the waiters ring buffer. A waiting fiber stays at the head of the waiters
+// queue until it actually takes a resource, so a fiber arriving while others
+// are waiting cannot take a returned resource ahead of them.
+
+typedef struct resource_pool {
+  VALUE         allocator;
+  unsigned int  limit;
+  unsigned int  size;
+  ring_buffer   stock;
+  ring_buffer   waiters;
+  st_table      *acquired;
+
+  unsigned long acquire_count;
+  unsigned long wait_count;
+  unsigned int  max_queue_depth;
+  double        total_wait_time;
+  double        max_wait_time;
+  double        total_hold_time;
+  double        max_hold_time;
+} ResourcePool_t;
+
+struct acquire_ctx {
+  ResourcePool_t  *pool;
+  VALUE           fiber;
+  VALUE           resource;
+  int             allocated;
+  double          stamp;
+};
+
+VALUE cResourcePool = Qnil;
+VALUE cResourcePoolTimeoutError = Qnil;
+static ID ID_timeout;
+static VALUE SYM_acquire_count;
+static VALUE SYM_wait_count;
+static VALUE SYM_max_queue_depth;
+static VALUE SYM_queue_depth;
+static VALUE SYM_total_wait_time;
+static VALUE SYM_max_wait_time;
+static VALUE SYM_total_hold_time;
+static VALUE SYM_max_hold_time;
+
+static int resource_pool_mark_acquired(st_data_t key, st_data_t value, st_data_t arg) {
+  rb_gc_mark((VALUE)key);
+  rb_gc_mark((VALUE)value);
+  return ST_CONTINUE;
+}
+
+static void ResourcePool_mark(void *ptr) {
+  ResourcePool_t *pool = ptr;
+  rb_gc_mark(pool->allocator);
+  ring_buffer_mark(&pool->stock);
+  ring_buffer_mark(&pool->waiters);
+  if (pool->acquired) st_foreach(pool->acquired, resource_pool_mark_acquired, 0);
+}
+
+static void ResourcePool_free(void *ptr) {
+  ResourcePool_t *pool = ptr;
+  if (pool->acquired) {
+    ring_buffer_free(&pool->stock);
+    ring_buffer_free(&pool->waiters);
+    st_free_table(pool->acquired);
+  }
+  xfree(ptr);
+}
+
+static size_t ResourcePool_size(const void *ptr) {
+  return sizeof(ResourcePool_t);
+}
+
+static const rb_data_type_t ResourcePool_type = {
+  "ResourcePool",
+  {ResourcePool_mark, ResourcePool_free, ResourcePool_size,},
+  0, 0, 0
+};
+
+static VALUE ResourcePool_allocate(VALUE klass) {
+  ResourcePool_t *pool;
+
+  pool = ALLOC(ResourcePool_t);
+  memset(pool, 0, sizeof(ResourcePool_t));
+  pool->allocator = Qnil;
+  return TypedData_Wrap_Struct(klass, &ResourcePool_type, pool);
+}
+
+#define GetResourcePool(obj, pool) \
+  TypedData_Get_Struct((obj), ResourcePool_t, &ResourcePool_type, (pool))
+
+static inline ResourcePool_t *get_resource_pool(VALUE self) {
+  ResourcePool_t *pool;
+  GetResourcePool(self, pool);
+  if (!pool->acquired) rb_raise(rb_eRuntimeError, "ResourcePool is not initialized");
+  return pool;
+}
+
+static inline double pool_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static VALUE ResourcePool_setup(VALUE self, VALUE limit, VALUE allocator) {
+  ResourcePool_t *pool;
+  GetResourcePool(self, pool);
+
+  pool->limit = NUM2UINT(limit);
+  if (!pool->limit) rb_raise(rb_eArgError, "limit must be positive");
+  pool->allocator = allocator;
+  ring_buffer_init(&pool->stock);
+  ring_buffer_init(&pool->waiters);
+  pool->acquired = st_init_numtable();
+  return self;
+}
+
+static inline VALUE ring_buffer_first(ring_buffer *buffer) {
+  return buffer->count ? buffer->entries[buffer->head] : Qnil;
+}
+
+// Wakes up the first waiting fiber, if a resource is available for it, or if
+// it may allocate a new one.
+static inline void resource_pool_wake_first_waiter(ResourcePool_t *pool) {
+  if (pool->waiters.count && (pool->stock.count || pool->size < pool->limit))
+    Fiber_make_runnable(ring_buffer_first(&pool->waiters), Qnil);
+}
+
+static VALUE resource_pool_call_allocator(VALUE allocator) {
+  return rb_funcall(allocator, ID_call, 0);
+}
+
+static VALUE resource_pool_allocate_resource(ResourcePool_t *pool, int *allocated) {
+  int state = 0;
+  if (allocated) *allocated = 1;
+  pool->size++;
+  VALUE resource = rb_protect(resource_pool_call_allocator, pool->allocator, &state);
+  if (state) {
+    // the next waiter, if any, is woken up to try allocating in its turn
+    pool->size--;
+    resource_pool_wake_first_waiter(pool);
+    rb_jump_tag(state);
+  }
+  return resource;
+}
+
+// Waits for a resource to be returned to the pool. Waiters are normally only
+// woken up when a resource is returned, but may also be woken up when a
+// resource in use is discarded, or when allocating a resource has failed, in
+// which case a new resource is allocated.
+static VALUE resource_pool_wait(RB_BLOCK_CALL_FUNC_ARGLIST(yielded_arg, arg)) {
+  struct acquire_ctx *ctx = (struct acquire_ctx *)arg;
+  ResourcePool_t *pool = ctx->pool;
+  VALUE fiber = rb_fiber_current();
+  VALUE backend = rb_ivar_get(rb_thread_current(), ID_ivar_backend);
+
+  ring_buffer_push(&pool->waiters, fiber);
+  if (pool->waiters.count > pool->max_queue_depth) pool->max_queue_depth = pool->waiters.count;
+
+  while (1) {
+    VALUE switchpoint_result = Backend_wait_event(backend, Qnil);
+    if (TEST_EXCEPTION(switchpoint_result)) {
+      ring_buffer_delete(&pool->waiters, fiber);
+      resource_pool_wake_first_waiter(pool);
+      RAISE_EXCEPTION(switchpoint_result);
+    }
+    RB_GC_GUARD(switchpoint_result);
+
+    if (ring_buffer_first(&pool->waiters) != fiber) continue;
+
+    if (pool->stock.count) {
+      ring_buffer_shift(&pool->waiters);
+      VALUE resource = ring_buffer_shift(&pool->stock);
+      resource_pool_wake_first_waiter(pool);
+      return resource;
+    }
+    if (pool->size < pool->limit) {
+      ring_buffer_shift(&pool->waiters);
+      return resource_pool_allocate_resource(pool, &ctx->allocated);
+    }
+  }
+}
+
+static VALUE resource_pool_checkout(struct acquire_ctx *ctx, VALUE timeout) {
+  ResourcePool_t *pool = ctx->pool;
+  pool->acquire_count++;
+  if (!pool->waiters.count && pool->stock.count) return ring_buffer_shift(&pool->stock);
+  if (pool->size < pool->limit) return resource_pool_allocate_resource(pool, &ctx->allocated);
+
+  pool->wait_count++;
+  double stamp = pool_now();
+  VALUE resource;
+  if (timeout == Qnil)
+    resource = resource_pool_wait(Qnil, (VALUE)ctx, 0, 0, Qnil);
+  else {
+    VALUE args[2] = {timeout, cResourcePoolTimeoutError};
+    VALUE backend = rb_ivar_get(rb_thread_current(), ID_ivar_backend);
+    resource = rb_block_call(backend, ID_timeout, 2, args, resource_pool_wait, (VALUE)ctx);
+  }
+
+  double elapsed = pool_now() - stamp;
+  pool->total_wait_time += elapsed;
+  if (elapsed > pool->max_wait_time) pool->max_wait_time = elapsed;
+  return resource;
+}
+
+static void resource_pool_checkin(ResourcePool_t *pool, VALUE resource) {
+  ring_buffer_push(&pool->stock, resource);
+  resource_pool_wake_first_waiter(pool);
+}
+
+// Allocating a resource is treated as a switchpoint, as the allocator would
+// normally do I/O. Snoozing here, once the resource is accounted for, lets
+// other fibers queue up for the existing resources in the meantime.
+static VALUE resource_pool_acquire_yield(VALUE arg) {
+  struct acquire_ctx *ctx = (struct acquire_ctx *)arg;
+  if (ctx->allocated) {
+    VALUE switchpoint_result = backend_snooze();
+    RAISE_IF_EXCEPTION(switchpoint_result);
+    RB_GC_GUARD(switchpoint_result);
+  }
+  return rb_yield(ctx->resource);
+}
+
+static VALUE resource_pool_acquire_ensure(VALUE arg) {
+  struct acquire_ctx *ctx = (struct acquire_ctx *)arg;
+  ResourcePool_t *pool = ctx->pool;
+  st_data_t key = (st_data_t)ctx->fiber;
+  st_data_t resource;
+
+  double elapsed = pool_now() - ctx->stamp;
+  pool->total_hold_time += elapsed;
+  if (elapsed > pool->max_hold_time) pool->max_hold_time = elapsed;
+
+  // The resource is not returned to the pool if discarded.
+  if (st_delete(pool->acquired, &key, &resource))
+    resource_pool_checkin(pool, (VALUE)resource);
+  return Qnil;
+}
+
+// Acquires a resource and yields it. Nested calls in the same fiber yield the
+// same resource. If a timeout is given and no resource becomes available
+// within the given interval, a ResourcePool::TimeoutError is raised.
+static VALUE ResourcePool_acquire(int argc, VALUE *argv, VALUE self) {
+  ResourcePool_t *pool = get_resource_pool(self);
+  VALUE timeout = argc > 0 ? argv[0] : Qnil;
+  VALUE fiber = rb_fiber_current();
+  st_data_t resource;
+
+  rb_check_arity(argc, 0, 1);
+  if (st_lookup(pool->acquired, (st_data_t)fiber, &resource))
+    return rb_yield((VALUE)resource);
+
+  struct acquire_ctx ctx = {pool, fiber, Qnil, 0, 0};
+  ctx.resource = resource_pool_checkout(&ctx, timeout);
+  ctx.stamp = pool_now();
+  st_insert(pool->acquired, (st_data_t)fiber, (st_data_t)ctx.resource);
+
+  VALUE result = rb_ensure(resource_pool_acquire_yield, (VALUE)&ctx, resource_pool_acquire_ensure, (VALUE)&ctx);
+  RB_GC_GUARD(ctx.resource);
+  return result;
+}
+
+// Discards the currently-acquired resource instead of returning it to the pool
+// when done.
+static VALUE ResourcePool_discard(VALUE self) {
+  ResourcePool_t *pool = get_resource_pool(self);
+  st_data_t key = (st_data_t)rb_fiber_current();
+
+  if (!st_delete(pool->acquired, &key, 0)) return self;
+
+  // the discarded resource will not be returned to the pool, so the first
+  // waiter is woken up to allocate a new one.
+  pool->size--;
+  resource_pool_wake_first_waiter(pool);
+  return self;
+}
+
+static VALUE ResourcePool_preheat(VALUE self) {
+  ResourcePool_t *pool = get_resource_pool(self);
+
+  while (pool->size < pool->limit)
+    resource_pool_checkin(pool, resource_pool_allocate_resource(pool, NULL));
+  return self;
+}
+
+static VALUE ResourcePool_limit(VALUE self) {
+  return UINT2NUM(get_resource_pool(self)->limit);
+}
+
+static VALUE ResourcePool_pool_size(VALUE self) {
+  return UINT2NUM(get_resource_pool(self)->size);
+}
+
+static VALUE ResourcePool_available(VALUE self) {
+  return UINT2NUM(get_resource_pool(self)->stock.count);
+}
+
+static VALUE ResourcePool_stats(VALUE self) {
+  ResourcePool_t *pool = get_resource_pool(self);
+
+  VALUE stats = rb_hash_new();
+  rb_hash_aset(stats, SYM_acquire_count, ULONG2NUM(pool->acquire_count));
+  rb_hash_aset(stats, SYM_wait_count, ULONG2NUM(pool->wait_count));
+  rb_hash_aset(stats, SYM_queue_depth, UINT2NUM(pool->waiters.count));
+  rb_hash_aset(stats, SYM_max_queue_depth, UINT2NUM(pool->max_queue_depth));
+  rb_hash_aset(stats, SYM_total_wait_time, DBL2NUM(pool->total_wait_time));
+  rb_hash_aset(stats, SYM_max_wait_time, DBL2NUM(pool->max_wait_time));
+  rb_hash_aset(stats, SYM_total_hold_time, DBL2NUM(pool->total_hold_time));
+  rb_hash_aset(stats, SYM_max_hold_time, DBL2NUM(pool->max_hold_time));
+  RB_GC_GUARD(stats);
+  return stats;
+}
+
+void Init_ResourcePool() {
+  cResourcePool = rb_define_class_under(mPolyphony, "ResourcePool", rb_cObject);
+  rb_define_alloc_func(cResourcePool, ResourcePool_allocate);
+
+  cResourcePoolTimeoutError = rb_define_class_under(cResourcePool, "TimeoutError", rb_eRuntimeError);
+
+  rb_define_private_method(cResourcePool, "setup", ResourcePool_setup, 2);
+  rb_define_method(cResourcePool, "acquire", ResourcePool_acquire, -1);
+  rb_define_method(cResourcePool, "discard!", ResourcePool_discard, 0);
+  rb_define_method(cResourcePool, "preheat!", ResourcePool_preheat, 0);
+  rb_define_method(cResourcePool, "limit", ResourcePool_limit, 0);
+  rb_define_method(cResourcePool, "size", ResourcePool_pool_size, 0);
+  rb_define_method(cResourcePool, "available", ResourcePool_available, 0);
+  rb_define_method(cResourcePool, "stats", ResourcePool_stats, 0);
+
+  ID_timeout = rb_intern("timeout");
+  SYM_acquire_count = ID2SYM(rb_intern("acquire_count"));
+  SYM_wait_count = ID2SYM(rb_intern("wait_count"));
+  SYM_queue_depth = ID2SYM(rb_intern("queue_depth"));
+  SYM_max_queue_depth = ID2SYM(rb_intern("max_queue_depth"));
+  SYM_total_wait_time = ID2SYM(rb_intern("total_wait_time"));
+  SYM_max_wait_time = ID2SYM(rb_intern("max_wait_time"));
+  SYM_total_hold_time = ID2SYM(rb_intern("total_hold_time"));
+  SYM_max_hold_time = ID2SYM(rb_intern("max_hold_time"));
+}
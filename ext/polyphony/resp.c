@@ -0,0 +1,368 @@
+#include <stdlib.h>
+#include <limits.h>
+#include "polyphony.h"
+#include "native_feed.h"
+#include "ruby/encoding.h"
+
+// Native RESP (REdis Serialization Protocol) encoder and incremental reader.
+// The reader keeps received data in a single buffer, and parses replies in
+// place, advancing a read position instead of slicing the buffer. Arrays are
+// parsed incrementally: elements already parsed are kept in the reader, so an
+// incomplete reply is not parsed again from its start when more data is fed.
+
+#define RESP_MAX_DEPTH 64
+#define RESP_COMPACT_THRESHOLD 65536
+
+typedef struct resp_reader {
+  VALUE buffer;
+  long  pos;
+  long  need;     // buffer length needed before parsing can make progress
+  long  partial;  // bytes consumed by partially parsed arrays
+  VALUE arrays;   // partially parsed arrays, outermost first
+  long  remaining[RESP_MAX_DEPTH + 1];
+} RESPReader_t;
+
+enum resp_parse_result {
+  RESP_INCOMPLETE = 0,
+  RESP_COMPLETE   = 1,
+  RESP_ARRAY      = 2
+};
+
+VALUE mRESP = Qnil;
+VALUE cRESPReader = Qnil;
+VALUE cRESPProtocolError = Qnil;
+
+static void RESPReader_mark(void *ptr) {
+  RESPReader_t *reader = ptr;
+  rb_gc_mark(reader->buffer);
+  rb_gc_mark(reader->arrays);
+}
+
+static void RESPReader_free(void *ptr) {
+  xfree(ptr);
+}
+
+static size_t RESPReader_size(const void *ptr) {
+  return sizeof(RESPReader_t);
+}
+
+static int RESPReader_native_feed(VALUE self, void *data, const char *ptr, size_t len);
+
+static const polyphony_native_feed_t RESPReader_native_feed_interface = {
+  POLYPHONY_NATIVE_FEED_MAGIC, POLYPHONY_NATIVE_FEED_VERSION, RESPReader_native_feed
+};
+
+static const rb_data_type_t RESPReader_type = {
+  "RESPReader",
+  {RESPReader_mark, RESPReader_free, RESPReader_size,},
+  0, (void *)&RESPReader_native_feed_interface, 0
+};
+
+static VALUE RESPReader_allocate(VALUE klass) {
+  RESPReader_t *reader;
+
+  reader = ALLOC(RESPReader_t);
+  reader->buffer = Qnil;
+  reader->pos = 0;
+  reader->need = 0;
+  reader->partial = 0;
+  reader->arrays = Qnil;
+  return TypedData_Wrap_Struct(klass, &RESPReader_type, reader);
+}
+
+#define GetRESPReader(obj, reader) \
+  TypedData_Get_Struct((obj), RESPReader_t, &RESPReader_type, (reader))
+
+static VALUE RESPReader_initialize(VALUE self) {
+  RESPReader_t *reader;
+  GetRESPReader(self, reader);
+
+  reader->buffer = rb_str_buf_new(4096);
+  reader->pos = 0;
+  reader->need = 0;
+  reader->partial = 0;
+  reader->arrays = rb_ary_new();
+  return self;
+}
+
+// Finds the end of the line starting at pos. Returns the offset of the CR, or
+// -1 if the line is not complete.
+static inline long resp_line_end(const char *ptr, long len, long pos) {
+  while (pos < len) {
+    const char *cr = memchr(ptr + pos, '\r', len - pos);
+    if (!cr) return -1;
+
+    long idx = cr - ptr;
+    if (idx + 1 >= len) return -1;
+    if (ptr[idx + 1] == '\n') return idx;
+    pos = idx + 1;
+  }
+  return -1;
+}
+
+static long long resp_parse_int(const char *ptr, long len) {
+  long long value = 0;
+  int negative = 0;
+  long i = 0;
+
+  if (len && ptr[0] == '-') {
+    negative = 1;
+    i = 1;
+  }
+  if (i == len) rb_raise(cRESPProtocolError, "invalid integer");
+  for (; i < len; i++) {
+    if (ptr[i] < '0' || ptr[i] > '9') rb_raise(cRESPProtocolError, "invalid integer");
+
+    int digit = ptr[i] - '0';
+    if (value > (LLONG_MAX - digit) / 10) rb_raise(cRESPProtocolError, "integer out of range");
+    value = value * 10 + digit;
+  }
+  return negative ? -value : value;
+}
+
+static inline VALUE resp_str_new(const char *ptr, long len) {
+  return rb_enc_str_new(ptr, len, rb_default_external_encoding());
+}
+
+// Parses a single value starting at *pos. On success, stores the value in
+// *result and advances *pos past it. For a non-empty array, stores an empty
+// array in *result and its element count in *count, advancing *pos past the
+// array header. Nothing is consumed if the value is incomplete, in which case
+// *need is set to the buffer length needed before trying again.
+static int resp_parse(const char *ptr, long len, long *pos, VALUE *result, long *count, long *need) {
+  *need = len + 1;
+  if (*pos >= len) return RESP_INCOMPLETE;
+
+  long start = *pos + 1;
+  long eol = resp_line_end(ptr, len, start);
+  if (eol < 0) return RESP_INCOMPLETE;
+
+  switch (ptr[*pos]) {
+    case '+':
+      *result = resp_str_new(ptr + start, eol - start);
+      *pos = eol + 2;
+      return RESP_COMPLETE;
+    case '-':
+      *result = rb_exc_new(rb_eRuntimeError, ptr + start, eol - start);
+      *pos = eol + 2;
+      return RESP_COMPLETE;
+    case ':':
+      *result = LL2NUM(resp_parse_int(ptr + start, eol - start));
+      *pos = eol + 2;
+      return RESP_COMPLETE;
+    case '$': {
+      long long size = resp_parse_int(ptr + start, eol - start);
+      if (size < 0) {
+        *result = Qnil;
+        *pos = eol + 2;
+        return RESP_COMPLETE;
+      }
+      long data = eol + 2;
+      if (size > len - data - 2) {
+        *need = size > LONG_MAX - data - 2 ? LONG_MAX : data + size + 2;
+        return RESP_INCOMPLETE;
+      }
+      if (ptr[data + size] != '\r' || ptr[data + size + 1] != '\n')
+        rb_raise(cRESPProtocolError, "invalid bulk string terminator");
+
+      *result = resp_str_new(ptr + data, size);
+      *pos = data + size + 2;
+      return RESP_COMPLETE;
+    }
+    case '*': {
+      long long size = resp_parse_int(ptr + start, eol - start);
+      *pos = eol + 2;
+      if (size < 0) {
+        *result = Qnil;
+        return RESP_COMPLETE;
+      }
+      // the announced size is not trusted for preallocation, as each element
+      // takes at least one byte
+      long remaining = len - *pos;
+      *result = rb_ary_new_capa(size < remaining ? size : remaining);
+      if (!size) return RESP_COMPLETE;
+
+      *count = size;
+      return RESP_ARRAY;
+    }
+    default:
+      rb_raise(cRESPProtocolError, "invalid reply type %c", ptr[*pos]);
+  }
+}
+
+// Parses the next reply in the buffer, advancing the read position. Parsed
+// elements of an incomplete array are kept in the reader.
+static int resp_reader_next(RESPReader_t *reader, VALUE *result) {
+  const char *ptr = RSTRING_PTR(reader->buffer);
+  long len = RSTRING_LEN(reader->buffer);
+  if (len < reader->need) return RESP_INCOMPLETE;
+
+  while (1) {
+    long depth = RARRAY_LEN(reader->arrays);
+    long start = reader->pos;
+    long count;
+    VALUE value;
+    if (depth > RESP_MAX_DEPTH) rb_raise(cRESPProtocolError, "nesting too deep");
+
+    int ret = resp_parse(ptr, len, &reader->pos, &value, &count, &reader->need);
+    if (ret == RESP_INCOMPLETE) return ret;
+
+    reader->partial += reader->pos - start;
+    if (ret == RESP_ARRAY) {
+      reader->remaining[depth] = count;
+      rb_ary_push(reader->arrays, value);
+      continue;
+    }
+
+    // add the value to the innermost array, popping any completed arrays
+    while (depth) {
+      VALUE array = RARRAY_AREF(reader->arrays, depth - 1);
+      rb_ary_push(array, value);
+      if (--reader->remaining[depth - 1]) break;
+
+      value = rb_ary_pop(reader->arrays);
+      depth--;
+    }
+    if (depth) continue;
+
+    reader->need = 0;
+    reader->partial = 0;
+    *result = value;
+    return RESP_COMPLETE;
+  }
+}
+
+// Discards consumed data. When the buffer is fully consumed it is simply
+// emptied, otherwise its tail is moved to the front only once enough data has
+// accumulated, to keep the memmove infrequent.
+static void resp_reader_compact(RESPReader_t *reader) {
+  long len = RSTRING_LEN(reader->buffer);
+  if (!reader->pos) return;
+
+  if (reader->pos >= len) {
+    rb_str_set_len(reader->buffer, 0);
+  }
+  else if (reader->pos >= RESP_COMPACT_THRESHOLD) {
+    char *ptr = RSTRING_PTR(reader->buffer);
+    memmove(ptr, ptr + reader->pos, len - reader->pos);
+    rb_str_set_len(reader->buffer, len - reader->pos);
+  }
+  else
+    return;
+
+  reader->need = reader->need > reader->pos ? reader->need - reader->pos : 0;
+  reader->pos = 0;
+}
+
+// Appends data to the reader. If a block is given, yields each complete
+// reply. The read position is updated before each yield, so breaking out of
+// the block leaves any remaining replies in the reader.
+static void resp_reader_feed(RESPReader_t *reader, const char *ptr, long len) {
+  rb_str_modify(reader->buffer);
+  resp_reader_compact(reader);
+  rb_str_buf_cat(reader->buffer, ptr, len);
+
+  if (rb_block_given_p()) {
+    VALUE reply;
+    while (resp_reader_next(reader, &reply)) rb_yield(reply);
+  }
+}
+
+static VALUE RESPReader_feed(VALUE self, VALUE data) {
+  RESPReader_t *reader;
+  GetRESPReader(self, reader);
+  StringValue(data);
+
+  resp_reader_feed(reader, RSTRING_PTR(data), RSTRING_LEN(data));
+  RB_GC_GUARD(data);
+  return self;
+}
+
+// Native feed function, used by #feed_loop (see native_feed.h)
+static int RESPReader_native_feed(VALUE self, void *data, const char *ptr, size_t len) {
+  resp_reader_feed(data, ptr, len);
+  return 0;
+}
+
+// Returns the next complete reply, or false if no complete reply is
+// available.
+static VALUE RESPReader_gets(VALUE self) {
+  RESPReader_t *reader;
+  VALUE reply;
+  GetRESPReader(self, reader);
+
+  return resp_reader_next(reader, &reply) ? reply : Qfalse;
+}
+
+static VALUE RESPReader_pending_bytes(VALUE self) {
+  RESPReader_t *reader;
+  GetRESPReader(self, reader);
+
+  return LONG2NUM(RSTRING_LEN(reader->buffer) - reader->pos + reader->partial);
+}
+
+static inline VALUE resp_arg_to_str(VALUE arg) {
+  switch (TYPE(arg)) {
+    case T_STRING:
+      return arg;
+    case T_SYMBOL:
+      return rb_sym2str(arg);
+    default:
+      return rb_obj_as_string(arg);
+  }
+}
+
+static inline char *resp_write_header(char *ptr, char type, long value) {
+  ptr += sprintf(ptr, "%c%ld\r\n", type, value);
+  return ptr;
+}
+
+// Encodes a command as a RESP array of bulk strings. The result is allocated
+// once at its final size. Nested arrays are flattened.
+static VALUE RESP_encode(VALUE self, VALUE args) {
+  Check_Type(args, T_ARRAY);
+  args = rb_funcall(args, rb_intern("flatten"), 0);
+
+  long count = RARRAY_LEN(args);
+  VALUE strs = rb_ary_new_capa(count);
+  // "*<count>\r\n" and "$<len>\r\n...\r\n" headers take at most 24 bytes each
+  long total = 24;
+  for (long i = 0; i < count; i++) {
+    VALUE str = resp_arg_to_str(RARRAY_AREF(args, i));
+    rb_ary_push(strs, str);
+    total += RSTRING_LEN(str) + 24 + 2;
+  }
+
+  VALUE result = rb_str_buf_new(total);
+  char *start = RSTRING_PTR(result);
+  char *ptr = resp_write_header(start, '*', count);
+  for (long i = 0; i < count; i++) {
+    VALUE str = RARRAY_AREF(strs, i);
+    long len = RSTRING_LEN(str);
+    ptr = resp_write_header(ptr, '$', len);
+    memcpy(ptr, RSTRING_PTR(str), len);
+    ptr += len;
+    *ptr++ = '\r';
+    *ptr++ = '\n';
+  }
+  rb_str_set_len(result, ptr - start);
+
+  RB_GC_GUARD(strs);
+  return result;
+}
+
+void Init_RESP() {
+  mRESP = rb_define_module_under(mPolyphony, "RESP");
+  rb_define_singleton_method(mRESP, "encode", RESP_encode, 1);
+
+  cRESPProtocolError = rb_define_class_under(mRESP, "ProtocolError", rb_eRuntimeError);
+
+  cRESPReader = rb_define_class_under(mRESP, "Reader", rb_cObject);
+  rb_define_alloc_func(cRESPReader, RESPReader_allocate);
+  rb_include_module(cRESPReader, rb_const_get(mPolyphony, rb_intern("NativeFeed")));
+
+  rb_define_method(cRESPReader, "initialize", RESPReader_initialize, 0);
+  rb_define_method(cRESPReader, "feed", RESPReader_feed, 1);
+  rb_define_method(cRESPReader, "gets", RESPReader_gets, 0);
+  rb_define_method(cRESPReader, "pending_bytes", RESPReader_pending_bytes, 0);
+}
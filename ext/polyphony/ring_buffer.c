@@ -1,10 +1,13 @@
 #include "polyphony.h"
 #include "ring_buffer.h"
 
+// Ring buffers start with zero capacity, and are allocated on first push, since
+// most ring buffers (e.g. the waiters of an Event or the values of a fiber's
+// mailbox) are never used.
 void ring_buffer_init(ring_buffer *buffer) {
-  buffer->size = 1;
+  buffer->size = 0;
   buffer->count = 0;
-  buffer->entries = malloc(buffer->size * sizeof(VALUE));
+  buffer->entries = NULL;
   buffer->head = 0;
   buffer->tail = 0;
 }
@@ -29,7 +32,7 @@ VALUE ring_buffer_shift(ring_buffer *buffer) {
 
 void ring_buffer_resize(ring_buffer *buffer) {
   unsigned int old_size = buffer->size;
-  buffer->size = old_size == 1 ? 4 : old_size * 2;
+  buffer->size = old_size <= 1 ? 4 : old_size * 2;
   buffer->entries = realloc(buffer->entries, buffer->size * sizeof(VALUE));
   for (unsigned int idx = 0; idx < buffer->head && idx < buffer->tail; idx++)
     buffer->entries[old_size + idx] = buffer->entries[idx];
@@ -80,14 +83,17 @@ void ring_buffer_delete_at(ring_buffer *buffer, unsigned int idx) {
   buffer->tail = (buffer->tail - 1) % buffer->size;
 }
 
-void ring_buffer_delete(ring_buffer *buffer, VALUE value) {
+// Deletes the first occurrence of the given value. Returns 1 if the value was
+// found, otherwise 0.
+int ring_buffer_delete(ring_buffer *buffer, VALUE value) {
   for (unsigned int i = 0; i < buffer->count; i++) {
     unsigned int idx = (buffer->head + i) % buffer->size;
     if (buffer->entries[idx] == value) {
       ring_buffer_delete_at(buffer, idx);
-      return;
+      return 1;
     }
   }
+  return 0;
 }
 
 void ring_buffer_clear(ring_buffer *buffer) {
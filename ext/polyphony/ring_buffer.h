@@ -23,6 +23,6 @@ void ring_buffer_push(ring_buffer *buffer, VALUE value);
 
 void ring_buffer_shift_each(ring_buffer *buffer);
 VALUE ring_buffer_shift_all(ring_buffer *buffer);
-void ring_buffer_delete(ring_buffer *buffer, VALUE value);
+int ring_buffer_delete(ring_buffer *buffer, VALUE value);
 
 #endif /* RING_BUFFER_H */
\ No newline at end of file
@@ -2,58 +2,156 @@
 #include "runqueue.h"
 
 inline void runqueue_initialize(runqueue_t *runqueue) {
-  runqueue_ring_buffer_init(&runqueue->entries);
+  for (int i = 0; i < RUNQUEUE_LEVELS; i++) {
+    runqueue_ring_buffer_init(&runqueue->levels[i]);
+    runqueue->bursts[i] = 0;
+  }
+  runqueue->count = 0;
   runqueue->high_watermark = 0;
+  runqueue->last_level = RUNQUEUE_LEVEL_NORMAL;
 }
 
 inline void runqueue_finalize(runqueue_t *runqueue) {
-  runqueue_ring_buffer_free(&runqueue->entries);
+  for (int i = 0; i < RUNQUEUE_LEVELS; i++)
+    runqueue_ring_buffer_free(&runqueue->levels[i]);
 }
 
 inline void runqueue_mark(runqueue_t *runqueue) {
-  runqueue_ring_buffer_mark(&runqueue->entries);
+  for (int i = 0; i < RUNQUEUE_LEVELS; i++)
+    runqueue_ring_buffer_mark(&runqueue->levels[i]);
 }
 
-inline void runqueue_push(runqueue_t *runqueue, VALUE fiber, VALUE value, int reschedule) {
-  if (reschedule) runqueue_ring_buffer_delete(&runqueue->entries, fiber);
-  runqueue_ring_buffer_push(&runqueue->entries, fiber, value);
-  if (runqueue->entries.count > runqueue->high_watermark)
-    runqueue->high_watermark = runqueue->entries.count;
+// Returns the level the given fiber is in, or -1 if not found. The fiber's
+// runqueue slot records the buffer it was last added to, so only that level is
+// checked.
+static inline int runqueue_level_of(runqueue_t *runqueue, VALUE fiber, runqueue_slot *slot) {
+  if (!runqueue->count || !slot || !slot->buffer) return -1;
+
+  for (int i = 0; i < RUNQUEUE_LEVELS; i++)
+    if (slot->buffer == &runqueue->levels[i])
+      return runqueue_ring_buffer_slot_p(&runqueue->levels[i], slot, fiber) ? i : -1;
+  return -1;
+}
+
+static inline int runqueue_remove(runqueue_t *runqueue, VALUE fiber, runqueue_slot *slot) {
+  int level = runqueue_level_of(runqueue, fiber, slot);
+  if (level < 0) return 0;
+
+  runqueue_ring_buffer_delete(&runqueue->levels[level], slot);
+  runqueue->count--;
+  return 1;
+}
+
+static inline void runqueue_update_watermark(runqueue_t *runqueue) {
+  if (runqueue->count > runqueue->high_watermark)
+    runqueue->high_watermark = runqueue->count;
 }
 
-inline void runqueue_unshift(runqueue_t *runqueue, VALUE fiber, VALUE value, int reschedule) {
-  if (reschedule) runqueue_ring_buffer_delete(&runqueue->entries, fiber);
-  runqueue_ring_buffer_unshift(&runqueue->entries, fiber, value);
-  if (runqueue->entries.count > runqueue->high_watermark)
-    runqueue->high_watermark = runqueue->entries.count;
+inline void runqueue_push(runqueue_t *runqueue, VALUE fiber, VALUE value, int level, int reschedule) {
+  runqueue_slot *slot = Fiber_runqueue_slot(fiber, 1);
+  if (reschedule) runqueue_remove(runqueue, fiber, slot);
+  runqueue_ring_buffer_push(&runqueue->levels[level], fiber, value, slot);
+  runqueue->count++;
+  runqueue_update_watermark(runqueue);
+}
+
+inline void runqueue_unshift(runqueue_t *runqueue, VALUE fiber, VALUE value, int level, int reschedule) {
+  runqueue_slot *slot = Fiber_runqueue_slot(fiber, 1);
+  if (reschedule) runqueue_remove(runqueue, fiber, slot);
+  runqueue_ring_buffer_unshift(&runqueue->levels[level], fiber, value, slot);
+  runqueue->count++;
+  runqueue_update_watermark(runqueue);
+}
+
+static runqueue_entry nil_runqueue_entry = {(Qnil), (Qnil), NULL};
+
+static inline int runqueue_lower_levels_empty_p(runqueue_t *runqueue, int level) {
+  for (int i = level + 1; i < RUNQUEUE_LEVELS; i++)
+    if (runqueue->levels[i].count) return 0;
+  return 1;
 }
 
 inline runqueue_entry runqueue_shift(runqueue_t *runqueue) {
-  return runqueue_ring_buffer_shift(&runqueue->entries);
+  if (!runqueue->count) return nil_runqueue_entry;
+
+  for (int i = 0; i < RUNQUEUE_LEVELS; i++) {
+    if (!runqueue->levels[i].count) continue;
+
+    if (runqueue->bursts[i] >= RUNQUEUE_PRIORITY_BURST) {
+      runqueue->bursts[i] = 0;
+      if (!runqueue_lower_levels_empty_p(runqueue, i)) continue;
+    }
+    runqueue->bursts[i]++;
+    runqueue->last_level = i;
+    runqueue->count--;
+    return runqueue_ring_buffer_shift(&runqueue->levels[i]);
+  }
+  return nil_runqueue_entry;
 }
 
 inline void runqueue_delete(runqueue_t *runqueue, VALUE fiber) {
-  runqueue_ring_buffer_delete(&runqueue->entries, fiber);
+  if (!runqueue->count) return;
+
+  runqueue_remove(runqueue, fiber, Fiber_runqueue_slot(fiber, 0));
 }
 
 inline int runqueue_index_of(runqueue_t *runqueue, VALUE fiber) {
-  return runqueue_ring_buffer_index_of(&runqueue->entries, fiber);
+  if (!runqueue->count) return -1;
+
+  runqueue_slot *slot = Fiber_runqueue_slot(fiber, 0);
+  int level = runqueue_level_of(runqueue, fiber, slot);
+  if (level < 0) return -1;
+
+  int offset = 0;
+  for (int i = 0; i < level; i++) offset += runqueue->levels[i].count;
+  return offset + runqueue_ring_buffer_index_of(&runqueue->levels[level], slot);
+}
+
+inline int runqueue_includes_p(runqueue_t *runqueue, VALUE fiber) {
+  if (!runqueue->count) return 0;
+
+  return runqueue_level_of(runqueue, fiber, Fiber_runqueue_slot(fiber, 0)) >= 0;
+}
+
+// Returns the value the given fiber is scheduled with, or Qundef if the fiber
+// is not in the runqueue.
+inline VALUE runqueue_value_of(runqueue_t *runqueue, VALUE fiber) {
+  if (!runqueue->count) return Qundef;
+
+  runqueue_slot *slot = Fiber_runqueue_slot(fiber, 0);
+  int level = runqueue_level_of(runqueue, fiber, slot);
+  return level < 0 ? Qundef : runqueue_ring_buffer_value_of(&runqueue->levels[level], slot);
 }
 
 inline void runqueue_migrate(runqueue_t *src, runqueue_t *dest, VALUE fiber) {
-  runqueue_ring_buffer_migrate(&src->entries, &dest->entries, fiber);
+  if (!src->count) return;
+
+  runqueue_slot *slot = Fiber_runqueue_slot(fiber, 0);
+  int level = runqueue_level_of(src, fiber, slot);
+  if (level < 0) return;
+
+  runqueue_ring_buffer_migrate(&src->levels[level], &dest->levels[level], slot);
+  src->count--;
+  dest->count++;
+  runqueue_update_watermark(dest);
 }
 
 inline void runqueue_clear(runqueue_t *runqueue) {
-  runqueue_ring_buffer_clear(&runqueue->entries);
+  for (int i = 0; i < RUNQUEUE_LEVELS; i++) {
+    runqueue_ring_buffer_clear(&runqueue->levels[i]);
+    runqueue->bursts[i] = 0;
+  }
+  runqueue->count = 0;
 }
 
 inline unsigned int runqueue_size(runqueue_t *runqueue) {
-  return runqueue->entries.size;
+  unsigned int size = 0;
+  for (int i = 0; i < RUNQUEUE_LEVELS; i++) size += runqueue->levels[i].size;
+  return size;
 }
 
 inline unsigned int runqueue_len(runqueue_t *runqueue) {
-  return runqueue->entries.count;
+  return runqueue->count;
 }
 
 inline unsigned int runqueue_max_len(runqueue_t *runqueue) {
@@ -63,5 +161,5 @@ inline unsigned int runqueue_max_len(runqueue_t *runqueue) {
 }
 
 inline int runqueue_empty_p(runqueue_t *runqueue) {
-  return (runqueue->entries.count == 0);
+  return (runqueue->count == 0);
 }
@@ -4,20 +4,36 @@
 #include "polyphony.h"
 #include "runqueue_ring_buffer.h"
 
+// Fibers are scheduled in priority levels, with level 0 being the highest
+// priority. A level is run ahead of lower levels, but once it has been
+// shifted from RUNQUEUE_PRIORITY_BURST times in a row while a lower level is
+// not empty, the lower level gets a turn, so lower priority fibers are never
+// starved.
+#define RUNQUEUE_LEVELS         3
+#define RUNQUEUE_LEVEL_HIGH     0
+#define RUNQUEUE_LEVEL_NORMAL   1
+#define RUNQUEUE_LEVEL_LOW      2
+#define RUNQUEUE_PRIORITY_BURST 8
+
 typedef struct runqueue {
-  runqueue_ring_buffer entries;
+  runqueue_ring_buffer levels[RUNQUEUE_LEVELS];
+  unsigned int bursts[RUNQUEUE_LEVELS];
+  unsigned int count;
   unsigned int high_watermark;
+  unsigned int last_level;
 } runqueue_t;
 
 void runqueue_initialize(runqueue_t *runqueue);
 void runqueue_finalize(runqueue_t *runqueue);
 void runqueue_mark(runqueue_t *runqueue);
 
-void runqueue_push(runqueue_t *runqueue, VALUE fiber, VALUE value, int reschedule);
-void runqueue_unshift(runqueue_t *runqueue, VALUE fiber, VALUE value, int reschedule);
+void runqueue_push(runqueue_t *runqueue, VALUE fiber, VALUE value, int level, int reschedule);
+void runqueue_unshift(runqueue_t *runqueue, VALUE fiber, VALUE value, int level, int reschedule);
 runqueue_entry runqueue_shift(runqueue_t *runqueue);
 void runqueue_delete(runqueue_t *runqueue, VALUE fiber);
 int runqueue_index_of(runqueue_t *runqueue, VALUE fiber);
+int runqueue_includes_p(runqueue_t *runqueue, VALUE fiber);
+VALUE runqueue_value_of(runqueue_t *runqueue, VALUE fiber);
 void runqueue_migrate(runqueue_t *src, runqueue_t *dest, VALUE fiber);
 void runqueue_clear(runqueue_t *runqueue);
 unsigned int runqueue_size(runqueue_t *runqueue);
@@ -25,4 +41,4 @@ unsigned int runqueue_len(runqueue_t *runqueue);
 unsigned int runqueue_max_len(runqueue_t *runqueue);
 int runqueue_empty_p(runqueue_t *runqueue);
 
-#endif /* RUNQUEUE_H */
\ No newline at end of file
+#endif /* RUNQUEUE_H */
@@ -1,6 +1,8 @@
 #include "polyphony.h"
 #include "runqueue_ring_buffer.h"
 
+#define SLOT(buffer, pos) ((buffer)->entries[(pos) & ((buffer)->size - 1)])
+
 inline void runqueue_ring_buffer_init(runqueue_ring_buffer *buffer) {
   buffer->size = 1;
   buffer->count = 0;
@@ -21,86 +23,103 @@ inline void runqueue_ring_buffer_clear(runqueue_ring_buffer *buffer) {
   buffer->count = buffer->head = buffer->tail = 0;
 }
 
-static runqueue_entry nil_runqueue_entry = {(Qnil), (Qnil)};
+static runqueue_entry nil_runqueue_entry = {(Qnil), (Qnil), NULL};
+
+// Drops tombstones from both ends of the buffer
+static inline void runqueue_ring_buffer_trim(runqueue_ring_buffer *buffer) {
+  while (buffer->head != buffer->tail && SLOT(buffer, buffer->head).fiber == Qnil)
+    buffer->head++;
+  while (buffer->head != buffer->tail && SLOT(buffer, buffer->tail - 1).fiber == Qnil)
+    buffer->tail--;
+}
 
 inline runqueue_entry runqueue_ring_buffer_shift(runqueue_ring_buffer *buffer) {
   if (buffer->count == 0) return nil_runqueue_entry;
 
-  runqueue_entry value = buffer->entries[buffer->head];
-  buffer->head = (buffer->head + 1) % buffer->size;
+  runqueue_entry value = SLOT(buffer, buffer->head);
+  buffer->head++;
   buffer->count--;
+  runqueue_ring_buffer_trim(buffer);
   return value;
 }
 
-inline void runqueue_ring_buffer_resize(runqueue_ring_buffer *buffer) {
-  unsigned int old_size = buffer->size;
-  buffer->size = old_size == 1 ? 4 : old_size * 2;
-  buffer->entries = realloc(buffer->entries, buffer->size * sizeof(runqueue_entry));
-  for (unsigned int idx = 0; idx < buffer->head && idx < buffer->tail; idx++)
-    buffer->entries[old_size + idx] = buffer->entries[idx];
-  buffer->tail = buffer->head + buffer->count;
+// Makes room for an additional entry, either by compacting the buffer if at
+// least half of the slots are tombstones, or by doubling its size.
+static void runqueue_ring_buffer_resize(runqueue_ring_buffer *buffer) {
+  unsigned int new_size = (buffer->count <= buffer->size / 2) ? buffer->size : buffer->size * 2;
+  if (new_size == 1) new_size = 4;
+  runqueue_entry *entries = malloc(new_size * sizeof(runqueue_entry));
+
+  unsigned long pos = 0;
+  for (unsigned long old_pos = buffer->head; old_pos != buffer->tail; old_pos++) {
+    runqueue_entry entry = SLOT(buffer, old_pos);
+    if (entry.fiber == Qnil) continue;
+
+    entries[pos] = entry;
+    entry.slot->pos = pos;
+    pos++;
+  }
+  free(buffer->entries);
+  buffer->entries = entries;
+  buffer->size = new_size;
+  buffer->head = 0;
+  buffer->tail = pos;
 }
 
-inline void runqueue_ring_buffer_unshift(runqueue_ring_buffer *buffer, VALUE fiber, VALUE value) {
-  if (buffer->count == buffer->size) runqueue_ring_buffer_resize(buffer);
+static inline void runqueue_ring_buffer_put(runqueue_ring_buffer *buffer, unsigned long pos, VALUE fiber, VALUE value, runqueue_slot *slot) {
+  runqueue_entry *entry = &SLOT(buffer, pos);
+  entry->fiber = fiber;
+  entry->value = value;
+  entry->slot = slot;
+  slot->buffer = buffer;
+  slot->pos = pos;
+}
 
-  buffer->head = (buffer->head - 1) % buffer->size;
-  buffer->entries[buffer->head].fiber = fiber;
-  buffer->entries[buffer->head].value = value;
+inline void runqueue_ring_buffer_unshift(runqueue_ring_buffer *buffer, VALUE fiber, VALUE value, runqueue_slot *slot) {
+  if (buffer->tail - buffer->head == buffer->size) runqueue_ring_buffer_resize(buffer);
+
+  buffer->head--;
+  runqueue_ring_buffer_put(buffer, buffer->head, fiber, value, slot);
   buffer->count++;
 }
 
-inline void runqueue_ring_buffer_push(runqueue_ring_buffer *buffer, VALUE fiber, VALUE value) {
-  if (buffer->count == buffer->size) runqueue_ring_buffer_resize(buffer);
+inline void runqueue_ring_buffer_push(runqueue_ring_buffer *buffer, VALUE fiber, VALUE value, runqueue_slot *slot) {
+  if (buffer->tail - buffer->head == buffer->size) runqueue_ring_buffer_resize(buffer);
 
-  buffer->entries[buffer->tail].fiber = fiber;
-  buffer->entries[buffer->tail].value = value;
-  buffer->tail = (buffer->tail + 1) % buffer->size;
+  runqueue_ring_buffer_put(buffer, buffer->tail, fiber, value, slot);
+  buffer->tail++;
   buffer->count++;
 }
 
 inline void runqueue_ring_buffer_mark(runqueue_ring_buffer *buffer) {
-  for (unsigned int i = 0; i < buffer->count; i++) {
-    runqueue_entry entry = buffer->entries[(buffer->head + i) % buffer->size];
+  for (unsigned long pos = buffer->head; pos != buffer->tail; pos++) {
+    runqueue_entry entry = SLOT(buffer, pos);
+    if (entry.fiber == Qnil) continue;
+
     rb_gc_mark(entry.fiber);
     rb_gc_mark(entry.value);
   }
 }
 
-inline void runqueue_ring_buffer_delete_at(runqueue_ring_buffer *buffer, unsigned int idx) {
-  for (unsigned int idx2 = idx; idx2 != buffer->tail; idx2 = (idx2 + 1) % buffer->size) {
-    buffer->entries[idx2] = buffer->entries[(idx2 + 1) % buffer->size];
-  }
+inline void runqueue_ring_buffer_delete(runqueue_ring_buffer *buffer, runqueue_slot *slot) {
+  SLOT(buffer, slot->pos) = nil_runqueue_entry;
   buffer->count--;
-  buffer->tail = (buffer->tail - 1) % buffer->size;
+  runqueue_ring_buffer_trim(buffer);
 }
 
-inline void runqueue_ring_buffer_delete(runqueue_ring_buffer *buffer, VALUE fiber) {
-  for (unsigned int i = 0; i < buffer->count; i++) {
-    unsigned int idx = (buffer->head + i) % buffer->size;
-    if (buffer->entries[idx].fiber == fiber) {
-      runqueue_ring_buffer_delete_at(buffer, idx);
-      return;
-    }
-  }
+inline int runqueue_ring_buffer_index_of(runqueue_ring_buffer *buffer, runqueue_slot *slot) {
+  int idx = 0;
+  for (unsigned long pos = buffer->head; pos != slot->pos; pos++)
+    if (SLOT(buffer, pos).fiber != Qnil) idx++;
+  return idx;
 }
 
-inline int runqueue_ring_buffer_index_of(runqueue_ring_buffer *buffer, VALUE fiber) {
-  for (unsigned int i = 0; i < buffer->count; i++) {
-    unsigned int idx = (buffer->head + i) % buffer->size;
-    if (buffer->entries[idx].fiber == fiber)
-      return i;
-  }
-  return -1;
+inline VALUE runqueue_ring_buffer_value_of(runqueue_ring_buffer *buffer, runqueue_slot *slot) {
+  return SLOT(buffer, slot->pos).value;
 }
 
-inline void runqueue_ring_buffer_migrate(runqueue_ring_buffer *src, runqueue_ring_buffer *dest, VALUE fiber) {
-  for (unsigned int i = 0; i < src->count; i++) {
-    unsigned int idx = (src->head + i) % src->size;
-    if (src->entries[idx].fiber == fiber) {
-      runqueue_ring_buffer_push(dest, src->entries[idx].fiber, src->entries[idx].value);
-      runqueue_ring_buffer_delete_at(src, idx);
-      return;
-    }
-  }
+inline void runqueue_ring_buffer_migrate(runqueue_ring_buffer *src, runqueue_ring_buffer *dest, runqueue_slot *slot) {
+  runqueue_entry entry = SLOT(src, slot->pos);
+  runqueue_ring_buffer_delete(src, slot);
+  runqueue_ring_buffer_push(dest, entry.fiber, entry.value, slot);
 }
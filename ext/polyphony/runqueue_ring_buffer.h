@@ -3,17 +3,32 @@
 
 #include "ruby.h"
 
+// A fiber's position in a runqueue, kept in the fiber's scheduling state. The
+// slot is only updated when the fiber is added to a runqueue, or when its
+// position changes. It's left as is when the fiber is shifted, so it's valid
+// only as long as the entry at the given position holds the same fiber.
+typedef struct runqueue_slot {
+  struct runqueue_ring_buffer *buffer;
+  unsigned long pos;
+} runqueue_slot;
+
 typedef struct runqueue_entry {
   VALUE fiber;
   VALUE value;
+  runqueue_slot *slot;
 } runqueue_entry;
 
+// Entries are addressed by logical position, which is mapped to a slot in
+// the (power of two sized) entries array. Each fiber's position is recorded in
+// its runqueue slot, so entries can be removed in O(1) by replacing them with
+// a tombstone (an entry with a nil fiber). Tombstones are skipped on shift and
+// dropped when the buffer is compacted.
 typedef struct runqueue_ring_buffer {
   runqueue_entry *entries;
   unsigned int size;
   unsigned int count;
-  unsigned int head;
-  unsigned int tail;
+  unsigned long head;
+  unsigned long tail;
 } runqueue_ring_buffer;
 
 void runqueue_ring_buffer_init(runqueue_ring_buffer *buffer);
@@ -23,12 +38,21 @@ int runqueue_ring_buffer_empty_p(runqueue_ring_buffer *buffer);
 void runqueue_ring_buffer_clear(runqueue_ring_buffer *buffer);
 
 runqueue_entry runqueue_ring_buffer_shift(runqueue_ring_buffer *buffer);
-void runqueue_ring_buffer_unshift(runqueue_ring_buffer *buffer, VALUE fiber, VALUE value);
-void runqueue_ring_buffer_push(runqueue_ring_buffer *buffer, VALUE fiber, VALUE value);
-
-void runqueue_ring_buffer_delete(runqueue_ring_buffer *buffer, VALUE fiber);
-int runqueue_ring_buffer_index_of(runqueue_ring_buffer *buffer, VALUE fiber);
-
-void runqueue_ring_buffer_migrate(runqueue_ring_buffer *src, runqueue_ring_buffer *dest, VALUE fiber);
-
-#endif /* RUNQUEUE_RING_BUFFER_H */
\ No newline at end of file
+void runqueue_ring_buffer_unshift(runqueue_ring_buffer *buffer, VALUE fiber, VALUE value, runqueue_slot *slot);
+void runqueue_ring_buffer_push(runqueue_ring_buffer *buffer, VALUE fiber, VALUE value, runqueue_slot *slot);
+
+// The following take the slot of a fiber found in the buffer
+void runqueue_ring_buffer_delete(runqueue_ring_buffer *buffer, runqueue_slot *slot);
+int runqueue_ring_buffer_index_of(runqueue_ring_buffer *buffer, runqueue_slot *slot);
+VALUE runqueue_ring_buffer_value_of(runqueue_ring_buffer *buffer, runqueue_slot *slot);
+void runqueue_ring_buffer_migrate(runqueue_ring_buffer *src, runqueue_ring_buffer *dest, runqueue_slot *slot);
+
+// Returns true if the given slot holds the position of the given fiber in the
+// buffer
+static inline int runqueue_ring_buffer_slot_p(runqueue_ring_buffer *buffer, runqueue_slot *slot, VALUE fiber) {
+  return slot->buffer == buffer &&
+    slot->pos - buffer->head < buffer->tail - buffer->head &&
+    buffer->entries[slot->pos & (buffer->size - 1)].fiber == fiber;
+}
+
+#endif /* RUNQUEUE_RING_BUFFER_H */
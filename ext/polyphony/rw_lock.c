@@ -0,0 +1,293 @@
+#include "polyphony.h"
+#include "ring_buffer.h"
+
+// A fiber-aware reader-writer lock. Any number of readers may hold the lock at
+// once, while a writer holds it exclusively. Once a writer is waiting, new
+// readers wait as well, so writers are not starved. On release, the lock is
+// handed over directly: a releasing writer admits all waiting readers at once,
+// or otherwise the next waiting writer, and the last releasing reader admits
+// the next waiting writer. Waiting fibers that are already runnable are handed
+// the lock without being rescheduled (see mutex.c). Read locks are not
+// reentrant.
+
+typedef struct rw_lock {
+  VALUE         writer;
+  unsigned long readers;
+  ring_buffer   read_waiters;
+  ring_buffer   write_waiters;
+
+  unsigned long read_acquire_count;
+  unsigned long write_acquire_count;
+  unsigned long wait_count;
+} RWLock_t;
+
+VALUE cRWLock = Qnil;
+static VALUE SYM_read_acquire_count;
+static VALUE SYM_write_acquire_count;
+static VALUE SYM_wait_count;
+static VALUE SYM_readers;
+static VALUE SYM_waiting_readers;
+static VALUE SYM_waiting_writers;
+
+static void RWLock_mark(void *ptr) {
+  RWLock_t *lock = ptr;
+  rb_gc_mark(lock->writer);
+  ring_buffer_mark(&lock->read_waiters);
+  ring_buffer_mark(&lock->write_waiters);
+}
+
+static void RWLock_free(void *ptr) {
+  RWLock_t *lock = ptr;
+  ring_buffer_free(&lock->read_waiters);
+  ring_buffer_free(&lock->write_waiters);
+  xfree(ptr);
+}
+
+static size_t RWLock_size(const void *ptr) {
+  return sizeof(RWLock_t);
+}
+
+static const rb_data_type_t RWLock_type = {
+  "RWLock",
+  {RWLock_mark, RWLock_free, RWLock_size,},
+  0, 0, 0
+};
+
+static VALUE RWLock_allocate(VALUE klass) {
+  RWLock_t *lock;
+
+  lock = ALLOC(RWLock_t);
+  lock->writer = Qnil;
+  lock->readers = 0;
+  ring_buffer_init(&lock->read_waiters);
+  ring_buffer_init(&lock->write_waiters);
+  lock->read_acquire_count = 0;
+  lock->write_acquire_count = 0;
+  lock->wait_count = 0;
+  return TypedData_Wrap_Struct(klass, &RWLock_type, lock);
+}
+
+#define GetRWLock(obj, lock) \
+  TypedData_Get_Struct((obj), RWLock_t, &RWLock_type, (lock))
+
+static inline void rw_lock_admit_readers(VALUE self, RWLock_t *lock) {
+  while (lock->read_waiters.count) {
+    VALUE fiber = ring_buffer_shift(&lock->read_waiters);
+    if (fiber == Qnil) continue;
+
+    lock->readers++;
+    if (!Fiber_runnable_p(fiber)) Fiber_make_runnable(fiber, self);
+  }
+}
+
+static inline int rw_lock_admit_writer(VALUE self, RWLock_t *lock) {
+  while (lock->write_waiters.count) {
+    VALUE fiber = ring_buffer_shift(&lock->write_waiters);
+    if (fiber == Qnil) continue;
+
+    lock->writer = fiber;
+    if (!Fiber_runnable_p(fiber)) Fiber_make_runnable(fiber, self);
+    return 1;
+  }
+  return 0;
+}
+
+static inline void rw_lock_release_read(VALUE self, RWLock_t *lock) {
+  lock->readers--;
+  if (!lock->readers) rw_lock_admit_writer(self, lock);
+}
+
+static inline void rw_lock_release_write(VALUE self, RWLock_t *lock) {
+  lock->writer = Qnil;
+  if (lock->read_waiters.count)
+    rw_lock_admit_readers(self, lock);
+  else
+    rw_lock_admit_writer(self, lock);
+}
+
+static inline VALUE rw_lock_wait(ring_buffer *waiters, VALUE fiber) {
+  VALUE backend = rb_ivar_get(rb_thread_current(), ID_ivar_backend);
+  ring_buffer_push(waiters, fiber);
+  VALUE switchpoint_result = Backend_wait_event(backend, Qnil);
+  RB_GC_GUARD(backend);
+  return switchpoint_result;
+}
+
+static void rw_lock_acquire_read(VALUE self, RWLock_t *lock) {
+  lock->read_acquire_count++;
+  if (lock->writer == Qnil && !lock->write_waiters.count) {
+    lock->readers++;
+    return;
+  }
+
+  VALUE fiber = rb_fiber_current();
+  if (lock->writer == fiber) rb_raise(rb_eThreadError, "deadlock; lock already held for writing");
+
+  lock->wait_count++;
+  while (1) {
+    VALUE switchpoint_result = rw_lock_wait(&lock->read_waiters, fiber);
+    // readers are removed from the waiters queue when admitted
+    int admitted = !ring_buffer_delete(&lock->read_waiters, fiber);
+    if (TEST_EXCEPTION(switchpoint_result)) {
+      if (admitted) rw_lock_release_read(self, lock);
+      RAISE_EXCEPTION(switchpoint_result);
+    }
+    if (admitted) break;
+    if (lock->writer == Qnil && !lock->write_waiters.count) {
+      lock->readers++;
+      break;
+    }
+  }
+}
+
+static void rw_lock_acquire_write(VALUE self, RWLock_t *lock) {
+  VALUE fiber = rb_fiber_current();
+
+  lock->write_acquire_count++;
+  if (lock->writer == Qnil && !lock->readers) {
+    lock->writer = fiber;
+    return;
+  }
+  if (lock->writer == fiber) rb_raise(rb_eThreadError, "deadlock; recursive locking");
+
+  lock->wait_count++;
+  while (1) {
+    VALUE switchpoint_result = rw_lock_wait(&lock->write_waiters, fiber);
+    int admitted = lock->writer == fiber;
+    if (!admitted) ring_buffer_delete(&lock->write_waiters, fiber);
+    if (TEST_EXCEPTION(switchpoint_result)) {
+      if (admitted)
+        rw_lock_release_write(self, lock);
+      else if (lock->writer == Qnil && !lock->write_waiters.count)
+        // readers held back only by this writer can now proceed
+        rw_lock_admit_readers(self, lock);
+      RAISE_EXCEPTION(switchpoint_result);
+    }
+    if (admitted) break;
+    if (lock->writer == Qnil && !lock->readers) {
+      lock->writer = fiber;
+      break;
+    }
+  }
+}
+
+VALUE RWLock_read_lock(VALUE self) {
+  RWLock_t *lock;
+  GetRWLock(self, lock);
+
+  rw_lock_acquire_read(self, lock);
+  return self;
+}
+
+VALUE RWLock_read_unlock(VALUE self) {
+  RWLock_t *lock;
+  GetRWLock(self, lock);
+
+  if (!lock->readers) rb_raise(rb_eThreadError, "Attempt to release a read lock which is not held");
+  rw_lock_release_read(self, lock);
+  return self;
+}
+
+VALUE RWLock_write_lock(VALUE self) {
+  RWLock_t *lock;
+  GetRWLock(self, lock);
+
+  rw_lock_acquire_write(self, lock);
+  return self;
+}
+
+VALUE RWLock_write_unlock(VALUE self) {
+  RWLock_t *lock;
+  GetRWLock(self, lock);
+
+  if (lock->writer != rb_fiber_current())
+    rb_raise(rb_eThreadError, "Attempt to release a write lock which is not held by the current fiber");
+  rw_lock_release_write(self, lock);
+  return self;
+}
+
+static VALUE rw_lock_read_ensure(VALUE self) {
+  RWLock_t *lock;
+  GetRWLock(self, lock);
+
+  rw_lock_release_read(self, lock);
+  return Qnil;
+}
+
+static VALUE rw_lock_write_ensure(VALUE self) {
+  RWLock_t *lock;
+  GetRWLock(self, lock);
+
+  if (lock->writer == rb_fiber_current()) rw_lock_release_write(self, lock);
+  return Qnil;
+}
+
+VALUE RWLock_with_read_lock(VALUE self) {
+  RWLock_t *lock;
+  GetRWLock(self, lock);
+
+  rw_lock_acquire_read(self, lock);
+  return rb_ensure(rb_yield, Qnil, rw_lock_read_ensure, self);
+}
+
+VALUE RWLock_with_write_lock(VALUE self) {
+  RWLock_t *lock;
+  GetRWLock(self, lock);
+
+  rw_lock_acquire_write(self, lock);
+  return rb_ensure(rb_yield, Qnil, rw_lock_write_ensure, self);
+}
+
+VALUE RWLock_readers(VALUE self) {
+  RWLock_t *lock;
+  GetRWLock(self, lock);
+
+  return ULONG2NUM(lock->readers);
+}
+
+VALUE RWLock_write_locked_p(VALUE self) {
+  RWLock_t *lock;
+  GetRWLock(self, lock);
+
+  return (lock->writer != Qnil) ? Qtrue : Qfalse;
+}
+
+// Returns contention statistics: the number of read and write acquisitions,
+// the number of acquisitions that had to wait, the current number of readers
+// and the number of waiting readers and writers.
+VALUE RWLock_stats(VALUE self) {
+  RWLock_t *lock;
+  GetRWLock(self, lock);
+
+  VALUE stats = rb_hash_new();
+  rb_hash_aset(stats, SYM_read_acquire_count, ULONG2NUM(lock->read_acquire_count));
+  rb_hash_aset(stats, SYM_write_acquire_count, ULONG2NUM(lock->write_acquire_count));
+  rb_hash_aset(stats, SYM_wait_count, ULONG2NUM(lock->wait_count));
+  rb_hash_aset(stats, SYM_readers, ULONG2NUM(lock->readers));
+  rb_hash_aset(stats, SYM_waiting_readers, UINT2NUM(lock->read_waiters.count));
+  rb_hash_aset(stats, SYM_waiting_writers, UINT2NUM(lock->write_waiters.count));
+  RB_GC_GUARD(stats);
+  return stats;
+}
+
+void Init_RWLock() {
+  cRWLock = rb_define_class_under(mPolyphony, "RWLock", rb_cObject);
+  rb_define_alloc_func(cRWLock, RWLock_allocate);
+
+  rb_define_method(cRWLock, "read_lock", RWLock_read_lock, 0);
+  rb_define_method(cRWLock, "read_unlock", RWLock_read_unlock, 0);
+  rb_define_method(cRWLock, "write_lock", RWLock_write_lock, 0);
+  rb_define_method(cRWLock, "write_unlock", RWLock_write_unlock, 0);
+  rb_define_method(cRWLock, "with_read_lock", RWLock_with_read_lock, 0);
+  rb_define_method(cRWLock, "with_write_lock", RWLock_with_write_lock, 0);
+  rb_define_method(cRWLock, "readers", RWLock_readers, 0);
+  rb_define_method(cRWLock, "write_locked?", RWLock_write_locked_p, 0);
+  rb_define_method(cRWLock, "stats", RWLock_stats, 0);
+
+  SYM_read_acquire_count = ID2SYM(rb_intern("read_acquire_count"));
+  SYM_write_acquire_count = ID2SYM(rb_intern("write_acquire_count"));
+  SYM_wait_count = ID2SYM(rb_intern("wait_count"));
+  SYM_readers = ID2SYM(rb_intern("readers"));
+  SYM_waiting_readers = ID2SYM(rb_intern("waiting_readers"));
+  SYM_waiting_writers = ID2SYM(rb_intern("waiting_writers"));
+}
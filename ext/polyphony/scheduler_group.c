@@ -0,0 +1,135 @@
+#include "polyphony.h"
+#include "ring_buffer.h"
+
+// A scheduler group holds a pool of tasks (blocks) shared by the threads in
+// the group. Since a fiber cannot be resumed on a thread other than the one
+// it was started on, tasks are held unstarted until a thread in the group
+// runs out of runnable fibers, at which point the thread takes a task from
+// the pool and spins a fiber for it (see backend_base_switch_fiber).
+
+typedef struct scheduler_group {
+  ring_buffer tasks;
+  VALUE backends;
+  unsigned int next_wakeup;
+} SchedulerGroup_t;
+
+VALUE cSchedulerGroup = Qnil;
+ID ID_spin;
+
+static void SchedulerGroup_mark(void *ptr) {
+  SchedulerGroup_t *group = ptr;
+  ring_buffer_mark(&group->tasks);
+  rb_gc_mark(group->backends);
+}
+
+static void SchedulerGroup_free(void *ptr) {
+  SchedulerGroup_t *group = ptr;
+  ring_buffer_free(&group->tasks);
+  xfree(ptr);
+}
+
+static size_t SchedulerGroup_size(const void *ptr) {
+  return sizeof(SchedulerGroup_t);
+}
+
+static const rb_data_type_t SchedulerGroup_type = {
+  "SchedulerGroup",
+  {SchedulerGroup_mark, SchedulerGroup_free, SchedulerGroup_size,},
+  0, 0, 0
+};
+
+static VALUE SchedulerGroup_allocate(VALUE klass) {
+  SchedulerGroup_t *group;
+
+  group = ALLOC(SchedulerGroup_t);
+  ring_buffer_init(&group->tasks);
+  group->backends = Qnil;
+  group->next_wakeup = 0;
+  return TypedData_Wrap_Struct(klass, &SchedulerGroup_type, group);
+}
+
+#define GetSchedulerGroup(obj, group) \
+  TypedData_Get_Struct((obj), SchedulerGroup_t, &SchedulerGroup_type, (group))
+
+static VALUE SchedulerGroup_setup(VALUE self) {
+  SchedulerGroup_t *group;
+  GetSchedulerGroup(self, group);
+
+  group->backends = rb_ary_new();
+  return self;
+}
+
+static VALUE SchedulerGroup_add_backend(VALUE self, VALUE backend) {
+  SchedulerGroup_t *group;
+  GetSchedulerGroup(self, group);
+
+  rb_ary_push(group->backends, backend);
+  return self;
+}
+
+static VALUE SchedulerGroup_remove_backend(VALUE self, VALUE backend) {
+  SchedulerGroup_t *group;
+  GetSchedulerGroup(self, group);
+
+  rb_ary_delete(group->backends, backend);
+  return self;
+}
+
+// Wakes up one idle backend in the group, trying backends in round-robin
+// order. If no backend is idle, the task will be picked up by the first
+// backend to run out of runnable fibers.
+static void SchedulerGroup_wakeup_idle_backend(SchedulerGroup_t *group) {
+  long len = RARRAY_LEN(group->backends);
+  for (long i = 0; i < len; i++) {
+    VALUE backend = RARRAY_AREF(group->backends, (group->next_wakeup + i) % len);
+    if (Backend_wakeup(backend) == Qtrue) {
+      group->next_wakeup = (group->next_wakeup + i + 1) % len;
+      return;
+    }
+  }
+}
+
+VALUE SchedulerGroup_push(VALUE self, VALUE task) {
+  SchedulerGroup_t *group;
+  GetSchedulerGroup(self, group);
+
+  ring_buffer_push(&group->tasks, task);
+  SchedulerGroup_wakeup_idle_backend(group);
+  return self;
+}
+
+VALUE SchedulerGroup_pending_count(VALUE self) {
+  SchedulerGroup_t *group;
+  GetSchedulerGroup(self, group);
+
+  return INT2NUM(group->tasks.count);
+}
+
+// Takes a task from the group, and spins a fiber for it on the current
+// thread. Returns true if a task was taken.
+int SchedulerGroup_run_task(VALUE self) {
+  SchedulerGroup_t *group;
+  GetSchedulerGroup(self, group);
+  if (ring_buffer_empty_p(&group->tasks)) return 0;
+
+  VALUE task = ring_buffer_shift(&group->tasks);
+  // hand remaining tasks over to another idle backend
+  if (!ring_buffer_empty_p(&group->tasks)) SchedulerGroup_wakeup_idle_backend(group);
+  VALUE main_fiber = rb_ivar_get(rb_thread_current(), ID_ivar_main_fiber);
+  rb_funcall_with_block(main_fiber, ID_spin, 0, 0, task);
+  RB_GC_GUARD(task);
+  return 1;
+}
+
+void Init_SchedulerGroup() {
+  cSchedulerGroup = rb_define_class_under(mPolyphony, "SchedulerGroup", rb_cObject);
+  rb_define_alloc_func(cSchedulerGroup, SchedulerGroup_allocate);
+
+  rb_define_method(cSchedulerGroup, "push", SchedulerGroup_push, 1);
+  rb_define_method(cSchedulerGroup, "pending_count", SchedulerGroup_pending_count, 0);
+  rb_define_private_method(cSchedulerGroup, "setup", SchedulerGroup_setup, 0);
+  rb_define_private_method(cSchedulerGroup, "add_backend", SchedulerGroup_add_backend, 1);
+  rb_define_private_method(cSchedulerGroup, "remove_backend", SchedulerGroup_remove_backend, 1);
+
+  ID_spin = rb_intern("spin");
+}
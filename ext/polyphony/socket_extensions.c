@@ -1,10 +1,34 @@
 #include "polyphony.h"
+#include "backend_common.h"
+#include "ruby/io.h"
 
+#ifdef HAVE_LINUX_TLS_H
+#include <sys/socket.h>
+#include <linux/tls.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#endif
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <linux/filter.h>
+#endif
+
+// Writes to a corked socket are buffered (see cork.c)
 VALUE Socket_send(VALUE self, VALUE msg, VALUE flags) {
+  if (NUM2INT(flags) == 0) {
+    long written = socket_cork_write(self, 1, &msg);
+    if (written >= 0) return LONG2NUM(written);
+  }
   return Backend_send(BACKEND(), self, msg, flags);
 }
 
 VALUE Socket_write(int argc, VALUE *argv, VALUE self) {
+  long written = socket_cork_write(self, argc, argv);
+  if (written >= 0) return LONG2NUM(written);
+
   VALUE ary = rb_ary_new_from_values(argc, argv);
   VALUE result = Backend_sendv(BACKEND(), self, ary, INT2NUM(0));
   RB_GC_GUARD(ary);
@@ -12,22 +36,107 @@ VALUE Socket_write(int argc, VALUE *argv, VALUE self) {
 }
 
 VALUE Socket_double_chevron(VALUE self, VALUE msg) {
-  Backend_send(BACKEND(), self, msg, INT2NUM(0));
+  if (socket_cork_write(self, 1, &msg) < 0)
+    Backend_send(BACKEND(), self, msg, INT2NUM(0));
+  return self;
+}
+
+// Returns true if kernel TLS offload is configured on the socket for the given
+// direction (TLS_TX or TLS_RX). Offload is set up by OpenSSL once the handshake
+// is done, if enabled with SSL_OP_ENABLE_KTLS and supported by the kernel.
+#ifdef HAVE_LINUX_TLS_H
+static VALUE socket_ktls_p(VALUE self, int optname) {
+  rb_io_t *fptr;
+  struct tls12_crypto_info_aes_gcm_256 crypto_info;
+  socklen_t len = sizeof(crypto_info);
+
+  VALUE underlying_io = rb_ivar_get(self, ID_ivar_io);
+  if (underlying_io != Qnil) self = underlying_io;
+  GetOpenFile(self, fptr);
+  return getsockopt(fptr->fd, SOL_TLS, optname, &crypto_info, &len) ? Qfalse : Qtrue;
+}
+
+VALUE Socket_ktls_tx_p(VALUE self) {
+  return socket_ktls_p(self, TLS_TX);
+}
+
+VALUE Socket_ktls_rx_p(VALUE self) {
+  return socket_ktls_p(self, TLS_RX);
+}
+#else
+VALUE Socket_ktls_tx_p(VALUE self) {
+  return Qfalse;
+}
+
+VALUE Socket_ktls_rx_p(VALUE self) {
+  return Qfalse;
+}
+#endif
+
+// Puts the socket in non-blocking mode, as required by OpenSSL non-blocking
+// calls. The backend switches the socket back to the mode it uses on its next
+// operation on the socket.
+VALUE Socket_nonblock_mode(VALUE self) {
+  rb_io_t *fptr;
+  VALUE underlying_io = rb_ivar_get(self, ID_ivar_io);
+  if (underlying_io != Qnil) self = underlying_io;
+  GetOpenFile(self, fptr);
+  io_verify_blocking_mode(fptr, self, Qfalse);
+  return self;
+}
+
+// Attaches a classic BPF program to the SO_REUSEPORT group of the socket,
+// which selects the socket at index (cpu % group_size) for each incoming
+// connection, the cpu being the one the connection was received on. Sockets
+// are indexed in the order in which they started listening.
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+VALUE Socket_attach_reuse_port_cpu_filter(VALUE self, VALUE group_size) {
+  rb_io_t *fptr;
+  unsigned int size = NUM2UINT(group_size);
+  if (!size) rb_raise(rb_eArgError, "group size must be positive");
+
+  struct sock_filter code[] = {
+    { BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+    { BPF_ALU | BPF_MOD | BPF_K, 0, 0, size },
+    { BPF_RET | BPF_A, 0, 0, 0 }
+  };
+  struct sock_fprog prog = { .len = sizeof(code) / sizeof(code[0]), .filter = code };
+
+  VALUE underlying_io = rb_ivar_get(self, ID_ivar_io);
+  if (underlying_io != Qnil) self = underlying_io;
+  GetOpenFile(self, fptr);
+  if (setsockopt(fptr->fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)))
+    rb_syserr_fail(errno, strerror(errno));
   return self;
 }
+#else
+VALUE Socket_attach_reuse_port_cpu_filter(VALUE self, VALUE group_size) {
+  rb_raise(rb_eNotImpError, "SO_ATTACH_REUSEPORT_CBPF is not supported on this platform");
+}
+#endif
 
 void Init_SocketExtensions() {
   rb_require("socket");
 
+  VALUE cBasicSocket = rb_const_get(rb_cObject, rb_intern("BasicSocket"));
   VALUE cSocket = rb_const_get(rb_cObject, rb_intern("Socket"));
   VALUE cTCPSocket = rb_const_get(rb_cObject, rb_intern("TCPSocket"));
+  VALUE cUNIXSocket = rb_const_get(rb_cObject, rb_intern("UNIXSocket"));
 
   rb_define_method(cSocket, "send", Socket_send, 2);
   rb_define_method(cTCPSocket, "send", Socket_send, 2);
+  rb_define_method(cUNIXSocket, "send", Socket_send, 2);
 
   rb_define_method(cSocket, "write", Socket_write, -1);
   rb_define_method(cTCPSocket, "write", Socket_write, -1);
+  rb_define_method(cUNIXSocket, "write", Socket_write, -1);
 
   rb_define_method(cSocket, "<<", Socket_double_chevron, 1);
   rb_define_method(cTCPSocket, "<<", Socket_double_chevron, 1);
+  rb_define_method(cUNIXSocket, "<<", Socket_double_chevron, 1);
+
+  rb_define_method(cBasicSocket, "ktls_tx?", Socket_ktls_tx_p, 0);
+  rb_define_method(cBasicSocket, "ktls_rx?", Socket_ktls_rx_p, 0);
+  rb_define_method(cBasicSocket, "nonblock_mode!", Socket_nonblock_mode, 0);
+  rb_define_method(cBasicSocket, "attach_reuse_port_cpu_filter", Socket_attach_reuse_port_cpu_filter, 1);
 }
@@ -8,6 +8,8 @@ ID ID_ivar_main_fiber;
 ID ID_ivar_terminated;
 ID ID_stop;
 
+unsigned int thread_backend_generation = 0;
+
 static VALUE Thread_setup_fiber_scheduling(VALUE self) {
   rb_ivar_set(self, ID_ivar_main_fiber, rb_fiber_current());
   return self;
@@ -52,6 +54,12 @@ VALUE Thread_debug(VALUE self) {
   return self;
 }
 
+VALUE Thread_set_backend(VALUE self, VALUE backend) {
+  rb_ivar_set(self, ID_ivar_backend, backend);
+  thread_backend_generation++;
+  return backend;
+}
+
 VALUE Thread_class_backend(VALUE _self) {
   return rb_ivar_get(rb_thread_current(), ID_ivar_backend);
 }
@@ -61,6 +69,7 @@ void Init_Thread() {
   rb_define_method(rb_cThread, "schedule_and_wakeup", Thread_fiber_schedule_and_wakeup, 2);
   rb_define_method(rb_cThread, "switch_fiber", Thread_switch_fiber, 0);
   rb_define_method(rb_cThread, "fiber_unschedule", Thread_fiber_unschedule, 1);
+  rb_define_method(rb_cThread, "backend=", Thread_set_backend, 1);
 
   rb_define_singleton_method(rb_cThread, "backend", Thread_class_backend, 0);
 
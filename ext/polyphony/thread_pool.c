@@ -0,0 +1,612 @@
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <time.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include "polyphony.h"
+#include "backend_common.h"
+#include "thread_pool.h"
+#include "ruby/thread.h"
+#ifdef POLYPHONY_ZLIB
+#include <zlib.h>
+#endif
+
+// A pool of native (non-Ruby) worker threads used for running blocking
+// operations. Completed jobs are handed back to the backend of the submitting
+// thread, and are reaped when it polls the completion fd (see
+// backend_base_drain_completions), instead of each completion going through
+// the cross-thread fiber scheduling path.
+
+typedef struct thread_pool {
+  pthread_mutex_t   lock;
+  pthread_cond_t    cond;
+  thread_pool_job_t *head;
+  thread_pool_job_t *tail;
+  pthread_t         *threads;
+  unsigned int      size;
+  unsigned int      pending;
+  int               stopping;
+  pid_t             pid;
+} ThreadPool_t;
+
+VALUE cNativeThreadPool = Qnil;
+VALUE default_pool = Qnil;
+
+// Pools with running worker threads are kept here, so they are not garbage
+// collected while their threads are running. They are stopped either
+// explicitly, using NativeThreadPool#stop, or at exit, so worker threads are
+// never joined in a GC free function.
+static VALUE running_pools = Qnil;
+
+static void ThreadPool_free(void *ptr) {
+  ThreadPool_t *pool = ptr;
+  // in a forked child, the lock and cond might still be in use by the
+  // parent's (now nonexistent) threads, and destroying them might block
+  int forked = pool->threads && pool->pid != getpid();
+  // worker threads still using the pool (which should not happen) are left
+  // alone, and the pool is leaked
+  if (pool->threads && !forked) return;
+
+  if (pool->threads) free(pool->threads);
+  if (!forked) {
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->cond);
+  }
+  xfree(ptr);
+}
+
+static size_t ThreadPool_size(const void *ptr) {
+  const ThreadPool_t *pool = ptr;
+  return sizeof(ThreadPool_t) + pool->size * sizeof(pthread_t);
+}
+
+static const rb_data_type_t ThreadPool_type = {
+  "NativeThreadPool",
+  {0, ThreadPool_free, ThreadPool_size,},
+  0, 0, 0
+};
+
+static VALUE ThreadPool_allocate(VALUE klass) {
+  ThreadPool_t *pool;
+
+  pool = ALLOC(ThreadPool_t);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+  pool->head = NULL;
+  pool->tail = NULL;
+  pool->threads = NULL;
+  pool->size = 0;
+  pool->pending = 0;
+  pool->stopping = 0;
+  pool->pid = 0;
+  return TypedData_Wrap_Struct(klass, &ThreadPool_type, pool);
+}
+
+#define GetThreadPool(obj, pool) \
+  TypedData_Get_Struct((obj), ThreadPool_t, &ThreadPool_type, (pool))
+
+static VALUE ThreadPool_initialize(int argc, VALUE *argv, VALUE self) {
+  ThreadPool_t *pool;
+  VALUE size;
+  GetThreadPool(self, pool);
+
+  rb_scan_args(argc, argv, "01", &size);
+  if (size == Qnil)
+    pool->size = sysconf(_SC_NPROCESSORS_ONLN);
+  else {
+    int value = NUM2INT(size);
+    if (value <= 0) rb_raise(rb_eArgError, "pool size must be positive");
+    pool->size = value;
+  }
+  return self;
+}
+
+static void *ThreadPool_worker(void *ptr) {
+  ThreadPool_t *pool = ptr;
+  thread_pool_job_t *job;
+
+  while (1) {
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->head && !pool->stopping) pthread_cond_wait(&pool->cond, &pool->lock);
+    job = pool->head;
+    if (!job) {
+      pthread_mutex_unlock(&pool->lock);
+      return NULL;
+    }
+    pool->head = job->next;
+    if (!pool->head) pool->tail = NULL;
+    pthread_mutex_unlock(&pool->lock);
+
+    job->run(job->data);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->pending--;
+    pthread_mutex_unlock(&pool->lock);
+
+    // the job may be freed as soon as it is handed back
+    thread_pool_job_push_completion(job);
+  }
+}
+
+// Worker threads are started lazily, and restarted in a forked child process,
+// where they do not exist anymore.
+static void ThreadPool_start_threads(VALUE self, ThreadPool_t *pool) {
+  pid_t pid = getpid();
+  if (pool->threads && pool->pid == pid) return;
+
+  if (!pool->threads) rb_ary_push(running_pools, self);
+  else {
+    // forked: the parent's threads and queued jobs are gone
+    free(pool->threads);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    pool->head = pool->tail = NULL;
+    pool->pending = 0;
+  }
+
+  // worker threads should not receive signals meant for Ruby threads
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+
+  pool->threads = malloc(pool->size * sizeof(pthread_t));
+  if (!pool->threads) {
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    rb_ary_delete(running_pools, self);
+    rb_memerror();
+  }
+  pool->stopping = 0;
+  pool->pid = pid;
+  for (unsigned int i = 0; i < pool->size; i++) {
+    int ret = pthread_create(&pool->threads[i], NULL, ThreadPool_worker, pool);
+    if (ret) {
+      pool->size = i;
+      pthread_sigmask(SIG_SETMASK, &old, NULL);
+      if (!i) {
+        free(pool->threads);
+        pool->threads = NULL;
+        rb_ary_delete(running_pools, self);
+      }
+      rb_syserr_fail(ret, strerror(ret));
+    }
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+static void *ThreadPool_join_threads(void *ptr) {
+  ThreadPool_t *pool = ptr;
+  for (unsigned int i = 0; i < pool->size; i++) pthread_join(pool->threads[i], NULL);
+  return NULL;
+}
+
+static void ThreadPool_stop_threads(ThreadPool_t *pool) {
+  if (!pool->threads) return;
+
+  if (pool->pid == getpid()) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    rb_thread_call_without_gvl(ThreadPool_join_threads, (void *)pool, RUBY_UBF_IO, 0);
+  }
+  else {
+    // forked: the lock and cond might still be held by the parent's threads,
+    // so they are reset before the pool can be reused or freed
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    pool->head = pool->tail = NULL;
+    pool->pending = 0;
+  }
+
+  free(pool->threads);
+  pool->threads = NULL;
+}
+
+// Stops the worker threads, once all queued jobs are done. Threads are
+// started again if more jobs are submitted.
+VALUE ThreadPool_stop(VALUE self) {
+  ThreadPool_t *pool;
+  GetThreadPool(self, pool);
+
+  ThreadPool_stop_threads(pool);
+  rb_ary_delete(running_pools, self);
+  return self;
+}
+
+static void ThreadPool_stop_all(VALUE _) {
+  while (RARRAY_LEN(running_pools)) {
+    VALUE self = rb_ary_pop(running_pools);
+    ThreadPool_t *pool;
+    GetThreadPool(self, pool);
+    ThreadPool_stop_threads(pool);
+  }
+}
+
+VALUE ThreadPool_size_m(VALUE self) {
+  ThreadPool_t *pool;
+  GetThreadPool(self, pool);
+
+  return INT2NUM(pool->size);
+}
+
+VALUE ThreadPool_pending_count(VALUE self) {
+  ThreadPool_t *pool;
+  GetThreadPool(self, pool);
+
+  pthread_mutex_lock(&pool->lock);
+  unsigned int pending = pool->pending;
+  pthread_mutex_unlock(&pool->lock);
+  return INT2NUM(pending);
+}
+
+VALUE ThreadPool_busy_p(VALUE self) {
+  return ThreadPool_pending_count(self) == INT2FIX(0) ? Qfalse : Qtrue;
+}
+
+VALUE ThreadPool_default(VALUE self) {
+  if (default_pool == Qnil) {
+    default_pool = rb_funcall(cNativeThreadPool, ID_new, 0);
+    rb_global_variable(&default_pool);
+  }
+  return default_pool;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+thread_pool_job_t *thread_pool_job_new(void (*run)(void *), size_t size) {
+  thread_pool_job_t *job = malloc(sizeof(thread_pool_job_t) + size);
+  if (!job) rb_memerror();
+  job->next = NULL;
+  job->run = run;
+  job->cleanup = NULL;
+  job->base = NULL;
+  job->completions = NULL;
+  job->fiber = Qnil;
+  job->completed = 0;
+  job->abandoned = 0;
+  return job;
+}
+
+void thread_pool_job_free(thread_pool_job_t *job) {
+  if (job->cleanup) job->cleanup(job->data);
+  free(job);
+}
+
+static VALUE thread_pool_job_await(VALUE arg) {
+  thread_pool_job_t *job = (thread_pool_job_t *)arg;
+
+  while (!job->completed) {
+    job->base->op_count++;
+    VALUE resume_value = backend_await(job->base);
+    RAISE_IF_EXCEPTION(resume_value);
+    RB_GC_GUARD(resume_value);
+  }
+  return Qnil;
+}
+
+// If the waiting fiber was interrupted, the job is freed once done.
+static VALUE thread_pool_job_ensure(VALUE arg) {
+  thread_pool_job_t *job = (thread_pool_job_t *)arg;
+  if (!job->completed) job->abandoned = 1;
+  return Qnil;
+}
+
+void thread_pool_run(VALUE self, thread_pool_job_t *job) {
+  ThreadPool_t *pool;
+  if (self == Qnil) self = ThreadPool_default(cNativeThreadPool);
+  GetThreadPool(self, pool);
+  ThreadPool_start_threads(self, pool);
+
+  job->fiber = rb_fiber_current();
+  Backend_watch_thread_pool_job(rb_ivar_get(rb_thread_current(), ID_ivar_backend), job);
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->tail)
+    pool->tail->next = job;
+  else
+    pool->head = job;
+  pool->tail = job;
+  pool->pending++;
+  pthread_cond_signal(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  rb_ensure(thread_pool_job_await, (VALUE)job, thread_pool_job_ensure, (VALUE)job);
+  RB_GC_GUARD(self);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+struct sleep_job {
+  double duration;
+};
+
+static void sleep_job_run(void *ptr) {
+  struct sleep_job *data = ptr;
+  struct timespec ts;
+  ts.tv_sec = (time_t)data->duration;
+  ts.tv_nsec = (long)((data->duration - ts.tv_sec) * 1e9);
+  while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+}
+
+VALUE ThreadPool_sleep(VALUE self, VALUE duration) {
+  thread_pool_job_t *job = thread_pool_job_new(sleep_job_run, sizeof(struct sleep_job));
+  ((struct sleep_job *)job->data)->duration = NUM2DBL(duration);
+
+  thread_pool_run(self, job);
+  thread_pool_job_free(job);
+  return self;
+}
+
+struct stat_job {
+  struct stat st;
+  int error;
+  char path[];
+};
+
+static void stat_job_run(void *ptr) {
+  struct stat_job *data = ptr;
+  data->error = stat(data->path, &data->st) ? errno : 0;
+}
+
+// Creates a job with the given path (or host name) copied to the given offset
+// in the job's data. The path should already be coerced to a string.
+static thread_pool_job_t *path_job_new(void (*run)(void *), size_t offset, VALUE path) {
+  long len = RSTRING_LEN(path);
+  thread_pool_job_t *job = thread_pool_job_new(run, offset + len + 1);
+  char *dest = job->data + offset;
+  memcpy(dest, RSTRING_PTR(path), len);
+  dest[len] = 0;
+  return job;
+}
+
+VALUE ThreadPool_stat(VALUE self, VALUE path) {
+  FilePathValue(path);
+  thread_pool_job_t *job = path_job_new(stat_job_run, offsetof(struct stat_job, path), path);
+  struct stat_job *data = (struct stat_job *)job->data;
+
+  thread_pool_run(self, job);
+  int error = data->error;
+  struct stat st = data->st;
+  thread_pool_job_free(job);
+
+  if (error) rb_syserr_fail_str(error, path);
+  return rb_stat_new(&st);
+}
+
+struct read_file_job {
+  char *buffer;
+  size_t len;
+  int error;
+  char path[];
+};
+
+static void read_file_job_run(void *ptr) {
+  struct read_file_job *data = ptr;
+  struct stat st;
+  size_t capacity;
+  ssize_t n;
+
+  int fd = open(data->path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) goto error;
+  capacity = (!fstat(fd, &st) && st.st_size > 0) ? st.st_size + 1 : 4096;
+  data->buffer = malloc(capacity);
+  data->len = 0;
+  if (!data->buffer) goto nomem;
+
+  while (1) {
+    if (data->len == capacity) {
+      char *buffer = realloc(data->buffer, capacity * 2);
+      if (!buffer) goto nomem;
+      data->buffer = buffer;
+      capacity *= 2;
+    }
+    n = read(fd, data->buffer + data->len, capacity - data->len);
+    if (n == 0) break;
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      close(fd);
+      goto error;
+    }
+    data->len += n;
+  }
+  close(fd);
+  data->error = 0;
+  return;
+nomem:
+  // the buffer, if any, is freed on cleanup
+  close(fd);
+  data->error = ENOMEM;
+  return;
+error:
+  data->error = errno;
+}
+
+static void read_file_job_cleanup(void *ptr) {
+  struct read_file_job *data = ptr;
+  if (data->buffer) free(data->buffer);
+}
+
+VALUE ThreadPool_read_file(VALUE self, VALUE path) {
+  FilePathValue(path);
+  thread_pool_job_t *job = path_job_new(read_file_job_run, offsetof(struct read_file_job, path), path);
+  struct read_file_job *data = (struct read_file_job *)job->data;
+  data->buffer = NULL;
+  job->cleanup = read_file_job_cleanup;
+
+  thread_pool_run(self, job);
+  int error = data->error;
+  VALUE str = error ? Qnil : rb_str_new(data->buffer, data->len);
+  thread_pool_job_free(job);
+
+  if (error == ENOMEM) rb_memerror();
+  if (error) rb_syserr_fail_str(error, path);
+  return str;
+}
+
+struct fsync_job {
+  int fd;
+  int error;
+};
+
+static void fsync_job_run(void *ptr) {
+  struct fsync_job *data = ptr;
+  data->error = fsync(data->fd) ? errno : 0;
+}
+
+VALUE ThreadPool_fsync(VALUE self, VALUE io) {
+  rb_io_t *fptr;
+  VALUE underlying_io = rb_ivar_get(io, ID_ivar_io);
+  if (underlying_io != Qnil) io = underlying_io;
+  GetOpenFile(io, fptr);
+  rb_io_flush(io);
+
+  thread_pool_job_t *job = thread_pool_job_new(fsync_job_run, sizeof(struct fsync_job));
+  struct fsync_job *data = (struct fsync_job *)job->data;
+  data->fd = fptr->fd;
+
+  thread_pool_run(self, job);
+  int error = data->error;
+  thread_pool_job_free(job);
+
+  if (error) rb_syserr_fail(error, strerror(error));
+  return self;
+}
+
+struct getaddrinfo_job {
+  struct addrinfo *result;
+  int error;
+  char host[];
+};
+
+static void getaddrinfo_job_run(void *ptr) {
+  struct getaddrinfo_job *data = ptr;
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  data->error = getaddrinfo(data->host, NULL, &hints, &data->result);
+}
+
+static void getaddrinfo_job_cleanup(void *ptr) {
+  struct getaddrinfo_job *data = ptr;
+  if (data->result) freeaddrinfo(data->result);
+}
+
+static VALUE getaddrinfo_job_addresses(VALUE arg) {
+  struct getaddrinfo_job *data = (struct getaddrinfo_job *)((thread_pool_job_t *)arg)->data;
+  if (data->error)
+    rb_raise(rb_const_get(rb_cObject, rb_intern("SocketError")), "%s", gai_strerror(data->error));
+
+  VALUE addresses = rb_ary_new();
+  char buf[NI_MAXHOST];
+  for (struct addrinfo *ai = data->result; ai; ai = ai->ai_next) {
+    if (getnameinfo(ai->ai_addr, ai->ai_addrlen, buf, sizeof(buf), NULL, 0, NI_NUMERICHOST)) continue;
+    VALUE address = rb_str_new_cstr(buf);
+    if (!RTEST(rb_ary_includes(addresses, address))) rb_ary_push(addresses, address);
+  }
+  return addresses;
+}
+
+static VALUE thread_pool_job_free_ensure(VALUE arg) {
+  thread_pool_job_free((thread_pool_job_t *)arg);
+  return Qnil;
+}
+
+// Resolves the given host name, returning an array of addresses.
+VALUE ThreadPool_getaddrinfo(VALUE self, VALUE host) {
+  StringValueCStr(host);
+  thread_pool_job_t *job = path_job_new(getaddrinfo_job_run, offsetof(struct getaddrinfo_job, host), host);
+  struct getaddrinfo_job *data = (struct getaddrinfo_job *)job->data;
+  data->result = NULL;
+  job->cleanup = getaddrinfo_job_cleanup;
+
+  thread_pool_run(self, job);
+  // the job is freed even if an exception is raised while building the result
+  return rb_ensure(getaddrinfo_job_addresses, (VALUE)job, thread_pool_job_free_ensure, (VALUE)job);
+}
+
+#ifdef POLYPHONY_ZLIB
+struct deflate_job {
+  int level;
+  int error;
+  Bytef *output;
+  uLongf output_len;
+  uLong input_len;
+  Bytef input[];
+};
+
+static void deflate_job_run(void *ptr) {
+  struct deflate_job *data = ptr;
+  data->output_len = compressBound(data->input_len);
+  data->output = malloc(data->output_len);
+  data->error = data->output ?
+    compress2(data->output, &data->output_len, data->input, data->input_len, data->level) :
+    Z_MEM_ERROR;
+}
+
+static void deflate_job_cleanup(void *ptr) {
+  struct deflate_job *data = ptr;
+  if (data->output) free(data->output);
+}
+
+// Compresses the given string in the zlib format (as Zlib::Deflate.deflate),
+// with an optional compression level.
+VALUE ThreadPool_deflate(int argc, VALUE *argv, VALUE self) {
+  VALUE str;
+  VALUE level;
+  rb_scan_args(argc, argv, "11", &str, &level);
+  StringValue(str);
+
+  long len = RSTRING_LEN(str);
+  thread_pool_job_t *job = thread_pool_job_new(deflate_job_run, sizeof(struct deflate_job) + len);
+  struct deflate_job *data = (struct deflate_job *)job->data;
+  data->level = NIL_P(level) ? Z_DEFAULT_COMPRESSION : NUM2INT(level);
+  data->output = NULL;
+  data->input_len = len;
+  memcpy(data->input, RSTRING_PTR(str), len);
+  job->cleanup = deflate_job_cleanup;
+
+  thread_pool_run(self, job);
+  int error = data->error;
+  VALUE compressed = error ? Qnil : rb_str_new((char *)data->output, data->output_len);
+  thread_pool_job_free(job);
+
+  if (error == Z_MEM_ERROR) rb_memerror();
+  if (error == Z_STREAM_ERROR) rb_raise(rb_eArgError, "invalid compression level");
+  if (error) rb_raise(rb_eRuntimeError, "deflate failed (%d)", error);
+  return compressed;
+}
+#endif
+
+void Init_NativeThreadPool() {
+  cNativeThreadPool = rb_define_class_under(mPolyphony, "NativeThreadPool", rb_cObject);
+  rb_define_alloc_func(cNativeThreadPool, ThreadPool_allocate);
+
+  running_pools = rb_ary_new();
+  rb_global_variable(&running_pools);
+  rb_set_end_proc(ThreadPool_stop_all, Qnil);
+
+  rb_define_singleton_method(cNativeThreadPool, "default", ThreadPool_default, 0);
+
+  rb_define_method(cNativeThreadPool, "initialize", ThreadPool_initialize, -1);
+  rb_define_method(cNativeThreadPool, "size", ThreadPool_size_m, 0);
+  rb_define_method(cNativeThreadPool, "pending_count", ThreadPool_pending_count, 0);
+  rb_define_method(cNativeThreadPool, "busy?", ThreadPool_busy_p, 0);
+  rb_define_method(cNativeThreadPool, "stop", ThreadPool_stop, 0);
+
+  rb_define_method(cNativeThreadPool, "sleep", ThreadPool_sleep, 1);
+  rb_define_method(cNativeThreadPool, "stat", ThreadPool_stat, 1);
+  rb_define_method(cNativeThreadPool, "read_file", ThreadPool_read_file, 1);
+  rb_define_method(cNativeThreadPool, "fsync", ThreadPool_fsync, 1);
+  rb_define_method(cNativeThreadPool, "getaddrinfo", ThreadPool_getaddrinfo, 1);
+#ifdef POLYPHONY_ZLIB
+  rb_define_method(cNativeThreadPool, "deflate", ThreadPool_deflate, -1);
+#endif
+}
@@ -0,0 +1,51 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "ruby.h"
+
+struct Backend_base;
+struct thread_pool_job;
+
+// Completed jobs are handed back to the submitting backend through a
+// completion channel, signalled through an eventfd on Linux, or a self-pipe
+// elsewhere (in which case fd is the pipe's read end). The channel is reference
+// counted: the backend holds a reference, as does every job in flight, so a
+// job completing after its backend is freed still has a valid channel to push
+// to. The last reference frees the channel, along with any unreaped jobs.
+typedef struct backend_completions {
+  struct thread_pool_job  *head;
+  int                     fd;
+  int                     write_fd;
+  unsigned int            refcount;
+} backend_completions_t;
+
+// A job run on a native thread pool. The job's function is called on a worker
+// thread, without the GVL, and must not call any Ruby API. Once done, the job
+// is handed back to the backend of the thread that submitted it, which wakes
+// up the waiting fiber.
+typedef struct thread_pool_job {
+  struct thread_pool_job  *next;
+  void                    (*run)(void *data);
+  void                    (*cleanup)(void *data);
+  struct Backend_base     *base;
+  backend_completions_t   *completions;
+  VALUE                   fiber;
+  int                     completed;
+  int                     abandoned;
+  char                    data[];
+} thread_pool_job_t;
+
+thread_pool_job_t *thread_pool_job_new(void (*run)(void *), size_t size);
+void thread_pool_job_free(thread_pool_job_t *job);
+
+// Hands a done job back to its backend. May be called from any thread. The
+// job must not be accessed afterwards, as it might be freed at any time.
+void thread_pool_job_push_completion(thread_pool_job_t *job);
+
+// Runs the given job on the given pool (or the default pool if pool is nil),
+// blocking the current fiber until the job is done. If the fiber is
+// interrupted while waiting, the job is freed once done, and the exception is
+// propagated. Otherwise the job should be freed by the caller.
+void thread_pool_run(VALUE pool, thread_pool_job_t *job);
+
+#endif /* THREAD_POOL_H */
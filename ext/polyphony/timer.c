@@ -0,0 +1,325 @@
+#include <math.h>
+#include "polyphony.h"
+#include "ruby/st.h"
+
+// The timer is implemented as a hierarchical timing wheel. Each level has
+// TIMER_WHEEL_SLOTS slots, with each slot in level n covering
+// TIMER_WHEEL_SLOTS^n ticks. Entries are inserted into the lowest level that
+// can hold their expiration, and are cascaded down into lower levels as the
+// wheel advances. Insert, reset and cancel are all O(1).
+//
+// Timeouts may be nested. The entries of each fiber form a stack, with the
+// entries table pointing to the innermost entry, which links to the enclosing
+// one. Disarming removes the innermost entry, and resetting re-arms only the
+// innermost entry, leaving the deadlines of enclosing timeouts unchanged.
+
+#define TIMER_WHEEL_BITS    6
+#define TIMER_WHEEL_SLOTS   (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK    (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS  4
+#define TIMER_WHEEL_SPAN    (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+typedef struct timer_entry {
+  struct timer_entry  *next;
+  struct timer_entry  **pprev;
+  struct timer_entry  *outer;
+  VALUE               fiber;
+  VALUE               exception;
+  double              interval;
+  double              target_stamp;
+  unsigned long long  expires;
+  int                 recurring;
+} timer_entry_t;
+
+typedef struct timer {
+  double              resolution;
+  double              start_stamp;
+  unsigned long long  current_tick;
+  timer_entry_t       *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+  st_table            *entries;
+  timer_entry_t       *free_list;
+} Timer_t;
+
+VALUE cTimer = Qnil;
+
+static int timer_mark_entry(st_data_t key, st_data_t value, st_data_t arg) {
+  for (timer_entry_t *entry = (timer_entry_t *)value; entry; entry = entry->outer) {
+    rb_gc_mark(entry->fiber);
+    rb_gc_mark(entry->exception);
+  }
+  return ST_CONTINUE;
+}
+
+static void Timer_mark(void *ptr) {
+  Timer_t *timer = ptr;
+  if (timer->entries) st_foreach(timer->entries, timer_mark_entry, 0);
+}
+
+static int timer_free_entry(st_data_t key, st_data_t value, st_data_t arg) {
+  timer_entry_t *entry = (timer_entry_t *)value;
+  while (entry) {
+    timer_entry_t *outer = entry->outer;
+    free(entry);
+    entry = outer;
+  }
+  return ST_CONTINUE;
+}
+
+static void Timer_free(void *ptr) {
+  Timer_t *timer = ptr;
+  if (timer->entries) {
+    st_foreach(timer->entries, timer_free_entry, 0);
+    st_free_table(timer->entries);
+  }
+  while (timer->free_list) {
+    timer_entry_t *entry = timer->free_list;
+    timer->free_list = entry->next;
+    free(entry);
+  }
+  xfree(ptr);
+}
+
+static size_t Timer_size(const void *ptr) {
+  const Timer_t *timer = ptr;
+  size_t count = timer->entries ? timer->entries->num_entries : 0;
+  return sizeof(Timer_t) + count * sizeof(timer_entry_t);
+}
+
+static const rb_data_type_t Timer_type = {
+  "Timer",
+  {Timer_mark, Timer_free, Timer_size,},
+  0, 0, 0
+};
+
+static VALUE Timer_allocate(VALUE klass) {
+  Timer_t *timer;
+
+  timer = ALLOC(Timer_t);
+  memset(timer, 0, sizeof(Timer_t));
+  return TypedData_Wrap_Struct(klass, &Timer_type, timer);
+}
+
+#define GetTimer(obj, timer) \
+  TypedData_Get_Struct((obj), Timer_t, &Timer_type, (timer))
+
+static inline double timer_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline unsigned long long timer_stamp_to_tick(Timer_t *timer, double stamp) {
+  double ticks = (stamp - timer->start_stamp) / timer->resolution;
+  return ticks > 0 ? (unsigned long long)ticks : 0;
+}
+
+static inline void timer_entry_unlink(timer_entry_t *entry) {
+  if (!entry->pprev) return;
+
+  *entry->pprev = entry->next;
+  if (entry->next) entry->next->pprev = entry->pprev;
+  entry->next = NULL;
+  entry->pprev = NULL;
+}
+
+static inline void timer_entry_link(timer_entry_t **head, timer_entry_t *entry) {
+  entry->next = *head;
+  if (entry->next) entry->next->pprev = &entry->next;
+  entry->pprev = head;
+  *head = entry;
+}
+
+static void timer_wheel_insert(Timer_t *timer, timer_entry_t *entry) {
+  unsigned long long delta = entry->expires - timer->current_tick;
+  unsigned long long expires = entry->expires;
+  int level = 0;
+
+  while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << (TIMER_WHEEL_BITS * (level + 1))))
+    level++;
+
+  // Entries beyond the wheel span are put in the last slot of the top level,
+  // and are reinserted once that slot is cascaded.
+  if (delta >= TIMER_WHEEL_SPAN) expires = timer->current_tick + TIMER_WHEEL_SPAN - 1;
+
+  unsigned int slot = (expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+  timer_entry_link(&timer->slots[level][slot], entry);
+}
+
+static inline void timer_entry_arm(Timer_t *timer, timer_entry_t *entry) {
+  double ticks = ceil((entry->target_stamp - timer->start_stamp) / timer->resolution);
+  entry->expires = ticks > 0 ? (unsigned long long)ticks : 0;
+  if (entry->expires <= timer->current_tick) entry->expires = timer->current_tick + 1;
+  timer_wheel_insert(timer, entry);
+}
+
+static VALUE timer_entry_make_value(VALUE exception) {
+  switch (TYPE(exception)) {
+    case T_NIL:
+      return Qnil;
+    case T_ARRAY:
+      return rb_funcall(RARRAY_AREF(exception, 0), ID_new, 1, RARRAY_AREF(exception, 1));
+    case T_CLASS:
+      return rb_funcall(exception, ID_new, 0);
+    default:
+      return rb_funcall(rb_eRuntimeError, ID_new, 1, exception);
+  }
+}
+
+// Any error raised while creating the exception is passed to the fiber
+// instead, since the wheel cannot be left in the middle of an update.
+static inline VALUE timer_entry_value(timer_entry_t *entry) {
+  int state = 0;
+  VALUE value = rb_protect(timer_entry_make_value, entry->exception, &state);
+  if (state) {
+    value = rb_errinfo();
+    rb_set_errinfo(Qnil);
+  }
+  return value;
+}
+
+static inline void timer_entry_fire(Timer_t *timer, timer_entry_t *entry, double now) {
+  timer_entry_unlink(entry);
+  VALUE fiber = entry->fiber;
+  VALUE value = timer_entry_value(entry);
+
+  if (entry->recurring) {
+    while (entry->target_stamp <= now) entry->target_stamp += entry->interval;
+    timer_entry_arm(timer, entry);
+  }
+  Fiber_make_runnable(fiber, value);
+  RB_GC_GUARD(value);
+}
+
+// Moves the given slot's entries into a local list, so entries may be safely
+// unlinked while the list is processed.
+static inline timer_entry_t *timer_slot_take(timer_entry_t **slot, timer_entry_t **list) {
+  *list = *slot;
+  *slot = NULL;
+  if (*list) (*list)->pprev = list;
+  return *list;
+}
+
+static void timer_wheel_advance(Timer_t *timer, unsigned long long target_tick, double now) {
+  if (!timer->entries || !timer->entries->num_entries) {
+    if (target_tick > timer->current_tick) timer->current_tick = target_tick;
+    return;
+  }
+
+  while (timer->current_tick < target_tick) {
+    unsigned long long tick = ++timer->current_tick;
+    timer_entry_t *list;
+
+    for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+      if (tick & ((1ULL << (TIMER_WHEEL_BITS * level)) - 1)) continue;
+
+      unsigned int slot = (tick >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+      timer_slot_take(&timer->slots[level][slot], &list);
+      while (list) {
+        timer_entry_t *entry = list;
+        timer_entry_unlink(entry);
+        timer_wheel_insert(timer, entry);
+      }
+    }
+
+    timer_slot_take(&timer->slots[0][tick & TIMER_WHEEL_MASK], &list);
+    while (list) timer_entry_fire(timer, list, now);
+  }
+}
+
+static VALUE Timer_setup(VALUE self, VALUE resolution) {
+  Timer_t *timer;
+  GetTimer(self, timer);
+
+  timer->resolution = NUM2DBL(resolution);
+  if (timer->resolution <= 0)
+    rb_raise(rb_eArgError, "resolution must be positive");
+
+  timer->start_stamp = timer_now();
+  timer->current_tick = 0;
+  timer->entries = st_init_numtable();
+  return self;
+}
+
+// Arms a timeout for the current fiber, nested in any existing one.
+static VALUE Timer_arm(VALUE self, VALUE interval, VALUE exception, VALUE recurring) {
+  Timer_t *timer;
+  timer_entry_t *entry;
+  timer_entry_t *outer = NULL;
+  VALUE fiber = rb_fiber_current();
+  GetTimer(self, timer);
+  if (!timer->entries) rb_raise(rb_eRuntimeError, "Timer is not initialized");
+
+  st_lookup(timer->entries, (st_data_t)fiber, (st_data_t *)&outer);
+  if (timer->free_list) {
+    entry = timer->free_list;
+    timer->free_list = entry->next;
+  }
+  else
+    entry = malloc(sizeof(timer_entry_t));
+  entry->next = NULL;
+  entry->pprev = NULL;
+  entry->outer = outer;
+  entry->fiber = fiber;
+  st_insert(timer->entries, (st_data_t)fiber, (st_data_t)entry);
+
+  entry->exception = exception;
+  entry->interval = NUM2DBL(interval);
+  entry->target_stamp = timer_now() + entry->interval;
+  entry->recurring = RTEST(recurring);
+  timer_entry_arm(timer, entry);
+  return self;
+}
+
+// Disarms the current fiber's innermost timeout.
+static VALUE Timer_disarm(VALUE self) {
+  Timer_t *timer;
+  timer_entry_t *entry;
+  st_data_t key = (st_data_t)rb_fiber_current();
+  GetTimer(self, timer);
+
+  if (!timer->entries || !st_lookup(timer->entries, key, (st_data_t *)&entry)) return self;
+
+  if (entry->outer)
+    st_insert(timer->entries, key, (st_data_t)entry->outer);
+  else
+    st_delete(timer->entries, &key, NULL);
+  timer_entry_unlink(entry);
+  entry->next = timer->free_list;
+  timer->free_list = entry;
+  return self;
+}
+
+// Re-arms the current fiber's innermost timeout.
+VALUE Timer_reset(VALUE self) {
+  Timer_t *timer;
+  timer_entry_t *entry;
+  GetTimer(self, timer);
+
+  if (!timer->entries || !st_lookup(timer->entries, (st_data_t)rb_fiber_current(), (st_data_t *)&entry))
+    return Qnil;
+
+  timer_entry_unlink(entry);
+  entry->target_stamp = timer_now() + entry->interval;
+  timer_entry_arm(timer, entry);
+  return self;
+}
+
+static VALUE Timer_update(VALUE self) {
+  Timer_t *timer;
+  GetTimer(self, timer);
+
+  double now = timer_now();
+  timer_wheel_advance(timer, timer_stamp_to_tick(timer, now), now);
+  return self;
+}
+
+void Init_Timer() {
+  cTimer = rb_define_class_under(mPolyphony, "Timer", rb_cObject);
+  rb_define_alloc_func(cTimer, Timer_allocate);
+
+  rb_define_method(cTimer, "reset", Timer_reset, 0);
+  rb_define_private_method(cTimer, "setup", Timer_setup, 1);
+  rb_define_private_method(cTimer, "arm", Timer_arm, 3);
+  rb_define_private_method(cTimer, "disarm", Timer_disarm, 0);
+  rb_define_private_method(cTimer, "update", Timer_update, 0);
+}
@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <string.h>
+#include "polyphony.h"
+#include "backend_common.h"
+#include "trace_ring.h"
+
+// Native tracing: trace records are written into a per-backend ring buffer,
+// without calling into Ruby or allocating any objects. Records are drained in
+// batches, either as arrays, or as a binary string of packed records that can
+// be written to a file and later unpacked with TRACE_RECORD_FORMAT.
+
+#define TRACE_RECORD_FORMAT "Q2S2l5"
+
+static VALUE SYM_trace_events[TRACE_EVENT_COUNT];
+static VALUE SYM_trace_op_types[OP_TYPE_COUNT];
+
+static const char *trace_event_names[TRACE_EVENT_COUNT] = {
+  "fiber_switchpoint", "fiber_run", "fiber_schedule", "poll_enter",
+  "poll_leave", "op_submit", "op_complete", "watchdog"
+};
+
+static trace_ring_t *trace_ring_new(unsigned int size) {
+  unsigned int capacity = 1;
+  while (capacity < size) capacity <<= 1;
+
+  trace_ring_t *ring = malloc(sizeof(trace_ring_t));
+  ring->records = malloc(sizeof(trace_record_t) * capacity);
+  ring->mask = capacity - 1;
+  ring->head = 0;
+  ring->tail = 0;
+  ring->dropped = 0;
+  return ring;
+}
+
+void trace_ring_free(trace_ring_t *ring) {
+  free(ring->records);
+  free(ring);
+}
+
+inline void trace_ring_push(trace_ring_t *ring, enum trace_event event, VALUE fiber, int op_type, int op_id, int fd, int length, int result) {
+  if (ring->tail - ring->head > ring->mask) {
+    ring->head++;
+    ring->dropped++;
+  }
+
+  trace_record_t *record = ring->records + (ring->tail++ & ring->mask);
+  record->time = current_time_ns();
+  record->fiber = fiber;
+  record->event = event;
+  record->op_type = op_type;
+  record->op_id = op_id;
+  record->fd = fd;
+  record->length = length;
+  record->result = result;
+  record->reserved = 0;
+}
+
+static inline struct Backend_base *trace_ring_backend_base(VALUE self) {
+  return (struct Backend_base *)RTYPEDDATA_DATA(self);
+}
+
+static inline uint64_t trace_ring_drain_count(trace_ring_t *ring, int argc, VALUE *argv) {
+  VALUE max = Qnil;
+  rb_scan_args(argc, argv, "01", &max);
+
+  uint64_t count = ring->tail - ring->head;
+  if (max != Qnil && NUM2ULL(max) < count) count = NUM2ULL(max);
+  return count;
+}
+
+// Enables tracing into a ring buffer of the given capacity (rounded up to a
+// power of 2). Setting to nil disables tracing and discards any records.
+VALUE Backend_trace_ring_set(VALUE self, VALUE size) {
+  struct Backend_base *base = trace_ring_backend_base(self);
+
+  if (base->trace_ring) {
+    trace_ring_free(base->trace_ring);
+    base->trace_ring = NULL;
+  }
+  if (RTEST(size)) {
+    int capacity = NUM2INT(size);
+    if (capacity <= 0) rb_raise(rb_eArgError, "invalid trace ring size");
+    base->trace_ring = trace_ring_new(capacity);
+  }
+  return self;
+}
+
+// Removes up to max records from the trace ring, returning them as an array
+// of [time, event, fiber_id, op_type, op_id, fd, length, result] arrays.
+VALUE Backend_trace_ring_drain(int argc, VALUE *argv, VALUE self) {
+  trace_ring_t *ring = trace_ring_backend_base(self)->trace_ring;
+  if (!ring) return rb_ary_new();
+
+  uint64_t count = trace_ring_drain_count(ring, argc, argv);
+  VALUE records = rb_ary_new_capa(count);
+  for (uint64_t i = 0; i < count; i++) {
+    trace_record_t *record = ring->records + (ring->head++ & ring->mask);
+    VALUE values[8] = {
+      DBL2NUM((double)record->time / 1e9),
+      SYM_trace_events[record->event],
+      ULL2NUM(record->fiber),
+      record->op_type ? SYM_trace_op_types[record->op_type] : Qnil,
+      INT2NUM(record->op_id),
+      INT2NUM(record->fd),
+      INT2NUM(record->length),
+      INT2NUM(record->result)
+    };
+    rb_ary_push(records, rb_ary_new_from_values(8, values));
+  }
+  RB_GC_GUARD(records);
+  return records;
+}
+
+// Removes up to max records from the trace ring, returning them packed in a
+// binary string. Each record can be unpacked using TRACE_RECORD_FORMAT, and
+// event and op types are indexes into TRACE_EVENTS and OP_TYPES.
+VALUE Backend_trace_ring_dump(int argc, VALUE *argv, VALUE self) {
+  trace_ring_t *ring = trace_ring_backend_base(self)->trace_ring;
+  if (!ring) return rb_str_new(0, 0);
+
+  uint64_t count = trace_ring_drain_count(ring, argc, argv);
+  VALUE str = rb_str_new(0, count * sizeof(trace_record_t));
+  char *ptr = RSTRING_PTR(str);
+  while (count) {
+    // copy contiguous records up to the end of the ring
+    uint64_t index = ring->head & ring->mask;
+    uint64_t chunk = ring->mask + 1 - index;
+    if (chunk > count) chunk = count;
+    memcpy(ptr, ring->records + index, chunk * sizeof(trace_record_t));
+    ptr += chunk * sizeof(trace_record_t);
+    ring->head += chunk;
+    count -= chunk;
+  }
+  return str;
+}
+
+// Returns the number of records overwritten before being drained.
+VALUE Backend_trace_ring_dropped(VALUE self) {
+  trace_ring_t *ring = trace_ring_backend_base(self)->trace_ring;
+  return ring ? ULL2NUM(ring->dropped) : INT2NUM(0);
+}
+
+void Init_TraceRing(VALUE cBackend) {
+  VALUE events = rb_ary_new();
+  for (int i = 0; i < TRACE_EVENT_COUNT; i++) {
+    SYM_trace_events[i] = ID2SYM(rb_intern(trace_event_names[i]));
+    rb_global_variable(&SYM_trace_events[i]);
+    rb_ary_push(events, SYM_trace_events[i]);
+  }
+
+  VALUE op_types = rb_ary_new();
+  for (int i = 0; i < OP_TYPE_COUNT; i++) {
+    SYM_trace_op_types[i] = ID2SYM(rb_intern(op_type_to_str(i)));
+    rb_global_variable(&SYM_trace_op_types[i]);
+    rb_ary_push(op_types, SYM_trace_op_types[i]);
+  }
+
+  rb_define_const(cBackend, "TRACE_EVENTS", rb_obj_freeze(events));
+  rb_define_const(cBackend, "OP_TYPES", rb_obj_freeze(op_types));
+  rb_define_const(cBackend, "TRACE_RECORD_FORMAT", rb_obj_freeze(rb_str_new_cstr(TRACE_RECORD_FORMAT)));
+
+  rb_define_method(cBackend, "trace_ring=", Backend_trace_ring_set, 1);
+  rb_define_method(cBackend, "trace_ring_drain", Backend_trace_ring_drain, -1);
+  rb_define_method(cBackend, "trace_ring_dump", Backend_trace_ring_dump, -1);
+  rb_define_method(cBackend, "trace_ring_dropped", Backend_trace_ring_dropped, 0);
+}
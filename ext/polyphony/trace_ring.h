@@ -0,0 +1,46 @@
+#ifndef TRACE_RING_H
+#define TRACE_RING_H
+
+#include <stdint.h>
+#include "ruby.h"
+
+enum trace_event {
+  TRACE_FIBER_SWITCHPOINT,
+  TRACE_FIBER_RUN,
+  TRACE_FIBER_SCHEDULE,
+  TRACE_POLL_ENTER,
+  TRACE_POLL_LEAVE,
+  TRACE_OP_SUBMIT,
+  TRACE_OP_COMPLETE,
+  TRACE_WATCHDOG,
+  TRACE_EVENT_COUNT
+};
+
+// A fixed-size trace record. Records are dumped as is, so the layout should be
+// kept in sync with TRACE_RECORD_FORMAT (see trace_ring.c).
+typedef struct trace_record {
+  uint64_t  time;
+  uint64_t  fiber;
+  uint16_t  event;
+  uint16_t  op_type;
+  int32_t   op_id;
+  int32_t   fd;
+  int32_t   length;
+  int32_t   result;
+  int32_t   reserved;
+} trace_record_t;
+
+// A fixed-capacity ring of trace records. When the ring is full, the oldest
+// records are overwritten.
+typedef struct trace_ring {
+  trace_record_t  *records;
+  unsigned int    mask;
+  uint64_t        head;
+  uint64_t        tail;
+  uint64_t        dropped;
+} trace_ring_t;
+
+void trace_ring_push(trace_ring_t *ring, enum trace_event event, VALUE fiber, int op_type, int op_id, int fd, int length, int result);
+void trace_ring_free(trace_ring_t *ring);
+
+#endif /* TRACE_RING_H */
@@ -0,0 +1,163 @@
+#include "polyphony.h"
+#include "ring_buffer.h"
+
+// A wait group counts pending tasks. Fibers waiting on the wait group are
+// resumed once the count drops to zero. The count is kept natively, so waiting
+// on any number of tasks has a constant cost.
+typedef struct wait_group {
+  long count;
+  ring_buffer waiters;
+} WaitGroup_t;
+
+VALUE cWaitGroup = Qnil;
+static ID ID_timeout;
+
+static void WaitGroup_mark(void *ptr) {
+  WaitGroup_t *wait_group = ptr;
+  ring_buffer_mark(&wait_group->waiters);
+}
+
+static void WaitGroup_free(void *ptr) {
+  WaitGroup_t *wait_group = ptr;
+  ring_buffer_free(&wait_group->waiters);
+  xfree(ptr);
+}
+
+static size_t WaitGroup_size(const void *ptr) {
+  const WaitGroup_t *wait_group = ptr;
+  return sizeof(WaitGroup_t) + wait_group->waiters.size * sizeof(VALUE);
+}
+
+static const rb_data_type_t WaitGroup_type = {
+  "WaitGroup",
+  {WaitGroup_mark, WaitGroup_free, WaitGroup_size,},
+  0, 0, 0
+};
+
+static VALUE WaitGroup_allocate(VALUE klass) {
+  WaitGroup_t *wait_group;
+
+  wait_group = ALLOC(WaitGroup_t);
+  wait_group->count = 0;
+  ring_buffer_init(&wait_group->waiters);
+  return TypedData_Wrap_Struct(klass, &WaitGroup_type, wait_group);
+}
+
+#define GetWaitGroup(obj, wait_group) \
+  TypedData_Get_Struct((obj), WaitGroup_t, &WaitGroup_type, (wait_group))
+
+static VALUE WaitGroup_initialize(int argc, VALUE *argv, VALUE self) {
+  WaitGroup_t *wait_group;
+  GetWaitGroup(self, wait_group);
+  VALUE count = Qnil;
+  rb_scan_args(argc, argv, "01", &count);
+
+  wait_group->count = (count == Qnil) ? 0 : NUM2LONG(count);
+  if (wait_group->count < 0) rb_raise(rb_eArgError, "negative WaitGroup count");
+  return self;
+}
+
+static inline void wait_group_update(VALUE self, WaitGroup_t *wait_group, long delta) {
+  if (wait_group->count + delta < 0) rb_raise(rb_eRuntimeError, "negative WaitGroup count");
+
+  wait_group->count += delta;
+  if (wait_group->count) return;
+
+  while (wait_group->waiters.count)
+    Fiber_make_runnable(ring_buffer_shift(&wait_group->waiters), self);
+}
+
+// Adds the given number of tasks (1 by default) to the count.
+VALUE WaitGroup_add(int argc, VALUE *argv, VALUE self) {
+  WaitGroup_t *wait_group;
+  GetWaitGroup(self, wait_group);
+  VALUE delta = Qnil;
+  rb_scan_args(argc, argv, "01", &delta);
+
+  wait_group_update(self, wait_group, (delta == Qnil) ? 1 : NUM2LONG(delta));
+  return self;
+}
+
+// Marks a task as done, decrementing the count.
+VALUE WaitGroup_done(VALUE self) {
+  WaitGroup_t *wait_group;
+  GetWaitGroup(self, wait_group);
+
+  wait_group_update(self, wait_group, -1);
+  return self;
+}
+
+VALUE WaitGroup_count(VALUE self) {
+  WaitGroup_t *wait_group;
+  GetWaitGroup(self, wait_group);
+
+  return LONG2NUM(wait_group->count);
+}
+
+static VALUE wait_group_wait(RB_BLOCK_CALL_FUNC_ARGLIST(yielded_arg, self)) {
+  WaitGroup_t *wait_group;
+  GetWaitGroup(self, wait_group);
+
+  VALUE backend = rb_ivar_get(rb_thread_current(), ID_ivar_backend);
+  VALUE fiber = rb_fiber_current();
+  ring_buffer_push(&wait_group->waiters, fiber);
+  while (1) {
+    VALUE switchpoint_result = Backend_wait_event(backend, Qnil);
+    if (TEST_EXCEPTION(switchpoint_result)) {
+      ring_buffer_delete(&wait_group->waiters, fiber);
+      RAISE_EXCEPTION(switchpoint_result);
+    }
+    // the fiber might have been resumed by something other than the wait group
+    if (switchpoint_result == self) break;
+    if (!wait_group->count) {
+      ring_buffer_delete(&wait_group->waiters, fiber);
+      break;
+    }
+  }
+
+  RB_GC_GUARD(backend);
+  return Qtrue;
+}
+
+// Waits for the count to drop to zero, returning true. If a timeout is given
+// and the count does not drop to zero within the given interval, returns
+// false.
+VALUE WaitGroup_wait(int argc, VALUE *argv, VALUE self) {
+  WaitGroup_t *wait_group;
+  GetWaitGroup(self, wait_group);
+  VALUE timeout = Qnil;
+  rb_scan_args(argc, argv, "01", &timeout);
+
+  if (!wait_group->count) return Qtrue;
+  if (timeout == Qnil) return wait_group_wait(Qnil, self, 0, 0, Qnil);
+
+  VALUE backend = rb_ivar_get(rb_thread_current(), ID_ivar_backend);
+  VALUE args[3] = {timeout, Qnil, Qfalse};
+  return rb_block_call(backend, ID_timeout, 3, args, wait_group_wait, self);
+}
+
+// Returns the number of fibers waiting on the wait group.
+VALUE WaitGroup_waiting_count(VALUE self) {
+  WaitGroup_t *wait_group;
+  GetWaitGroup(self, wait_group);
+
+  return UINT2NUM(wait_group->waiters.count);
+}
+
+void Init_WaitGroup() {
+  cWaitGroup = rb_define_class_under(mPolyphony, "WaitGroup", rb_cObject);
+  rb_define_alloc_func(cWaitGroup, WaitGroup_allocate);
+
+  rb_define_method(cWaitGroup, "initialize", WaitGroup_initialize, -1);
+  rb_define_method(cWaitGroup, "add", WaitGroup_add, -1);
+  rb_define_method(cWaitGroup, "done", WaitGroup_done, 0);
+  rb_define_method(cWaitGroup, "count", WaitGroup_count, 0);
+  rb_define_method(cWaitGroup, "wait", WaitGroup_wait, -1);
+  rb_define_method(cWaitGroup, "waiting_count", WaitGroup_waiting_count, 0);
+
+  rb_define_alias(cWaitGroup, "count_down", "done");
+  rb_define_alias(cWaitGroup, "await", "wait");
+  rb_define_const(mPolyphony, "CountDownLatch", cWaitGroup);
+
+  ID_timeout = rb_intern("timeout");
+}
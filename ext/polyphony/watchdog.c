@@ -0,0 +1,254 @@
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "polyphony.h"
+#include "backend_common.h"
+
+// The run-slice watchdog detects fibers that run for too long without
+// switching, e.g. when running CPU-bound code, or when calling a blocking
+// library. The start of each run slice is recorded in backend_base_switch_fiber.
+// A monitor thread periodically checks the current run slice, and captures the
+// backtrace of a fiber that has exceeded the threshold while it's still
+// running. Reports are delivered on the backend's thread once the fiber
+// switches, since the monitor thread cannot safely call into Polyphony. If the
+// monitor thread did not get to run during the slice (e.g. when a C extension
+// blocks without releasing the GVL), the backtrace of the switchpoint is used.
+
+struct backend_watchdog {
+  // set to NULL when the watchdog is stopped, the monitor thread then frees
+  // the watchdog on exiting
+  struct Backend_base *base;
+  int       monitor_running;
+  uint64_t  threshold;
+  uint64_t  slice_start;
+  uint64_t  slice_id;
+  uint64_t  reported_slice_id;
+  uint64_t  hit_count;
+  unsigned int slice_op_count;
+  VALUE     slice_fiber;
+  VALUE     live_backtrace;
+  VALUE     thread;
+  VALUE     monitor;
+  VALUE     proc;
+};
+
+static VALUE SYM_fiber;
+static VALUE SYM_run_time;
+static VALUE SYM_backtrace;
+static VALUE SYM_op_count;
+static VALUE SYM_live;
+static ID ID_backtrace;
+static ID ID_name_set;
+
+static inline unsigned int watchdog_slice_op_count(struct backend_watchdog *watchdog) {
+  unsigned int op_count = watchdog->base->op_count;
+  // the op count is reset by Backend#stats
+  return op_count >= watchdog->slice_op_count ? op_count - watchdog->slice_op_count : op_count;
+}
+
+// Counts a run slice exceeding the threshold. This can be called either from
+// the monitor thread or from the backend's thread.
+static void watchdog_hit(struct backend_watchdog *watchdog, uint64_t run_time) {
+  struct Backend_base *base = watchdog->base;
+
+  watchdog->reported_slice_id = watchdog->slice_id;
+  watchdog->hit_count++;
+  base->watchdog_hit_count++;
+  TRACE_RING_RECORD(
+    base, TRACE_WATCHDOG, watchdog->slice_fiber, 0, 0, -1, (int)(run_time / 1000),
+    watchdog_slice_op_count(watchdog)
+  );
+}
+
+// Writes a report to stderr. This bypasses the IO layer, so it can be used from
+// the monitor thread.
+static void watchdog_warn(VALUE fiber, uint64_t run_time, unsigned int op_count, VALUE backtrace) {
+  VALUE msg = rb_sprintf(
+    "Polyphony watchdog: %"PRIsVALUE" ran for %.3fs without switching (%u ops)\n",
+    rb_inspect(fiber), (double)run_time / 1e9, op_count
+  );
+  if (RTEST(backtrace)) {
+    rb_str_cat_cstr(msg, "\t");
+    rb_str_append(msg, rb_ary_join(backtrace, rb_str_new_cstr("\n\t")));
+    rb_str_cat_cstr(msg, "\n");
+  }
+  if (write(2, RSTRING_PTR(msg), RSTRING_LEN(msg)) < 0) return;
+  RB_GC_GUARD(msg);
+}
+
+static void watchdog_report(struct backend_watchdog *watchdog, uint64_t run_time, VALUE backtrace, int live) {
+  VALUE report = rb_hash_new();
+  rb_hash_aset(report, SYM_fiber, watchdog->slice_fiber);
+  rb_hash_aset(report, SYM_run_time, DBL2NUM((double)run_time / 1e9));
+  rb_hash_aset(report, SYM_backtrace, backtrace);
+  rb_hash_aset(report, SYM_op_count, UINT2NUM(watchdog_slice_op_count(watchdog)));
+  rb_hash_aset(report, SYM_live, live ? Qtrue : Qfalse);
+  rb_obj_freeze(report);
+
+  rb_funcall(watchdog->proc, ID_call, 1, report);
+  RB_GC_GUARD(report);
+}
+
+void backend_watchdog_slice_start(struct Backend_base *base, VALUE fiber) {
+  struct backend_watchdog *watchdog = base->watchdog;
+  watchdog->slice_fiber = fiber;
+  watchdog->slice_op_count = base->op_count;
+  watchdog->live_backtrace = Qnil;
+  watchdog->slice_id++;
+  watchdog->slice_start = current_time_ns();
+}
+
+void backend_watchdog_slice_end(struct Backend_base *base) {
+  struct backend_watchdog *watchdog = base->watchdog;
+  if (!watchdog->slice_start) return;
+
+  uint64_t run_time = current_time_ns() - watchdog->slice_start;
+  watchdog->slice_start = 0;
+  if (run_time < watchdog->threshold) return;
+
+  VALUE backtrace = watchdog->live_backtrace;
+  int live = backtrace != Qnil;
+  watchdog->live_backtrace = Qnil;
+  if (!live) {
+    // not detected by the monitor thread
+    watchdog_hit(watchdog, run_time);
+    backtrace = rb_make_backtrace();
+    if (watchdog->proc == Qnil)
+      watchdog_warn(watchdog->slice_fiber, run_time, watchdog_slice_op_count(watchdog), backtrace);
+  }
+  // the watchdog might be stopped by the proc, so it should be called last
+  if (watchdog->proc != Qnil)
+    watchdog_report(watchdog, run_time, backtrace, live);
+  RB_GC_GUARD(backtrace);
+}
+
+void backend_watchdog_mark(struct Backend_base *base) {
+  struct backend_watchdog *watchdog = base->watchdog;
+  rb_gc_mark(watchdog->slice_fiber);
+  rb_gc_mark(watchdog->live_backtrace);
+  rb_gc_mark(watchdog->thread);
+  rb_gc_mark(watchdog->monitor);
+  rb_gc_mark(watchdog->proc);
+}
+
+static VALUE watchdog_monitor_loop(VALUE arg) {
+  struct backend_watchdog *watchdog = (struct backend_watchdog *)arg;
+
+  // check the current slice four times per threshold period
+  uint64_t interval = watchdog->threshold / 4;
+  struct timeval tv = { interval / 1000000000, (interval % 1000000000) / 1000 };
+
+  while (1) {
+    rb_thread_wait_for(tv);
+    if (!watchdog->base) break;
+    if (!watchdog->slice_start || watchdog->reported_slice_id == watchdog->slice_id) continue;
+
+    uint64_t run_time = current_time_ns() - watchdog->slice_start;
+    if (run_time < watchdog->threshold) continue;
+
+    uint64_t slice_id = watchdog->slice_id;
+    watchdog_hit(watchdog, run_time);
+    // the backtrace of the thread is that of its currently running fiber
+    VALUE backtrace = rb_funcall(watchdog->thread, ID_backtrace, 0);
+    if (!watchdog->base || watchdog->slice_id != slice_id) continue;
+
+    watchdog->live_backtrace = backtrace;
+    if (watchdog->proc == Qnil)
+      watchdog_warn(watchdog->slice_fiber, run_time, watchdog_slice_op_count(watchdog), backtrace);
+  }
+  return Qnil;
+}
+
+static VALUE watchdog_monitor_ensure(VALUE arg) {
+  struct backend_watchdog *watchdog = (struct backend_watchdog *)arg;
+  if (watchdog->base)
+    watchdog->monitor_running = 0;
+  else
+    free(watchdog);
+  return Qnil;
+}
+
+static VALUE watchdog_monitor(void *arg) {
+  return rb_ensure(watchdog_monitor_loop, (VALUE)arg, watchdog_monitor_ensure, (VALUE)arg);
+}
+
+// Detaches the watchdog from the backend. The monitor thread exits on its next
+// check, so the watchdog is freed here only if the monitor is not running.
+void backend_watchdog_stop(struct Backend_base *base) {
+  struct backend_watchdog *watchdog = base->watchdog;
+  if (!watchdog) return;
+
+  base->watchdog = NULL;
+  watchdog->base = NULL;
+  if (!watchdog->monitor_running) free(watchdog);
+}
+
+// Called after forking, where the monitor thread does not exist anymore.
+void backend_watchdog_reset(struct Backend_base *base) {
+  if (!base->watchdog) return;
+
+  free(base->watchdog);
+  base->watchdog = NULL;
+}
+
+// Enables the run-slice watchdog with the given threshold in seconds, or
+// disables it if the threshold is nil. If a block is given, it is called with
+// a report hash for each fiber exceeding the threshold, otherwise reports are
+// written to $stderr. Each report includes the fiber's backtrace, captured
+// while it was still running if possible.
+VALUE Backend_watchdog(int argc, VALUE *argv, VALUE self) {
+  struct Backend_base *base = RTYPEDDATA_DATA(self);
+  VALUE threshold;
+  VALUE proc;
+  rb_scan_args(argc, argv, "1&", &threshold, &proc);
+
+  backend_watchdog_stop(base);
+  if (threshold == Qnil) return self;
+
+  double threshold_d = NUM2DBL(threshold);
+  if (threshold_d <= 0) rb_raise(rb_eArgError, "invalid watchdog threshold");
+
+  struct backend_watchdog *watchdog = malloc(sizeof(struct backend_watchdog));
+  watchdog->base = base;
+  watchdog->monitor_running = 1;
+  watchdog->threshold = threshold_d * 1e9;
+  watchdog->slice_start = 0;
+  watchdog->slice_id = 0;
+  watchdog->reported_slice_id = 0;
+  watchdog->hit_count = 0;
+  watchdog->slice_op_count = 0;
+  watchdog->slice_fiber = Qnil;
+  watchdog->live_backtrace = Qnil;
+  watchdog->thread = rb_thread_current();
+  watchdog->monitor = Qnil;
+  watchdog->proc = proc;
+  base->watchdog = watchdog;
+
+  watchdog->monitor = rb_thread_create(watchdog_monitor, (void *)watchdog);
+  rb_funcall(watchdog->monitor, ID_name_set, 1, rb_str_new_cstr("polyphony-watchdog"));
+  return self;
+}
+
+// Returns the number of run slices that exceeded the watchdog threshold.
+VALUE Backend_watchdog_hit_count(VALUE self) {
+  struct Backend_base *base = RTYPEDDATA_DATA(self);
+  return base->watchdog ? ULL2NUM(base->watchdog->hit_count) : INT2NUM(0);
+}
+
+void Init_Watchdog(VALUE cBackend) {
+  SYM_fiber = ID2SYM(rb_intern("fiber"));
+  SYM_run_time = ID2SYM(rb_intern("run_time"));
+  SYM_backtrace = ID2SYM(rb_intern("backtrace"));
+  SYM_op_count = ID2SYM(rb_intern("op_count"));
+  SYM_live = ID2SYM(rb_intern("live"));
+  rb_global_variable(&SYM_fiber);
+  rb_global_variable(&SYM_run_time);
+  rb_global_variable(&SYM_backtrace);
+  rb_global_variable(&SYM_op_count);
+  rb_global_variable(&SYM_live);
+  ID_backtrace = rb_intern("backtrace");
+  ID_name_set = rb_intern("name=");
+
+  rb_define_method(cBackend, "watchdog", Backend_watchdog, -1);
+  rb_define_method(cBackend, "watchdog_hit_count", Backend_watchdog_hit_count, 0);
+}
@@ -12,11 +12,15 @@ Thread.current.setup_fiber_scheduling
 Thread.current.backend = Polyphony::Backend.new
 
 require_relative './polyphony/core/global_api'
+require_relative './polyphony/core/channel'
 require_relative './polyphony/core/resource_pool'
 require_relative './polyphony/core/sync'
 require_relative './polyphony/core/timer'
+require_relative './polyphony/core/scheduler_group'
+require_relative './polyphony/core/fiber_pool'
 require_relative './polyphony/net'
 require_relative './polyphony/adapters/process'
+require_relative './polyphony/core/prefork'
 
 # Polyphony API
 module Polyphony
@@ -64,6 +64,78 @@ class ::PG::Connection
     end
   end
 
+  PIPELINE_FLUSH_METHOD = method_defined?(:sync_flush) ? :sync_flush : :flush
+
+  # Runs the given queries using the libpq pipeline mode (libpq 14+), sending
+  # them all with a single flush and consuming the results as they arrive.
+  # Each query is either an SQL string or an array of SQL string and params.
+  # If a block is given, each result is yielded as it is received. If any of
+  # the queries fails, the first error is raised once all results are
+  # consumed.
+  # @return [Array<PG::Result>] query results
+  def pipeline(queries)
+    raise NotImplementedError, 'pipeline mode requires libpq 14+' unless respond_to?(:enter_pipeline_mode)
+
+    state = :sending
+    enter_pipeline_mode
+    queries.each do |q|
+      sql, params = q.is_a?(Array) ? q : [q, nil]
+      send_query_params(sql, params || [])
+    end
+    pipeline_sync
+    state = :synced
+    pipeline_flush
+
+    results = queries.map do
+      result = get_result
+      get_result # consume the terminating nil
+      yield result if block_given?
+      result
+    end
+    get_result # consume the PGRES_PIPELINE_SYNC result
+    state = :done
+    results.each(&:check)
+  ensure
+    leave_pipeline_mode($!, state)
+  end
+
+  # Leaves pipeline mode. If the pipeline was not run to completion, e.g. when
+  # an error is raised by the given block, any results left are consumed first,
+  # so the connection can be used for other queries. If an error has been
+  # raised in pipeline mode, any error raised here is ignored, so the original
+  # error is not hidden.
+  def leave_pipeline_mode(error, state)
+    return unless respond_to?(:pipeline_status) && pipeline_status != PQ_PIPELINE_OFF
+
+    drain_pipeline(state) unless state == :done
+    exit_pipeline_mode
+  rescue PG::Error
+    raise unless error
+  end
+
+  # Consumes all results up to and including the PGRES_PIPELINE_SYNC result,
+  # sending the sync first if it was not yet sent.
+  def drain_pipeline(state)
+    if state == :sending
+      pipeline_sync
+      pipeline_flush
+    end
+    while true
+      result = get_result
+      break if result&.result_status == PGRES_PIPELINE_SYNC
+    end
+  end
+
+  # Flushes the send buffer, waiting for the socket to become writable as
+  # needed. Input is consumed while waiting to prevent a deadlock with the
+  # server, which might be blocked on sending results.
+  def pipeline_flush
+    until send(PIPELINE_FLUSH_METHOD)
+      Polyphony.backend_wait_io(socket_io, true)
+      consume_input
+    end
+  end
+
   SQL_BEGIN = 'begin'
   SQL_COMMIT = 'commit'
   SQL_ROLLBACK = 'rollback'
@@ -3,7 +3,6 @@
 require_relative '../../polyphony'
 
 require 'redis'
-require 'hiredis/reader'
 
 # Polyphony-based Redis driver
 class Polyphony::RedisDriver
@@ -22,7 +21,8 @@ class Polyphony::RedisDriver
 
   def initialize(host, port)
     @connection = Polyphony::Net.tcp_connect(host, port)
-    @reader = ::Hiredis::Reader.new
+    @reader = Polyphony::RESP::Reader.new
+    @pending = []
   end
 
   def connected?
@@ -34,34 +34,50 @@ class Polyphony::RedisDriver
   end
 
   def disconnect
+    flush if connected?
     @connection.close
     @connection = nil
   end
 
+  # Commands are buffered until the next read, so that pipelined commands are
+  # sent with a single writev.
   def write(command)
-    @connection.write(format_command(command))
+    @pending << Polyphony::RESP.encode(command)
   end
 
   def format_command(args)
-    args = args.flatten
-    (+"*#{args.size}\r\n").tap do |s|
-      args.each do |a|
-        a = a.to_s
-        s << "$#{a.bytesize}\r\n#{a}\r\n"
-      end
-    end
+    Polyphony::RESP.encode(args)
   end
 
   def read
+    flush
     reply = @reader.gets
-    return reply if reply
+    return format_reply(reply) unless reply == false
 
     @connection.read_loop do |data|
-      @reader.feed(data)
-      reply = @reader.gets
-      return reply unless reply == false
+      @reader.feed(data) { |r| return format_reply(r) }
     end
   end
+
+  # Sends the given commands in a single write and returns their replies.
+  # Replies are parsed as they arrive.
+  def pipeline(commands)
+    commands.each { |c| write(c) }
+    Array.new(commands.size) { read }
+  end
+
+  private
+
+  def flush
+    return if @pending.empty?
+
+    @connection.write(*@pending)
+    @pending.clear
+  end
+
+  def format_reply(reply)
+    reply.is_a?(RuntimeError) ? Redis::CommandError.new(reply.message) : reply
+  end
 end
 
 Redis::Connection.drivers << Polyphony::RedisDriver
@@ -1,15 +1,22 @@
 # frozen_string_literal: true
 
-require_relative './exceptions'
-
 module Polyphony
   # Implements a unidirectional communication channel along the lines of Go
-  # (buffered) channels.
-  class Channel < Polyphony::Queue
-    alias_method :receive, :shift
-
-    def close
-      flush_waiters(Polyphony::MoveOn.new)
+  # channels. Channels are unbuffered by default, with an optional buffer
+  # capacity. The channel itself is implemented natively.
+  class Channel
+    # Receives values from the channel until it is closed.
+    # @return [Polyphony::Channel] self
+    def each
+      while true
+        begin
+          value = receive
+        rescue ClosedError
+          return self
+        end
+        yield value
+      end
     end
+    alias_method :receive_loop, :each
   end
 end
@@ -0,0 +1,82 @@
+# frozen_string_literal: true
+
+module Polyphony
+  # Implements a pool of recycled fibers for running short-lived tasks, e.g.
+  # handling a connection or a request. A pooled fiber that has finished
+  # running a task is kept idle, and is reused for running the next task, so
+  # running a task normally does not involve creating a fiber. Since pooled
+  # fibers are reused, tasks are run in a fire-and-forget manner: no fiber is
+  # returned, and a task cannot be awaited, monitored or restarted. As with
+  # spin, any child fibers spun by a task are terminated once the task is done,
+  # and an uncaught exception raised by a task terminates the fiber running it
+  # and is propagated to the pool's parent fiber. Fiber-local variables are
+  # reset between tasks.
+  #
+  # Pooled fibers are bound to the thread of the pool's parent fiber, so the
+  # pool should only be used from that thread.
+  class FiberPool
+    attr_reader :limit, :created_count, :reused_count
+
+    # Sets up a pool keeping up to limit idle fibers. Pooled fibers are spun as
+    # children of the given parent fiber.
+    def initialize(limit: 1024, parent: Fiber.current)
+      @limit = limit
+      @parent = parent
+      @idle = []
+      @created_count = 0
+      @reused_count = 0
+    end
+
+    # Runs the given block on an idle pooled fiber, or on a new fiber if no
+    # pooled fiber is idle.
+    def spin(&block)
+      raise ArgumentError, 'No block given' unless block
+
+      fiber = @idle.pop
+      if fiber
+        @reused_count += 1
+        fiber.schedule(block)
+      else
+        @created_count += 1
+        @parent.spin { worker_loop(block) }
+      end
+      self
+    end
+
+    def idle_count
+      @idle.size
+    end
+
+    # Terminates all idle fibers.
+    def clear
+      @idle.pop.terminate until @idle.empty?
+      self
+    end
+
+    private
+
+    def worker_loop(block)
+      fiber = Fiber.current
+      while true
+        block.call
+        fiber.shutdown_all_children
+        reset_fiber_locals
+        # A fiber being awaited, e.g. by its parent while shutting down its
+        # children, is not recycled, since the termination might have been
+        # requested while the fiber was already scheduled.
+        break if @idle.size >= @limit || !fiber.monitors.empty?
+
+        @idle << fiber
+        block = nil
+        block = suspend until block.is_a?(Proc)
+      end
+    ensure
+      @idle.delete(fiber)
+    end
+
+    def reset_fiber_locals
+      thread = Thread.current
+      thread.keys.each { |k| thread[k] = nil }
+    end
+  end
+end
@@ -50,16 +50,16 @@ module Polyphony
     end
 
     def spin(tag = nil, &block)
-      Fiber.current.spin(tag, caller, &block)
+      Fiber.current.spin(tag, caller_locations, &block)
     end
 
     def spin_loop(tag = nil, rate: nil, interval: nil, &block)
       if rate || interval
-        Fiber.current.spin(tag, caller) do
+        Fiber.current.spin(tag, caller_locations) do
           throttled_loop(rate: rate, interval: interval, &block)
         end
       else
-        spin_looped_block(tag, caller, block)
+        spin_looped_block(tag, caller_locations, block)
       end
     end
 
@@ -95,6 +95,20 @@ module Polyphony
       end
     end
 
+    # Runs the given block, cancelling it if the current fiber has not
+    # transferred any data for the given interval. Unlike cancel_after, the
+    # timeout is pushed back by each read or write, without using a timer per
+    # op.
+    def cancel_after_idle(interval, with_exception: Polyphony::Cancel, &block)
+      Polyphony.backend_idle_timeout(interval, with_exception, &block)
+    end
+
+    # Runs the given block, moving on if the current fiber has not transferred
+    # any data for the given interval (see cancel_after_idle).
+    def move_on_after_idle(interval, with_value: nil, &block)
+      Polyphony.backend_idle_timeout(interval, nil, with_value, &block)
+    end
+
     def move_on_blockless_canceller(fiber, interval, with_value)
       spin do
         sleep interval
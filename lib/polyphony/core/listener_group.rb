@@ -0,0 +1,73 @@
+# frozen_string_literal: true
+
+module Polyphony
+  # Implements a group of threads accepting connections on the same port. Each
+  # thread has its own listening socket, bound with SO_REUSEPORT, and runs its
+  # own accept loop, so that the kernel distributes incoming connections
+  # between the threads, and each connection is handled on the thread that has
+  # accepted it. Listening sockets are normally created with
+  # Polyphony::Net.tcp_listen, using the threads option.
+  class ListenerGroup
+    attr_reader :sockets
+
+    # Starts a thread for each of the given listening sockets. Each accepted
+    # connection is handled by calling the given block on a separate fiber,
+    # taken from a per-thread fiber pool.
+    # The connection is closed once the block returns.
+    def initialize(sockets, &handler)
+      raise ArgumentError, 'No block given' unless handler
+
+      @sockets = sockets
+      @accepted = Array.new(sockets.size, 0)
+      @active = Array.new(sockets.size, 0)
+      @threads = sockets.each_index.map { |idx| Thread.new { thread_loop(idx, handler) } }
+    end
+
+    def size
+      @sockets.size
+    end
+
+    def port
+      @sockets.first.to_io.local_address.ip_port
+    end
+
+    # Returns per-thread accept stats, with the number of accepted connections
+    # and the number of connections currently being handled by each thread.
+    def stats
+      @sockets.each_index.map do |idx|
+        { accepted: @accepted[idx], active: @active[idx] }
+      end
+    end
+
+    def join
+      @threads.each(&:join)
+    end
+    alias_method :await, :join
+
+    # Stops all threads, along with the connections they handle, and closes the
+    # listening sockets.
+    def stop
+      @threads.each(&:kill)
+      @threads.each(&:join)
+      @sockets.each(&:close)
+    end
+
+    private
+
+    def thread_loop(idx, handler)
+      pool = FiberPool.new
+      @sockets[idx].accept_loop do |conn|
+        @accepted[idx] += 1
+        pool.spin { handle_connection(idx, conn, handler) }
+      end
+    end
+
+    def handle_connection(idx, conn, handler)
+      @active[idx] += 1
+      handler.(conn)
+    ensure
+      @active[idx] -= 1
+      conn.close
+    end
+  end
+end
@@ -0,0 +1,309 @@
+# frozen_string_literal: true
+
+require 'etc'
+
+module Polyphony
+  unless defined?(Polyphony::ChildWatcher)
+    # Watches child processes, using a fiber per child. This is used where the
+    # native child watcher (based on pidfds) is not available.
+    class ChildWatcher
+      def initialize
+        @pid = ::Process.pid
+        @pids = []
+        @fibers = {}
+        @queue = Polyphony::Queue.new
+      end
+
+      def add(pid)
+        check_open
+        return self if @fibers.key?(pid)
+
+        # raises Errno::ESRCH if no such process exists
+        ::Process.kill(0, pid)
+        @pids << pid
+        @fibers[pid] = spin do
+          result = Polyphony.backend_waitpid(pid)
+          @fibers.delete(pid)
+          @queue << result
+        end
+        self
+      end
+
+      def delete(pid)
+        check_open
+        return nil unless @pids.delete(pid)
+
+        @fibers.delete(pid)&.stop
+        pid
+      end
+
+      def wait
+        check_open
+        loop do
+          return nil if @pids.empty?
+
+          result = @queue.shift
+          return result if @pids.delete(result.first)
+        end
+      end
+
+      def size
+        check_open
+        @pids.size
+      end
+
+      def pids
+        check_open
+        @pids.dup
+      end
+
+      def close
+        # The watching fibers belong to the process that has created them, and
+        # must not be resumed in a forked process.
+        @fibers.each_value(&:stop) if ::Process.pid == @pid
+        @fibers.clear
+        @pids.clear
+        @closed = true
+        self
+      end
+
+      def closed?
+        !!@closed
+      end
+
+      private
+
+      def check_open
+        raise IOError, 'closed child watcher' if @closed
+      end
+    end
+  end
+
+  # Implements a prefork supervisor, running a fixed number of worker processes.
+  # Any listening socket opened before the workers are started is inherited and
+  # shared by all workers, such that the kernel distributes incoming
+  # connections between them. All workers are monitored using a single child
+  # watcher, and crashed workers are restarted with exponential backoff.
+  #
+  # A reload starts a new generation of workers before draining the previous
+  # generation, so there is always a generation of workers accepting
+  # connections. A worker is drained by sending it drain_signal, upon which its
+  # block is interrupted with a Prefork::Drain exception, and the worker waits
+  # for the block's child fibers (e.g. connections being handled) to finish.
+  # The exception is raised at the block's next switchpoint, normally a pending
+  # accept, and an interrupted accept never drops a connection it has already
+  # accepted, so every connection accepted by the worker is handled. Workers
+  # not terminating within drain_timeout seconds are killed.
+  #
+  #   server = Polyphony::Net.tcp_listen('0.0.0.0', 1234, reuse_addr: true)
+  #   prefork = Polyphony::Prefork.new(workers: 4) do |index|
+  #     server.accept_loop { |conn| spin { handle(conn) } }
+  #   end
+  #   trap('HUP') { prefork.reload }
+  #   prefork.run
+  class Prefork
+    Worker = Struct.new(:pid, :index, :generation, :started_at)
+
+    # Raised in the worker's main fiber when the worker is drained
+    class Drain < Polyphony::BaseException; end
+
+    # Raised in the supervising fiber in order to recompute its timers
+    class Wakeup < RuntimeError; end
+
+    attr_reader :size, :generation, :restart_count
+
+    # Sets up a supervisor running the given block in each worker process. The
+    # block is called with the worker index. The backoff delay before
+    # restarting a crashed worker starts at backoff seconds, doubling with each
+    # successive crash up to max_backoff seconds. The delay is reset once a
+    # worker has run for more than max_backoff seconds.
+    def initialize(workers: Etc.nprocessors, backoff: 0.1, max_backoff: 10, drain_signal: 'TERM', drain_timeout: 10, &block)
+      raise ArgumentError, 'No block given' unless block
+      raise ArgumentError, 'Invalid number of workers' unless workers.positive?
+
+      @size = workers
+      @block = block
+      @min_backoff = backoff
+      @max_backoff = max_backoff
+      @drain_signal = drain_signal
+      @drain_timeout = drain_timeout
+
+      @watcher = ChildWatcher.new
+      @workers = {}
+      @backoff = Array.new(workers, backoff)
+      @restarts = {}
+      @drain_deadlines = {}
+      @generation = 0
+      @restart_count = 0
+    end
+
+    # Returns the pids of the current generation of workers, ordered by worker
+    # index. The pid of a worker waiting to be restarted is nil.
+    def pids
+      current = @workers.values.select { |w| w.generation == @generation }
+      (0...@size).map { |idx| current.find { |w| w.index == idx }&.pid }
+    end
+
+    # Returns the pids of workers being drained.
+    def draining_pids
+      @drain_deadlines.keys
+    end
+
+    # Starts a new generation of workers. The parent process is garbage
+    # collected before forking, so workers share as many memory pages with the
+    # parent process as possible.
+    def start
+      @generation += 1
+      GC.start
+      @size.times { |idx| spawn_worker(idx) }
+      self
+    end
+
+    # Starts the workers, if not already started, and supervises them until
+    # the supervisor is stopped and all workers have terminated.
+    def run
+      @run_fiber = Fiber.current
+      start if @generation == 0
+      until @stopped && @workers.empty?
+        exited = wait_for_exit
+        handle_exit(exited.first) if exited
+        handle_timers
+      end
+    ensure
+      terminate_workers unless @workers.empty?
+    end
+
+    # Starts a new generation of workers, then drains the previous one.
+    def reload
+      previous = @workers.values.select { |w| w.generation == @generation }.map(&:pid)
+      @restarts.clear
+      start
+      drain(previous)
+      wakeup
+      self
+    end
+
+    # Drains all workers. The supervisor stops once all workers have
+    # terminated.
+    def stop
+      @stopped = true
+      @restarts.clear
+      drain(@workers.keys)
+      wakeup
+      self
+    end
+
+    private
+
+    def now
+      ::Process.clock_gettime(::Process::CLOCK_MONOTONIC)
+    end
+
+    def spawn_worker(idx)
+      generation = @generation
+      pid = Polyphony.fork { run_worker(idx) }
+      @workers[pid] = Worker.new(pid, idx, generation, now)
+      @watcher.add(pid)
+    end
+
+    def run_worker(idx)
+      @watcher.close
+      # The trap runs in a separate fiber, which passes the exception to the
+      # main fiber, so the block is interrupted only at a switchpoint.
+      trap(@drain_signal) { raise Drain }
+      @block.(idx)
+    rescue Drain
+      # stop accepting connections, letting those being handled finish
+      Fiber.current.await_all_children
+    end
+
+    def next_timer_delay
+      times = @restarts.values + @drain_deadlines.values
+      times.empty? ? nil : times.min - now
+    end
+
+    def wait_for_exit
+      delay = next_timer_delay
+      return nil if delay && delay <= 0
+
+      @waiting = true
+      if !delay
+        @watcher.wait
+      elsif @workers.empty?
+        sleep(delay)
+        nil
+      else
+        move_on_after(delay) { @watcher.wait }
+      end
+    rescue Wakeup
+      nil
+    ensure
+      @waiting = false
+    end
+
+    # Interrupts the supervising fiber if it is waiting, so that it takes into
+    # account changes made by another fiber.
+    def wakeup
+      return unless @waiting && Fiber.current != @run_fiber
+
+      @waiting = false
+      @run_fiber.raise(Wakeup)
+    end
+
+    def handle_exit(pid)
+      @drain_deadlines.delete(pid)
+      worker = @workers.delete(pid)
+      return unless worker && !@stopped && worker.generation == @generation
+
+      idx = worker.index
+      delay = now - worker.started_at > @max_backoff ? @min_backoff : @backoff[idx]
+      @backoff[idx] = [delay * 2, @max_backoff].min
+      @restarts[idx] = now + delay
+    end
+
+    def handle_timers
+      t = now
+      @restarts.select { |_, time| time <= t }.each_key do |idx|
+        @restarts.delete(idx)
+        @restart_count += 1
+        spawn_worker(idx)
+      end
+      @drain_deadlines.select { |_, time| time <= t }.each_key do |pid|
+        @drain_deadlines.delete(pid)
+        signal('KILL', pid)
+      end
+    end
+
+    def drain(pids)
+      deadline = now + @drain_timeout
+      pids.each do |pid|
+        next if @drain_deadlines.key?(pid)
+
+        @drain_deadlines[pid] = deadline
+        signal(@drain_signal, pid)
+      end
+    end
+
+    def signal(sig, pid)
+      ::Process.kill(sig, pid)
+    rescue Errno::ESRCH
+      # process has already terminated
+    end
+
+    def terminate_workers
+      @workers.each_key { |pid| signal(@drain_signal, pid) }
+      move_on_after(@drain_timeout) { reap_workers }
+      @workers.each_key { |pid| signal('KILL', pid) }
+      reap_workers
+    end
+
+    def reap_workers
+      until @workers.empty?
+        exited = @watcher.wait
+        break unless exited
+
+        @workers.delete(exited.first)
+      end
+    end
+  end
+end
@@ -0,0 +1,288 @@
+# frozen_string_literal: true
+
+require 'socket'
+require 'securerandom'
+
+module Polyphony
+  # Implements an asynchronous DNS resolver. Names are looked up in the hosts
+  # file, and then queried from the name servers listed in resolv.conf. Queries
+  # are sent over UDP using the backend's socket ops (falling back to TCP for
+  # truncated responses), so lookups block only the calling fiber. Query
+  # results, including negative results, are cached according to their TTL.
+  class Resolver
+    # Raised when the name does not exist, or has no addresses
+    class NotFound < SocketError; end
+
+    # Raised when no name server has returned a usable response
+    class Unavailable < SocketError; end
+
+    DEFAULT_OPTIONS = {
+      resolv_conf:  '/etc/resolv.conf',
+      hosts:        '/etc/hosts',
+      nameservers:  ['127.0.0.1'],
+      search:       [],
+      ndots:        1,
+      timeout:      2,
+      attempts:     2,
+      max_ttl:      3600,
+      negative_ttl: 30,
+      cache_size:   4096
+    }.freeze
+
+    DNS_PORT = 53
+    RCODE_NOERROR = 0
+    RCODE_NXDOMAIN = 3
+    IPV4_REGEXP = /\A\d{1,3}(\.\d{1,3}){3}\z/.freeze
+
+    class << self
+      attr_writer :default
+
+      # Returns the resolver used for getaddrinfo calls.
+      def default
+        @default ||= new
+      end
+
+      def ip_address?(name)
+        name.include?(':') || IPV4_REGEXP.match?(name)
+      end
+
+      # Returns true if the given getaddrinfo arguments call for a name lookup,
+      # i.e. the node name is neither numeric nor empty, and the address family
+      # is unspecified or an IP family.
+      def name_lookup?(nodename, family, flags)
+        nodename.is_a?(String) && !nodename.empty? && !ip_address?(nodename) &&
+          (flags.to_i & Socket::AI_NUMERICHOST).zero? &&
+          (family.nil? || query_types(family))
+      end
+
+      # Returns the record types to query for the given address family, or nil
+      # if the family is not an IP family.
+      def query_types(family)
+        case family
+        when nil, 0, Socket::AF_UNSPEC, :UNSPEC, :AF_UNSPEC, 'UNSPEC', 'AF_UNSPEC'
+          [DNS::TYPE_AAAA, DNS::TYPE_A]
+        when Socket::AF_INET, :INET, :AF_INET, 'INET', 'AF_INET'
+          [DNS::TYPE_A]
+        when Socket::AF_INET6, :INET6, :AF_INET6, 'INET6', 'AF_INET6'
+          [DNS::TYPE_AAAA]
+        end
+      end
+    end
+
+    attr_reader :nameservers
+
+    # Creates a resolver. Options not given are read from resolv.conf (the
+    # resolv_conf option, which may be set to nil), or taken from
+    # DEFAULT_OPTIONS. Name servers are given as addresses, or as [address,
+    # port] pairs. The timeout applies to each attempt.
+    def initialize(opts = {})
+      conf = read_resolv_conf(opts.fetch(:resolv_conf, DEFAULT_OPTIONS[:resolv_conf]))
+      opts = DEFAULT_OPTIONS.merge(conf).merge(opts)
+      @nameservers = opts[:nameservers].map { |ns| ns.is_a?(Array) ? ns : [ns, DNS_PORT] }
+      @search = opts[:search]
+      @ndots = opts[:ndots]
+      @timeout = opts[:timeout]
+      @attempts = opts[:attempts]
+      @max_ttl = opts[:max_ttl]
+      @negative_ttl = opts[:negative_ttl]
+      @cache_size = opts[:cache_size]
+      @hosts = opts[:hosts] ? read_hosts(opts[:hosts]) : {}
+      @cache = {}
+    end
+
+    # Returns the addresses of the given name, IPv6 addresses first. If an
+    # address family is given, only addresses of that family are returned.
+    # Raises NotFound if the name has no addresses, or Unavailable if no name
+    # server could be reached.
+    def resolve(name, family = nil)
+      return [name] if Resolver.ip_address?(name)
+
+      types = Resolver.query_types(family) or raise ArgumentError, "Invalid address family #{family.inspect}"
+      name = name.downcase
+      addresses = hosts_addresses(name, types)
+      return addresses unless addresses.empty?
+
+      search_names(name).each do |fqdn|
+        addresses = lookup(fqdn, types)
+        return addresses unless addresses.empty?
+      end
+      raise NotFound, "#{name}: name not found"
+    end
+
+    # Removes all cached query results.
+    def clear_cache
+      @cache.clear
+    end
+
+    private
+
+    def read_resolv_conf(path)
+      return {} unless path && File.file?(path)
+
+      IO.read(path).each_line.with_object({}) do |line, conf|
+        key, *values = line.sub(/[#;].*/, '').split
+        case key
+        when 'nameserver' then (conf[:nameservers] ||= []) << values.first if values.first
+        when 'search'     then conf[:search] = values
+        when 'domain'     then conf[:search] = values.take(1)
+        when 'options'    then read_resolv_conf_options(values, conf)
+        end
+      end
+    end
+
+    def read_resolv_conf_options(values, conf)
+      values.each do |option|
+        key, value = option.split(':', 2)
+        case key
+        when 'ndots'    then conf[:ndots] = value.to_i
+        when 'timeout'  then conf[:timeout] = value.to_i
+        when 'attempts' then conf[:attempts] = value.to_i
+        end
+      end
+    end
+
+    def read_hosts(path)
+      return {} unless File.file?(path)
+
+      IO.read(path).each_line.with_object({}) do |line, hosts|
+        address, *names = line.sub(/#.*/, '').split
+        next if names.empty?
+
+        type = address.include?(':') ? DNS::TYPE_AAAA : DNS::TYPE_A
+        names.each { |n| ((hosts[n.downcase] ||= {})[type] ||= []) << address }
+      end
+    end
+
+    def hosts_addresses(name, types)
+      entry = @hosts[name]
+      entry ? types.flat_map { |t| entry[t] || [] } : []
+    end
+
+    def search_names(name)
+      return [name.chomp('.')] if name.end_with?('.') || @search.empty?
+
+      searched = @search.map { |domain| "#{name}.#{domain}" }
+      name.count('.') >= @ndots ? [name, *searched] : [*searched, name]
+    end
+
+    def lookup(name, types)
+      now = ::Process.clock_gettime(::Process::CLOCK_MONOTONIC)
+      results = {}
+      missing = types.reject { |t| (results[t] = cached_addresses(name, t, now)) }
+      unless missing.empty?
+        query(name, missing).each do |type, (ttl, addresses)|
+          results[type] = cache(name, type, now, ttl, addresses)
+        end
+      end
+      types.flat_map { |t| results[t] }
+    end
+
+    def cached_addresses(name, type, now)
+      expires, addresses = @cache[[name, type]]
+      expires && expires > now ? addresses : nil
+    end
+
+    def cache(name, type, now, ttl, addresses)
+      ttl = [ttl, @max_ttl].min
+      return addresses unless ttl > 0
+
+      purge_cache(now) if @cache.size >= @cache_size
+      @cache[[name, type]] = [now + ttl, addresses]
+      addresses
+    end
+
+    def purge_cache(now)
+      @cache.delete_if { |_, (expires, _)| expires <= now }
+      @cache.clear if @cache.size >= @cache_size
+    end
+
+    # Queries the name servers, returning a hash mapping each of the given
+    # record types to a [ttl, addresses] pair.
+    def query(name, types)
+      @attempts.times do
+        @nameservers.each do |host, port|
+          answers = query_nameserver(host, port, name, types)
+          return answers if answers
+        end
+      end
+      raise Unavailable, "#{name}: no response from name servers"
+    end
+
+    # Sends queries for all given record types at once, and returns the
+    # answers, or nil if the name server has failed to answer all queries in
+    # time.
+    def query_nameserver(host, port, name, types)
+      socket = UDPSocket.new(host.include?(':') ? Socket::AF_INET6 : Socket::AF_INET)
+      socket.connect(host, port)
+      queries = query_ids(types)
+      queries.each { |id, type| socket.send(DNS.encode_query(id, name, type), 0) }
+
+      answers = {}
+      move_on_after(@timeout) do
+        while answers.size < queries.size
+          response = DNS.decode_response(socket.recv(DNS::UDP_PAYLOAD_SIZE))
+          type = queries[response[0]]
+          next unless type && !answers[type] && question?(response, name, type)
+
+          response = tcp_query(host, port, response[0], name, type) if response[2]
+          answers[type] = answer(response, type) or return nil
+        end
+      end
+      answers.size == queries.size ? answers : nil
+    rescue SystemCallError, IOError, DNS::ProtocolError
+      nil
+    ensure
+      socket&.close
+    end
+
+    # Returns a hash mapping random query ids to the given record types. Ids
+    # are unpredictable, in order to make spoofed responses harder to forge.
+    def query_ids(types)
+      types.each_with_object({}) do |type, queries|
+        id = SecureRandom.random_number(0x10000)
+        id = SecureRandom.random_number(0x10000) while queries[id]
+        queries[id] = type
+      end
+    end
+
+    # Returns true if the question of the given response matches the query.
+    def question?(response, name, type)
+      q_name, q_type, q_class = response[4]
+      q_name&.casecmp?(name.chomp('.')) && q_type == type && q_class == DNS::CLASS_IN
+    end
+
+    def tcp_query(host, port, id, name, type)
+      socket = TCPSocket.new(host, port)
+      query = DNS.encode_query(id, name, type)
+      socket << [query.bytesize].pack('n') << query
+      len = tcp_read(socket, 2).unpack1('n')
+      response = DNS.decode_response(tcp_read(socket, len))
+      response[0] == id && question?(response, name, type) ? response : nil
+    ensure
+      socket&.close
+    end
+
+    def tcp_read(socket, len)
+      buf = +''
+      socket.readpartial(len - buf.bytesize, buf, -1) while buf.bytesize < len
+      buf
+    end
+
+    # Returns the [ttl, addresses] pair for the given response, or nil if the
+    # name server has failed.
+    def answer(response, type)
+      return nil unless response
+
+      case response[1]
+      when RCODE_NOERROR
+        records = response[3]
+        addresses = records.select { |r| r[0] == type }.map { |r| r[2] }
+        return [@negative_ttl, []] if addresses.empty?
+
+        [records.map { |r| r[1] }.min, addresses]
+      when RCODE_NXDOMAIN
+        [@negative_ttl, []]
+      end
+    end
+  end
+end
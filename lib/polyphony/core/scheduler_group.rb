@@ -0,0 +1,50 @@
+# frozen_string_literal: true
+
+require 'etc'
+
+module Polyphony
+  # Implements a group of threads sharing a pool of tasks. Each task is run
+  # on a fiber spun by the first thread in the group that runs out of work.
+  class SchedulerGroup
+    attr_reader :size
+
+    def initialize(size = Etc.nprocessors)
+      setup
+      @size = size
+      @threads = (1..@size).map { Thread.new { thread_loop } }
+    end
+
+    # Adds the given thread to the group. A thread may belong to a single
+    # group at a time.
+    def attach(thread = Thread.current)
+      thread.backend.scheduler_group = self
+      add_backend(thread.backend)
+      self
+    end
+
+    def detach(thread = Thread.current)
+      remove_backend(thread.backend)
+      thread.backend.scheduler_group = nil
+      self
+    end
+
+    def spin(&block)
+      push(block)
+    end
+    alias_method :<<, :push
+
+    def stop
+      @threads.each(&:kill)
+      @threads.each(&:join)
+    end
+
+    private
+
+    def thread_loop
+      attach
+      loop { Thread.current.backend.wait_event(true) }
+    ensure
+      detach
+    end
+  end
+end
@@ -1,11 +1,13 @@
 # frozen_string_literal: true
 
 module Polyphony
-  # Implements a common timer for running multiple timeouts
+  # Implements a common timer for running multiple timeouts. Timeouts are kept
+  # in a native timer wheel (see ext/polyphony/timer.c), which is advanced by
+  # the timer fiber on each tick.
   class Timer
     def initialize(tag = nil, resolution:)
+      setup(resolution)
       @fiber = spin_loop(tag, interval: resolution) { update }
-      @timeouts = {}
     end
 
     def stop
@@ -13,14 +15,10 @@ module Polyphony
     end
 
     def sleep(duration)
-      fiber = Fiber.current
-      @timeouts[fiber] = {
-        interval: duration,
-        target_stamp: now + duration
-      }
+      arm(duration, nil, false)
       Polyphony.backend_wait_event(true)
     ensure
-      @timeouts.delete(fiber)
+      disarm
     end
 
     def after(interval, &block)
@@ -31,85 +29,29 @@ module Polyphony
     end
 
     def every(interval)
-      fiber = Fiber.current
-      @timeouts[fiber] = {
-        interval: interval,
-        target_stamp: now + interval,
-        recurring: true
-      }
+      arm(interval, nil, true)
       while true
         Polyphony.backend_wait_event(true)
         yield
       end
     ensure
-      @timeouts.delete(fiber)
+      disarm
     end
 
     def cancel_after(interval, with_exception: Polyphony::Cancel)
-      fiber = Fiber.current
-      @timeouts[fiber] = {
-        interval: interval,
-        target_stamp: now + interval,
-        exception: with_exception
-      }
+      arm(interval, with_exception, false)
       yield
     ensure
-      @timeouts.delete(fiber)
+      disarm
     end
 
     def move_on_after(interval, with_value: nil)
-      fiber = Fiber.current
-      @timeouts[fiber] = {
-        interval: interval,
-        target_stamp: now + interval,
-        exception: [Polyphony::MoveOn, with_value]
-      }
+      arm(interval, [Polyphony::MoveOn, with_value], false)
       yield
     rescue Polyphony::MoveOn => e
       e.value
     ensure
-      @timeouts.delete(fiber)
-    end
-
-    def reset
-      record = @timeouts[Fiber.current]
-      return unless record
-
-      record[:target_stamp] = now + record[:interval]
-    end
-
-    private
-
-    def now
-      ::Process.clock_gettime(::Process::CLOCK_MONOTONIC)
-    end
-
-    def timeout_exception(record)
-      case (exception = record[:exception])
-      when Array
-        exception[0].new(exception[1])
-      when Class
-        exception.new
-      else
-        RuntimeError.new(exception)
-      end
-    end
-
-    def update
-      return if @timeouts.empty?
-
-      @timeouts.each do |fiber, record|
-        next if record[:target_stamp] > now
-
-        value = record[:exception] ? timeout_exception(record) : record[:value]
-        fiber.schedule value
-
-        next unless record[:recurring]
-
-        while record[:target_stamp] <= now
-          record[:target_stamp] += record[:interval]
-        end
-      end
+      disarm
     end
   end
 end
@@ -204,7 +204,7 @@ module Polyphony
       @children.delete(child_fiber) if @children
     end
 
-    def spin(tag = nil, orig_caller = Kernel.caller, &block)
+    def spin(tag = nil, orig_caller = Kernel.caller_locations, &block)
       f = Fiber.new { |v| f.run(v) }
       f.prepare(tag, block, orig_caller, self)
       (@children ||= {})[f] = true
@@ -244,7 +244,7 @@ module Polyphony
 
     def detach
       @parent.remove_child(self)
-      @parent = @thread.main_fiber
+      @parent = thread.main_fiber
       @parent.add_child(self)
       self
     end
@@ -266,8 +266,8 @@ module Polyphony
   # Fiber life cycle methods
   module FiberLifeCycle
     def prepare(tag, block, caller, parent)
-      @thread = Thread.current
-      @tag = tag
+      self.thread = Thread.current
+      @tag = tag if tag
       @parent = parent
       @caller = caller
       @block = block
@@ -299,14 +299,14 @@ module Polyphony
     # fiber terminates after it has already been created. Calling #setup_raw
     # allows the fiber to be scheduled and to receive messages.
     def setup_raw
-      @thread = Thread.current
+      self.thread = Thread.current
       @running = true
     end
 
     def setup_main_fiber
       @main = true
       @tag = :main
-      @thread = Thread.current
+      self.thread = Thread.current
       @running = true
       @children&.clear
     end
@@ -326,7 +326,7 @@ module Polyphony
     ensure
       @parent&.remove_child(self)
       # Prevent fiber from being resumed after terminating
-      @thread.fiber_unschedule(self)
+      thread.fiber_unschedule(self)
       Thread.current.switch_fiber
     end
 
@@ -379,7 +379,7 @@ class ::Fiber
 
   extend Polyphony::FiberControlClassMethods
 
-  attr_accessor :tag, :thread, :parent
+  attr_accessor :tag, :parent
   attr_reader :result
 
   def running?
@@ -396,11 +396,15 @@ class ::Fiber
   alias_method :to_s, :inspect
 
   def location
-    @caller ? @caller[0] : '(root)'
+    @caller ? @caller[0].to_s : '(root)'
   end
 
+  # Returns the backtrace of the code that has spun the fiber, followed by that
+  # of the fiber's ancestors. The spin location is kept as an array of
+  # Thread::Backtrace::Location, which is converted to strings only when
+  # needed.
   def caller
-    spin_caller = @caller || []
+    spin_caller = @caller ? @caller.map(&:to_s) : []
     if @parent
       spin_caller + @parent.caller
     else
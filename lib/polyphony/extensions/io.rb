@@ -134,6 +134,12 @@ class ::IO
     result
   end
 
+  alias_method :orig_io_close, :close
+  def close
+    Polyphony.__unregister_closing_io__(self)
+    orig_io_close
+  end
+
   alias_method :orig_write, :write
   def write(str, *args)
     Polyphony.backend_write(self, str, *args)
@@ -227,6 +233,11 @@ class ::IO
     Polyphony.backend_read_loop(self, maxlen, &block)
   end
 
+  def gets_loop(sep = $/, chomp: false, &block)
+    @read_buffer ||= +''
+    Polyphony.backend_gets_loop(self, sep, chomp, @read_buffer, &block)
+  end
+
   def feed_loop(receiver, method = :call, &block)
     Polyphony.backend_feed_loop(self, receiver, method, &block)
   end
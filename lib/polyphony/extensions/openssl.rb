@@ -3,6 +3,24 @@
 require 'openssl'
 require_relative './socket'
 
+# Kernel TLS (kTLS) offload settings
+class ::OpenSSL::SSL::SSLContext
+  KTLS_OPTION = defined?(::OpenSSL::SSL::OP_ENABLE_KTLS) ? ::OpenSSL::SSL::OP_ENABLE_KTLS : 0
+
+  # Enables or disables kernel TLS offload for connections using this context.
+  # When enabled, and supported by both OpenSSL and the kernel, OpenSSL
+  # installs the session keys on the socket once the handshake is done, and
+  # encryption is done by the kernel. This allows writing to the underlying
+  # socket directly, including with splice and sendfile.
+  def ktls=(enabled)
+    self.options = enabled ? (options | KTLS_OPTION) : (options & ~KTLS_OPTION)
+  end
+
+  def ktls?
+    KTLS_OPTION != 0 && (options & KTLS_OPTION) != 0
+  end
+end
+
 # OpenSSL socket helper methods (to make it compatible with Socket API) and overrides
 class ::OpenSSL::SSL::SSLSocket
   def __parser_read_method__
@@ -36,8 +54,28 @@ class ::OpenSSL::SSL::SSLSocket
     end
   end
 
+  # Performs the server side of the handshake. The handshake is performed
+  # using non-blocking steps, waiting for the socket to become readable or
+  # writable in between, so other fibers can run during the handshake.
+  alias_method :orig_accept, :accept
+  def accept
+    handshake_nonblock(:accept_nonblock)
+  end
+
+  alias_method :orig_connect, :connect
+  def connect
+    handshake_nonblock(:connect_nonblock)
+  end
+
+  # Returns true if kernel TLS offload is active for sending. Data written to
+  # the socket is then written directly to the underlying socket.
+  def ktls_send?
+    !!@ktls_send
+  end
+
   alias_method :orig_sysread, :sysread
   def sysread(maxlen, buf = +'')
+    io.nonblock_mode!
     while true
       case (result = read_nonblock(maxlen, buf, exception: false))
       when :wait_readable then Polyphony.backend_wait_io(io, false)
@@ -49,6 +87,9 @@ class ::OpenSSL::SSL::SSLSocket
 
   alias_method :orig_syswrite, :syswrite
   def syswrite(buf)
+    return io.write(buf) if @ktls_send
+
+    io.nonblock_mode!
     while true
       case (result = write_nonblock(buf, exception: false))
       when :wait_readable then Polyphony.backend_wait_io(io, false)
@@ -106,96 +147,292 @@ class ::OpenSSL::SSL::SSLSocket
   end
   alias_method :recv_loop, :read_loop
 
+  # Yields lines read from the socket. Data already buffered by #gets is
+  # consumed first, and data left over when the loop is broken out of is put
+  # back in the same buffer, to be returned by the next #gets or #gets_loop.
+  def gets_loop(sep = $/, chomp: false)
+    sep_size = sep.bytesize
+    # sysread returns buffered data first, so the buffer is emptied while
+    # reading
+    buffer = @rbuffer.slice!(0, @rbuffer.bytesize)
+    pos = 0
+    loop do
+      while (idx = buffer.index(sep, pos))
+        line = buffer.byteslice(pos, idx + (chomp ? 0 : sep_size) - pos)
+        pos = idx + sep_size
+        yield line
+      end
+      buffer.slice!(0, pos) if pos > 0
+      pos = 0
+      break unless (data = sysread(8192))
+
+      buffer << data
+    end
+    @eof = true
+    return if buffer.empty?
+
+    pos = buffer.bytesize
+    yield buffer.dup
+  ensure
+    @rbuffer[0, 0] = buffer.byteslice(pos, buffer.bytesize - pos) if buffer && pos < buffer.bytesize
+  end
+
   alias_method :orig_peeraddr, :peeraddr
   def peeraddr(_ = nil)
     orig_peeraddr
   end
+
+  # Splices up to maxlen bytes from the given pipe to the socket. With kTLS
+  # send offload, data is spliced directly to the underlying socket without
+  # copying. Otherwise it is read and written through OpenSSL. Returns the
+  # number of bytes written, or 0 on EOF.
+  def splice(src, maxlen)
+    return Polyphony.backend_splice(src, io, maxlen) if @ktls_send
+
+    syswrite(src.readpartial(maxlen))
+  rescue EOFError
+    0
+  end
+
+  def splice_to_eof(src, chunksize = 8192)
+    return Polyphony.backend_splice_to_eof(src, io, chunksize) if @ktls_send
+
+    total = 0
+    buf = +''
+    loop { total += syswrite(src.readpartial(chunksize, buf)) }
+  rescue EOFError
+    total
+  end
+
+  # Sends length bytes (or up to EOF if length is nil) from the given file,
+  # starting at the given offset. With kTLS send offload, sendfile(2) is used.
+  # Returns the number of bytes written.
+  def sendfile(file, offset = 0, length = nil)
+    return Thread.current.backend.sendfile(file, io, offset, length) if @ktls_send
+
+    total = 0
+    buf = +''
+    while length.nil? || total < length
+      chunk_size = length ? [length - total, 65_536].min : 65_536
+      break unless file.pread(chunk_size, offset + total, buf)
+
+      total += syswrite(buf)
+    end
+    total
+  rescue EOFError
+    total
+  end
+
+  private
+
+  def handshake_nonblock(method)
+    io.nonblock_mode!
+    while true
+      case send(method, exception: false)
+      when :wait_readable then Polyphony.backend_wait_io(io, false)
+      when :wait_writable then Polyphony.backend_wait_io(io, true)
+      else break
+      end
+    end
+    detect_ktls
+    self
+  end
+
+  def detect_ktls
+    @ktls_send = context.ktls? && io.ktls_tx?
+  end
 end
 
 # OpenSSL socket helper methods (to make it compatible with Socket API) and overrides
 class ::OpenSSL::SSL::SSLServer
-  attr_reader :ctx
+  # Raised when a handshake takes longer than the handshake timeout
+  class HandshakeTimeoutError < ::OpenSSL::SSL::SSLError; end
 
-  alias_method :orig_accept, :accept
-  def accept
-    # when @ctx.servername_cb is set, we use a worker thread to run the
-    # ssl.accept call. We need to do this because:
-    # - We cannot switch fibers inside of the servername_cb proc (see
-    #   https://github.com/ruby/openssl/issues/415)
-    # - We don't want to stop the world while we're busy provisioning an ACME
-    #   certificate
-    if @use_accept_worker.nil?
-      if (@use_accept_worker = use_accept_worker_thread?)
-        start_accept_worker_thread
-      end
+  # A handshake to be performed on a handshake worker thread. If the requesting
+  # fiber is interrupted before the handshake is started, the handshake is
+  # skipped. If interrupted while the handshake is in progress, the worker
+  # closes the socket once the handshake is done.
+  class HandshakeRequest
+    attr_reader :ssl, :peer
+
+    def initialize(ssl, peer)
+      @ssl = ssl
+      @peer = peer
+      @lock = ::Mutex.new
+      @state = :queued
     end
 
-    # STDOUT.puts 'SSLServer#accept'
-    sock, = @svr.accept
-    # STDOUT.puts "- raw sock: #{sock.inspect}"
-    begin
-      ssl = OpenSSL::SSL::SSLSocket.new(sock, @ctx)
-      # STDOUT.puts "- ssl sock: #{ssl.inspect}"
-      ssl.sync_close = true
-      if @use_accept_worker
-        # STDOUT.puts "- send to accept worker"
-        @accept_worker_fiber << [ssl, Fiber.current]
-        # STDOUT.puts "- wait for accept worker"
-        r = receive
-        # STDOUT.puts "- got reply from accept worker: #{r.inspect}"
-        r.invoke if r.is_a?(Exception)
-      else
-        ssl.accept
+    # Called by the worker before performing the handshake. Returns false if
+    # the request was cancelled.
+    def start
+      transition(:queued, :running)
+    end
+
+    # Called by the worker once the handshake is done. Returns false if the
+    # request was cancelled, in which case the worker closes the socket.
+    def finish
+      transition(:running, :done)
+    end
+
+    # Called by the requesting fiber when interrupted. Returns true if the
+    # handshake is in progress, in which case the socket is closed by the
+    # worker.
+    def cancel
+      @lock.synchronize do
+        running = @state == :running
+        @state = :cancelled unless @state == :done
+        running
       end
-      ssl
-    rescue Exception => e
-      # STDOUT.puts "- accept exception: #{e.inspect}"
-      if ssl
-        ssl.close
-      else
-        sock.close
+    end
+
+    private
+
+    def transition(from, to)
+      @lock.synchronize do
+        next false unless @state == from
+
+        @state = to
+        true
       end
-      raise e
     end
   end
 
-  def start_accept_worker_thread
-    fiber = Fiber.current
-    @accept_worker_thread = Thread.new do
-      fiber << Fiber.current
+  attr_reader :ctx
+
+  # Maximum duration of a handshake in seconds, or nil for no limit.
+  attr_accessor :handshake_timeout
+
+  # Sets the number of threads used for performing handshakes. If zero,
+  # handshakes are performed on the accepting thread, using non-blocking
+  # steps. This should be set before accepting connections.
+  attr_writer :handshake_threads
+
+  # Returns the number of handshake threads. When @ctx.servername_cb is set,
+  # at least one thread is used, because:
+  # - We cannot switch fibers inside of the servername_cb proc (see
+  #   https://github.com/ruby/openssl/issues/415)
+  # - We don't want to stop the world while we're busy provisioning an ACME
+  #   certificate
+  def handshake_threads
+    @handshake_threads || (@ctx.servername_cb ? 1 : 0)
+  end
+
+  # Returns handshake statistics: the number of handshakes in progress, the
+  # current and maximum depth of the handshake thread queue, and the number of
+  # completed and failed handshakes.
+  def handshake_stats
+    stats = (@handshake_stats ||= new_handshake_stats)
+    stats.merge(queue_depth: @handshake_queue ? @handshake_queue.size : 0)
+  end
+
+  alias_method :orig_accept, :accept
+  def accept
+    sock, = @svr.accept
+    accept_handshake(sock)
+  end
+
+  # Accepts connections in a loop, yielding each connection once its handshake
+  # is done. Connections are accepted on a separate fiber, and handshakes are
+  # performed concurrently, so a slow handshake does not hold back connections
+  # accepted after it. Handshake errors are ignored unless ignore_errors is
+  # false.
+  def accept_loop(ignore_errors = true)
+    ready = Polyphony::Queue.new
+    acceptor = spin do
       loop do
-        # STDOUT.puts "- accept_worker wait for work"
-        socket, peer = receive
-        # STDOUT.puts "- accept_worker got socket from peer #{peer.inspect}"
-        socket.accept
-        # STDOUT.puts "- accept_worker accept returned"
-        peer << socket
-        # STDOUT.puts "- accept_worker sent socket back to peer"
-      rescue Polyphony::BaseException
-        raise
-      rescue Exception => e
-        # STDOUT.puts "- accept_worker error: #{e}"
-        peer << e if peer
+        sock, = @svr.accept
+        spin do
+          ready << accept_handshake(sock)
+        rescue SystemCallError, StandardError => e
+          ready << e unless ignore_errors
+        end
+      rescue SystemCallError => e
+        raise e unless ignore_errors
       end
+    rescue Exception => e
+      ready << e
     end
-    @accept_worker_fiber = receive
-  end
 
-  def use_accept_worker_thread?
-    !!@ctx.servername_cb
+    loop do
+      conn = ready.shift
+      conn.is_a?(Exception) ? raise(conn) : yield(conn)
+    end
+  ensure
+    acceptor&.stop
+    acceptor&.await
+    ready&.shift_all&.each { |c| c.close unless c.is_a?(Exception) }
   end
 
   alias_method :orig_close, :close
   def close
-    @accept_worker_thread&.kill
+    @handshake_workers&.each(&:kill)
     orig_close
   end
 
-  def accept_loop(ignore_errors = true)
-    loop do
-      yield accept
-    rescue SystemCallError, StandardError => e
-      raise e unless ignore_errors
+  private
+
+  def new_handshake_stats
+    { in_progress: 0, max_queue_depth: 0, completed: 0, failed: 0 }
+  end
+
+  def accept_handshake(sock)
+    ssl = OpenSSL::SSL::SSLSocket.new(sock, @ctx)
+    ssl.sync_close = true
+    stats = (@handshake_stats ||= new_handshake_stats)
+    stats[:in_progress] += 1
+    if handshake_threads > 0
+      request = HandshakeRequest.new(ssl, Fiber.current)
+      handshake_on_worker_thread(request, stats)
+    else
+      handshake(ssl)
+    end
+    stats[:completed] += 1
+    ssl
+  rescue Exception => e
+    stats[:failed] += 1 if stats
+    # a socket still being handshaked is closed by the worker
+    (ssl || sock).close unless request&.cancel
+    raise e
+  ensure
+    stats[:in_progress] -= 1 if stats
+  end
+
+  def handshake(ssl)
+    if @handshake_timeout
+      cancel_after(@handshake_timeout, with_exception: HandshakeTimeoutError) { ssl.accept }
+    else
+      ssl.accept
+    end
+  end
+
+  def handshake_on_worker_thread(request, stats)
+    start_handshake_workers unless @handshake_queue
+    @handshake_queue << request
+    depth = @handshake_queue.size
+    stats[:max_queue_depth] = depth if depth > stats[:max_queue_depth]
+    r = receive
+    r.invoke if r.is_a?(Exception)
+  end
+
+  def start_handshake_workers
+    @handshake_queue = Polyphony::Queue.new
+    @handshake_workers = Array.new(handshake_threads) do
+      Thread.new do
+        loop do
+          request = @handshake_queue.shift
+          next unless request.start
+
+          begin
+            handshake(request.ssl)
+            result = request.ssl
+          rescue Polyphony::BaseException
+            raise
+          rescue Exception => e
+            result = e
+          end
+          request.finish ? request.peer << result : request.ssl.close
+        end
+      end
     end
   end
 end
@@ -4,11 +4,23 @@ require 'socket'
 
 require_relative './io'
 require_relative '../core/thread_pool'
+require_relative '../core/resolver'
 
 class BasicSocket
   def __parser_read_method__
     :backend_recv
   end
+
+  # Closes the socket. The final close is performed by the backend, so closing
+  # a socket with SO_LINGER set does not block the thread.
+  def close
+    Polyphony.backend_close(self)
+  end
+
+  def shutdown(how = :RDWR)
+    how = how.to_sym if how.is_a?(String)
+    Polyphony.backend_shutdown(self, how)
+  end
 end
 
 # Socket overrides (eventually rewritten in C)
@@ -24,8 +36,8 @@ class ::Socket
   NO_EXCEPTION = { exception: false }.freeze
 
   def connect(addr)
-    addr = Addrinfo.new(addr) if addr.is_a?(String)
-    Polyphony.backend_connect(self, addr.ip_address, addr.ip_port)
+    addr = addr.to_sockaddr if addr.is_a?(Addrinfo)
+    Polyphony.backend_connect(self, addr, nil)
   end
 
   alias_method :orig_read, :read
@@ -106,10 +118,60 @@ class ::Socket
     setsockopt(::Socket::SOL_SOCKET, ::Socket::SO_REUSEPORT, 1)
   end
 
+  # Delay between connection attempts, as recommended by RFC 8305
+  CONNECT_ATTEMPT_DELAY = 0.25
+
+  class << self
+    alias_method :orig_getaddrinfo, :getaddrinfo
+    # Names are resolved using Polyphony::Resolver, falling back to the system
+    # resolver, run on the thread pool, if no name server can be reached.
+    # Reverse lookups are always performed by the system resolver.
+    def getaddrinfo(host, port, family = nil, socktype = nil, protocol = nil, flags = nil, reverse_lookup = nil)
+      args = [port, family, socktype, protocol]
+      reverse = reverse_lookup.nil? ? !BasicSocket.do_not_reverse_lookup : reverse_lookup
+      return Polyphony::ThreadPool.process { orig_getaddrinfo(host, *args, flags, reverse_lookup) } if reverse
+      return orig_getaddrinfo(host, *args, flags, reverse_lookup) unless Polyphony::Resolver.name_lookup?(host, family, flags)
+
+      Polyphony::Resolver.default.resolve(host, family).flat_map do |address|
+        orig_getaddrinfo(address, *args, flags.to_i | Socket::AI_NUMERICHOST, false)
+      end
+    rescue Polyphony::Resolver::Unavailable
+      Polyphony::ThreadPool.process { orig_getaddrinfo(host, *args, flags, reverse_lookup) }
+    end
+
+    # Connects to the first of the given addrinfos to accept the connection
+    # and returns the connected socket. Attempts are started one after the
+    # other, separated by the given delay, alternating between address
+    # families, and are raced against each other (Happy Eyeballs, RFC 8305).
+    def connect_racing(addrinfos, stagger_delay = CONNECT_ATTEMPT_DELAY)
+      Polyphony.backend_connect_racing(interleave_address_families(addrinfos), stagger_delay)
+    end
+
+    private
+
+    def interleave_address_families(addrinfos)
+      first, second = addrinfos.partition { |a| a.afamily == addrinfos.first.afamily }
+      return first if second.empty?
+
+      first.zip(second).flatten.compact + second.drop(first.size)
+    end
+  end
+end
+
+class ::Addrinfo
   class << self
     alias_method :orig_getaddrinfo, :getaddrinfo
-    def getaddrinfo(*args)
-      Polyphony::ThreadPool.process { orig_getaddrinfo(*args) }
+    # Names are resolved using Polyphony::Resolver, falling back to the system
+    # resolver, run on the thread pool, if no name server can be reached.
+    def getaddrinfo(nodename, service, family = nil, socktype = nil, protocol = nil, flags = nil)
+      args = [service, family, socktype, protocol]
+      return orig_getaddrinfo(nodename, *args, flags) unless Polyphony::Resolver.name_lookup?(nodename, family, flags)
+
+      Polyphony::Resolver.default.resolve(nodename, family).flat_map do |address|
+        orig_getaddrinfo(address, *args, flags.to_i | Socket::AI_NUMERICHOST)
+      end
+    rescue Polyphony::Resolver::Unavailable
+      Polyphony::ThreadPool.process { orig_getaddrinfo(nodename, *args, flags) }
     end
   end
 end
@@ -121,16 +183,10 @@ class ::TCPSocket
   attr_reader :io
 
   def initialize(remote_host, remote_port, local_host = nil, local_port = nil)
-    @io = Socket.new Socket::AF_INET, Socket::SOCK_STREAM
-    if local_host && local_port
-      addr = Addrinfo.tcp(local_host, local_port)
-      @io.bind(addr)
-    end
-
-    return unless remote_host && remote_port
+    return connect_from(local_host, local_port, remote_host, remote_port) if local_host && local_port
+    return @io = Socket.new(Socket::AF_INET, Socket::SOCK_STREAM) unless remote_host && remote_port
 
-    addr = Addrinfo.tcp(remote_host, remote_port)
-    @io.connect(addr)
+    @io = Socket.connect_racing(Addrinfo.getaddrinfo(remote_host, remote_port, nil, :STREAM))
   end
 
   alias_method :orig_close, :close
@@ -138,6 +194,15 @@ class ::TCPSocket
     @io ? @io.close : orig_close
   end
 
+  private def connect_from(local_host, local_port, remote_host, remote_port)
+    local_addr = Addrinfo.getaddrinfo(local_host, local_port, nil, :STREAM).first
+    @io = Socket.new(local_addr.afamily, Socket::SOCK_STREAM)
+    @io.bind(local_addr)
+    return unless remote_host && remote_port
+
+    @io.connect(Addrinfo.getaddrinfo(remote_host, remote_port, local_addr.afamily, :STREAM).first)
+  end
+
   alias_method :orig_setsockopt, :setsockopt
   def setsockopt(*args)
     @io ? @io.setsockopt(*args) : orig_setsockopt(*args)
@@ -224,8 +289,9 @@ end
 # Override stock TCPServer code by encapsulating a Socket instance.
 class ::TCPServer
   def initialize(hostname = nil, port = 0)
-    @io = Socket.new Socket::AF_INET, Socket::SOCK_STREAM
-    @io.bind(Addrinfo.tcp(hostname, port))
+    addr = Addrinfo.getaddrinfo(hostname, port, nil, :STREAM).first
+    @io = Socket.new addr.afamily, Socket::SOCK_STREAM
+    @io.bind(addr)
     @io.listen(0)
   end
 
@@ -286,18 +352,6 @@ class ::UNIXSocket
     Polyphony.backend_recv_feed_loop(self, receiver, method, &block)
   end
 
-  def send(mesg, flags)
-    Polyphony.backend_send(self, mesg, flags)
-  end
-
-  def write(*args)
-    Polyphony.backend_sendv(self, args, 0)
-  end
-
-  def <<(mesg)
-    Polyphony.backend_send(self, mesg, 0)
-  end
-
   def readpartial(maxlen, str = +'', buffer_pos = 0, raise_on_eof = true)
     result = Polyphony.backend_recv(self, str, maxlen, buffer_pos)
     raise EOFError if !result && raise_on_eof
@@ -311,4 +365,50 @@ class ::UNIXSocket
   def write_nonblock(buf, exception: true)
     @io.write_nonblock(buf, exception: exception)
   end
-end
\ No newline at end of file
+end
+
+# UDPSocket overrides. Peer addresses are given as packed sockaddr strings
+# (e.g. as returned by Socket.sockaddr_in or Addrinfo#to_sockaddr).
+class ::UDPSocket
+  def recvfrom(maxlen, flags = 0)
+    data, addr = Polyphony.backend_recvfrom(self, maxlen, flags)
+    return [data, nil] unless addr
+
+    addr = Addrinfo.new(addr)
+    family = addr.ipv6? ? 'AF_INET6' : 'AF_INET'
+    [data, [family, addr.ip_port, addr.ip_address, addr.ip_address]]
+  end
+
+  def recv(maxlen, flags = 0, outbuf = nil)
+    data, = Polyphony.backend_recvfrom(self, maxlen, flags)
+    outbuf ? outbuf.replace(data) : data
+  end
+
+  def send(mesg, flags, *dest)
+    Polyphony.backend_sendto(self, mesg, flags, dest_sockaddr(dest))
+  end
+
+  # Receives up to count datagrams, each of up to maxlen bytes, waiting for at
+  # least one datagram to arrive. Returns an array of [data, sockaddr] pairs.
+  def recvmmsg(count = 64, maxlen = 2048)
+    Polyphony.backend_recvmmsg(self, count, maxlen)
+  end
+
+  # Sends the given datagrams, each either a string, sent to the given
+  # destination (or to the connected peer), or a [data, sockaddr] pair.
+  # Returns the number of datagrams sent.
+  def sendmmsg(msgs, *dest)
+    Polyphony.backend_sendmmsg(self, msgs, dest_sockaddr(dest))
+  end
+
+  private
+
+  def dest_sockaddr(dest)
+    case dest.size
+    when 0 then nil
+    when 1 then dest.first.is_a?(Addrinfo) ? dest.first.to_sockaddr : dest.first
+    when 2 then Socket.sockaddr_in(dest[1], dest[0])
+    else raise ArgumentError, "wrong number of arguments (given #{dest.size + 2}, expected 2..4)"
+    end
+  end
+end
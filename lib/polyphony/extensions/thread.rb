@@ -18,7 +18,7 @@ class ::Thread
   def execute
     # backend must be created in the context of the new thread, therefore it
     # cannot be created in Thread#initialize
-    @backend = Polyphony::Backend.new
+    self.backend = Polyphony::Backend.new
     setup
     @ready = true
     result = @block.(*@args)
@@ -31,7 +31,7 @@ class ::Thread
     finalize(result)
   end
 
-  attr_accessor :backend
+  attr_reader :backend
 
   def setup
     @main_fiber = Fiber.current
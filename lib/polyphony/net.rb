@@ -2,6 +2,7 @@
 
 require_relative './extensions/socket'
 require_relative './extensions/openssl'
+require_relative './core/listener_group'
 
 module Polyphony
   # A more elegant networking API
@@ -16,9 +17,14 @@ module Polyphony
         end
       end
 
-      def tcp_listen(host = nil, port = nil, opts = {})
+      # Creates a listening socket. If the threads option is given, a listening
+      # socket is created for each thread, and a ListenerGroup running the
+      # given block for each accepted connection is returned instead (see
+      # tcp_listener_group).
+      def tcp_listen(host = nil, port = nil, opts = {}, &block)
         host ||= '0.0.0.0'
         raise 'Port number not specified' unless port
+        return tcp_listener_group(host, port, opts, &block) if opts[:threads]
 
         socket = listening_socket_from_options(host, port, opts)
         if opts[:secure_context] || opts[:secure]
@@ -28,12 +34,38 @@ module Polyphony
         end
       end
 
+      # Creates a ListenerGroup with opts[:threads] threads, each accepting
+      # connections on its own listening socket, bound to the same port using
+      # SO_REUSEPORT. If port is 0, all sockets are bound to the port picked
+      # for the first one. If the cpu_affinity option is set, connections are
+      # distributed according to the CPU they were received on, rather than by
+      # a hash of their addresses, which keeps a connection on the CPU
+      # processing its packets, given sufficient RX queues (see
+      # BasicSocket#attach_reuse_port_cpu_filter).
+      def tcp_listener_group(host, port, opts, &block)
+        opts = opts.merge(reuse_port: true)
+        sockets = []
+        opts[:threads].times do
+          socket = listening_socket_from_options(host, port, opts)
+          sockets << socket
+          port = socket.local_address.ip_port
+        end
+        sockets.first.attach_reuse_port_cpu_filter(sockets.size) if opts[:cpu_affinity]
+        if opts[:secure_context] || opts[:secure]
+          sockets.map! { |s| secure_server(s, opts[:secure_context], opts) }
+        end
+        ListenerGroup.new(sockets, &block)
+      rescue Exception
+        sockets.each(&:close)
+        raise
+      end
+
       def listening_socket_from_options(host, port, opts)
         ::Socket.new(:INET, :STREAM).tap do |s|
           s.reuse_addr if opts[:reuse_addr]
           s.dont_linger if opts[:dont_linger]
           s.reuse_port if opts[:reuse_port]
-          addr = ::Socket.sockaddr_in(port, host)
+          addr = Addrinfo.getaddrinfo(host, port, :INET, :STREAM).first
           s.bind(addr)
           s.listen(opts[:backlog] || Socket::SOMAXCONN)
         end
@@ -1,6 +1,7 @@
 # frozen_string_literal: true
 
 require_relative 'helper'
+require 'fcntl'
 
 class BackendTest < MiniTest::Test
   def setup
@@ -15,6 +16,24 @@ class BackendTest < MiniTest::Test
     Thread.current.backend = @prev_backend
   end
 
+  def test_backend_kind
+    assert_equal Polyphony::Backend.default_kind, @backend.kind
+    assert_kind_of Polyphony::Backend, @backend
+    assert_raises(TypeError) { Polyphony::Backend.allocate }
+  end
+
+  def test_runtime_backend_selection
+    # a thread may use a different backend implementation
+    kind = Thread.new do
+      Thread.current.backend.finalize
+      Thread.current.backend = Polyphony::Backend::Libev.new
+      r, w = IO.pipe
+      spin { w << 'foo'; w.close }
+      [Thread.current.backend.kind, r.read]
+    end.value
+    assert_equal [:libev, 'foo'], kind
+  end
+
   def test_sleep
     count = 0
     t0 = Time.now
@@ -188,6 +207,30 @@ class BackendTest < MiniTest::Test
     assert_equal ['foo', 'bar'], buf
   end
 
+  def test_read_loop_with_big_chunks
+    r, w = IO.pipe
+
+    data = 'x' * 50_000
+    spin { w << data; w.close }
+    buf = []
+    @backend.read_loop(r, 65536) { |d| buf << d }
+    assert_equal data, buf.join
+  end
+
+  def test_read_loop_multiple_fibers
+    pipes = 300.times.map { IO.pipe }
+    bufs = pipes.map { [] }
+    fibers = pipes.each_with_index.map do |(r, _), idx|
+      spin { @backend.read_loop(r, 8192) { |d| bufs[idx] << d } }
+    end
+    snooze
+
+    pipes.each_with_index { |(_, w), idx| w << "foo#{idx}" }
+    pipes.each { |(_, w)| w.close }
+    fibers.each(&:await)
+    assert_equal pipes.size.times.map { |idx| "foo#{idx}" }, bufs.map(&:join)
+  end
+
   Net = Polyphony::Net
 
   def test_accept
@@ -242,6 +285,108 @@ class BackendTest < MiniTest::Test
     server&.close
   end
 
+  def test_accept_loop_burst
+    server = Net.listening_socket_from_options('127.0.0.1', 1236, reuse_addr: true)
+
+    clients = []
+    server_fiber = spin do
+      @backend.accept_loop(server, TCPSocket) do |c|
+        clients << c
+        break if clients.size == 10
+      end
+      :done
+    end
+
+    sockets = 12.times.map { TCPSocket.new('127.0.0.1', 1236) }
+    assert_equal :done, server_fiber.await
+    assert_equal 10, clients.size
+  ensure
+    sockets&.each(&:close)
+    clients&.each(&:close)
+    server&.close
+  end
+
+  def test_accept_loop_break_with_pending_connections
+    server = Net.listening_socket_from_options('127.0.0.1', 1238, reuse_addr: true)
+
+    clients = []
+    sockets = 3.times.map { TCPSocket.new('127.0.0.1', 1238) }
+    sleep 0.01
+    @backend.accept_loop(server, TCPSocket) do |c|
+      clients << c
+      sleep 0.01
+      break
+    end
+
+    # connections accepted after the loop was done are not dropped
+    move_on_after(1) { 2.times { clients << @backend.accept(server, TCPSocket) } }
+    sockets.each_with_index { |s, i| s << i.to_s }
+    assert_equal %w{0 1 2}, clients.map { |c| c.readpartial(8192) }
+  ensure
+    sockets&.each(&:close)
+    clients&.each(&:close)
+    server&.close
+  end
+
+  def test_recv_loop
+    server = Net.listening_socket_from_options('127.0.0.1', 1237, reuse_addr: true)
+    client = TCPSocket.new('127.0.0.1', 1237)
+    conn = @backend.accept(server, TCPSocket)
+
+    buf = []
+    f = spin do
+      @backend.recv_loop(conn, 65536) { |d| buf << d }
+      :eof
+    end
+    snooze
+    client << 'foo'
+    sleep 0.01
+    client << 'bar'
+    sleep 0.01
+    client.close
+    assert_equal :eof, f.await
+    assert_equal ['foo', 'bar'], buf
+  ensure
+    conn&.close
+    server&.close
+  end
+
+  def test_recv_loop_break_mid_stream
+    server = Net.listening_socket_from_options('127.0.0.1', 1239, reuse_addr: true)
+    client = TCPSocket.new('127.0.0.1', 1239)
+    conn = @backend.accept(server, TCPSocket)
+
+    buf = []
+    f = spin do
+      @backend.recv_loop(conn, 65536) do |d|
+        buf << d
+        sleep 0.02
+        break
+      end
+    end
+    client << 'a' * 10
+    sleep 0.01
+    client << 'b' * 10
+    sleep 0.005
+    client << 'c' * 10
+    f.await
+    client.close
+
+    # nothing is read past the loop, so the rest of the data is left in the
+    # socket, for any reader to receive
+    while (data = conn.orig_read_nonblock(65536, exception: false))
+      if data == :wait_readable
+        @backend.wait_io(conn, false)
+        next
+      end
+      buf << data
+    end
+    assert_equal 'a' * 10 + 'b' * 10 + 'c' * 10, buf.join
+  ensure
+    conn&.close
+    server&.close
+  end
+
   def test_timer_loop
     skip unless IS_LINUX
 
@@ -307,6 +452,30 @@ class BackendTest < MiniTest::Test
     assert_equal [1], buffer
   end
 
+  def test_many_pending_timeouts
+    skip unless IS_LINUX
+
+    results = []
+    fibers = 200.times.map do |i|
+      spin do
+        # most timeouts are cancelled early, only those with i % 50 == 0 fire
+        results << @backend.timeout(i % 50 == 0 ? 0.01 : 10, nil, :timeout) do
+          @backend.sleep(i % 50 == 0 ? 1 : 0.02)
+          :done
+        end
+      end
+    end
+    # a timeout sooner than all pending deadlines
+    t0 = Time.now
+    result = @backend.timeout(0.005, nil, :early) { @backend.sleep(1) }
+    assert_equal :early, result
+    assert_in_range 0..0.05, Time.now - t0
+
+    fibers.each(&:await)
+    assert_equal 4, results.count(:timeout)
+    assert_equal 196, results.count(:done)
+  end
+
   def test_splice
     i1, o1 = IO.pipe
     i2, o2 = IO.pipe
@@ -386,6 +555,411 @@ class BackendTest < MiniTest::Test
     w.close
   end
 
+  def test_readv
+    i, o = IO.pipe
+    o << 'abcdefghijklmnop'
+
+    header = +"\0" * 4
+    body = +''
+    assert_equal 10, @backend.readv(i, [header, [body, 6]])
+    assert_equal 'abcd', header
+    assert_equal 'efghij', body
+
+    # short read
+    assert_equal 6, @backend.readv(i, [[header, 4], [body, 10]])
+    assert_equal 'klmn', header
+    assert_equal 'op', body
+
+    o.close
+    assert_nil @backend.readv(i, [[header, 4]])
+    assert_equal '', header
+
+    assert_raises(ArgumentError) { @backend.readv(i, []) }
+    assert_raises(TypeError) { @backend.readv(i, [1]) }
+  end
+
+  def test_readv_empty_buffers
+    i, o = IO.pipe
+    o << 'abcdefghijklmnop'
+
+    # empty strings are read into up to their capacity
+    buffer = String.new(capacity: 8)
+    len = @backend.readv(i, [buffer])
+    assert_operator len, :>=, 8
+    assert_equal 'abcdefghijklmnop'[0, len], buffer
+
+    assert_raises(ArgumentError) { @backend.readv(i, [[+'', 0]]) }
+    assert_raises(ArgumentError) { @backend.readv(i, [[+'foo', 0], [+'', 0]]) }
+  ensure
+    i&.close
+    o&.close
+  end
+
+  def test_sendfile
+    content = IO.orig_read(__FILE__)
+    buf = +''
+    r, w = IO.pipe
+    reader = spin { r.read_loop { |data| buf << data } }
+
+    File.open(__FILE__, 'r') do |f|
+      assert_equal content.bytesize - 10, @backend.sendfile(f, w, 10, nil)
+      assert_equal 16, @backend.sendfile(f, w, 4, 16)
+    end
+    w.close
+    reader.await
+
+    assert_equal content[10..] + content[4, 16], buf
+  ensure
+    w.close
+    r.close
+  end
+
+  def test_sendfile_chunks
+    body = IO.orig_read(__FILE__)[0, 30]
+    buf = +''
+    r, w = IO.pipe
+    reader = spin { r.read_loop { |data| buf << data } }
+
+    File.open(__FILE__, 'r') do |f|
+      len = @backend.sendfile(f, w, 0, 30, ->(len) { "#{len.to_s(16)}\r\n" }, "\r\n", 12)
+      assert_equal 30, len
+    end
+    w.close
+    reader.await
+
+    expected = "c\r\n#{body[0, 12]}\r\nc\r\n#{body[12, 12]}\r\n6\r\n#{body[24, 6]}\r\n"
+    assert_equal expected, buf
+  ensure
+    w.close
+    r.close
+  end
+
+  def test_sendfile_chunks_past_eof
+    fn = '/tmp/polyphony_sendfile_test'
+    body = 'a' * 20
+    IO.orig_write(fn, body)
+    buf = +''
+    r, w = IO.pipe
+    reader = spin { r.read_loop { |data| buf << data } }
+
+    File.open(fn, 'r') do |f|
+      len = @backend.sendfile(f, w, 0, 100, ->(len) { "#{len.to_s(16)}\r\n" }, "\r\n", 12)
+      assert_equal 20, len
+    end
+    w.close
+    reader.await
+
+    assert_equal "c\r\n#{body[0, 12]}\r\n8\r\n#{body[12, 8]}\r\n", buf
+  ensure
+    w.close
+    r.close
+    FileUtils.rm_f(fn)
+  end
+
+  def test_poll_policy
+    assert_equal({ min_complete: 1, max_wait: nil, busy_spin: nil }, @backend.poll_policy)
+
+    @backend.poll_policy = { min_complete: 4, max_wait: 0.005, busy_spin: 0.0001 }
+    assert_equal({ min_complete: 4, max_wait: 0.005, busy_spin: 0.0001 }, @backend.poll_policy)
+
+    assert_raises(ArgumentError) { @backend.poll_policy = { min_complete: 4 } }
+    assert_raises(ArgumentError) { @backend.poll_policy = { min_complete: 0 } }
+    assert_raises(ArgumentError) { @backend.poll_policy = { max_wait: -1 } }
+  end
+
+  def test_poll_policy_batched_completions
+    @backend.poll_policy = { min_complete: 8, max_wait: 0.05 }
+    @backend.stats
+
+    count = 0
+    t0 = Time.now
+    10.times.map { spin { @backend.sleep(0.01); count += 1 } }.each(&:await)
+    elapsed = Time.now - t0
+    stats = @backend.stats
+
+    assert_equal 10, count
+    assert_in_range 0.01..0.08, elapsed if IS_LINUX
+    assert stats[:completion_count] >= 10
+    assert stats[:max_poll_completions] > 1
+  end
+
+  def test_extended_stats
+    assert_nil @backend.extended_stats
+    @backend.extended_stats = true
+
+    i, o = IO.pipe
+    spin { @backend.write(o, 'foobar'); o.close }
+    assert_equal 'foobar', @backend.read(i, +'', 6, true, 0)
+    @backend.sleep(0.01)
+    t0 = Time.now
+    nil while Time.now - t0 < 0.01
+    snooze
+
+    stats = @backend.extended_stats
+    assert stats.frozen?
+    assert_equal 6, stats[:bytes_read]
+    assert_equal 6, stats[:bytes_written]
+    assert stats[:poll_wait_time] > 0
+    assert_in_range 0..stats[:uptime], stats[:run_time]
+    assert stats[:max_run_slice] >= 0.01
+
+    read_stats = stats[:ops][:read]
+    assert read_stats[:count] >= 1
+    assert stats[:ops][:write][:count] >= 1
+    bounds = read_stats[:latency_buckets].map(&:first)
+    assert_equal bounds.sort, bounds
+    assert_equal read_stats[:count], read_stats[:latency_buckets].last.last
+    assert read_stats[:latency_max] <= read_stats[:latency_sum]
+
+    @backend.extended_stats = false
+    assert_nil @backend.extended_stats
+  end
+
+  def test_trace_ring
+    @backend.trace_ring = 1000
+    i, o = IO.pipe
+    f = spin { @backend.read(i, +'', 3, false, 0) }
+    snooze
+    @backend.write(o, 'foo')
+    f.await
+
+    records = @backend.trace_ring_drain
+    events = records.map { |r| r[1] }
+    assert_includes events, :fiber_switchpoint
+    assert_includes events, :fiber_run
+    assert_includes events, :fiber_schedule
+    assert_equal records.map(&:first).sort, records.map(&:first)
+
+    read = records.select { |r| r[1] == :op_complete && r[3] == :read }.last
+    assert_equal [i.fileno, 3], read.values_at(5, 7)
+    if @backend.kind == :io_uring
+      submit = records.find { |r| r[1] == :op_submit && r[4] == read[4] }
+      assert_equal [:read, i.fileno, 3], submit.values_at(3, 5, 6)
+    end
+    assert_equal [], @backend.trace_ring_drain
+
+    snooze
+    dump = @backend.trace_ring_dump
+    assert_equal 0, dump.bytesize % 40
+    count = dump.bytesize / 40
+    assert count > 0
+    unpacked = dump.unpack(Polyphony::Backend::TRACE_RECORD_FORMAT * count).each_slice(9).to_a
+    # snoozing schedules the current fiber, then switches to it
+    assert_equal [:fiber_schedule, :fiber_switchpoint, :fiber_run],
+      unpacked.first(3).map { |r| Polyphony::Backend::TRACE_EVENTS[r[2]] }
+
+    @backend.trace_ring = 4
+    10.times { snooze }
+    assert_equal 4, @backend.trace_ring_drain(10).size
+    assert @backend.trace_ring_dropped > 0
+  ensure
+    @backend.trace_ring = nil
+  end
+
+  def test_watchdog
+    reports = []
+    @backend.watchdog(0.05) { |r| reports << r }
+    @backend.stats
+
+    @backend.sleep(0.1)
+    assert_equal [], reports
+
+    f = spin do
+      t0 = Time.now
+      nil while Time.now - t0 < 0.3
+    end
+    f.await
+    snooze
+
+    assert_equal 1, reports.size
+    report = reports.first
+    assert_equal f, report[:fiber]
+    assert report[:run_time] >= 0.05
+    assert_kind_of Array, report[:backtrace]
+    assert report.frozen?
+    assert_equal 1, @backend.watchdog_hit_count
+    assert_equal 1, @backend.stats[:watchdog_hit_count]
+
+    @backend.watchdog(nil)
+    spin { t0 = Time.now; nil while Time.now - t0 < 0.1 }.await
+    assert_equal 1, reports.size
+  ensure
+    @backend.watchdog(nil)
+  end
+
+  def test_register_io
+    i, o = IO.pipe
+    registered = @backend.register_io(o)
+    assert_equal @backend.kind == :io_uring, registered
+    @backend.register_io(i)
+
+    @backend.write(o, 'foo')
+    @backend.write(o, 'bar')
+    assert_equal 'foobar', @backend.read(i, +'', 6, false, 0)
+
+    assert_equal registered, @backend.unregister_io(o)
+    assert_equal false, @backend.unregister_io(o)
+    @backend.write(o, 'baz')
+    o.close
+    assert_equal 'baz', @backend.read(i, +'', 6, false, 0)
+  ensure
+    @backend.unregister_io(i)
+  end
+
+  def test_register_io_close
+    i, o = IO.pipe
+    assert_equal @backend.kind == :io_uring, @backend.register_io(o)
+
+    o.close
+    result = move_on_after(1, with_value: :timeout) { i.readpartial(6) rescue EOFError }
+    assert_equal EOFError, result
+  ensure
+    i&.close
+  end
+
+  def test_register_io_high_fd
+    skip unless @backend.kind == :io_uring
+
+    high_fd = 5000
+    limit, max = Process.getrlimit(:NOFILE)
+    if limit <= high_fd
+      skip "RLIMIT_NOFILE too low" if max != Process::RLIM_INFINITY && max <= high_fd
+      Process.setrlimit(:NOFILE, high_fd + 1, max)
+    end
+
+    # the registered files table is sized when the first io is registered
+    backend = Polyphony::Backend.new
+    Thread.current.backend = backend
+
+    i, o = IO.pipe
+    ho = IO.for_fd(o.fcntl(Fcntl::F_DUPFD, high_fd), autoclose: true)
+    o.close
+    assert ho.fileno >= high_fd
+    assert_equal true, backend.register_io(ho)
+
+    backend.write(ho, 'foo')
+    assert_equal 'foo', backend.read(i, +'', 3, true, 0)
+    assert_equal true, backend.unregister_io(ho)
+  ensure
+    ho&.close
+    i&.close
+    backend&.finalize
+    Process.setrlimit(:NOFILE, limit, max) if limit
+  end
+
+  def test_sqpoll
+    skip unless @backend.kind == :io_uring
+
+    begin
+      backend = Polyphony::Backend.new(sqpoll: true, sqpoll_idle: 0.01)
+    rescue Errno::EPERM, Errno::EINVAL
+      skip 'SQPOLL not available'
+    end
+    Thread.current.backend = backend
+
+    i, o = IO.pipe
+    spin { backend.write(o, 'foo'); backend.sleep(0.05); backend.write(o, 'bar'); o.close }
+    assert_equal 'foobar', backend.read(i, +'', 6, true, 0)
+  ensure
+    backend&.finalize
+  end
+
+  def test_sq_full
+    skip unless @backend.kind == :io_uring
+
+    backend = Polyphony::Backend.new(sq_entries: 8)
+    Thread.current.backend = backend
+    backend.stats
+
+    pipes = 20.times.map { IO.pipe }
+    fibers = pipes.map do |(_i, o)|
+      spin { backend.chain([:write, o, 'foo'], [:write, o, 'bar'], [:write, o, 'baz']) }
+    end
+    assert_equal [[3, 3, 3]] * 20, fibers.map(&:await)
+    pipes.each { |(i, _o)| assert_equal 'foobarbaz', i.readpartial(9) }
+    assert backend.stats[:sq_full_count] > 0
+
+    assert_raises(ArgumentError) { backend.chain(*([[:write, pipes[0][1], 'foo']] * 9)) }
+    assert_raises(ArgumentError) { Polyphony::Backend.new(sq_entries: 0) }
+  ensure
+    backend&.finalize
+  end
+
+  def test_sq_full_sqpoll
+    skip unless @backend.kind == :io_uring
+
+    begin
+      backend = Polyphony::Backend.new(sqpoll: true, sq_entries: 8)
+    rescue Errno::EPERM, Errno::EINVAL
+      skip 'SQPOLL not available'
+    end
+    Thread.current.backend = backend
+
+    pipes = 20.times.map { IO.pipe }
+    fibers = pipes.map do |(_i, o)|
+      spin { backend.chain([:write, o, 'foo'], [:write, o, 'bar'], [:write, o, 'baz']) }
+    end
+    assert_equal [[3, 3, 3]] * 20, fibers.map(&:await)
+    pipes.each { |(i, _o)| assert_equal 'foobarbaz', i.readpartial(9) }
+    assert backend.stats[:sq_full_count] > 0
+  ensure
+    backend&.finalize
+  end
+
+  def test_op_context_store_trim
+    skip unless @backend.kind == :io_uring
+
+    backend = Polyphony::Backend.new(op_context_watermark: 64, op_context_trim_interval: 0.02)
+    Thread.current.backend = backend
+
+    i, o = IO.pipe
+    readers = 1000.times.map { spin { backend.wait_io(i, false) } }
+    snooze
+    stats = backend.stats
+    assert_equal 1000, stats[:op_context_taken_count]
+    assert stats[:op_context_count] >= 1000
+
+    o << 'foo'
+    readers.each(&:await)
+    3.times { backend.sleep(0.03) }
+    stats = backend.stats
+    assert_equal 0, stats[:op_context_taken_count]
+    assert_equal 64, stats[:op_context_count]
+  ensure
+    backend&.finalize
+  end
+
+  def test_send_zc
+    port = rand(1234..5678)
+    server = TCPServer.new('127.0.0.1', port)
+    received = +''
+    server_fiber = spin do
+      socket = server.accept
+      while (data = socket.readpartial(65536) rescue nil)
+        received << data
+      end
+    end
+
+    snooze
+    client = TCPSocket.new('127.0.0.1', port)
+    @backend.send_zc_threshold = 1024
+    data = 'x' * 300_000
+    assert_equal 300_000, @backend.send(client, data, 0)
+    # the buffer may still be read by the kernel after the send returns
+    mutable = +'y' * 300_000
+    assert_equal 300_000, @backend.send(client, mutable, 0)
+    mutable.tr!('y', 'z')
+    assert_equal 3, @backend.send(client, 'foo', 0)
+    @backend.sendv(client, ['bar' * 500, 'baz' * 500], 0)
+    client.close
+    server_fiber.await
+
+    assert_equal data + 'y' * 300_000 + 'foo' + 'bar' * 500 + 'baz' * 500, received
+  ensure
+    server_fiber&.stop
+    server&.close
+  end
+
   def test_idle_gc
     GC.disable
 
@@ -423,6 +997,60 @@ class BackendTest < MiniTest::Test
     GC.enable
   end
 
+  def timed_sleeps(count, duration)
+    count.times.map do
+      t0 = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      sleep duration
+      Process.clock_gettime(Process::CLOCK_MONOTONIC) - t0
+    end
+  end
+
+  def test_idle_gc_budget
+    GC.disable
+    assert_nil @backend.idle_gc_budget
+
+    @backend.idle_gc_period = 0.01
+    @backend.idle_gc_max_defer = 0.1
+    @backend.stats
+    max_sleep = timed_sleeps(10, 0.02).max
+    stats = @backend.stats
+    budget = @backend.idle_gc_budget
+
+    assert_equal 0.1, budget[:max_defer]
+    # the idle window is predicted from the time spent waiting for events
+    assert budget[:idle_window] > 0
+    assert budget[:idle_window] <= max_sleep
+    assert budget[:minor_cost] + budget[:major_cost] > 0
+    assert_in_range 5..10, stats[:idle_gc_minor_count] + stats[:idle_gc_major_count]
+    assert_equal 0, stats[:idle_gc_deferred_count]
+    assert stats[:idle_gc_time] > 0
+
+    # the window grows with longer idle periods
+    window = budget[:idle_window]
+    max_sleep = [max_sleep, *timed_sleeps(4, 0.05)].max
+    assert @backend.idle_gc_budget[:idle_window] > window
+    assert @backend.idle_gc_budget[:idle_window] <= max_sleep
+    @backend.stats
+
+    # a due GC is deferred while there's work to do, up to max_defer
+    ticker = spin { loop { suspend } }
+    @backend.idle_proc = proc { ticker.schedule }
+    30.times { sleep 0.01 }
+    stats = @backend.stats
+    assert_in_range 1..4, stats[:idle_gc_minor_count] + stats[:idle_gc_major_count]
+    assert stats[:idle_gc_deferred_count] > 10
+
+    assert_raises(ArgumentError) { @backend.idle_gc_max_defer = -1 }
+    @backend.idle_gc_max_defer = nil
+    assert_nil @backend.idle_gc_budget
+  ensure
+    ticker&.stop
+    @backend.idle_proc = nil
+    @backend.idle_gc_period = 0
+    @backend.idle_gc_max_defer = nil
+    GC.enable
+  end
+
   def test_idle_proc
     counter = 0
 
@@ -467,7 +1095,7 @@ class BackendChainTest < MiniTest::Test
       [:write, o, ' world']
     )
 
-    assert_equal 6, result
+    assert_equal [5, 6], result
     o.close
     assert_equal 'hello world', i.read
   end
@@ -534,6 +1162,100 @@ class BackendChainTest < MiniTest::Test
     assert_equal "Content-Length: 12\r\n\r\nHello world!", to_r.read
   end
 
+  def test_chain_with_poll_and_read
+    i, o = IO.pipe
+
+    f = spin { Thread.backend.chain([:poll, i, :read], [:read, i, 16]) }
+    snooze
+    o << 'foo'
+    assert_equal [true, 'foo'], f.await
+
+    o.close
+    assert_equal [nil], Thread.backend.chain([:read, i, 16])
+  end
+
+  def test_chain_with_recv_and_link_timeout
+    i, o = UNIXSocket.pair
+
+    o << 'bar'
+    result = Thread.backend.chain(
+      [:send, i, 'foo', 0],
+      [:recv, i, 16, 0],
+      [:timeout, 1]
+    )
+    assert_equal [3, 'bar', false], result
+    assert_equal 'foo', o.recv(16)
+  end
+
+  def test_chain_timeout_expired
+    i, o = IO.pipe
+
+    t0 = Time.now
+    result = Thread.backend.chain(
+      [:read, i, 16],
+      [:timeout, 0.05],
+      [:write, o, 'foo']
+    )
+    assert_in_range 0.04..0.2, Time.now - t0
+    assert_equal [nil, true, nil], result
+
+    assert_raises(RuntimeError) { Thread.backend.chain([:timeout, 1]) }
+  end
+
+  def test_chain_failed_op
+    i, o = UNIXSocket.pair
+    r, w = IO.pipe
+    o.close
+
+    result = Thread.backend.chain([:send, i, 'foo', 0], [:write, w, 'bar'])
+    assert_kind_of SystemCallError, result[0]
+    assert_nil result[1]
+  end
+
+  def test_chain_with_write_and_close
+    i, o = IO.pipe
+
+    result = Thread.backend.chain([:write, o, 'foo'], [:close, o])
+    assert_equal [3, true], result
+    assert o.closed?
+    assert_equal 'foo', i.read
+
+    # a cancelled close still closes the io
+    fd_count = Dir['/proc/self/fd/*'].size
+    i, o = UNIXSocket.pair
+    i.close
+    result = Thread.backend.chain([:send, o, 'foo', 0], [:close, o])
+    assert_kind_of SystemCallError, result[0]
+    assert_nil result[1]
+    assert o.closed?
+    assert_equal fd_count, Dir['/proc/self/fd/*'].size
+  end
+
+  def test_close
+    i, o = UNIXSocket.pair
+    o.setsockopt(Socket::SOL_SOCKET, Socket::SO_LINGER, [1, 1].pack('ii'))
+    o << 'foo'
+
+    assert_nil @backend.close(o)
+    assert o.closed?
+    assert_equal 'foo', i.read
+    # closing a closed io is a no-op
+    assert_nil @backend.close(o)
+  end
+
+  def test_shutdown
+    i, o = UNIXSocket.pair
+
+    o << 'foo'
+    assert_equal 0, @backend.shutdown(o, :WR)
+    assert_equal 'foo', i.read
+    i << 'bar'
+    assert_equal 'bar', o.recv(16)
+
+    assert_equal [true], @backend.chain([:shutdown, i, Socket::SHUT_RDWR])
+    assert_raises(ArgumentError) { @backend.shutdown(o, :FOO) }
+  end
+
   def test_invalid_op
     i, o = IO.pipe
 
@@ -0,0 +1,130 @@
+# frozen_string_literal: true
+
+require_relative 'helper'
+
+class ChannelTest < MiniTest::Test
+  def test_unbuffered_rendezvous
+    ch = Polyphony::Channel.new
+    buf = []
+
+    f = spin do
+      buf << :push
+      ch << 1
+      buf << :pushed
+    end
+    snooze
+    assert_equal [:push], buf
+
+    assert_equal 1, ch.receive
+    f.await
+    assert_equal [:push, :pushed], buf
+  end
+
+  def test_handoff_to_waiting_receiver
+    ch = Polyphony::Channel.new
+    buf = []
+
+    receiver = spin { buf << ch.receive }
+    snooze # receiver parks
+    other = spin { buf << :other }
+
+    ch << :value
+    # the receiver is run right away, before other runnable fibers
+    assert_equal [:value, :other], buf
+    receiver.await
+    other.await
+  end
+
+  def test_pipeline
+    channels = 5.times.map { Polyphony::Channel.new }
+    stages = 4.times.map do |i|
+      spin do
+        channels[i].each { |v| channels[i + 1] << v + 1 }
+        channels[i + 1].close
+      end
+    end
+
+    results = []
+    collector = spin { channels.last.each { |v| results << v } }
+    10.times { |i| channels.first << i }
+    channels.first.close
+    collector.await
+
+    assert_equal (4..13).to_a, results
+    stages.each(&:await)
+  end
+
+  def test_buffered_channel
+    ch = Polyphony::Channel.new(2)
+    assert_equal 2, ch.capacity
+
+    ch << 1
+    ch << 2
+    assert_equal 2, ch.size
+
+    f = spin { ch << 3 }
+    snooze
+    assert_equal 2, ch.size
+
+    assert_equal 1, ch.receive
+    assert_equal 2, ch.size
+    f.await
+    assert_equal 2, ch.receive
+    assert_equal 3, ch.receive
+  end
+
+  def test_close
+    ch = Polyphony::Channel.new(1)
+    ch << :a
+    waiter = spin { ch << :b }
+    snooze
+
+    ch.close
+    assert ch.closed?
+    assert_raises(Polyphony::Channel::ClosedError) { waiter.await }
+    assert_equal :a, ch.receive
+    assert_raises(Polyphony::Channel::ClosedError) { ch.receive }
+    assert_raises(Polyphony::Channel::ClosedError) { ch << :c }
+  end
+
+  def test_select_receive
+    a = Polyphony::Channel.new
+    b = Polyphony::Channel.new
+
+    spin { b << :foo }
+    assert_equal [b, :foo], Polyphony::Channel.select(a, b)
+
+    f = spin { Polyphony::Channel.select(a, b) }
+    snooze
+    a << :bar
+    assert_equal [a, :bar], f.await
+
+    # the select no longer waits on b
+    c = spin { b << :baz }
+    snooze
+    assert_equal :baz, b.receive
+    c.await
+  end
+
+  def test_select_send
+    a = Polyphony::Channel.new
+    b = Polyphony::Channel.new
+
+    f = spin { Polyphony::Channel.select([a, 1], [b, 2]) }
+    snooze
+    assert_equal 2, b.receive
+    assert_equal [b, nil], f.await
+  end
+
+  def test_interrupted_receiver_does_not_take_value
+    ch = Polyphony::Channel.new
+    f = spin { ch.receive }
+    snooze
+
+    f.interrupt(:interrupted)
+    sender = spin { ch << :foo }
+    assert_equal :interrupted, f.await
+    assert_equal :foo, ch.receive
+    sender.await
+  end
+end
@@ -56,5 +56,31 @@ class EventTest < MiniTest::Test
     assert_raises(RuntimeError) do
       f.await
     end
+    assert_equal 0, e.waiting_count
+  end
+
+  def test_multiple_waiters
+    e = Polyphony::Event.new
+    results = []
+    fibers = 3.times.map { |i| spin { results << [i, e.await] } }
+    snooze
+    assert_equal 3, e.waiting_count
+
+    e.signal(:foo)
+    fibers.each(&:await)
+    assert_equal [[0, :foo], [1, :foo], [2, :foo]], results
+    assert_equal 0, e.waiting_count
+  end
+
+  def test_await_with_timeout
+    e = Polyphony::Event.new
+
+    t0 = Time.now
+    assert_nil e.await(0.05)
+    assert_in_range 0.04..0.2, Time.now - t0
+    assert_equal 0, e.waiting_count
+
+    spin { e.signal(:bar) }
+    assert_equal :bar, e.await(1)
   end
 end
@@ -278,6 +278,29 @@ class FiberTest < MiniTest::Test
     f&.stop
   end
 
+  def test_dead_fibers_collected
+    GC.start
+    count = ObjectSpace.each_object(Fiber).count
+    # fibers are created on a separate thread, so no reference to them is left
+    # on the stack. The last terminated thread might still be referenced by the
+    # VM, so another thread is run before collecting.
+    Thread.new { 200.times.map { spin { snooze } }.each(&:await) }.join
+    Thread.new {}.join
+    GC.start
+    assert_in_range 0..(count + 20), ObjectSpace.each_object(Fiber).count
+  end
+
+  def test_raise_not_overridden_by_schedule
+    f = spin { suspend }
+    snooze
+
+    f.raise MyError
+    f.schedule(:foo)
+    assert_raises(MyError) { f.await }
+  ensure
+    f&.stop
+  end
+
   def test_raise_with_exception
     result = []
     error = nil
@@ -476,6 +499,81 @@ class FiberTest < MiniTest::Test
     f&.stop
   end
 
+  def test_state_after_unschedule
+    f = spin { suspend }
+    snooze
+    assert_equal :waiting, f.state
+
+    f.schedule
+    assert_equal :runnable, f.state
+    Thread.current.fiber_unschedule(f)
+    assert_equal :waiting, f.state
+  ensure
+    f&.stop
+  end
+
+  def test_state_with_thread_without_backend
+    # Thread.start does not call Thread#initialize, so no backend is set up
+    t = Thread.start {}
+    Thread.pass while t.alive?
+    assert_nil t.backend
+
+    f = Fiber.new {}
+    f.thread = t
+    assert_equal :waiting, f.state
+  end
+
+  def test_thread_backend_change
+    f = spin { suspend }
+    snooze
+    prev_backend = Thread.current.backend
+    backend = Polyphony::Backend.new
+    Thread.current.backend = backend
+    f.schedule
+    assert_equal 1, backend.stats[:runqueue_length]
+    assert_equal 0, prev_backend.stats[:runqueue_length]
+  ensure
+    Thread.current.backend = prev_backend
+    backend.finalize
+    f&.stop
+  end
+
+  def test_priority
+    buf = []
+    fibers = [:low, :normal, :high].map do |priority|
+      f = spin { buf << [priority, suspend] }
+      f.priority = priority
+      f
+    end
+    snooze
+    assert_equal [:low, :normal, :high], fibers.map(&:priority)
+    assert_raises(ArgumentError) { fibers[0].priority = :foo }
+
+    fibers.each { |f| f.schedule(1) }
+    snooze
+    assert_equal [[:high, 1], [:normal, 1]], buf
+    # the low priority fiber runs once the normal level's burst is exhausted
+    10.times { snooze }
+    assert_equal [[:high, 1], [:normal, 1], [:low, 1]], buf
+  ensure
+    fibers&.each(&:stop)
+  end
+
+  def test_priority_starvation_protection
+    high_fibers = 20.times.map do
+      spin { loop { snooze } }.tap { |f| f.priority = :high }
+    end
+    ran = false
+    low = spin { ran = true }
+    low.priority = :low
+    snooze
+
+    20.times { snooze }
+    assert_equal true, ran
+  ensure
+    high_fibers&.each(&:stop)
+  end
+
   def test_main?
     f = spin {
       sleep
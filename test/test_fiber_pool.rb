@@ -0,0 +1,88 @@
+# frozen_string_literal: true
+
+require_relative 'helper'
+
+class FiberPoolTest < MiniTest::Test
+  def test_reuse
+    pool = Polyphony::FiberPool.new
+    fibers = []
+    10.times do
+      pool.spin { fibers << Fiber.current }
+      snooze
+    end
+
+    assert_equal 1, fibers.uniq.size
+    assert_equal 1, pool.created_count
+    assert_equal 9, pool.reused_count
+    assert_equal 1, pool.idle_count
+    assert_equal fibers.first.parent, Fiber.current
+  end
+
+  def test_concurrent_tasks
+    pool = Polyphony::FiberPool.new(limit: 3)
+    done = []
+    5.times { |i| pool.spin { sleep 0.01; done << i } }
+    assert_equal 5, pool.created_count
+
+    sleep 0.03
+    assert_equal [0, 1, 2, 3, 4], done.sort
+    assert_equal 3, pool.idle_count
+    assert_equal 3, Fiber.current.children.size
+
+    pool.clear
+    snooze
+    assert_equal 0, pool.idle_count
+    assert_equal 0, Fiber.current.children.size
+  end
+
+  def test_task_isolation
+    pool = Polyphony::FiberPool.new
+    child = nil
+    pool.spin do
+      Thread.current[:foo] = :bar
+      child = spin { sleep }
+    end
+    sleep 0.01
+    assert child.dead?
+
+    value = :unset
+    pool.spin { value = Thread.current[:foo] }
+    snooze
+    assert_nil value
+    assert_equal 1, pool.created_count
+  end
+
+  def test_exception
+    pool = Polyphony::FiberPool.new
+    pool.spin { snooze }
+    sleep 0.01
+    assert_equal 1, pool.idle_count
+
+    err = capture_exception do
+      pool.spin { raise 'foo' }
+      sleep 0.01
+    end
+    assert_kind_of RuntimeError, err
+    assert_equal 'foo', err.message
+    assert_equal 0, pool.idle_count
+
+    pool.spin { snooze }
+    snooze
+    assert_equal 2, pool.created_count
+  end
+
+  def test_parent_termination
+    pool = nil
+    parent = spin do
+      pool = Polyphony::FiberPool.new
+      3.times { pool.spin { snooze } }
+      sleep
+    end
+    sleep 0.01
+    assert_equal 3, pool.idle_count
+
+    parent.stop
+    parent.await
+    assert_equal 0, pool.idle_count
+  end
+end
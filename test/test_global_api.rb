@@ -253,6 +253,118 @@ class CancelAfterTest < MiniTest::Test
   end
 end
 
+class IdleTimeoutTest < MiniTest::Test
+  def test_move_on_after_idle
+    t0 = Time.now
+    v = move_on_after_idle(0.02, with_value: :bar) do
+      sleep 1
+      :foo
+    end
+    assert_equal :bar, v
+    assert_in_range 0.015..0.1, Time.now - t0
+
+    assert_equal :foo, move_on_after_idle(0.02) { :foo }
+    assert_raises(ArgumentError) { move_on_after_idle(0) { } }
+  end
+
+  def test_idle_timeout_pushed_back_by_reads
+    i, o = IO.pipe
+    writer = spin do
+      6.times { |x| o << "#{x}"; sleep 0.01 }
+    end
+
+    buf = +''
+    t0 = Time.now
+    v = move_on_after_idle(0.03, with_value: :idle) do
+      i.read_loop { |data| buf << data }
+    end
+    elapsed = Time.now - t0
+    assert_equal :idle, v
+    assert_equal '012345', buf
+    assert_in_range 0.08..0.2, elapsed
+  ensure
+    writer&.stop
+    i&.close
+    o&.close
+  end
+
+  def test_idle_timeout_pushed_back_by_writes
+    i, o = IO.pipe
+    count = 0
+    t0 = Time.now
+    cancel_after_idle(0.03) do
+      move_on_after(0.08) do
+        loop do
+          o << 'foo'
+          i.read(3)
+          count += 1
+          sleep 0.01
+        end
+      end
+    end
+    assert count >= 4
+    assert Time.now - t0 >= 0.07
+  ensure
+    i&.close
+    o&.close
+  end
+
+  def test_cancel_after_idle
+    assert_raises(Polyphony::Cancel) { cancel_after_idle(0.01) { sleep 1 } }
+
+    err = assert_raises(RuntimeError) do
+      cancel_after_idle(0.01, with_exception: [RuntimeError, 'idle']) { sleep 1 }
+    end
+    assert_equal 'idle', err.message
+  end
+
+  def test_nested_idle_timeouts
+    t0 = Time.now
+    v = move_on_after_idle(0.02, with_value: 1) do
+      move_on_after_idle(0.1, with_value: 2) { sleep 1 }
+    end
+    assert_equal 1, v
+    assert_in_range 0.015..0.08, Time.now - t0
+
+    v = move_on_after_idle(0.1, with_value: 1) do
+      move_on_after_idle(0.02, with_value: 2) { sleep 1 }
+    end
+    assert_equal 2, v
+  end
+
+  def test_touch_idle_timeout
+    count = 0
+    v = move_on_after_idle(0.03, with_value: :idle) do
+      5.times do
+        sleep 0.01
+        count += 1
+        Thread.current.backend.touch_idle_timeout
+      end
+      :done
+    end
+    assert_equal :done, v
+    assert_equal 5, count
+  end
+
+  def test_idle_timeouts_of_multiple_fibers
+    i, o = IO.pipe
+    busy = spin do
+      move_on_after_idle(0.03, with_value: :idle) do
+        loop { o << 'x'; i.read(1); sleep 0.005 }
+      end
+    end
+    idle = spin { move_on_after_idle(0.03, with_value: :idle) { sleep 1 } }
+
+    assert_equal :idle, idle.await
+    sleep 0.02
+    assert busy.alive?
+  ensure
+    busy&.stop
+    i&.close
+    o&.close
+  end
+end
+
 
 class SpinLoopTest < MiniTest::Test
   def test_spin_loop
@@ -423,6 +423,69 @@ class IOClassMethodsTest < MiniTest::Test
     assert s == IO.orig_read(fn)
   end
 
+  def test_read_uncached_file
+    fn = '/tmp/test_uncached.txt'
+    data = (1..100_000).map { |i| "#{i}\n" }.join
+    File.open(fn, 'w') do |f|
+      f << data
+      f.fsync
+      # drop the file from the page cache
+      f.advise(:dontneed)
+    end
+
+    File.open(fn, 'r') do |f|
+      assert_equal data[0, 1000], f.readpartial(1000)
+      f.seek(2000)
+      assert_equal data[2000..], f.read
+    end
+
+    chunks = []
+    File.open(fn, 'r') { |f| f.read_loop(65536) { |d| chunks << d } }
+    assert_equal data, chunks.join
+  ensure
+    FileUtils.rm(fn) rescue nil
+  end
+
+  def test_read_uncached_file_interrupted
+    # io_uring file reads cannot be cancelled once started by the kernel
+    skip unless Thread.current.backend.kind == :libev
+
+    fn = '/tmp/test_uncached_interrupted.txt'
+    data = (1..100_000).map { |i| "#{i}\n" }.join
+    File.open(fn, 'w') do |f|
+      f << data
+      f.fsync
+    end
+
+    File.open(fn, 'r') do |f|
+      10.times do
+        f.advise(:dontneed)
+        pos = f.pos
+        result = move_on_after(0.0001) { f.readpartial(1000) }
+        # let any abandoned read complete
+        sleep 0.01
+        pos += result.bytesize if result
+        assert_equal pos, f.pos
+        assert_equal data[pos, 1000], f.readpartial(1000)
+      end
+    end
+  ensure
+    FileUtils.rm(fn) rescue nil
+  end
+
+  def test_read_file_instance_variables
+    fn = '/tmp/test_ivars.txt'
+    File.open(fn, 'w') { |f| f << 'foobar' }
+
+    File.open(fn, 'r') do |f|
+      assert_equal 'foo', f.readpartial(3)
+      assert_equal 'bar', f.read
+      refute_includes f.instance_variables, :@regular_file
+    end
+  ensure
+    FileUtils.rm(fn) rescue nil
+  end
+
   def pipe_read
     i, o = IO.pipe
     yield o
@@ -467,4 +530,44 @@ class IOClassMethodsTest < MiniTest::Test
     r.read_loop(3) { |data| buf << data }
     assert_equal ['foo', 'bar'], buf
   end
+
+  def test_gets_loop
+    i, o = IO.pipe
+
+    buf = []
+    f = spin do
+      i.gets_loop { |l| buf << l }
+      buf << :done
+    end
+
+    o << "foo\nba"
+    o << "r\n\nbaz"
+    o.close
+
+    f.await
+    assert_equal ["foo\n", "bar\n", "\n", 'baz', :done], buf
+  end
+
+  def test_gets_loop_with_separator
+    i, o = IO.pipe
+
+    o << "foo\r\nbar\rbaz\r\n"
+    o.close
+    buf = []
+    i.gets_loop("\r\n", chomp: true) { |l| buf << l }
+    assert_equal ['foo', "bar\rbaz"], buf
+  end
+
+  def test_gets_loop_break
+    i, o = IO.pipe
+
+    o << "foo\nbar\nbaz\n"
+    o.close
+    buf = []
+    i.gets_loop { |l| buf << l; break }
+    assert_equal ["foo\n"], buf
+    assert_equal "bar\n", i.gets
+    assert_equal "baz\n", i.gets
+    assert_nil i.gets
+  end
 end
@@ -0,0 +1,52 @@
+# frozen_string_literal: true
+
+require_relative 'helper'
+
+begin
+  require 'polyphony/adapters/postgres'
+rescue LoadError
+  # the pg gem is not installed
+end
+
+class PostgresPipelineTest < MiniTest::Test
+  def setup
+    super
+    skip 'pg gem not available' unless defined?(PG::Connection)
+    @conn = connect
+    skip 'pipeline mode not supported' unless @conn.respond_to?(:enter_pipeline_mode)
+  end
+
+  def teardown
+    @conn&.close
+    super
+  end
+
+  def connect
+    PG.connect(dbname: ENV.fetch('POLYPHONY_PG_DBNAME', 'postgres'))
+  rescue PG::ConnectionBad
+    skip 'PostgreSQL server not available'
+  end
+
+  def test_pipeline
+    yielded = []
+    results = @conn.pipeline(['select 1 as a', ['select $1::int + 1 as b', [41]]]) { |r| yielded << r }
+    assert_equal [[{ 'a' => '1' }], [{ 'b' => '42' }]], results.map(&:to_a)
+    assert_equal results, yielded
+    assert_equal PG::PQ_PIPELINE_OFF, @conn.pipeline_status
+    assert_equal [{ 'c' => '3' }], @conn.exec('select 3 as c').to_a
+  end
+
+  def test_pipeline_failing_query
+    err = assert_raises(PG::Error) { @conn.pipeline(['select 1', 'select 1/0', 'select 2']) }
+    assert_match(/division by zero/, err.message)
+    assert_equal PG::PQ_PIPELINE_OFF, @conn.pipeline_status
+    assert_equal [{ 'c' => '3' }], @conn.exec('select 3 as c').to_a
+  end
+
+  def test_pipeline_error_in_block
+    err = assert_raises(RuntimeError) { @conn.pipeline(['select 1', 'select 2']) { raise 'foo' } }
+    assert_equal 'foo', err.message
+    assert_equal PG::PQ_PIPELINE_OFF, @conn.pipeline_status
+    assert_equal [{ 'c' => '3' }], @conn.exec('select 3 as c').to_a
+  end
+end
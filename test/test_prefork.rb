@@ -0,0 +1,185 @@
+# frozen_string_literal: true
+
+require_relative 'helper'
+
+class ChildWatcherTest < MiniTest::Test
+  def test_wait
+    watcher = Polyphony::ChildWatcher.new
+    assert_nil watcher.wait
+
+    pids = [3, 0, 5].map { |code| Process.spawn('sh', '-c', "sleep #{0.02 * code}; exit #{code}") }
+    pids.each { |pid| watcher.add(pid) }
+    assert_equal 3, watcher.size
+    assert_equal pids.sort, watcher.pids.sort
+
+    counter = 0
+    ticker = spin { loop { counter += 1; sleep 0.01 } }
+
+    results = 3.times.map { watcher.wait }
+    assert_equal [[pids[1], 0], [pids[0], 3], [pids[2], 5]], results
+    assert_nil watcher.wait
+    assert_equal 0, watcher.size
+    assert counter > 2
+  ensure
+    ticker&.stop
+    watcher&.close
+  end
+
+  def test_delete
+    watcher = Polyphony::ChildWatcher.new
+    pid = Process.spawn('sh', '-c', 'sleep 0.05; exit 1')
+    watcher.add(pid)
+    assert_equal pid, watcher.delete(pid)
+    assert_nil watcher.delete(pid)
+    assert_nil watcher.wait
+    assert_equal [pid, 1], Polyphony.backend_waitpid(pid)
+
+    assert_raises(Errno::ESRCH) { watcher.add(pid) }
+
+    pid = Process.spawn('sleep', '5')
+    watcher.add(pid)
+    Process.kill('KILL', pid)
+    result = watcher.wait
+    # the signal is reported only by the native (pidfd based) child watcher
+    if Polyphony::ChildWatcher.instance_method(:wait).source_location.nil?
+      assert_equal [pid, -Signal.list['KILL']], result
+    else
+      assert_equal pid, result.first
+    end
+
+    watcher.close
+    assert watcher.closed?
+    assert_raises(IOError) { watcher.wait }
+  end
+end
+
+class PreforkTest < MiniTest::Test
+  def setup
+    super
+    @server = TCPServer.new('127.0.0.1', 0)
+    @port = @server.instance_variable_get(:@io).local_address.ip_port
+  end
+
+  def teardown
+    @prefork&.stop
+    @supervisor&.await
+    @server.close
+    super
+  end
+
+  def start_prefork(opts = {}, &block)
+    block ||= proc do |idx|
+      @server.accept_loop { |c| spin { c << "#{idx} #{Process.pid}\n"; c.close } }
+    end
+    @prefork = Polyphony::Prefork.new(**{ workers: 2, backoff: 0.01 }.merge(opts), &block)
+    @supervisor = spin { @prefork.run }
+    snooze
+    @prefork
+  end
+
+  def request
+    conn = TCPSocket.new('127.0.0.1', @port)
+    line = conn.gets
+    conn.close
+    # a connection dropped by the server is closed without a response
+    raise EOFError, 'connection dropped' unless line
+
+    line.split.map(&:to_i)
+  end
+
+  def await_workers(count)
+    move_on_after(5) { sleep 0.01 until @prefork.pids.compact.size == count }
+  end
+
+  def test_shared_listener
+    prefork = start_prefork
+    assert_equal 1, prefork.generation
+    pids = prefork.pids
+    assert_equal 2, pids.compact.size
+
+    responses = 20.times.map { request }
+    responses.each { |idx, pid| assert_equal pids[idx], pid }
+  end
+
+  def test_restart_crashed_worker
+    prefork = start_prefork
+    pids = prefork.pids
+    Process.kill('KILL', pids[1])
+
+    move_on_after(5) { sleep 0.01 until prefork.restart_count == 1 }
+    assert_equal 1, prefork.restart_count
+    await_workers(2)
+    new_pids = prefork.pids
+    assert_equal pids[0], new_pids[0]
+    refute_includes pids, new_pids[1]
+    assert_equal 1, prefork.generation
+  end
+
+  def test_restart_backoff
+    starts = []
+    i, o = IO.pipe
+    reader = spin { while (l = i.gets) do starts << Time.now end }
+    start_prefork(workers: 1, backoff: 0.02, max_backoff: 0.1) { o.puts; exit! }
+
+    sleep 0.4
+    @prefork.stop
+    @supervisor.await
+    # delays: 0.02, 0.04, 0.08, 0.1, 0.1...
+    assert_in_range 4..6, @prefork.restart_count
+    intervals = starts.each_cons(2).map { |a, b| b - a }
+    assert intervals.last > intervals.first * 2
+  ensure
+    o.close
+    reader&.await
+    i.close
+  end
+
+  def test_reload
+    prefork = start_prefork
+    old_pids = prefork.pids
+
+    failures = 0
+    served = Hash.new(0)
+    client = spin do
+      loop do
+        served[request[1]] += 1
+      rescue SystemCallError, EOFError
+        failures += 1
+      end
+    end
+
+    sleep 0.05
+    prefork.reload
+    assert_equal 2, prefork.generation
+    assert_equal old_pids.sort, prefork.draining_pids.sort
+    new_pids = prefork.pids
+    assert_equal 2, new_pids.compact.size
+    assert_empty new_pids & old_pids
+
+    move_on_after(5) { sleep 0.01 until prefork.draining_pids.empty? }
+    assert_empty prefork.draining_pids
+    served.clear
+    sleep 0.05
+    client.stop
+
+    assert_equal 0, failures
+    refute_empty served
+    assert_empty served.keys - new_pids
+    assert_equal new_pids.sort, prefork.pids.sort
+    assert_equal 0, prefork.restart_count
+  end
+
+  def test_drain_timeout
+    prefork = start_prefork(workers: 1, drain_timeout: 0.1) do
+      trap('TERM', 'IGNORE')
+      loop { sleep 0.01 }
+    end
+    sleep 0.05
+
+    t0 = Time.now
+    prefork.stop
+    @supervisor.await
+    assert_in_range 0.08..0.5, Time.now - t0
+    assert_empty prefork.pids.compact
+  end
+end
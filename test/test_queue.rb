@@ -129,6 +129,30 @@ class QueueTest < MiniTest::Test
 
     assert_equal 0, @queue.size
   end
+
+  def test_push_all
+    buf = []
+    fibers = 3.times.map { spin { buf << @queue.shift } }
+    snooze
+
+    @queue.push_all([1, 2, 3, 4])
+    fibers.each(&:await)
+    assert_equal [1, 2, 3], buf
+    assert_equal [4], @queue.shift_all
+  end
+
+  def test_shift_with_count
+    @queue.push_all([1, 2, 3, 4, 5])
+    assert_equal [1, 2], @queue.shift(2)
+    assert_equal [3, 4, 5], @queue.pop(10)
+    assert_equal [], @queue.shift(0)
+    assert_raises(ArgumentError) { @queue.shift(-1) }
+
+    f = spin { @queue.shift(3) }
+    snooze
+    @queue << :foo
+    assert_equal [:foo], f.await
+  end
 end
 
 class CappedQueueTest < MiniTest::Test
@@ -246,4 +270,65 @@ class CappedQueueTest < MiniTest::Test
     a.join
     assert_equal [1, 2, 3, :d5, 4, :d8, 5], buffer
   end
-end
\ No newline at end of file
+
+  def test_capped_push_all
+    buffer = []
+    a = spin do
+      @queue.push_all([1, 2, 3, 4, 5])
+      buffer << :done
+    end
+    snooze
+    assert_equal [], buffer
+    assert_equal 3, @queue.size
+
+    assert_equal [1, 2, 3], @queue.shift(5)
+    a.await
+    assert_equal [:done], buffer
+    assert_equal [4, 5], @queue.shift_all
+  end
+
+  def test_nogvl_push
+    assert_raises(RuntimeError) { Polyphony::Queue.new.enable_nogvl_push }
+
+    @queue.enable_nogvl_push
+    assert_equal true, @queue.try_push(1)
+    assert_equal [1], @queue.shift(3)
+
+    buf = []
+    f = spin { 6.times { buf << @queue.shift } }
+    snooze
+    t = Thread.new do
+      (1..6).each { |i| Thread.pass until @queue.try_push(i) }
+    end
+    f.await
+    t.join
+    assert_equal [1, 2, 3, 4, 5, 6], buf
+  end
+
+  def test_nogvl_push_capacity
+    @queue.enable_nogvl_push
+
+    # values pushed by fibers and by native threads share the capacity
+    @queue << 1
+    @queue << 2
+    assert_equal true, @queue.try_push(3)
+    assert_equal false, @queue.try_push(4)
+    assert_equal 1, @queue.shift
+    assert_equal true, @queue.try_push(4)
+    assert_equal false, @queue.try_push(5)
+    assert_equal [2, 3, 4], @queue.shift_all
+
+    (1..3).each { |i| assert_equal true, @queue.try_push(i) }
+    assert_equal false, @queue.try_push(4)
+    buf = []
+    f = spin { @queue << 4; buf << :pushed }
+    snooze
+    assert_equal [], buf
+
+    assert_equal 1, @queue.shift
+    f.await
+    assert_equal [:pushed], buf
+    assert_equal false, @queue.try_push(5)
+    assert_equal [2, 3, 4], @queue.shift_all
+  end
+end
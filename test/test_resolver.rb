@@ -0,0 +1,278 @@
+# frozen_string_literal: true
+
+require_relative 'helper'
+require 'ipaddr'
+require 'fileutils'
+
+module DNSHelpers
+  def dns_name(name)
+    name.split('.').map { |l| [l.bytesize].pack('C') + l }.join + "\0"
+  end
+
+  def dns_question(query)
+    pos = 12
+    labels = []
+    while (len = query.getbyte(pos)) > 0
+      labels << query.byteslice(pos + 1, len)
+      pos += len + 1
+    end
+    [labels.join('.'), query.byteslice(pos + 1, 2).unpack1('n'), pos + 5]
+  end
+
+  def dns_response(query, rcode: 0, records: [], truncated: false)
+    _name, _type, question_end = dns_question(query)
+    flags = 0x8180 | rcode | (truncated ? 0x0200 : 0)
+    header = [query.unpack1('n'), flags, 1, records.size, 0, 0].pack('n6')
+    answers = records.map do |type, ttl, value|
+      data = type == Polyphony::DNS::TYPE_CNAME ? dns_name(value) : IPAddr.new(value).hton
+      [0xc00c, type, 1, ttl, data.bytesize].pack('nnnNn') + data
+    end
+    header + query.byteslice(12, question_end - 12) + answers.join
+  end
+
+  # Starts a fake name server, calling the given block with the name and type
+  # of each query. The block returns the records to be returned, or nil for
+  # NXDOMAIN.
+  def spin_dns_server(truncate: false, &block)
+    server = UDPSocket.new
+    server.bind('127.0.0.1', 0)
+    port = server.addr[1]
+    queries = []
+    spin do
+      loop do
+        query, addr = server.recvfrom(2048)
+        name, type, = dns_question(query)
+        queries << [name, type]
+        records = block.(name, type)
+        response = records ? dns_response(query, records: records, truncated: truncate) : dns_response(query, rcode: 3)
+        server.send(response, 0, addr[3], addr[1])
+      end
+    ensure
+      server.close
+    end
+    [port, queries]
+  end
+
+  def resolver_for(port, opts = {})
+    Polyphony::Resolver.new({ resolv_conf: nil, hosts: nil, nameservers: [['127.0.0.1', port]] }.merge(opts))
+  end
+end
+
+class DNSTest < MiniTest::Test
+  include DNSHelpers
+
+  def test_encode_query
+    query = Polyphony::DNS.encode_query(0x1234, 'foo.example.com.', Polyphony::DNS::TYPE_AAAA)
+    assert_equal [0x1234, 0x0100, 1, 0, 0, 1], query.unpack('n6')
+    assert_equal ['foo.example.com', Polyphony::DNS::TYPE_AAAA, 33], dns_question(query)
+    assert_equal "\0\0\x29\x04\xd0\0\0\0\0\0\0".b, query.byteslice(33..-1)
+
+    assert_raises(ArgumentError) { Polyphony::DNS.encode_query(1, '', 1) }
+    assert_raises(ArgumentError) { Polyphony::DNS.encode_query(1, 'foo..com', 1) }
+    assert_raises(ArgumentError) { Polyphony::DNS.encode_query(1, "#{'a' * 64}.com", 1) }
+  end
+
+  def test_decode_response
+    query = Polyphony::DNS.encode_query(42, 'www.example.com', Polyphony::DNS::TYPE_A)
+    response = dns_response(query, records: [
+      [Polyphony::DNS::TYPE_CNAME, 300, 'example.com'],
+      [Polyphony::DNS::TYPE_A, 60, '93.184.216.34'],
+      [Polyphony::DNS::TYPE_AAAA, 0x80000000, '2606:2800::1']
+    ])
+    question = ['www.example.com', Polyphony::DNS::TYPE_A, Polyphony::DNS::CLASS_IN]
+    assert_equal [42, 0, false, [
+      [Polyphony::DNS::TYPE_CNAME, 300, 'example.com'],
+      [Polyphony::DNS::TYPE_A, 60, '93.184.216.34'],
+      [Polyphony::DNS::TYPE_AAAA, 0, '2606:2800::1']
+    ], question], Polyphony::DNS.decode_response(response)
+
+    assert_equal [42, 3, false, [], question], Polyphony::DNS.decode_response(dns_response(query, rcode: 3))
+    assert_equal [42, 0, true, [], question], Polyphony::DNS.decode_response(dns_response(query, truncated: true))
+
+    assert_raises(Polyphony::DNS::ProtocolError) { Polyphony::DNS.decode_response('foo') }
+    assert_raises(Polyphony::DNS::ProtocolError) { Polyphony::DNS.decode_response(query) }
+    # compression pointer loop
+    looped = [42, 0x8180, 1, 0, 0, 0].pack('n6') + "\xc0\x0c".b
+    assert_raises(Polyphony::DNS::ProtocolError) { Polyphony::DNS.decode_response(looped) }
+    assert_raises(Polyphony::DNS::ProtocolError) { Polyphony::DNS.decode_response(response[0..-3]) }
+  end
+end
+
+class ResolverTest < MiniTest::Test
+  include DNSHelpers
+
+  def test_resolve
+    port, queries = spin_dns_server do |_name, type|
+      type == Polyphony::DNS::TYPE_A ? [[type, 60, '1.2.3.4']] : [[type, 60, '2001:db8::1']]
+    end
+    resolver = resolver_for(port)
+
+    assert_equal ['2001:db8::1', '1.2.3.4'], resolver.resolve('foo.test')
+    assert_equal 2, queries.size
+    assert_equal ['foo.test'], queries.map(&:first).uniq
+
+    # cached
+    assert_equal ['1.2.3.4'], resolver.resolve('FOO.test', Socket::AF_INET)
+    assert_equal ['2001:db8::1'], resolver.resolve('foo.test', :INET6)
+    assert_equal 2, queries.size
+
+    resolver.clear_cache
+    assert_equal ['1.2.3.4'], resolver.resolve('foo.test', :INET)
+    assert_equal 3, queries.size
+
+    assert_equal ['10.0.0.1'], resolver.resolve('10.0.0.1')
+    assert_equal 3, queries.size
+  end
+
+  def test_ttl
+    ttl = 0
+    port, queries = spin_dns_server { |_name, type| [[Polyphony::DNS::TYPE_CNAME, 60, 'bar.test'], [type, ttl, '1.2.3.4']] }
+    resolver = resolver_for(port)
+
+    # records with a zero TTL are not cached
+    assert_equal ['1.2.3.4'], resolver.resolve('foo.test', :INET)
+    assert_equal ['1.2.3.4'], resolver.resolve('foo.test', :INET)
+    assert_equal 2, queries.size
+
+    ttl = 1
+    resolver = resolver_for(port, max_ttl: 0.05)
+    resolver.resolve('foo.test', :INET)
+    resolver.resolve('foo.test', :INET)
+    assert_equal 3, queries.size
+    sleep 0.06
+    resolver.resolve('foo.test', :INET)
+    assert_equal 4, queries.size
+  end
+
+  def test_not_found
+    port, queries = spin_dns_server { |name, type| name == 'foo.test' ? [] : nil }
+    resolver = resolver_for(port)
+
+    assert_raises(Polyphony::Resolver::NotFound) { resolver.resolve('foo.test') }
+    assert_raises(Polyphony::Resolver::NotFound) { resolver.resolve('bar.test', :INET) }
+    assert_equal 3, queries.size
+
+    # negative results are cached
+    assert_raises(Polyphony::Resolver::NotFound) { resolver.resolve('foo.test') }
+    assert_equal 3, queries.size
+  end
+
+  def test_unavailable
+    socket = UDPSocket.new
+    socket.bind('127.0.0.1', 0)
+    port = socket.addr[1]
+    resolver = resolver_for(port, timeout: 0.05, attempts: 2)
+
+    t0 = Time.now
+    assert_raises(Polyphony::Resolver::Unavailable) { resolver.resolve('foo.test') }
+    assert_in_range 0.08..0.5, Time.now - t0
+    socket.close
+
+    # refused
+    assert_raises(Polyphony::Resolver::Unavailable) { resolver.resolve('foo.test') }
+  end
+
+  def test_mismatched_question
+    server = UDPSocket.new
+    server.bind('127.0.0.1', 0)
+    port = server.addr[1]
+    server_fiber = spin do
+      loop do
+        query, addr = server.recvfrom(2048)
+        id = query.unpack1('n')
+        # responses with a matching id but a different question are ignored
+        spoofed = Polyphony::DNS.encode_query(id, 'evil.test', Polyphony::DNS::TYPE_A)
+        server.send(dns_response(spoofed, records: [[Polyphony::DNS::TYPE_A, 60, '6.6.6.6']]), 0, addr[3], addr[1])
+        spoofed = Polyphony::DNS.encode_query(id, 'foo.test', Polyphony::DNS::TYPE_AAAA)
+        server.send(dns_response(spoofed, records: [[Polyphony::DNS::TYPE_AAAA, 60, '::6']]), 0, addr[3], addr[1])
+        server.send(dns_response(query, records: [[Polyphony::DNS::TYPE_A, 60, '1.2.3.4']]), 0, addr[3], addr[1])
+      end
+    end
+
+    resolver = resolver_for(port)
+    assert_equal ['1.2.3.4'], resolver.resolve('foo.test', :INET)
+  ensure
+    server_fiber&.stop
+    server&.close
+  end
+
+  def test_truncated_response
+    port, queries = spin_dns_server(truncate: true) { |_name, type| [[type, 60, '1.2.3.4']] }
+    server = TCPServer.new('127.0.0.1', port)
+    tcp_queries = []
+    server_fiber = spin do
+      server.accept_loop do |conn|
+        len = conn.read(2).unpack1('n')
+        query = conn.read(len)
+        tcp_queries << dns_question(query).first
+        response = dns_response(query, records: [[Polyphony::DNS::TYPE_A, 60, '5.6.7.8']])
+        conn << [response.bytesize].pack('n') << response
+        conn.close
+      end
+    end
+
+    resolver = resolver_for(port)
+    assert_equal ['5.6.7.8'], resolver.resolve('foo.test', :INET)
+    assert_equal 1, queries.size
+    assert_equal ['foo.test'], tcp_queries
+  ensure
+    server_fiber&.stop
+    server&.close
+  end
+
+  def test_hosts_and_search
+    port, queries = spin_dns_server { |name, type| name == 'foo.example.com' ? [[type, 60, '1.2.3.4']] : nil }
+    hosts = "/tmp/polyphony-hosts-#{$$}"
+    IO.write(hosts, "# comment\n10.0.0.1 myhost myhost.local\n::2 myhost # alias\n")
+    resolver = resolver_for(port, hosts: hosts, search: ['example.com'])
+
+    assert_equal ['::2', '10.0.0.1'], resolver.resolve('MyHost')
+    assert_equal ['10.0.0.1'], resolver.resolve('myhost.local', :INET)
+    assert_equal 0, queries.size
+
+    assert_equal ['1.2.3.4'], resolver.resolve('foo', :INET)
+    assert_equal [['foo.example.com', Polyphony::DNS::TYPE_A]], queries
+
+    queries.clear
+    assert_raises(Polyphony::Resolver::NotFound) { resolver.resolve('bar.', :INET) }
+    assert_equal [['bar', Polyphony::DNS::TYPE_A]], queries
+  ensure
+    FileUtils.rm_f(hosts)
+  end
+
+  def test_resolv_conf
+    path = "/tmp/polyphony-resolv-#{$$}"
+    IO.write(path, "nameserver 10.1.1.1\nnameserver ::1 ; local\nsearch a.com b.com\noptions ndots:2 timeout:3\n")
+    resolver = Polyphony::Resolver.new(resolv_conf: path, hosts: nil)
+    assert_equal [['10.1.1.1', 53], ['::1', 53]], resolver.nameservers
+    assert_equal ['a.com', 'b.com'], resolver.instance_variable_get(:@search)
+    assert_equal 2, resolver.instance_variable_get(:@ndots)
+    assert_equal 3, resolver.instance_variable_get(:@timeout)
+  ensure
+    FileUtils.rm_f(path)
+  end
+
+  def test_getaddrinfo
+    port, queries = spin_dns_server { |name, type| name == 'foo.test' ? [[type, 60, '127.0.0.1']] : nil }
+    prev_resolver = Polyphony::Resolver.default
+    Polyphony::Resolver.default = resolver_for(port)
+
+    addrinfos = Addrinfo.getaddrinfo('foo.test', 80, :INET, :STREAM)
+    assert_equal [['127.0.0.1', 80]], addrinfos.map { |a| [a.ip_address, a.ip_port] }
+    assert_equal [['AF_INET', 80, '127.0.0.1', '127.0.0.1', Socket::AF_INET, Socket::SOCK_STREAM, Socket::IPPROTO_TCP]],
+      Socket.getaddrinfo('foo.test', 80, :INET, :STREAM)
+    assert_raises(SocketError) { Addrinfo.getaddrinfo('bar.test', 80, :INET, :STREAM) }
+
+    server = TCPServer.new('127.0.0.1', 0)
+    server_port = server.instance_variable_get(:@io).local_address.ip_port
+    server_fiber = spin { server.accept_loop { |c| c << 'hi'; c.close } }
+    client = Polyphony::Net.tcp_connect('foo.test', server_port)
+    assert_equal 'hi', client.read
+    assert_equal 3, queries.size
+  ensure
+    Polyphony::Resolver.default = prev_resolver
+    client&.close
+    server_fiber&.stop
+    server&.close
+  end
+end
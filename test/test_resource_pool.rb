@@ -28,7 +28,7 @@ class ResourcePoolTest < MiniTest::Test
   end
 
   def test_discard
-    resources = [+'a', +'b']
+    resources = [+'a', +'b', +'c']
     pool = Polyphony::ResourcePool.new(limit: 2) { resources.shift }
 
     results = []
@@ -44,8 +44,9 @@ class ResourcePoolTest < MiniTest::Test
     }
     Fiber.current.await_all_children
 
-    assert_equal ['a', 'b', 'a', 'a'], results
-    assert_equal 1, pool.size
+    # the last waiter allocates a new resource in place of the discarded one
+    assert_equal ['a', 'b', 'a', 'c'], results
+    assert_equal 2, pool.size
   end
 
   def test_single_resource_limit
@@ -126,4 +127,97 @@ class ResourcePoolTest < MiniTest::Test
 
     assert_equal [1, 1, 1, 1], buf
   end
-end
\ No newline at end of file
+
+  def test_fifo_waiters
+    pool = Polyphony::ResourcePool.new(limit: 1) { :r }
+
+    buf = []
+    pool.acquire do
+      5.times { |i| spin { pool.acquire { buf << i; snooze } } }
+      snooze
+      # a fiber arriving while others are waiting does not jump the queue
+      spin { pool.acquire { buf << :late } }
+      snooze
+    end
+    Fiber.current.await_all_children
+
+    assert_equal [0, 1, 2, 3, 4, :late], buf
+  end
+
+  def test_acquire_timeout
+    pool = Polyphony::ResourcePool.new(limit: 1) { :r }
+
+    f = spin { pool.acquire { sleep 0.05 } }
+    snooze
+    t0 = Time.now
+    assert_raises(Polyphony::ResourcePool::TimeoutError) do
+      pool.acquire(0.01) { }
+    end
+    assert_in_range 0.01..0.04, Time.now - t0
+    assert_equal 0, pool.stats[:queue_depth]
+
+    assert_equal :r, pool.acquire(1) { |r| r }
+    f.await
+  end
+
+  def test_discard_last_resource_wakes_waiter
+    resources = [+'a', +'b']
+    pool = Polyphony::ResourcePool.new(limit: 1) { resources.shift }
+
+    buf = []
+    f = spin { pool.acquire { |r| buf << r } }
+    pool.acquire do |r|
+      buf << r
+      snooze
+      pool.discard!
+    end
+    f.await
+
+    assert_equal ['a', 'b'], buf
+    assert_equal 1, pool.size
+  end
+
+  def test_failing_allocator_wakes_next_waiter
+    allocations = 0
+    pool = Polyphony::ResourcePool.new(limit: 1) do
+      allocations += 1
+      raise 'foo' if allocations == 2
+
+      +"r#{allocations}"
+    end
+
+    buf = []
+    waiters = 2.times.map do
+      spin do
+        pool.acquire { |r| buf << r }
+      rescue RuntimeError => e
+        buf << e.message
+      end
+    end
+    pool.acquire do |r|
+      buf << r
+      snooze
+      pool.discard!
+    end
+    waiters.each(&:await)
+
+    assert_equal ['r1', 'foo', 'r3'], buf
+    assert_equal 1, pool.size
+  end
+
+  def test_stats
+    pool = Polyphony::ResourcePool.new(limit: 1) { :r }
+
+    3.times { spin { pool.acquire { sleep 0.01 } } }
+    Fiber.current.await_all_children
+
+    stats = pool.stats
+    assert_equal 3, stats[:acquire_count]
+    assert_equal 2, stats[:wait_count]
+    assert_equal 2, stats[:max_queue_depth]
+    assert_equal 0, stats[:queue_depth]
+    assert stats[:total_hold_time] >= 0.03
+    assert stats[:max_wait_time] >= 0.02
+    assert stats[:total_wait_time] >= 0.03
+  end
+end
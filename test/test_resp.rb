@@ -0,0 +1,153 @@
+# frozen_string_literal: true
+
+require_relative 'helper'
+
+class RESPTest < MiniTest::Test
+  def test_encode
+    assert_equal "*3\r\n$3\r\nSET\r\n$3\r\nfoo\r\n$2\r\n42\r\n",
+      Polyphony::RESP.encode(['SET', :foo, 42])
+    assert_equal "*2\r\n$3\r\nGET\r\n$0\r\n\r\n", Polyphony::RESP.encode(['GET', ['']])
+  end
+
+  def test_reader_replies
+    reader = Polyphony::RESP::Reader.new
+    reader.feed("+OK\r\n:-12\r\n$3\r\nfoo\r\n$-1\r\n*2\r\n:1\r\n*1\r\n$1\r\na\r\n-ERR bad\r\n")
+
+    assert_equal 'OK', reader.gets
+    assert_equal -12, reader.gets
+    assert_equal 'foo', reader.gets
+    assert_nil reader.gets
+    assert_equal [1, ['a']], reader.gets
+
+    err = reader.gets
+    assert_kind_of RuntimeError, err
+    assert_equal 'ERR bad', err.message
+    assert_equal false, reader.gets
+    assert_equal 0, reader.pending_bytes
+  end
+
+  def test_reader_partial_replies
+    reader = Polyphony::RESP::Reader.new
+    data = "*2\r\n$5\r\nhello\r\n$5\r\nworld\r\n"
+    data.each_char.with_index do |c, i|
+      assert_equal false, reader.gets
+      reader.feed(c)
+      assert_equal i + 1, reader.pending_bytes
+    end
+    assert_equal ['hello', 'world'], reader.gets
+  end
+
+  def test_reader_feed_with_block
+    reader = Polyphony::RESP::Reader.new
+    replies = []
+    reader.feed(":1\r\n:2\r\n:3") { |r| replies << r }
+    assert_equal [1, 2], replies
+
+    reader.feed("\r\n:4\r\n") { |r| replies << r; break }
+    assert_equal [1, 2, 3], replies
+    assert_equal 4, reader.gets
+  end
+
+  def test_reader_protocol_error
+    reader = Polyphony::RESP::Reader.new
+    reader.feed("?foo\r\n")
+    assert_raises(Polyphony::RESP::ProtocolError) { reader.gets }
+  end
+
+  def test_reader_invalid_lengths
+    reader = Polyphony::RESP::Reader.new
+    reader.feed("$99999999999999999999\r\n")
+    assert_raises(Polyphony::RESP::ProtocolError) { reader.gets }
+
+    reader = Polyphony::RESP::Reader.new
+    reader.feed("$1x\r\n")
+    assert_raises(Polyphony::RESP::ProtocolError) { reader.gets }
+
+    reader = Polyphony::RESP::Reader.new
+    reader.feed("*-\r\n")
+    assert_raises(Polyphony::RESP::ProtocolError) { reader.gets }
+
+    reader = Polyphony::RESP::Reader.new
+    reader.feed("$9223372036854775807\r\nfoo\r\n")
+    assert_equal false, reader.gets
+
+    reader = Polyphony::RESP::Reader.new
+    reader.feed("*9223372036854775807\r\n:1\r\n")
+    assert_equal false, reader.gets
+    reader.feed(":2\r\n")
+    assert_equal false, reader.gets
+  end
+
+  def test_reader_large_array
+    reader = Polyphony::RESP::Reader.new
+    items = (1..1000).map { |i| "item#{i}" }
+    data = "*2\r\n#{Polyphony::RESP.encode(items)}:42\r\n"
+    data.chars.each_slice(7) do |chunk|
+      assert_equal false, reader.gets
+      reader.feed(chunk.join)
+    end
+    assert_equal [items, 42], reader.gets
+    assert_equal 0, reader.pending_bytes
+  end
+
+  def test_native_feed_loop
+    reader = Polyphony::RESP::Reader.new
+    assert_kind_of Polyphony::NativeFeed, reader
+
+    i, o = UNIXSocket.pair
+    writer = spin do
+      (1..50).each { |n| o << Polyphony::RESP.encode(['ECHO', "msg#{n}"]); snooze }
+      o << ':1' << "\r\n"
+      o.close
+    end
+
+    replies = []
+    i.feed_loop(reader, :ignored) { |r| replies << r }
+    assert_equal (1..50).map { |n| ['ECHO', "msg#{n}"] } + [1], replies
+
+    r, w = IO.pipe
+    w << ":1\r\n:2\r\n:3\r\n"
+    replies = []
+    r.feed_loop(reader) { |x| replies << x; break if x == 2 }
+    assert_equal [1, 2], replies
+    assert_equal 3, reader.gets
+  ensure
+    writer&.await
+    i&.close
+    w&.close
+    r&.close
+  end
+
+  def test_native_feed_invalid_receiver
+    klass = Class.new { include Polyphony::NativeFeed }
+    i, o = UNIXSocket.pair
+    o << 'foo'
+    assert_raises(TypeError) { i.feed_loop(klass.new) }
+  ensure
+    i&.close
+    o&.close
+  end
+
+  def test_pipeline
+    i, o = UNIXSocket.pair
+    server = spin do
+      reader = Polyphony::RESP::Reader.new
+      o.read_loop do |data|
+        reader.feed(data) { |cmd| o << "$#{cmd[1].bytesize}\r\n#{cmd[1]}\r\n" }
+      end
+    end
+
+    commands = (1..100).map { |n| Polyphony::RESP.encode(['ECHO', "msg#{n}"]) }
+    i.write(*commands)
+
+    reader = Polyphony::RESP::Reader.new
+    replies = []
+    i.read_loop do |data|
+      reader.feed(data) { |r| replies << r }
+      break if replies.size == 100
+    end
+    assert_equal (1..100).map { |n| "msg#{n}" }, replies
+  ensure
+    server&.stop
+  end
+end
@@ -0,0 +1,53 @@
+# frozen_string_literal: true
+
+require_relative 'helper'
+
+class SchedulerGroupTest < MiniTest::Test
+  def setup
+    super
+    @group = Polyphony::SchedulerGroup.new(4)
+  end
+
+  def teardown
+    @group.stop
+    super
+  end
+
+  def test_spin
+    queue = Queue.new
+    10.times { |i| @group.spin { queue << [i, Thread.current] } }
+
+    results = 10.times.map { queue.pop }
+    assert_equal (0..9).to_a, results.map(&:first).sort
+    refute_includes results.map(&:last), Thread.current
+    assert_equal 0, @group.pending_count
+  end
+
+  def test_tasks_spread_across_threads
+    queue = Queue.new
+    8.times do
+      @group.spin do
+        t0 = Time.now
+        nil while Time.now - t0 < 0.05
+        queue << Thread.current
+      end
+    end
+
+    threads = 8.times.map { queue.pop }
+    assert_operator threads.uniq.size, :>, 1
+  end
+
+  def test_attached_thread_runs_tasks_when_idle
+    group = Polyphony::SchedulerGroup.new(0)
+    group.attach
+    buffer = []
+    3.times { |i| group.spin { buffer << i } }
+    assert_equal 3, group.pending_count
+
+    sleep 0.01
+    assert_equal [0, 1, 2], buffer
+    assert_equal 0, group.pending_count
+  ensure
+    group.detach
+  end
+end
@@ -158,6 +158,176 @@ class SocketTest < MiniTest::Test
     server_fiber&.await
     server&.close
   end
+
+  def test_ipv6
+    skip 'IPv6 not available' unless Socket.ip_address_list.any?(&:ipv6_loopback?)
+
+    port = rand(1100..60000)
+    server = TCPServer.new('::1', port)
+    server_fiber = spin do
+      server.accept_loop { |c| c << 'hi'; c.close }
+    end
+
+    client = TCPSocket.new('::1', port)
+    assert_equal 'hi', client.recv(8192)
+    assert client.io.remote_address.ipv6?
+  ensure
+    server_fiber&.stop
+    server&.close
+  end
+
+  def test_connect_racing
+    port, server = start_tcp_server_on_random_port
+    server_fiber = spin do
+      server.accept_loop { |c| c << 'hi'; c.close }
+    end
+
+    # a server with a full backlog, to which connects stall
+    stalled = Socket.new(:INET, :STREAM)
+    stalled.bind(Addrinfo.tcp('127.0.0.1', 0))
+    stalled.listen(0)
+    stalled_addr = stalled.local_address
+    fillers = 3.times.map do
+      Socket.new(:INET, :STREAM).tap { |s| s.connect_nonblock(stalled_addr, exception: false) }
+    end
+    sleep 0.01
+
+    refused = Addrinfo.tcp('127.0.0.1', 1)
+    target = Addrinfo.tcp('127.0.0.1', port)
+
+    # a failed attempt starts the next one immediately
+    t0 = Time.now
+    client = Socket.connect_racing([refused, target], 10)
+    assert Time.now - t0 < 1
+    assert_equal 'hi', client.recv(8192)
+
+    # a stalled attempt is raced against the next one after the delay
+    t0 = Time.now
+    client = Socket.connect_racing([Addrinfo.tcp('127.0.0.1', stalled_addr.ip_port), target], 0.05)
+    elapsed = Time.now - t0
+    assert_in_range 0.04..1, elapsed
+    assert_equal 'hi', client.recv(8192)
+    assert_equal port, client.remote_address.ip_port
+
+    assert_raises(Errno::ECONNREFUSED) { Socket.connect_racing([refused, refused], 0.01) }
+  ensure
+    server_fiber&.stop
+    server&.close
+    stalled&.close
+    fillers&.each(&:close)
+  end
+
+  def test_tcp_listener_group
+    group = Polyphony::Net.tcp_listen('127.0.0.1', 0, threads: 3, reuse_addr: true) do |conn|
+      conn << "#{Thread.current.object_id}:#{conn.readpartial(100)}"
+    end
+    assert_equal 3, group.size
+    assert_equal [group.port], group.sockets.map { |s| s.local_address.ip_port }.uniq
+
+    responses = 30.times.map do |i|
+      client = TCPSocket.new('127.0.0.1', group.port)
+      client << "#{i}"
+      client.read.tap { client.close }
+    end
+    thread_ids = responses.map { |r| r.split(':').first }
+    assert_equal 30.times.map(&:to_s), responses.map { |r| r.split(':').last }
+    assert_equal 30, group.stats.sum { |s| s[:accepted] }
+    assert_equal group.stats.map { |s| s[:accepted] }.reject(&:zero?).sort, thread_ids.group_by(&:itself).values.map(&:size).sort
+    assert_equal [0, 0, 0], group.stats.map { |s| s[:active] }
+  ensure
+    group&.stop
+  end
+
+  def test_tcp_listener_group_cpu_affinity
+    group = Polyphony::Net.tcp_listen('127.0.0.1', 0, threads: 2, cpu_affinity: true) do |conn|
+      conn << 'hi'
+    end
+    3.times do
+      client = TCPSocket.new('127.0.0.1', group.port)
+      assert_equal 'hi', client.read
+      client.close
+    end
+    assert_equal 3, group.stats.sum { |s| s[:accepted] }
+
+    socket = Socket.new(:INET, :STREAM)
+    assert_raises(ArgumentError) { socket.attach_reuse_port_cpu_filter(0) }
+  ensure
+    group&.stop
+    socket&.close
+  end
+
+  def test_udp_socket
+    server = UDPSocket.new
+    server.bind('127.0.0.1', 0)
+    port = server.local_address.ip_port
+    server_fiber = spin do
+      while true
+        data, addr = server.recvfrom(1024)
+        server.send(data.upcase, 0, addr[3], addr[1])
+      end
+    end
+
+    client = UDPSocket.new
+    client.connect('127.0.0.1', port)
+    assert_equal 3, client.send('foo', 0)
+    data, addr = client.recvfrom(1024)
+    assert_equal 'FOO', data
+    assert_equal ['AF_INET', port, '127.0.0.1', '127.0.0.1'], addr
+
+    client.send('bar', 0)
+    assert_equal 'BAR', client.recv(1024)
+  ensure
+    server_fiber&.stop
+    server&.close
+    client&.close
+  end
+
+  def test_udp_batch
+    server = UDPSocket.new
+    server.bind('127.0.0.1', 0)
+    client = UDPSocket.new
+    client.bind('127.0.0.1', 0)
+    server_addr = server.local_address.to_sockaddr
+
+    received = []
+    server_fiber = spin do
+      while received.size < 10
+        msgs = server.recvmmsg(4, 64)
+        assert msgs.size <= 4
+        received.concat(msgs)
+      end
+    end
+
+    assert_equal 6, client.sendmmsg((1..6).map(&:to_s), server_addr)
+    assert_equal 4, client.sendmmsg((7..10).map { |i| [i.to_s, server_addr] })
+    server_fiber.await
+
+    assert_equal (1..10).map(&:to_s), received.map(&:first)
+    addrs = received.map(&:last)
+    assert_equal [client.local_address.to_sockaddr], addrs.uniq
+    assert addrs.all?(&:frozen?)
+
+    # replies are sent back to the peer address of each received datagram
+    server.sendmmsg(received.map { |data, addr| [data * 2, addr] })
+    replies = []
+    replies.concat(client.recvmmsg(10, 64)) while replies.size < 10
+    assert_equal (1..10).map { |i| i.to_s * 2 }, replies.map(&:first)
+
+    # the batch buffer size is bounded
+    assert_raises(ArgumentError) { client.recvmmsg(1024, 1 << 62) }
+    assert_raises(ArgumentError) { client.recvmmsg(4, 65537) }
+
+    # strings converted using #to_str are kept alive while being sent
+    msg = Object.new
+    def msg.to_str; GC.start; 'baz' * 100; end
+    assert_equal 2, client.sendmmsg([msg, msg], server_addr)
+    got = []
+    got.concat(server.recvmmsg(2, 1024)) while got.size < 2
+    assert_equal ['baz' * 100] * 2, got.map(&:first)
+  ensure
+    server&.close
+    client&.close
+  end
 end
 
 if IS_LINUX
@@ -178,4 +348,386 @@ if IS_LINUX
       assert_equal 'https://ipinfo.io/missingauth', response['readme']
     end
   end
-end
\ No newline at end of file
+end
+
+class CorkTest < MiniTest::Test
+  def setup
+    super
+    @client, @server = UNIXSocket.pair
+    @backend = Thread.current.backend
+  end
+
+  def teardown
+    @client.close unless @client.closed?
+    @server.close unless @server.closed?
+    super
+  end
+
+  def test_cork_switchpoint_flush
+    refute @client.corked?
+    @client.cork!
+    assert @client.corked?
+
+    @backend.stats
+    header = +'header:'
+    @client << header << 'body:'
+    assert_equal 8, @client.write('trailer', '.')
+    header << 'changed'
+    assert_equal :wait_readable, @server.recv_nonblock(100, exception: false)
+
+    snooze
+    assert_equal 'header:body:trailer.', @server.recv_nonblock(100)
+    # sent with a single non-blocking sendmsg, no backend op involved
+    assert_equal 0, @backend.stats[:op_count]
+  end
+
+  def test_cork_threshold
+    @client.cork!(8)
+    @client << 'abcd'
+    assert_equal :wait_readable, @server.recv_nonblock(100, exception: false)
+    @client << 'efgh'
+    assert_equal 'abcdefgh', @server.recv_nonblock(100)
+  end
+
+  def test_cork_tcp_socket
+    server = TCPServer.new('127.0.0.1', 0)
+    port = server.instance_variable_get(:@io).local_address.ip_port
+    server_fiber = spin do
+      server.accept_loop { |c| spin { c << "you said #{c.readpartial(100)}"; c.close } }
+    end
+
+    client = TCPSocket.new('127.0.0.1', port)
+    client.cork!
+    assert client.io.corked?
+    client << 'foo' << 'bar'
+    assert_equal 'you said foobar', client.read
+  ensure
+    client&.close
+    server_fiber&.stop
+    server&.close
+  end
+
+  def test_cork_read_flush
+    @client.cork!
+    responder = spin { @server << "you said #{@server.readpartial(100)}" }
+    @client << 'foo'
+    @client << 'bar'
+    assert_equal 'you said foobar', @client.readpartial(100)
+    responder.await
+  end
+
+  def test_cork_flush_and_uncork
+    @client.cork!
+    @client << 'foo'
+    assert_equal @client, @client.flush
+    assert_equal 'foo', @server.recv_nonblock(100)
+
+    @client << 'bar'
+    @client.uncork!
+    refute @client.corked?
+    assert_equal 'bar', @server.recv_nonblock(100)
+
+    @client << 'baz'
+    assert_equal 'baz', @server.recv_nonblock(100)
+  end
+
+  def test_cork_background_flush
+    @client.cork!(1 << 24)
+    chunks = 32.times.map { |i| (i % 10).to_s * 65536 }
+    received = +''
+    reader = spin do
+      sleep 0.01
+      while received.bytesize < 1 << 21
+        received << @server.readpartial(65536)
+      end
+    end
+
+    # the socket buffer fills up, and the rest is sent by a flusher fiber
+    chunks[0, 16].each { |c| @client << c }
+    snooze
+    chunks[16, 16].each { |c| @client << c }
+    @client.flush
+    reader.await
+    assert_equal chunks.join, received
+  end
+
+  def test_cork_background_flush_and_close
+    @client.cork!(1 << 24)
+    chunks = 32.times.map { |i| (i % 10).to_s * 65536 }
+    received = +''
+    reader = spin do
+      sleep 0.01
+      while (data = @server.readpartial(65536) rescue nil)
+        received << data
+      end
+    end
+
+    chunks.each { |c| @client << c }
+    snooze
+    # the flusher fiber is still sending, closing must wait for it
+    @client.close
+    reader.await
+    assert_equal chunks.join, received
+  end
+
+  def test_cork_background_flush_and_uncork
+    @client.cork!(1 << 24)
+    chunks = 32.times.map { |i| (i % 10).to_s * 65536 }
+    received = +''
+    reader = spin do
+      sleep 0.01
+      while received.bytesize < 33 * 65536
+        received << @server.readpartial(65536)
+      end
+    end
+
+    chunks.each { |c| @client << c }
+    snooze
+    @client.uncork!
+    @client << 'x' * 65536
+    reader.await
+    assert_equal chunks.join + 'x' * 65536, received
+  end
+
+  def corked_then(&block)
+    @client.cork!(1 << 24)
+    data = 'H' * 1_000_000
+    received = +''
+    reader = spin do
+      sleep 0.01
+      while received.bytesize < data.bytesize + 4
+        received << @server.readpartial(65536)
+      end
+    end
+
+    @client << data
+    snooze
+    # the flusher fiber is still sending, the op must wait for it
+    block.call
+    reader.await
+    assert_equal data + 'BODY', received
+  end
+
+  def test_cork_ordering_with_other_ops
+    corked_then { @backend.sendv(@client, ['BO', 'DY'], 0) }
+    corked_then { @backend.chain([:write, @client, 'BODY']) }
+
+    fn = '/tmp/test_cork_ordering'
+    IO.write(fn, 'BODY')
+    corked_then do
+      File.open(fn, 'r') { |f| assert_equal 4, @backend.sendfile(f, @client, 0, 4) }
+    end
+  ensure
+    FileUtils.rm(fn) rescue nil
+  end
+
+  def test_cork_background_error
+    @client.cork!
+    @server.close
+    @client << 'foo'
+    snooze
+    assert_raises(Errno::EPIPE) { @client << 'bar' }
+  end
+end
+
+class SSLSocketTest < MiniTest::Test
+  def ssl_contexts
+    key = OpenSSL::PKey::EC.generate('prime256v1')
+    cert = OpenSSL::X509::Certificate.new
+    cert.version = 2
+    cert.serial = 1
+    cert.subject = cert.issuer = OpenSSL::X509::Name.parse('/CN=localhost')
+    cert.public_key = key
+    cert.not_before = Time.now - 60
+    cert.not_after = Time.now + 3600
+    cert.sign(key, OpenSSL::Digest.new('SHA256'))
+
+    server_ctx = OpenSSL::SSL::SSLContext.new
+    server_ctx.cert = cert
+    server_ctx.key = key
+    server_ctx.ktls = true
+    client_ctx = OpenSSL::SSL::SSLContext.new
+    client_ctx.verify_mode = OpenSSL::SSL::VERIFY_NONE
+    [server_ctx, client_ctx]
+  end
+
+  def test_ktls_option
+    ctx = OpenSSL::SSL::SSLContext.new
+    assert !ctx.ktls?
+    ctx.ktls = true
+    assert_equal defined?(OpenSSL::SSL::OP_ENABLE_KTLS) ? true : false, ctx.ktls?
+    ctx.ktls = false
+    assert !ctx.ktls?
+  end
+
+  def test_splice_and_sendfile
+    server_ctx, client_ctx = ssl_contexts
+    server = Polyphony::Net.tcp_listen('127.0.0.1', 0, reuse_addr: true)
+    port = server.local_address.ip_port
+
+    client = Thread.new do
+      sock = OpenSSL::SSL::SSLSocket.new(TCPSocket.new('127.0.0.1', port), client_ctx)
+      sock.sync_close = true
+      sock.connect
+      data = +''
+      sock.read_loop { |d| data << d }
+      sock.close
+      data
+    end
+
+    sock = OpenSSL::SSL::SSLSocket.new(server.accept, server_ctx)
+    sock.sync_close = true
+    sock.accept
+    # kTLS offload depends on kernel support, both paths must behave the same
+    assert_equal sock.io.ktls_tx?, sock.ktls_send?
+
+    i, o = IO.pipe
+    o << 'foo'
+    o.close
+    assert_equal 3, sock.splice_to_eof(i)
+    File.open(__FILE__, 'r') do |f|
+      assert_equal 10, sock.sendfile(f, 0, 10)
+    end
+    sock.close
+
+    assert_equal "foo#{IO.read(__FILE__, 10)}", client.value
+  ensure
+    server&.close
+  end
+
+  def ssl_client(port, ctx)
+    Thread.new do
+      sock = OpenSSL::SSL::SSLSocket.new(TCPSocket.new('127.0.0.1', port), ctx)
+      sock.sync_close = true
+      sock.connect
+      sock.syswrite('hi')
+      data = sock.sysread(100)
+      sock.close
+      data
+    end
+  end
+
+  def test_ssl_server_accept_loop
+    [0, 2].each do |threads|
+      server_ctx, client_ctx = ssl_contexts
+      tcp_server = Polyphony::Net.tcp_listen('127.0.0.1', 0, reuse_addr: true)
+      port = tcp_server.local_address.ip_port
+      server = OpenSSL::SSL::SSLServer.new(tcp_server, server_ctx)
+      server.handshake_threads = threads
+      server_fiber = spin do
+        server.accept_loop { |conn| spin { conn.syswrite(conn.sysread(100)); conn.close } }
+      end
+
+      # a client that never completes its handshake should not hold back others
+      stalled = TCPSocket.new('127.0.0.1', port)
+      snooze
+      clients = Array.new(3) { ssl_client(port, client_ctx) }
+      assert_equal ['hi'] * 3, clients.map(&:join)
+
+      stats = server.handshake_stats
+      assert_equal 3, stats[:completed]
+      assert_equal 1, stats[:in_progress]
+      assert_equal 0, stats[:failed]
+    ensure
+      stalled&.close
+      server_fiber&.stop
+      server_fiber&.await
+      server&.close
+    end
+  end
+
+  def test_gets_loop_break_and_resume
+    server_ctx, client_ctx = ssl_contexts
+    server = Polyphony::Net.tcp_listen('127.0.0.1', 0, reuse_addr: true)
+    port = server.local_address.ip_port
+
+    client = Thread.new do
+      sock = OpenSSL::SSL::SSLSocket.new(TCPSocket.new('127.0.0.1', port), client_ctx)
+      sock.sync_close = true
+      sock.connect
+      sock.syswrite("foo\nbar\nbaz\nqux")
+      sock.close
+    end
+
+    sock = OpenSSL::SSL::SSLSocket.new(server.accept, server_ctx)
+    sock.sync_close = true
+    sock.accept
+
+    lines = []
+    sock.gets_loop(chomp: true) { |l| lines << l; break }
+    assert_equal ['foo'], lines
+
+    sock.gets_loop(chomp: true) { |l| lines << l }
+    assert_equal ['foo', 'bar', 'baz', 'qux'], lines
+  ensure
+    client&.join
+    sock&.close
+    server&.close
+  end
+
+  def test_gets_and_gets_loop
+    server_ctx, client_ctx = ssl_contexts
+    server = Polyphony::Net.tcp_listen('127.0.0.1', 0, reuse_addr: true)
+    port = server.local_address.ip_port
+
+    client = Thread.new do
+      sock = OpenSSL::SSL::SSLSocket.new(TCPSocket.new('127.0.0.1', port), client_ctx)
+      sock.sync_close = true
+      sock.connect
+      sock.syswrite("foo\nbar\nbaz\nqux\nquux")
+      sock.close
+    end
+
+    sock = OpenSSL::SSL::SSLSocket.new(server.accept, server_ctx)
+    sock.sync_close = true
+    sock.accept
+
+    lines = [sock.gets.chomp]
+    sock.gets_loop(chomp: true) { |l| lines << l; break }
+    lines << sock.gets.chomp
+    sock.gets_loop(chomp: true) { |l| lines << l }
+    assert_equal ['foo', 'bar', 'baz', 'qux', 'quux'], lines
+    assert_nil sock.gets
+  ensure
+    client&.join
+    sock&.close
+    server&.close
+  end
+
+  def test_ssl_server_handshake_timeout
+    server_ctx, = ssl_contexts
+    tcp_server = Polyphony::Net.tcp_listen('127.0.0.1', 0, reuse_addr: true)
+    server = OpenSSL::SSL::SSLServer.new(tcp_server, server_ctx)
+    server.handshake_timeout = 0.05
+    stalled = TCPSocket.new('127.0.0.1', tcp_server.local_address.ip_port)
+
+    assert_raises(OpenSSL::SSL::SSLServer::HandshakeTimeoutError) { server.accept }
+    assert_equal 1, server.handshake_stats[:failed]
+    assert_equal 0, server.handshake_stats[:in_progress]
+  ensure
+    stalled&.close
+    server&.close
+  end
+
+  def test_ssl_server_worker_handshake_cancel
+    server_ctx, = ssl_contexts
+    tcp_server = Polyphony::Net.tcp_listen('127.0.0.1', 0, reuse_addr: true)
+    server = OpenSSL::SSL::SSLServer.new(tcp_server, server_ctx)
+    server.handshake_threads = 1
+    server.handshake_timeout = 0.1
+    stalled = TCPSocket.new('127.0.0.1', tcp_server.local_address.ip_port)
+
+    # interrupt the accepting fiber while the worker is doing the handshake
+    assert_nil move_on_after(0.02) { server.accept }
+    assert_equal 1, server.handshake_stats[:failed]
+
+    # the worker closes the socket once the handshake times out, without
+    # sending anything to the interrupted fiber
+    assert_equal '', move_on_after(1) { stalled.read }
+    sleep 0.02
+    assert_equal [], Fiber.current.receive_all_pending
+  ensure
+    stalled&.close
+    server&.close
+  end
+end
@@ -113,4 +113,114 @@ class MutexTest < MiniTest::Test
     receive
     assert !lock.locked?
   end
-end
\ No newline at end of file
+
+  def test_lock_handoff
+    lock = Polyphony::Mutex.new
+    buf = []
+    lock.lock
+    f = spin { lock.synchronize { buf << :f } }
+    snooze
+
+    lock.unlock
+    assert_equal f, lock.owner
+    lock.synchronize { buf << :main }
+    assert_equal [:f, :main], buf
+    assert_equal({ acquire_count: 3, wait_count: 2, queue_depth: 0, max_queue_depth: 1 }, lock.stats)
+  end
+
+  def test_lock_unlock_errors
+    lock = Polyphony::Mutex.new
+    assert_raises(ThreadError) { lock.unlock }
+    assert_equal true, lock.try_lock
+    assert_equal false, lock.try_lock
+    assert_raises(ThreadError) { lock.lock }
+
+    f = spin { lock.unlock }
+    assert_raises(ThreadError) { f.await }
+    lock.unlock
+    assert !lock.locked?
+  end
+
+  def test_interrupted_lock_wait
+    lock = Polyphony::Mutex.new
+    lock.lock
+    f1 = spin { lock.lock }
+    f2 = spin { lock.synchronize { :f2 } }
+    snooze
+
+    f1.stop
+    lock.unlock
+    assert_equal :f2, f2.await
+    assert !lock.locked?
+  end
+
+  def test_condition_variable_broadcast_and_timeout
+    lock = Polyphony::Mutex.new
+    cond = Polyphony::ConditionVariable.new
+    buf = []
+    fibers = (1..3).map do |i|
+      spin { lock.synchronize { cond.wait(lock); buf << [i, lock.owned?] } }
+    end
+    snooze
+    assert_equal 3, cond.waiting_count
+
+    lock.synchronize { cond.broadcast }
+    fibers.each(&:await)
+    assert_equal [[1, true], [2, true], [3, true]], buf
+
+    lock.synchronize do
+      assert_nil cond.wait(lock, 0.01)
+      assert lock.owned?
+    end
+  end
+end
+
+class RWLockTest < MiniTest::Test
+  def test_concurrent_readers
+    lock = Polyphony::RWLock.new
+    buf = []
+    fibers = (1..3).map do |i|
+      spin { lock.with_read_lock { buf << [i, lock.readers]; snooze } }
+    end
+    fibers.each(&:await)
+    assert_equal [[1, 1], [2, 2], [3, 3]], buf
+    assert_equal 0, lock.readers
+  end
+
+  def test_writer_exclusion_and_priority
+    lock = Polyphony::RWLock.new
+    buf = []
+    lock.read_lock
+    w = spin { lock.with_write_lock { buf << :w; snooze } }
+    snooze
+    r = spin { lock.with_read_lock { buf << :r } }
+    snooze
+    assert_equal [], buf
+
+    lock.read_unlock
+    w.await
+    r.await
+    assert_equal [:w, :r], buf
+    assert !lock.write_locked?
+
+    stats = lock.stats
+    assert_equal 2, stats[:read_acquire_count]
+    assert_equal 1, stats[:write_acquire_count]
+    assert_equal 2, stats[:wait_count]
+  end
+
+  def test_interrupted_writer_wait
+    lock = Polyphony::RWLock.new
+    lock.read_lock
+    w = spin { lock.write_lock }
+    snooze
+    r = spin { lock.with_read_lock { :r } }
+    snooze
+
+    w.stop
+    assert_equal :r, r.await
+    lock.read_unlock
+    assert_equal 0, lock.readers
+    assert_raises(ThreadError) { lock.read_unlock }
+  end
+end
@@ -221,6 +221,43 @@ class ThreadTest < MiniTest::Test
     assert_equal 2, counter
   end
 
+  def test_fiber_unschedule
+    buf = []
+    fibers = 1000.times.map { |i| spin { buf << [i, suspend] } }
+    snooze
+
+    fibers.each_with_index { |f, i| f.schedule(i) }
+    fibers.each_with_index { |f, i| Thread.current.fiber_unschedule(f) if i.odd? }
+    # rescheduling moves the fiber to the end of the runqueue
+    fibers[0].schedule(:last)
+    snooze
+
+    expected = (2...1000).step(2).map { |i| [i, i] } + [[0, :last]]
+    assert_equal expected, buf
+    assert_equal 0, Thread.current.backend.stats[:runqueue_length]
+  ensure
+    fibers.each(&:stop)
+  end
+
+  def test_cross_thread_scheduled_fiber_unschedule
+    buf = []
+    f = spin { buf << suspend }
+    snooze
+
+    t = Thread.new { f.schedule(:foo) }
+    # wait without switching fibers, so the fiber stays in the inbox
+    Thread.pass while t.alive?
+
+    assert_equal :runnable, f.state
+    Thread.current.fiber_unschedule(f)
+    assert_equal :waiting, f.state
+
+    snooze
+    assert_equal [], buf
+  ensure
+    f.stop
+  end
+
   def test_cross_thread_receive
     buf = []
     f = Fiber.current
@@ -240,4 +277,18 @@ class ThreadTest < MiniTest::Test
     t.join
     assert_equal [1, 2, 3], buf
   end
+
+  def test_cross_thread_schedule_burst
+    buf = []
+    fibers = 64.times.map { |i| spin { buf << [i, suspend] } }
+    snooze
+
+    threads = fibers.each_with_index.map do |f, i|
+      Thread.new { f.schedule(i * 10) }
+    end
+    threads.each(&:join)
+    fibers.each(&:await)
+
+    assert_equal 64.times.map { |i| [i, i * 10] }, buf.sort
+  end
 end
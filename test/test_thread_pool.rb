@@ -1,6 +1,8 @@
 # frozen_string_literal: true
 
 require_relative 'helper'
+require 'pathname'
+require 'zlib'
 
 class ThreadPoolTest < MiniTest::Test
   def setup
@@ -99,3 +101,106 @@ class ThreadPoolTest < MiniTest::Test
     assert processing_thread != current_thread
   end
 end
+
+class NativeThreadPoolTest < MiniTest::Test
+  def setup
+    super
+    @pool = Polyphony::NativeThreadPool.new(4)
+  end
+
+  def teardown
+    @pool.stop
+    super
+  end
+
+  def test_sleep
+    t0 = Time.now
+    4.times { spin { @pool.sleep(0.05) } }
+    Fiber.current.await_all_children
+    elapsed = Time.now - t0
+    assert_in_range 0.05..0.15, elapsed
+    assert_equal false, @pool.busy?
+  end
+
+  def test_many_completions
+    results = []
+    100.times { |i| spin { @pool.sleep(0.001); results << i } }
+    Fiber.current.await_all_children
+    assert_equal (0..99).to_a, results.sort
+  end
+
+  def test_read_file_and_stat
+    assert_equal IO.orig_read(__FILE__), @pool.read_file(__FILE__)
+    assert_equal File.size(__FILE__), @pool.stat(__FILE__).size
+    assert_raises(Errno::ENOENT) { @pool.read_file('/foo/bar/baz') }
+    assert_raises(Errno::ENOENT) { @pool.stat('/foo/bar/baz') }
+
+    path = Pathname.new('/foo/bar/baz')
+    assert_raises(Errno::ENOENT) { @pool.read_file(path) }
+    error = assert_raises(Errno::ENOENT) { @pool.stat(path) }
+    assert_match(/\/foo\/bar\/baz/, error.message)
+  end
+
+  def test_deflate
+    skip unless @pool.respond_to?(:deflate)
+
+    data = IO.orig_read(__FILE__) * 10
+    assert_equal data, Zlib::Inflate.inflate(@pool.deflate(data))
+    assert_equal data, Zlib::Inflate.inflate(@pool.deflate(data, Zlib::BEST_SPEED))
+    assert_equal '', Zlib::Inflate.inflate(@pool.deflate(''))
+    assert_raises(ArgumentError) { @pool.deflate(data, 42) }
+  end
+
+  def test_getaddrinfo
+    addresses = @pool.getaddrinfo('localhost')
+    assert !(addresses & ['127.0.0.1', '::1']).empty?
+  end
+
+  def test_cancel
+    t0 = Time.now
+    result = move_on_after(0.01, with_value: :moved_on) { @pool.sleep(0.1) }
+    assert_equal :moved_on, result
+    assert Time.now - t0 < 0.05
+
+    @pool.sleep(0.001)
+    sleep 0.15
+    assert_equal false, @pool.busy?
+  end
+
+  def test_stop_and_restart
+    @pool.sleep(0.001)
+    @pool.stop
+    # threads are started again for new jobs
+    @pool.sleep(0.001)
+    assert_equal false, @pool.busy?
+  end
+
+  def test_job_outliving_backend
+    # the job is abandoned, and completes after its thread and backend are gone
+    t = Thread.new { move_on_after(0.01) { @pool.sleep(0.1) } }
+    t.join
+    t = nil
+    GC.start
+    sleep 0.15
+    assert_equal false, @pool.busy?
+    # the pool is still usable
+    @pool.sleep(0.001)
+  end
+
+  def test_fork
+    @pool.sleep(0.001)
+    # the parent's threads do not exist in the child, which should exit
+    # whether or not it uses the pool
+    pids = [
+      Polyphony.fork { },
+      Polyphony.fork { @pool.sleep(0.001) }
+    ]
+    results = move_on_after(2) { pids.map { |pid| Process.detach(pid).await } }
+    assert_equal pids.map { |pid| [pid, 0] }, results
+  end
+
+  def test_default_pool
+    assert_kind_of Polyphony::NativeThreadPool, Polyphony::NativeThreadPool.default
+    assert_equal Polyphony::NativeThreadPool.default, Polyphony::NativeThreadPool.default
+  end
+end
@@ -94,6 +94,24 @@ class TimerCancelAfterTest < MiniTest::Test
     assert_equal [1, 2, 3, 4], buf
   end
 
+  def test_timer_cancel_after_with_nested_reset
+    skip unless IS_LINUX
+
+    t0 = Time.now
+    assert_raises Polyphony::Cancel do
+      @timer.cancel_after(0.05) do
+        @timer.move_on_after(0.03) do
+          10.times do
+            sleep 0.01
+            @timer.reset
+          end
+        end
+      end
+    end
+    t1 = Time.now
+    assert_in_range 0.05..0.08, t1 - t0
+  end
+
   class CustomException < Exception
   end
 
@@ -162,4 +180,39 @@ class TimerMiscTest < MiniTest::Test
     f.stop
     assert_in_range 3..7, buffer.size
   end
-end
\ No newline at end of file
+
+  def test_timer_nested_timeouts
+    t0 = Time.now
+    v = @timer.move_on_after(0.05, with_value: :outer) do
+      inner = @timer.move_on_after(0.01, with_value: :inner) { sleep 1 }
+      assert_equal :inner, inner
+      # the outer timeout is still armed once the inner one is disarmed
+      sleep 1
+      :foo
+    end
+    assert_equal :outer, v
+    assert_in_range 0.05..0.1, Time.now - t0 if IS_LINUX
+
+    v = @timer.move_on_after(0.02, with_value: :outer) do
+      @timer.cancel_after(1) { sleep 1 }
+    end
+    assert_equal :outer, v
+    assert_in_range 0.07..0.15, Time.now - t0 if IS_LINUX
+  end
+
+  def test_timer_many_timeouts
+    buffer = []
+    fibers = 1000.times.map do |i|
+      spin { @timer.sleep(0.01 + (i % 10) * 0.015); buffer << i }
+    end
+    canceled = spin do
+      @timer.cancel_after(0.05) { sleep 1 }
+    rescue Polyphony::Cancel
+      :canceled
+    end
+    fibers.each(&:await)
+    assert_equal 1000, buffer.size
+    assert_equal (0..999).select { |i| i % 10 == 0 }, buffer.first(100).sort
+    assert_equal :canceled, canceled.await
+  end
+end
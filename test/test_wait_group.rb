@@ -0,0 +1,75 @@
+# frozen_string_literal: true
+
+require_relative 'helper'
+
+class WaitGroupTest < MiniTest::Test
+  def test_wait
+    wg = Polyphony::WaitGroup.new
+    assert_equal true, wg.wait
+
+    done = []
+    10.times do |i|
+      wg.add
+      spin { sleep(0.001 * i); done << i; wg.done }
+    end
+    assert_equal 10, wg.count
+    assert_equal true, wg.wait
+    assert_equal 10, done.size
+    assert_equal 0, wg.count
+  end
+
+  def test_multiple_waiters
+    wg = Polyphony::WaitGroup.new(2)
+    waiters = 3.times.map { spin { wg.wait } }
+    snooze
+    assert_equal 3, wg.waiting_count
+
+    wg.count_down
+    snooze
+    assert_equal 3, wg.waiting_count
+
+    wg.count_down
+    assert_equal [true] * 3, waiters.map(&:await)
+    assert_equal 0, wg.waiting_count
+  end
+
+  def test_wait_with_timeout
+    wg = Polyphony::WaitGroup.new(1)
+
+    t0 = Time.now
+    assert_equal false, wg.wait(0.05)
+    assert_in_range 0.04..0.2, Time.now - t0
+    assert_equal 0, wg.waiting_count
+
+    spin { wg.done }
+    assert_equal true, wg.wait(1)
+  end
+
+  def test_spin
+    wg = Polyphony::WaitGroup.new
+    results = []
+    50.times { |i| wg.spin { snooze; results << i } }
+    wg.spin { raise 'foo' }
+    assert_equal 51, wg.count
+
+    assert_raises(RuntimeError) { wg.wait }
+    wg.wait
+    assert_equal 50, results.size
+  end
+
+  def test_negative_count
+    assert_raises(ArgumentError) { Polyphony::WaitGroup.new(-1) }
+
+    wg = Polyphony::WaitGroup.new
+    assert_raises(RuntimeError) { wg.done }
+    assert_equal 0, wg.count
+  end
+
+  def test_cross_thread_done
+    wg = Polyphony::WaitGroup.new(1)
+    t = Thread.new { orig_sleep 0.01; wg.done }
+    assert_equal true, wg.wait
+  ensure
+    t&.join
+  end
+end